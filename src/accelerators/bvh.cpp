@@ -37,7 +37,16 @@
 #include "paramset.h"
 #include "stats.h"
 #include "parallel.h"
+#include "scenecache.h"
+#include "shapes/triangle.h"
 #include <algorithm>
+#include <chrono>
+#include <limits>
+#include <unordered_map>
+#if defined(PBRT_HAVE_SSE2) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#define PBRT_BVH_SSE_PACKETS
+#include <immintrin.h>
+#endif
 
 namespace pbrt {
 
@@ -45,6 +54,15 @@ STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
+STAT_COUNTER("BVH/Trees loaded from scene cache", nCachedTrees);
+STAT_FLOAT_DISTRIBUTION("BVH/Build time (seconds)", buildSeconds);
+STAT_COUNTER("BVH/Subtrees built as parallel tasks", nParallelSubtrees);
+STAT_COUNTER("BVH/Parallel binning passes", nParallelBinningPasses);
+STAT_MEMORY_COUNTER("Memory/BVH build arenas", buildArenaBytes);
+STAT_COUNTER("BVH/Trees with leaf triangles", nLeafTriangleTrees);
+STAT_COUNTER("BVH/Leaf triangle tests", nLeafTriangleTests);
+STAT_MEMORY_COUNTER("Memory/BVH tree saved by compact nodes",
+                    compactTreeSavedBytes);
 
 // BVHAccel Local Declarations
 struct BVHPrimitiveInfo {
@@ -82,6 +100,243 @@ struct BVHBuildNode {
     int splitAxis, firstPrimOffset, nPrimitives;
 };
 
+// Compact BVH nodes represent an interior node of the binary tree along
+// with both of its children; each child's bounds are stored as integer
+// offsets in the parent's bounds, rounded outward, and leaf children
+// refer to their primitives directly.
+template <typename T>
+struct CompactBVHNode {
+    T bounds[2][2][3];       // [child][pMin, pMax][axis]
+    uint32_t child[2];       // interior child: node index, leaf: primitives
+    uint8_t nPrimitives[2];  // 0 -> interior child
+    uint8_t axis;
+};
+
+// Larger leaves are split into several compact leaves
+static PBRT_CONSTEXPR int MaxCompactLeafPrimitives = 255;
+
+// Returns the value of quantized coordinate _q_ between _lo_ and _hi_;
+// the end points are returned exactly.
+template <typename T>
+inline Float DequantizeCoordinate(Float lo, Float hi, T q) {
+    const T maxQ = std::numeric_limits<T>::max();
+    if (q == 0) return lo;
+    if (q == maxQ) return hi;
+    return lo + q * ((hi - lo) / maxQ);
+}
+
+// Returns the bounds of child _c_ of a compact node with bounds _b_.
+template <typename T>
+inline Bounds3f DequantizeBounds(const CompactBVHNode<T> &node, int c,
+                                 const Bounds3f &b) {
+    Bounds3f cb;
+    for (int a = 0; a < 3; ++a) {
+        cb.pMin[a] =
+            DequantizeCoordinate(b.pMin[a], b.pMax[a], node.bounds[c][0][a]);
+        cb.pMax[a] =
+            DequantizeCoordinate(b.pMin[a], b.pMax[a], node.bounds[c][1][a]);
+    }
+    return cb;
+}
+
+// Sets child _c_'s bounds in _node_, whose bounds are _b_, to quantized
+// bounds that contain _childBounds_.
+template <typename T>
+static void QuantizeBounds(const Bounds3f &childBounds, const Bounds3f &b,
+                           CompactBVHNode<T> *node, int c) {
+    const int maxQ = std::numeric_limits<T>::max();
+    for (int a = 0; a < 3; ++a) {
+        Float lo = b.pMin[a], hi = b.pMax[a];
+        Float scale = (hi - lo) / maxQ;
+        int qMin = 0, qMax = maxQ;
+        if (scale > 0) {
+            qMin = Clamp(std::floor((childBounds.pMin[a] - lo) / scale), 0,
+                         maxQ);
+            qMax = Clamp(std::ceil((childBounds.pMax[a] - lo) / scale), 0,
+                         maxQ);
+        }
+        // Make sure that rounding in the dequantization can't shrink the
+        // bounds
+        while (qMin > 0 &&
+               DequantizeCoordinate(lo, hi, T(qMin)) > childBounds.pMin[a])
+            --qMin;
+        while (qMax < maxQ &&
+               DequantizeCoordinate(lo, hi, T(qMax)) < childBounds.pMax[a])
+            ++qMax;
+        node->bounds[c][0][a] = qMin;
+        node->bounds[c][1][a] = qMax;
+    }
+}
+
+// A node to visit during compact BVH traversal, along with its bounds.
+struct CompactNodeToVisit {
+    int nodeIndex;
+    Float pMin[3], pMax[3];
+    void Set(int index, const Bounds3f &b) {
+        nodeIndex = index;
+        for (int a = 0; a < 3; ++a) {
+            pMin[a] = b.pMin[a];
+            pMax[a] = b.pMax[a];
+        }
+    }
+    Bounds3f Bounds() const {
+        Bounds3f b;
+        for (int a = 0; a < 3; ++a) {
+            b.pMin[a] = pMin[a];
+            b.pMax[a] = pMax[a];
+        }
+        return b;
+    }
+};
+
+// The vertices of a triangle stored in a BVH leaf.
+struct LeafTriangle {
+    Point3f p[3];
+};
+
+// Intersects a ray with the primitives in the BVH leaves that it visits.
+// When the tree stores its primitives' triangles, they are tested directly
+// using the watertight test from _Triangle::Intersect()_, with the ray's
+// permutation and shear computed once; only the closest triangle found is
+// then intersected through its _Primitive_ to initialize the
+// _SurfaceInteraction_.
+class LeafIntersector {
+  public:
+    LeafIntersector(const std::vector<std::shared_ptr<Primitive>> &primitives,
+                    const LeafTriangle *triangles, const Ray &ray)
+        : primitives(primitives), triangles(triangles), ray(ray),
+          tMax(ray.tMax) {
+        if (!triangles) return;
+        // Permute the ray direction and compute its shear, as in
+        // _Triangle::Intersect()_
+        kz = MaxDimension(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3) kx = 0;
+        ky = kx + 1;
+        if (ky == 3) ky = 0;
+        Vector3f d = Permute(ray.d, kx, ky, kz);
+        Sx = -d.x / d.z;
+        Sy = -d.y / d.z;
+        Sz = 1.f / d.z;
+    }
+    bool Intersect(int offset, int nPrimitives, SurfaceInteraction *isect) {
+        bool hit = false;
+        if (!triangles) {
+            for (int i = 0; i < nPrimitives; ++i)
+                if (primitives[offset + i]->Intersect(ray, isect)) hit = true;
+            return hit;
+        }
+        nLeafTriangleTests += nPrimitives;
+        for (int i = 0; i < nPrimitives; ++i) {
+            Float t;
+            if (intersectTriangle(triangles[offset + i], &t)) {
+                ray.tMax = t;
+                closest = offset + i;
+                hit = true;
+            }
+        }
+        return hit;
+    }
+    bool IntersectP(int offset, int nPrimitives) const {
+        if (!triangles) {
+            for (int i = 0; i < nPrimitives; ++i)
+                if (primitives[offset + i]->IntersectP(ray)) return true;
+            return false;
+        }
+        nLeafTriangleTests += nPrimitives;
+        Float t;
+        for (int i = 0; i < nPrimitives; ++i)
+            if (intersectTriangle(triangles[offset + i], &t)) return true;
+        return false;
+    }
+    // Called once traversal is done with whether any of the leaves'
+    // primitives were hit; returns whether the ray hit anything.
+    bool Finish(bool hit, SurfaceInteraction *isect) const {
+        if (!triangles || !hit) return hit;
+        ray.tMax = tMax;
+        return primitives[closest]->Intersect(ray, isect);
+    }
+
+  private:
+    bool intersectTriangle(const LeafTriangle &tri, Float *tHit) const {
+        // Translate, permute and shear the vertices
+        Point3f p0t = Permute(tri.p[0] - Vector3f(ray.o), kx, ky, kz);
+        Point3f p1t = Permute(tri.p[1] - Vector3f(ray.o), kx, ky, kz);
+        Point3f p2t = Permute(tri.p[2] - Vector3f(ray.o), kx, ky, kz);
+        p0t.x += Sx * p0t.z;
+        p0t.y += Sy * p0t.z;
+        p1t.x += Sx * p1t.z;
+        p1t.y += Sy * p1t.z;
+        p2t.x += Sx * p2t.z;
+        p2t.y += Sy * p2t.z;
+
+        // Compute edge function coefficients _e0_, _e1_, and _e2_
+        Float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
+        Float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
+        Float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+
+        // Fall back to double precision test at triangle edges
+        if (sizeof(Float) == sizeof(float) &&
+            (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)) {
+            double p2txp1ty = (double)p2t.x * (double)p1t.y;
+            double p2typ1tx = (double)p2t.y * (double)p1t.x;
+            e0 = (float)(p2typ1tx - p2txp1ty);
+            double p0txp2ty = (double)p0t.x * (double)p2t.y;
+            double p0typ2tx = (double)p0t.y * (double)p2t.x;
+            e1 = (float)(p0typ2tx - p0txp2ty);
+            double p1txp0ty = (double)p1t.x * (double)p0t.y;
+            double p1typ0tx = (double)p1t.y * (double)p0t.x;
+            e2 = (float)(p1typ0tx - p1txp0ty);
+        }
+
+        // Perform triangle edge and determinant tests
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+            return false;
+        Float det = e0 + e1 + e2;
+        if (det == 0) return false;
+
+        // Compute scaled hit distance to triangle and test against ray $t$
+        // range
+        p0t.z *= Sz;
+        p1t.z *= Sz;
+        p2t.z *= Sz;
+        Float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
+        if (det < 0 && (tScaled >= 0 || tScaled < ray.tMax * det))
+            return false;
+        else if (det > 0 && (tScaled <= 0 || tScaled > ray.tMax * det))
+            return false;
+        Float invDet = 1 / det;
+        Float t = tScaled * invDet;
+
+        // Ensure that computed triangle $t$ is conservatively greater than
+        // zero
+        Float maxZt = MaxComponent(Abs(Vector3f(p0t.z, p1t.z, p2t.z)));
+        Float deltaZ = gamma(3) * maxZt;
+        Float maxXt = MaxComponent(Abs(Vector3f(p0t.x, p1t.x, p2t.x)));
+        Float maxYt = MaxComponent(Abs(Vector3f(p0t.y, p1t.y, p2t.y)));
+        Float deltaX = gamma(5) * (maxXt + maxZt);
+        Float deltaY = gamma(5) * (maxYt + maxZt);
+        Float deltaE =
+            2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+        Float maxE = MaxComponent(Abs(Vector3f(e0, e1, e2)));
+        Float deltaT = 3 *
+                       (gamma(3) * maxE * maxZt + deltaE * maxZt +
+                        deltaZ * maxE) *
+                       std::abs(invDet);
+        if (t <= deltaT) return false;
+        *tHit = t;
+        return true;
+    }
+
+    const std::vector<std::shared_ptr<Primitive>> &primitives;
+    const LeafTriangle *triangles;
+    const Ray &ray;
+    Float tMax;
+    int kx, ky, kz;
+    Float Sx, Sy, Sz;
+    int closest = -1;
+};
+
 struct MortonPrimitive {
     int primitiveIndex;
     uint32_t mortonCode;
@@ -92,15 +347,72 @@ struct LBVHTreelet {
     BVHBuildNode *buildNodes;
 };
 
-struct LinearBVHNode {
-    Bounds3f bounds;
-    union {
-        int primitivesOffset;   // leaf
-        int secondChildOffset;  // interior
-    };
-    uint16_t nPrimitives;  // 0 -> interior node
-    uint8_t axis;          // interior node: xyz
-    uint8_t pad[1];        // ensure 32 byte total size
+// Batches of rays are traced through the BVH in packets of four; each
+// node's bounds are tested against all of the rays in a packet at once.
+struct RayPacket {
+    RayPacket(const RayBatch &rays, int start) {
+        int count = std::min(4, rays.Size() - start);
+        activeMask = (1 << count) - 1;
+        for (int lane = 0; lane < 4; ++lane) {
+            // Unused lanes repeat the last ray
+            int i = start + std::min(lane, count - 1);
+            for (int a = 0; a < 3; ++a) {
+                o[a][lane] = rays.o[a][i];
+                invDir[a][lane] = 1 / rays.d[a][i];
+                invDirFar[a][lane] = invDir[a][lane] * (1 + 2 * gamma(3));
+                dirIsNeg[a][lane] = invDir[a][lane] < 0;
+            }
+            tMax[lane] = rays.tMax[i];
+        }
+    }
+    // Returns a mask of the lanes whose rays overlap _b_; as in the wide
+    // BVH, NaN slab distances are ignored.
+    int IntersectP(const Bounds3f &b) const {
+#ifdef PBRT_BVH_SSE_PACKETS
+        __m128 tEntry = _mm_setzero_ps(), tExit = _mm_loadu_ps(tMax);
+        for (int a = 0; a < 3; ++a) {
+            __m128 isNeg = _mm_castsi128_ps(_mm_sub_epi32(
+                _mm_setzero_si128(),
+                _mm_loadu_si128((const __m128i *)dirIsNeg[a])));
+            __m128 pMin = _mm_set1_ps(b.pMin[a]), pMax = _mm_set1_ps(b.pMax[a]);
+            __m128 pNear = _mm_or_ps(_mm_and_ps(isNeg, pMax),
+                                     _mm_andnot_ps(isNeg, pMin));
+            __m128 pFar = _mm_or_ps(_mm_and_ps(isNeg, pMin),
+                                    _mm_andnot_ps(isNeg, pMax));
+            __m128 orig = _mm_loadu_ps(o[a]);
+            __m128 tNear =
+                _mm_mul_ps(_mm_sub_ps(pNear, orig), _mm_loadu_ps(invDir[a]));
+            __m128 tFar =
+                _mm_mul_ps(_mm_sub_ps(pFar, orig), _mm_loadu_ps(invDirFar[a]));
+            tEntry = _mm_max_ps(tNear, tEntry);
+            tExit = _mm_min_ps(tFar, tExit);
+        }
+        return _mm_movemask_ps(_mm_cmple_ps(tEntry, tExit)) & activeMask;
+#else
+        int mask = 0;
+        for (int lane = 0; lane < 4; ++lane) {
+            Float tEntry = 0, tExit = tMax[lane];
+            for (int a = 0; a < 3; ++a) {
+                Float tNear = (b[dirIsNeg[a][lane]][a] - o[a][lane]) *
+                              invDir[a][lane];
+                Float tFar = (b[1 - dirIsNeg[a][lane]][a] - o[a][lane]) *
+                             invDirFar[a][lane];
+                tEntry = tNear > tEntry ? tNear : tEntry;
+                tExit = tFar < tExit ? tFar : tExit;
+            }
+            if (tEntry <= tExit) mask |= 1 << lane;
+        }
+        return mask & activeMask;
+#endif
+    }
+
+    Float o[3][4], invDir[3][4], invDirFar[3][4], tMax[4];
+    int32_t dirIsNeg[3][4];
+    int activeMask;
+};
+
+struct PacketNodeToVisit {
+    int nodeIndex, mask;
 };
 
 // BVHAccel Utility Functions
@@ -179,12 +491,51 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
     if (nPasses & 1) std::swap(*v, tempVector);
 }
 
+// Layout of a BVH stored in the scene cache: the header is followed by
+// the index in the original primitive vector of each ordered primitive
+// and then by the flattened nodes.
+struct CachedBVHHeader {
+    uint32_t nodeSize;
+    int32_t nPrimitives, totalNodes;
+};
+
+// _LinearBVHNode_ as stored in the scene cache
+struct CachedBVHNode {
+    Float bounds[2][3];  // [pMin, pMax][axis]
+    int32_t offset;      // leaf: first primitive, interior: second child
+    uint16_t nPrimitives;
+    uint8_t axis;
+    uint8_t pad[1];
+};
+
+static uint64_t sceneCacheKey(
+    const std::vector<BVHPrimitiveInfo> &primitiveInfo, int maxPrimsInNode,
+    BVHAccel::SplitMethod splitMethod) {
+    // FNV-1a hash of the build parameters and primitive bounds
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= ((const uint8_t *)data)[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    int params[3] = {maxPrimsInNode, int(splitMethod),
+                     int(primitiveInfo.size())};
+    add(params, sizeof(params));
+    for (const BVHPrimitiveInfo &pi : primitiveInfo)
+        add(&pi.bounds, sizeof(pi.bounds));
+    return hash;
+}
+
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
-                   int maxPrimsInNode, SplitMethod splitMethod)
+                   int maxPrimsInNode, SplitMethod splitMethod,
+                   int boundsBits, bool leafTriangles)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       splitMethod(splitMethod),
-      primitives(std::move(p)) {
+      primitives(std::move(p)),
+      boundsBits(boundsBits) {
+    CHECK(boundsBits == 8 || boundsBits == 16 || boundsBits == 32);
     ProfilePhase _(Prof::AccelConstruction);
     if (primitives.empty()) return;
     // Build BVH from _primitives_
@@ -194,26 +545,46 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
     for (size_t i = 0; i < primitives.size(); ++i)
         primitiveInfo[i] = {i, primitives[i]->WorldBound()};
 
-    // Build BVH tree for primitives using _primitiveInfo_
-    MemoryArena arena(1024 * 1024);
+    // Use the tree built for these primitives by an earlier run, if the
+    // scene cache has one. The tree only depends on the primitives'
+    // bounds, so they are all included in its key.
+    uint64_t cacheKey = 0;
+    if (SceneCacheActive()) {
+        cacheKey =
+            sceneCacheKey(primitiveInfo, this->maxPrimsInNode, splitMethod);
+        if (loadFromSceneCache(cacheKey)) {
+            if (leafTriangles) initLeafTriangles();
+            return;
+        }
+    }
+
+    // Build BVH tree for primitives using _primitiveInfo_; each thread that
+    // takes part in the build allocates nodes from its own arena
+    auto buildStart = std::chrono::steady_clock::now();
+    std::vector<MemoryArena> arenas(MaxThreadIndex());
     int totalNodes = 0;
     std::vector<std::shared_ptr<Primitive>> orderedPrims;
-    orderedPrims.reserve(primitives.size());
     BVHBuildNode *root;
-    if (splitMethod == SplitMethod::HLBVH)
-        root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
-    else
-        root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(),
+    if (splitMethod == SplitMethod::HLBVH) {
+        orderedPrims.reserve(primitives.size());
+        root = HLBVHBuild(arenas[ThreadIndex], primitiveInfo, &totalNodes,
+                          orderedPrims);
+    } else {
+        orderedPrims.resize(primitives.size());
+        root = recursiveBuild(arenas, primitiveInfo, 0, primitives.size(),
                               &totalNodes, orderedPrims);
+    }
     primitives.swap(orderedPrims);
     primitiveInfo.resize(0);
+    size_t arenaBytes = 0;
+    for (const MemoryArena &arena : arenas) arenaBytes += arena.TotalAllocated();
+    buildArenaBytes += arenaBytes;
     LOG(INFO) << StringPrintf("BVH created with %d nodes for %d "
-                              "primitives (%.2f MB), arena allocated %.2f MB",
+                              "primitives (%.2f MB), arenas allocated %.2f MB",
                               totalNodes, (int)primitives.size(),
                               float(totalNodes * sizeof(LinearBVHNode)) /
                               (1024.f * 1024.f),
-                              float(arena.TotalAllocated()) /
-                              (1024.f * 1024.f));
+                              float(arenaBytes) / (1024.f * 1024.f));
 
     // Compute representation of depth-first traversal of BVH tree
     treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
@@ -222,56 +593,179 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
     int offset = 0;
     flattenBVHTree(root, &offset);
     CHECK_EQ(totalNodes, offset);
+    std::chrono::duration<double> buildTime =
+        std::chrono::steady_clock::now() - buildStart;
+    ReportValue(buildSeconds, buildTime.count());
+    // _orderedPrims_ now holds the primitives in their original order
+    if (SceneCacheRecording())
+        storeInSceneCache(cacheKey, totalNodes, orderedPrims);
+    if (boundsBits != 32) compactTree(totalNodes);
+    if (leafTriangles) initLeafTriangles();
 }
 
 Bounds3f BVHAccel::WorldBound() const {
+    if (boundsBits != 32) return compactRootBounds;
     return nodes ? nodes[0].bounds : Bounds3f();
 }
 
+Float BVHAccel::SAHCost() const {
+    if (boundsBits == 8) return compactSAHCost(nodes8);
+    if (boundsBits == 16) return compactSAHCost(nodes16);
+    if (!nodes) return 0;
+    // Sum the costs of visiting each node, weighted by the probability
+    // of a ray that hits the root also hitting the node
+    Float cost = 0, rootArea = nodes[0].bounds.SurfaceArea();
+    int nodesToVisit[64], toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = 0;
+    while (toVisitOffset > 0) {
+        int nodeIndex = nodesToVisit[--toVisitOffset];
+        const LinearBVHNode &node = nodes[nodeIndex];
+        Float p = rootArea > 0 ? node.bounds.SurfaceArea() / rootArea : 1;
+        if (node.nPrimitives > 0)
+            cost += p * node.nPrimitives;
+        else {
+            cost += p;
+            nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+            nodesToVisit[toVisitOffset++] = nodeIndex + 1;
+        }
+    }
+    return cost;
+}
+
 struct BucketInfo {
     int count = 0;
     Bounds3f bounds;
 };
 
+// Ranges of at least _parallelBinningThreshold_ primitives have their
+// bounds, SAH buckets and partitions computed in parallel, in chunks of
+// _binningChunkSize_ primitives; the two children of nodes with at least
+// _parallelBuildThreshold_ primitives are built as separate tasks.
+static const int parallelBinningThreshold = 64 * 1024;
+static const int binningChunkSize = 16 * 1024;
+static const int parallelBuildThreshold = 4 * 1024;
+
+// Calls _func(chunkStart, chunkEnd, chunk)_ for each chunk of the given
+// range of primitives, in parallel if the range is large enough, and
+// returns the number of chunks.
+static int ForPrimitiveChunks(
+    int start, int end,
+    const std::function<void(int, int, int)> &func) {
+    int n = end - start;
+    if (n < parallelBinningThreshold || !ParallelRunning()) {
+        func(start, end, 0);
+        return 1;
+    }
+    ++nParallelBinningPasses;
+    int nChunks = (n + binningChunkSize - 1) / binningChunkSize;
+    ParallelFor([&](int64_t chunk) {
+        int chunkStart = start + chunk * binningChunkSize;
+        func(chunkStart, std::min(chunkStart + binningChunkSize, end), chunk);
+    }, nChunks);
+    return nChunks;
+}
+
+// Reorders _primitiveInfo[start, end)_ so that the primitives for which
+// _pred_ is true come first and returns the index of the first one for
+// which it is false. Large ranges are partitioned in parallel, keeping
+// the primitives on each side in their original order.
+template <typename Predicate>
+static int PartitionPrimitives(std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                               int start, int end, const Predicate &pred) {
+    if (end - start < parallelBinningThreshold || !ParallelRunning())
+        return std::partition(&primitiveInfo[start],
+                              &primitiveInfo[end - 1] + 1, pred) -
+               &primitiveInfo[0];
+    // Count the primitives that go first in each chunk
+    int nChunks = (end - start + binningChunkSize - 1) / binningChunkSize;
+    std::vector<int> chunkFirst(nChunks, 0);
+    ForPrimitiveChunks(start, end, [&](int s, int e, int chunk) {
+        for (int i = s; i < e; ++i) chunkFirst[chunk] += pred(primitiveInfo[i]);
+    });
+
+    // Find where each chunk's primitives go and move them there
+    std::vector<int> firstOffset(nChunks), secondOffset(nChunks);
+    int nFirst = 0;
+    for (int chunk = 0; chunk < nChunks; ++chunk) nFirst += chunkFirst[chunk];
+    for (int chunk = 0, first = 0, second = nFirst; chunk < nChunks; ++chunk) {
+        firstOffset[chunk] = first;
+        secondOffset[chunk] = second;
+        first += chunkFirst[chunk];
+        second += std::min(binningChunkSize,
+                           end - start - chunk * binningChunkSize) -
+                  chunkFirst[chunk];
+    }
+    std::vector<BVHPrimitiveInfo> partitioned(end - start);
+    ForPrimitiveChunks(start, end, [&](int s, int e, int chunk) {
+        int first = firstOffset[chunk], second = secondOffset[chunk];
+        for (int i = s; i < e; ++i)
+            partitioned[pred(primitiveInfo[i]) ? first++ : second++] =
+                primitiveInfo[i];
+    });
+    ForPrimitiveChunks(start, end, [&](int s, int e, int chunk) {
+        std::copy(partitioned.begin() + (s - start),
+                  partitioned.begin() + (e - start), &primitiveInfo[s]);
+    });
+    return start + nFirst;
+}
+
 BVHBuildNode *BVHAccel::recursiveBuild(
-    MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
-    int end, int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
+    std::vector<MemoryArena> &arenas,
+    std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end,
+    int *totalNodes, std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
     CHECK_NE(start, end);
-    BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
+    BVHBuildNode *node = arenas[ThreadIndex].Alloc<BVHBuildNode>();
     (*totalNodes)++;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, primitiveInfo[i].bounds);
-    int nPrimitives = end - start;
-    if (nPrimitives == 1) {
-        // Create leaf _BVHBuildNode_
-        int firstPrimOffset = orderedPrims.size();
+    // Compute bounds of all primitives and their centroids in BVH node;
+    // only ranges that are binned in parallel need per-chunk bounds,
+    // which come from this thread's arena
+    Bounds3f bounds, centroidBounds;
+    Bounds3f *chunkBounds = &bounds, *chunkCentroidBounds = &centroidBounds;
+    if (end - start >= parallelBinningThreshold) {
+        int maxChunks =
+            (end - start + binningChunkSize - 1) / binningChunkSize;
+        chunkBounds = arenas[ThreadIndex].Alloc<Bounds3f>(2 * maxChunks);
+        chunkCentroidBounds = chunkBounds + maxChunks;
+    }
+    int nChunks = ForPrimitiveChunks(start, end, [&](int s, int e, int chunk) {
+        for (int i = s; i < e; ++i) {
+            chunkBounds[chunk] = Union(chunkBounds[chunk],
+                                       primitiveInfo[i].bounds);
+            chunkCentroidBounds[chunk] = Union(chunkCentroidBounds[chunk],
+                                               primitiveInfo[i].centroid);
+        }
+    });
+    if (chunkBounds != &bounds)
+        for (int chunk = 0; chunk < nChunks; ++chunk) {
+            bounds = Union(bounds, chunkBounds[chunk]);
+            centroidBounds =
+                Union(centroidBounds, chunkCentroidBounds[chunk]);
+        }
+
+    // Leaves are given the primitives at the same offsets in
+    // _orderedPrims_ as in _primitiveInfo_, so subtrees can be built
+    // independently
+    auto initLeaf = [&]() {
         for (int i = start; i < end; ++i) {
             int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
+            orderedPrims[i] = primitives[primNum];
         }
-        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+        node->InitLeaf(start, end - start, bounds);
         return node;
+    };
+    int nPrimitives = end - start;
+    if (nPrimitives == 1) {
+        // Create leaf _BVHBuildNode_
+        return initLeaf();
     } else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+        // Choose split dimension _dim_
         int dim = centroidBounds.MaximumExtent();
 
         // Partition primitives into two sets and build children
         int mid = (start + end) / 2;
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
             // Create leaf _BVHBuildNode_
-            int firstPrimOffset = orderedPrims.size();
-            for (int i = start; i < end; ++i) {
-                int primNum = primitiveInfo[i].primitiveNumber;
-                orderedPrims.push_back(primitives[primNum]);
-            }
-            node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
-            return node;
+            return initLeaf();
         } else {
             // Partition primitives based on _splitMethod_
             switch (splitMethod) {
@@ -279,12 +773,11 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                 // Partition primitives through node's midpoint
                 Float pmid =
                     (centroidBounds.pMin[dim] + centroidBounds.pMax[dim]) / 2;
-                BVHPrimitiveInfo *midPtr = std::partition(
-                    &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+                mid = PartitionPrimitives(
+                    primitiveInfo, start, end,
                     [dim, pmid](const BVHPrimitiveInfo &pi) {
                         return pi.centroid[dim] < pmid;
                     });
-                mid = midPtr - &primitiveInfo[0];
                 // For lots of prims with large overlapping bounding boxes, this
                 // may fail to partition; in that case don't break and fall
                 // through
@@ -319,19 +812,41 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                     // Allocate _BucketInfo_ for SAH partition buckets
                     PBRT_CONSTEXPR int nBuckets = 12;
                     BucketInfo buckets[nBuckets];
-
-                    // Initialize _BucketInfo_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
+                    auto bucketIndex = [&](const BVHPrimitiveInfo &pi) {
                         int b = nBuckets *
-                                centroidBounds.Offset(
-                                    primitiveInfo[i].centroid)[dim];
+                                centroidBounds.Offset(pi.centroid)[dim];
                         if (b == nBuckets) b = nBuckets - 1;
                         CHECK_GE(b, 0);
                         CHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, primitiveInfo[i].bounds);
-                    }
+                        return b;
+                    };
+
+                    // Initialize _BucketInfo_ for SAH partition buckets,
+                    // binning each chunk of primitives separately when
+                    // there's more than one
+                    BucketInfo *chunkBuckets = buckets;
+                    if (nChunks > 1)
+                        chunkBuckets = arenas[ThreadIndex].Alloc<BucketInfo>(
+                            nChunks * nBuckets);
+                    ForPrimitiveChunks(start, end, [&](int s, int e,
+                                                       int chunk) {
+                        BucketInfo *cb = &chunkBuckets[chunk * nBuckets];
+                        for (int i = s; i < e; ++i) {
+                            int b = bucketIndex(primitiveInfo[i]);
+                            cb[b].count++;
+                            cb[b].bounds =
+                                Union(cb[b].bounds, primitiveInfo[i].bounds);
+                        }
+                    });
+                    if (chunkBuckets != buckets)
+                        for (int chunk = 0; chunk < nChunks; ++chunk)
+                            for (int b = 0; b < nBuckets; ++b) {
+                                const BucketInfo &cb =
+                                    chunkBuckets[chunk * nBuckets + b];
+                                buckets[b].count += cb.count;
+                                buckets[b].bounds =
+                                    Union(buckets[b].bounds, cb.bounds);
+                            }
 
                     // Compute costs for splitting after each bucket
                     Float cost[nBuckets - 1];
@@ -366,36 +881,38 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                     // bucket
                     Float leafCost = nPrimitives;
                     if (nPrimitives > maxPrimsInNode || minCost < leafCost) {
-                        BVHPrimitiveInfo *pmid = std::partition(
-                            &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
-                            [=](const BVHPrimitiveInfo &pi) {
-                                int b = nBuckets *
-                                        centroidBounds.Offset(pi.centroid)[dim];
-                                if (b == nBuckets) b = nBuckets - 1;
-                                CHECK_GE(b, 0);
-                                CHECK_LT(b, nBuckets);
-                                return b <= minCostSplitBucket;
+                        mid = PartitionPrimitives(
+                            primitiveInfo, start, end,
+                            [&](const BVHPrimitiveInfo &pi) {
+                                return bucketIndex(pi) <= minCostSplitBucket;
                             });
-                        mid = pmid - &primitiveInfo[0];
                     } else {
                         // Create leaf _BVHBuildNode_
-                        int firstPrimOffset = orderedPrims.size();
-                        for (int i = start; i < end; ++i) {
-                            int primNum = primitiveInfo[i].primitiveNumber;
-                            orderedPrims.push_back(primitives[primNum]);
-                        }
-                        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
-                        return node;
+                        return initLeaf();
                     }
                 }
                 break;
             }
             }
-            node->InitInterior(dim,
-                               recursiveBuild(arena, primitiveInfo, start, mid,
-                                              totalNodes, orderedPrims),
-                               recursiveBuild(arena, primitiveInfo, mid, end,
-                                              totalNodes, orderedPrims));
+            if (nPrimitives >= parallelBuildThreshold && ParallelRunning()) {
+                // Build the two children as separate tasks
+                BVHBuildNode *children[2];
+                int childNodes[2] = {0, 0};
+                ParallelFor([&](int64_t child) {
+                    children[child] = recursiveBuild(
+                        arenas, primitiveInfo, child ? mid : start,
+                        child ? end : mid, &childNodes[child], orderedPrims);
+                }, 2);
+                nParallelSubtrees += 2;
+                *totalNodes += childNodes[0] + childNodes[1];
+                node->InitInterior(dim, children[0], children[1]);
+            } else
+                node->InitInterior(
+                    dim,
+                    recursiveBuild(arenas, primitiveInfo, start, mid,
+                                   totalNodes, orderedPrims),
+                    recursiveBuild(arenas, primitiveInfo, mid, end,
+                                   totalNodes, orderedPrims));
         }
     }
     return node;
@@ -657,14 +1174,395 @@ int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
     return myOffset;
 }
 
-BVHAccel::~BVHAccel() { FreeAligned(nodes); }
+static bool validCachedTree(const std::vector<CachedBVHNode> &cachedNodes,
+                            int nPrimitives) {
+    // Nodes are stored depth first: an interior node's first child
+    // follows it, and its second child comes after the first child's
+    // subtree. Requiring children to have larger indices than their
+    // parents also rules out cycles.
+    int totalNodes = cachedNodes.size();
+    std::vector<std::pair<int, int>> todo;  // node index, end of subtree
+    todo.push_back(std::make_pair(0, totalNodes));
+    int nNodesVisited = 0;
+    while (!todo.empty()) {
+        int index = todo.back().first, end = todo.back().second;
+        todo.pop_back();
+        if (index >= end || ++nNodesVisited > totalNodes) return false;
+        const CachedBVHNode &node = cachedNodes[index];
+        if (node.nPrimitives > 0) {
+            if (node.offset < 0 ||
+                node.offset > nPrimitives - node.nPrimitives)
+                return false;
+        } else {
+            int second = node.offset;
+            if (node.axis > 2 || second <= index + 1 || second >= end)
+                return false;
+            todo.push_back(std::make_pair(second, end));
+            todo.push_back(std::make_pair(index + 1, second));
+        }
+    }
+    return nNodesVisited == totalNodes;
+}
+
+bool BVHAccel::loadFromSceneCache(uint64_t key) {
+    const char *data;
+    size_t size;
+    if (!FindCachedAccelerator(key, &data, &size)) return false;
+    CachedBVHHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.nodeSize != sizeof(CachedBVHNode) ||
+        header.nPrimitives != int(primitives.size()) ||
+        header.totalNodes <= 0 ||
+        size != sizeof(header) + header.nPrimitives * sizeof(int32_t) +
+                    header.totalNodes * sizeof(CachedBVHNode))
+        return false;
+
+    // The cache key is only a hash, so check that the primitive order is
+    // a permutation and that the tree is well formed before using them;
+    // if not, the tree is rebuilt.
+    std::vector<int32_t> primitiveIndices(header.nPrimitives);
+    memcpy(primitiveIndices.data(), data + sizeof(header),
+           header.nPrimitives * sizeof(int32_t));
+    std::vector<bool> primitiveSeen(header.nPrimitives, false);
+    bool valid = true;
+    for (int32_t index : primitiveIndices) {
+        if (index < 0 || index >= header.nPrimitives || primitiveSeen[index]) {
+            valid = false;
+            break;
+        }
+        primitiveSeen[index] = true;
+    }
+    std::vector<CachedBVHNode> cachedNodes(header.totalNodes);
+    memcpy(cachedNodes.data(),
+           data + sizeof(header) + header.nPrimitives * sizeof(int32_t),
+           header.totalNodes * sizeof(CachedBVHNode));
+    if (!valid || !validCachedTree(cachedNodes, header.nPrimitives)) {
+        Warning("Ignoring malformed BVH in scene cache.");
+        return false;
+    }
+
+    // Reorder the primitives as they were when the tree was built
+    std::vector<std::shared_ptr<Primitive>> orderedPrims;
+    orderedPrims.reserve(primitives.size());
+    for (int32_t index : primitiveIndices)
+        orderedPrims.push_back(primitives[index]);
+    primitives.swap(orderedPrims);
+
+    treeBytes += header.totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
+                 primitives.size() * sizeof(primitives[0]);
+    nodes = AllocAligned<LinearBVHNode>(header.totalNodes);
+    for (int i = 0; i < header.totalNodes; ++i) {
+        const CachedBVHNode &cn = cachedNodes[i];
+        LinearBVHNode &node = nodes[i];
+        node.bounds = Bounds3f(Point3f(cn.bounds[0][0], cn.bounds[0][1],
+                                       cn.bounds[0][2]),
+                               Point3f(cn.bounds[1][0], cn.bounds[1][1],
+                                       cn.bounds[1][2]));
+        node.primitivesOffset = cn.offset;
+        node.nPrimitives = cn.nPrimitives;
+        node.axis = cn.axis;
+    }
+    ++nCachedTrees;
+    LOG(INFO) << StringPrintf("BVH with %d nodes for %d primitives loaded "
+                              "from scene cache", header.totalNodes,
+                              header.nPrimitives);
+    if (boundsBits != 32) compactTree(header.totalNodes);
+    return true;
+}
+
+void BVHAccel::storeInSceneCache(
+    uint64_t key, int totalNodes,
+    const std::vector<std::shared_ptr<Primitive>> &originalPrims) const {
+    // Find the original index of each of the ordered primitives
+    std::unordered_map<const Primitive *, int32_t> primitiveIndex;
+    for (size_t i = 0; i < originalPrims.size(); ++i)
+        primitiveIndex[originalPrims[i].get()] = i;
+
+    CachedBVHHeader header;
+    header.nodeSize = sizeof(CachedBVHNode);
+    header.nPrimitives = primitives.size();
+    header.totalNodes = totalNodes;
+    std::string data((const char *)&header, sizeof(header));
+    data.reserve(sizeof(header) + primitives.size() * sizeof(int32_t) +
+                 totalNodes * sizeof(CachedBVHNode));
+    for (const std::shared_ptr<Primitive> &p : primitives) {
+        int32_t index = primitiveIndex[p.get()];
+        data.append((const char *)&index, sizeof(index));
+    }
+    for (int i = 0; i < totalNodes; ++i) {
+        const LinearBVHNode &node = nodes[i];
+        CachedBVHNode cn;
+        for (int a = 0; a < 3; ++a) {
+            cn.bounds[0][a] = node.bounds.pMin[a];
+            cn.bounds[1][a] = node.bounds.pMax[a];
+        }
+        cn.offset = node.primitivesOffset;
+        cn.nPrimitives = node.nPrimitives;
+        cn.axis = node.nPrimitives > 0 ? 0 : node.axis;
+        cn.pad[0] = 0;
+        data.append((const char *)&cn, sizeof(cn));
+    }
+    CacheAccelerator(key, std::move(data));
+}
+
+void BVHAccel::compactTree(int totalNodes) {
+    // Convert the flattened binary tree to compact nodes
+    compactRootBounds = nodes[0].bounds;
+    std::vector<CompactBVHNode<uint8_t>> compact8;
+    std::vector<CompactBVHNode<uint16_t>> compact16;
+    size_t compactBytes;
+    if (boundsBits == 8) {
+        if (nodes[0].nPrimitives == 0)
+            compactSubtree(0, compactRootBounds, &compact8);
+        nCompactNodes = compact8.size();
+        nodes8 = AllocAligned<CompactBVHNode<uint8_t>>(nCompactNodes);
+        std::copy(compact8.begin(), compact8.end(), nodes8);
+        compactBytes = nCompactNodes * sizeof(CompactBVHNode<uint8_t>);
+    } else {
+        if (nodes[0].nPrimitives == 0)
+            compactSubtree(0, compactRootBounds, &compact16);
+        nCompactNodes = compact16.size();
+        nodes16 = AllocAligned<CompactBVHNode<uint16_t>>(nCompactNodes);
+        std::copy(compact16.begin(), compact16.end(), nodes16);
+        compactBytes = nCompactNodes * sizeof(CompactBVHNode<uint16_t>);
+    }
+    FreeAligned(nodes);
+    nodes = nullptr;
+
+    // Account for the memory saved in the tree's statistics
+    size_t linearBytes = totalNodes * sizeof(LinearBVHNode);
+    treeBytes -= linearBytes;
+    treeBytes += compactBytes;
+    compactTreeSavedBytes += linearBytes - compactBytes;
+    LOG(INFO) << StringPrintf("BVH compacted to %d %d-bit nodes (%.2f MB)",
+                              nCompactNodes, boundsBits,
+                              float(compactBytes) / (1024.f * 1024.f));
+}
+
+template <typename T>
+int BVHAccel::compactSubtree(int nodeIndex, const Bounds3f &bounds,
+                             std::vector<CompactBVHNode<T>> *compactNodes)
+    const {
+    const LinearBVHNode &node = nodes[nodeIndex];
+    int compactIndex = compactNodes->size();
+    compactNodes->push_back(CompactBVHNode<T>());
+    (*compactNodes)[compactIndex].axis = node.axis;
+    int childIndex[2] = {nodeIndex + 1, node.secondChildOffset};
+    for (int c = 0; c < 2; ++c) {
+        const LinearBVHNode &child = nodes[childIndex[c]];
+        CompactBVHNode<T> &cn = (*compactNodes)[compactIndex];
+        QuantizeBounds(child.bounds, bounds, &cn, c);
+        Bounds3f childBounds = DequantizeBounds(cn, c, bounds);
+        if (child.nPrimitives > 0 &&
+            child.nPrimitives <= MaxCompactLeafPrimitives) {
+            cn.nPrimitives[c] = child.nPrimitives;
+            cn.child[c] = child.primitivesOffset;
+            continue;
+        }
+        // Convert the child's subtree, using its quantized bounds as the
+        // reference for its children's bounds
+        cn.nPrimitives[c] = 0;
+        int index =
+            child.nPrimitives > 0
+                ? compactLeaf(child.primitivesOffset, child.nPrimitives,
+                              childBounds, compactNodes)
+                : compactSubtree(childIndex[c], childBounds, compactNodes);
+        (*compactNodes)[compactIndex].child[c] = index;
+    }
+    return compactIndex;
+}
+
+template <typename T>
+int BVHAccel::compactLeaf(int primitivesOffset, int nPrimitives,
+                          const Bounds3f &bounds,
+                          std::vector<CompactBVHNode<T>> *compactNodes)
+    const {
+    // Leaves with more primitives than a compact node can record (which
+    // may come from primitives with coincident centroids or from HLBVH)
+    // are split in half until their parts fit
+    int compactIndex = compactNodes->size();
+    compactNodes->push_back(CompactBVHNode<T>());
+    (*compactNodes)[compactIndex].axis = 0;
+    int half = nPrimitives / 2;
+    int offset[2] = {primitivesOffset, primitivesOffset + half};
+    int count[2] = {half, nPrimitives - half};
+    for (int c = 0; c < 2; ++c) {
+        Bounds3f partBounds;
+        for (int i = offset[c]; i < offset[c] + count[c]; ++i)
+            partBounds = Union(partBounds, primitives[i]->WorldBound());
+        CompactBVHNode<T> &cn = (*compactNodes)[compactIndex];
+        QuantizeBounds(partBounds, bounds, &cn, c);
+        if (count[c] <= MaxCompactLeafPrimitives) {
+            cn.nPrimitives[c] = count[c];
+            cn.child[c] = offset[c];
+        } else {
+            Bounds3f childBounds = DequantizeBounds(cn, c, bounds);
+            cn.nPrimitives[c] = 0;
+            int index =
+                compactLeaf(offset[c], count[c], childBounds, compactNodes);
+            (*compactNodes)[compactIndex].child[c] = index;
+        }
+    }
+    return compactIndex;
+}
+
+template <typename T>
+bool BVHAccel::compactIntersect(const CompactBVHNode<T> *compactNodes,
+                                const Ray &ray,
+                                SurfaceInteraction *isect) const {
+    if (primitives.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersect);
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    if (!compactRootBounds.IntersectP(ray, invDir, dirIsNeg)) return false;
+    LeafIntersector leaves(primitives, triangles, ray);
+    if (nCompactNodes == 0)
+        return leaves.Finish(leaves.Intersect(0, primitives.size(), isect),
+                             isect);
+    // Follow ray through the compact nodes, testing both children's
+    // bounds at each one
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    Bounds3f currentBounds = compactRootBounds;
+    CompactNodeToVisit nodesToVisit[64];
+    while (true) {
+        const CompactBVHNode<T> &node = compactNodes[currentNodeIndex];
+        int nearChild = dirIsNeg[node.axis], nInterior = 0;
+        int interior[2];
+        Bounds3f interiorBounds[2];
+        for (int i = 0; i < 2; ++i) {
+            int c = nearChild ^ i;
+            Bounds3f childBounds = DequantizeBounds(node, c, currentBounds);
+            if (!childBounds.IntersectP(ray, invDir, dirIsNeg)) continue;
+            if (node.nPrimitives[c] > 0) {
+                // Intersect ray with primitives in leaf child
+                if (leaves.Intersect(node.child[c], node.nPrimitives[c], isect))
+                    hit = true;
+            } else {
+                interior[nInterior] = node.child[c];
+                interiorBounds[nInterior++] = childBounds;
+            }
+        }
+        if (nInterior == 2)
+            nodesToVisit[toVisitOffset++].Set(interior[1], interiorBounds[1]);
+        if (nInterior > 0) {
+            currentNodeIndex = interior[0];
+            currentBounds = interiorBounds[0];
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset].nodeIndex;
+            currentBounds = nodesToVisit[toVisitOffset].Bounds();
+        }
+    }
+    return leaves.Finish(hit, isect);
+}
+
+template <typename T>
+bool BVHAccel::compactIntersectP(const CompactBVHNode<T> *compactNodes,
+                                 const Ray &ray) const {
+    if (primitives.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersectP);
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    if (!compactRootBounds.IntersectP(ray, invDir, dirIsNeg)) return false;
+    LeafIntersector leaves(primitives, triangles, ray);
+    if (nCompactNodes == 0) return leaves.IntersectP(0, primitives.size());
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    Bounds3f currentBounds = compactRootBounds;
+    CompactNodeToVisit nodesToVisit[64];
+    while (true) {
+        const CompactBVHNode<T> &node = compactNodes[currentNodeIndex];
+        int nearChild = dirIsNeg[node.axis], nInterior = 0;
+        int interior[2];
+        Bounds3f interiorBounds[2];
+        for (int i = 0; i < 2; ++i) {
+            int c = nearChild ^ i;
+            Bounds3f childBounds = DequantizeBounds(node, c, currentBounds);
+            if (!childBounds.IntersectP(ray, invDir, dirIsNeg)) continue;
+            if (node.nPrimitives[c] > 0) {
+                if (leaves.IntersectP(node.child[c], node.nPrimitives[c]))
+                    return true;
+            } else {
+                interior[nInterior] = node.child[c];
+                interiorBounds[nInterior++] = childBounds;
+            }
+        }
+        if (nInterior == 2)
+            nodesToVisit[toVisitOffset++].Set(interior[1], interiorBounds[1]);
+        if (nInterior > 0) {
+            currentNodeIndex = interior[0];
+            currentBounds = interiorBounds[0];
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset].nodeIndex;
+            currentBounds = nodesToVisit[toVisitOffset].Bounds();
+        }
+    }
+    return false;
+}
+
+template <typename T>
+Float BVHAccel::compactSAHCost(const CompactBVHNode<T> *compactNodes) const {
+    if (primitives.empty()) return 0;
+    if (nCompactNodes == 0) return primitives.size();
+    Float cost = 0, rootArea = compactRootBounds.SurfaceArea();
+    auto probability = [&](const Bounds3f &b) {
+        return rootArea > 0 ? b.SurfaceArea() / rootArea : 1;
+    };
+    CompactNodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++].Set(0, compactRootBounds);
+    while (toVisitOffset > 0) {
+        const CompactNodeToVisit &toVisit = nodesToVisit[--toVisitOffset];
+        const CompactBVHNode<T> &node = compactNodes[toVisit.nodeIndex];
+        Bounds3f bounds = toVisit.Bounds();
+        cost += probability(bounds);
+        for (int c = 0; c < 2; ++c) {
+            Bounds3f childBounds = DequantizeBounds(node, c, bounds);
+            if (node.nPrimitives[c] > 0)
+                cost += probability(childBounds) * node.nPrimitives[c];
+            else
+                nodesToVisit[toVisitOffset++].Set(node.child[c], childBounds);
+        }
+    }
+    return cost;
+}
+
+void BVHAccel::initLeafTriangles() {
+    // Leaf triangles are only used if every primitive is an opaque triangle
+    for (const std::shared_ptr<Primitive> &prim : primitives) {
+        auto gp = dynamic_cast<const GeometricPrimitive *>(prim.get());
+        auto tri = gp ? dynamic_cast<const Triangle *>(gp->GetShape())
+                      : nullptr;
+        if (!tri || tri->HasAlphaMask()) return;
+    }
+    triangles = AllocAligned<LeafTriangle>(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        auto gp = static_cast<const GeometricPrimitive *>(primitives[i].get());
+        static_cast<const Triangle *>(gp->GetShape())
+            ->GetVertices(triangles[i].p);
+    }
+    treeBytes += primitives.size() * sizeof(LeafTriangle);
+    ++nLeafTriangleTrees;
+}
+
+BVHAccel::~BVHAccel() {
+    FreeAligned(nodes);
+    FreeAligned(nodes8);
+    FreeAligned(nodes16);
+    FreeAligned(triangles);
+}
 
 bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
+    if (boundsBits == 8) return compactIntersect(nodes8, ray, isect);
+    if (boundsBits == 16) return compactIntersect(nodes16, ray, isect);
     if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersect);
     bool hit = false;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    LeafIntersector leaves(primitives, triangles, ray);
     // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
@@ -674,10 +1572,9 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i)
-                    if (primitives[node->primitivesOffset + i]->Intersect(
-                            ray, isect))
-                        hit = true;
+                if (leaves.Intersect(node->primitivesOffset, node->nPrimitives,
+                                     isect))
+                    hit = true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
@@ -696,14 +1593,17 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
-    return hit;
+    return leaves.Finish(hit, isect);
 }
 
 bool BVHAccel::IntersectP(const Ray &ray) const {
+    if (boundsBits == 8) return compactIntersectP(nodes8, ray);
+    if (boundsBits == 16) return compactIntersectP(nodes16, ray);
     if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersectP);
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    LeafIntersector leaves(primitives, triangles, ray);
     int nodesToVisit[64];
     int toVisitOffset = 0, currentNodeIndex = 0;
     while (true) {
@@ -711,12 +1611,9 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    if (primitives[node->primitivesOffset + i]->IntersectP(
-                            ray)) {
-                        return true;
-                    }
-                }
+                if (leaves.IntersectP(node->primitivesOffset,
+                                      node->nPrimitives))
+                    return true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
@@ -737,26 +1634,154 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
     return false;
 }
 
-std::shared_ptr<BVHAccel> CreateBVHAccelerator(
-    std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
+void BVHAccel::IntersectBatch(const RayBatch &rays, SurfaceInteraction *isects,
+                              bool *hits) const {
+    // Compact trees are traversed one ray at a time
+    if (boundsBits != 32) {
+        Aggregate::IntersectBatch(rays, isects, hits);
+        return;
+    }
+    for (int i = 0; i < rays.Size(); ++i) hits[i] = false;
+    if (!nodes) return;
+    ProfilePhase p(Prof::AccelIntersect);
+    for (int start = 0; start < rays.Size(); start += 4) {
+        RayPacket packet(rays, start);
+        // Each of the packet's rays is intersected with the leaves
+        // separately
+        int count = std::min(4, rays.Size() - start);
+        Ray laneRays[4];
+        for (int lane = 0; lane < 4; ++lane)
+            laneRays[lane] = rays.GetRay(start + std::min(lane, count - 1));
+        LeafIntersector leaves[4] = {{primitives, triangles, laneRays[0]},
+                                     {primitives, triangles, laneRays[1]},
+                                     {primitives, triangles, laneRays[2]},
+                                     {primitives, triangles, laneRays[3]}};
+        // Follow the packet through the BVH; _mask_ records which of its
+        // rays overlap the current node's parent
+        PacketNodeToVisit nodesToVisit[64];
+        int toVisitOffset = 0, currentNodeIndex = 0;
+        int mask = packet.activeMask;
+        while (true) {
+            const LinearBVHNode *node = &nodes[currentNodeIndex];
+            int hitMask = mask & packet.IntersectP(node->bounds);
+            if (hitMask && node->nPrimitives > 0) {
+                // Intersect the overlapping rays with the leaf's primitives
+                for (int m = hitMask; m != 0; m &= m - 1) {
+                    int lane = CountTrailingZeros(m), i = start + lane;
+                    if (leaves[lane].Intersect(node->primitivesOffset,
+                                               node->nPrimitives, &isects[i]))
+                        hits[i] = true;
+                    rays.tMax[i] = packet.tMax[lane] = laneRays[lane].tMax;
+                }
+            } else if (hitMask) {
+                // Visit the child that is nearer for the first overlapping
+                // ray first
+                int lane = CountTrailingZeros(hitMask);
+                int nearChild = currentNodeIndex + 1;
+                int farChild = node->secondChildOffset;
+                if (packet.dirIsNeg[node->axis][lane])
+                    std::swap(nearChild, farChild);
+                nodesToVisit[toVisitOffset++] = {farChild, hitMask};
+                currentNodeIndex = nearChild;
+                mask = hitMask;
+                continue;
+            }
+            if (toVisitOffset == 0) break;
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+            mask = nodesToVisit[toVisitOffset].mask;
+        }
+        for (int lane = 0; lane < count; ++lane) {
+            int i = start + lane;
+            hits[i] = leaves[lane].Finish(hits[i], &isects[i]);
+            rays.tMax[i] = laneRays[lane].tMax;
+        }
+    }
+}
+
+void BVHAccel::IntersectPBatch(const RayBatch &rays, bool *hits) const {
+    if (boundsBits != 32) {
+        Aggregate::IntersectPBatch(rays, hits);
+        return;
+    }
+    for (int i = 0; i < rays.Size(); ++i) hits[i] = false;
+    if (!nodes) return;
+    ProfilePhase p(Prof::AccelIntersectP);
+    for (int start = 0; start < rays.Size(); start += 4) {
+        RayPacket packet(rays, start);
+        // Each of the packet's rays is intersected with the leaves
+        // separately
+        int count = std::min(4, rays.Size() - start);
+        Ray laneRays[4];
+        for (int lane = 0; lane < 4; ++lane)
+            laneRays[lane] = rays.GetRay(start + std::min(lane, count - 1));
+        LeafIntersector leaves[4] = {{primitives, triangles, laneRays[0]},
+                                     {primitives, triangles, laneRays[1]},
+                                     {primitives, triangles, laneRays[2]},
+                                     {primitives, triangles, laneRays[3]}};
+        PacketNodeToVisit nodesToVisit[64];
+        int toVisitOffset = 0, currentNodeIndex = 0;
+        // Rays are removed from _unoccluded_ as soon as they hit something
+        int unoccluded = packet.activeMask, mask = unoccluded;
+        while (unoccluded != 0) {
+            const LinearBVHNode *node = &nodes[currentNodeIndex];
+            int hitMask = mask & unoccluded & packet.IntersectP(node->bounds);
+            if (hitMask && node->nPrimitives > 0) {
+                for (int m = hitMask; m != 0; m &= m - 1) {
+                    int lane = CountTrailingZeros(m), i = start + lane;
+                    if (leaves[lane].IntersectP(node->primitivesOffset,
+                                                node->nPrimitives)) {
+                        hits[i] = true;
+                        unoccluded &= ~(1 << lane);
+                    }
+                }
+            } else if (hitMask) {
+                int lane = CountTrailingZeros(hitMask);
+                int nearChild = currentNodeIndex + 1;
+                int farChild = node->secondChildOffset;
+                if (packet.dirIsNeg[node->axis][lane])
+                    std::swap(nearChild, farChild);
+                nodesToVisit[toVisitOffset++] = {farChild, hitMask};
+                currentNodeIndex = nearChild;
+                mask = hitMask;
+                continue;
+            }
+            if (toVisitOffset == 0) break;
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+            mask = nodesToVisit[toVisitOffset].mask;
+        }
+    }
+}
+
+BVHAccel::SplitMethod BVHSplitMethod(const ParamSet &ps) {
     std::string splitMethodName = ps.FindOneString("splitmethod", "sah");
-    BVHAccel::SplitMethod splitMethod;
     if (splitMethodName == "sah")
-        splitMethod = BVHAccel::SplitMethod::SAH;
+        return BVHAccel::SplitMethod::SAH;
     else if (splitMethodName == "hlbvh")
-        splitMethod = BVHAccel::SplitMethod::HLBVH;
+        return BVHAccel::SplitMethod::HLBVH;
     else if (splitMethodName == "middle")
-        splitMethod = BVHAccel::SplitMethod::Middle;
+        return BVHAccel::SplitMethod::Middle;
     else if (splitMethodName == "equal")
-        splitMethod = BVHAccel::SplitMethod::EqualCounts;
-    else {
-        Warning("BVH split method \"%s\" unknown.  Using \"sah\".",
-                splitMethodName.c_str());
-        splitMethod = BVHAccel::SplitMethod::SAH;
-    }
+        return BVHAccel::SplitMethod::EqualCounts;
+    Warning("BVH split method \"%s\" unknown.  Using \"sah\".",
+            splitMethodName.c_str());
+    return BVHAccel::SplitMethod::SAH;
+}
 
+std::shared_ptr<BVHAccel> CreateBVHAccelerator(
+    std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
+    BVHAccel::SplitMethod splitMethod = BVHSplitMethod(ps);
     int maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode, splitMethod);
+    int boundsBits = ps.FindOneInt("boundsbits", 32);
+    if (boundsBits != 8 && boundsBits != 16 && boundsBits != 32) {
+        Warning("BVH \"boundsbits\" must be 8, 16 or 32; got %d. Using 32.",
+                boundsBits);
+        boundsBits = 32;
+    }
+    bool leafTriangles = ps.FindOneBool("leaftriangles", true);
+    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode,
+                                      splitMethod, boundsBits, leafTriangles);
 }
 
 }  // namespace pbrt
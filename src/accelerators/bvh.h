@@ -49,7 +49,25 @@ struct BVHBuildNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 struct MortonPrimitive;
-struct LinearBVHNode;
+template <int Width>
+class WideBVHAccel;
+
+// Flattened BVH nodes are stored in depth-first order, so that the first
+// child of an interior node immediately follows it.
+struct LinearBVHNode {
+    Bounds3f bounds;
+    union {
+        int primitivesOffset;   // leaf
+        int secondChildOffset;  // interior
+    };
+    uint16_t nPrimitives;  // 0 -> interior node
+    uint8_t axis;          // interior node: xyz
+    uint8_t pad[1];        // ensure 32 byte total size
+};
+
+template <typename T>
+struct CompactBVHNode;
+struct LeafTriangle;
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
@@ -60,17 +78,30 @@ class BVHAccel : public Aggregate {
     // BVHAccel Public Methods
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH, int boundsBits = 32,
+             bool leafTriangles = true);
     Bounds3f WorldBound() const;
+    // Returns the expected cost of tracing a ray through the tree under
+    // the SAH cost model used to build it, relative to the cost of
+    // intersecting a single primitive.
+    Float SAHCost() const;
     ~BVHAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void IntersectBatch(const RayBatch &rays, SurfaceInteraction *isects,
+                        bool *hits) const;
+    void IntersectPBatch(const RayBatch &rays, bool *hits) const;
 
   private:
+    // Wide BVHs are built by collapsing a binary BVH's nodes.
+    template <int Width>
+    friend class WideBVHAccel;
+
     // BVHAccel Private Methods
     BVHBuildNode *recursiveBuild(
-        MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
-        int start, int end, int *totalNodes,
+        std::vector<MemoryArena> &arenas,
+        std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end,
+        int *totalNodes,
         std::vector<std::shared_ptr<Primitive>> &orderedPrims);
     BVHBuildNode *HLBVHBuild(
         MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
@@ -86,14 +117,51 @@ class BVHAccel : public Aggregate {
                                 std::vector<BVHBuildNode *> &treeletRoots,
                                 int start, int end, int *totalNodes) const;
     int flattenBVHTree(BVHBuildNode *node, int *offset);
+    void compactTree(int totalNodes);
+    template <typename T>
+    int compactSubtree(int nodeIndex, const Bounds3f &bounds,
+                       std::vector<CompactBVHNode<T>> *compactNodes) const;
+    template <typename T>
+    int compactLeaf(int primitivesOffset, int nPrimitives,
+                    const Bounds3f &bounds,
+                    std::vector<CompactBVHNode<T>> *compactNodes) const;
+    template <typename T>
+    bool compactIntersect(const CompactBVHNode<T> *compactNodes,
+                          const Ray &ray, SurfaceInteraction *isect) const;
+    template <typename T>
+    bool compactIntersectP(const CompactBVHNode<T> *compactNodes,
+                           const Ray &ray) const;
+    template <typename T>
+    Float compactSAHCost(const CompactBVHNode<T> *compactNodes) const;
+    void initLeafTriangles();
+    bool loadFromSceneCache(uint64_t key);
+    void storeInSceneCache(
+        uint64_t key, int totalNodes,
+        const std::vector<std::shared_ptr<Primitive>> &originalPrims) const;
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<std::shared_ptr<Primitive>> primitives;
     LinearBVHNode *nodes = nullptr;
+    // If _boundsBits_ is 8 or 16, the tree is stored using _nodes8_ or
+    // _nodes16_ instead of _nodes_ once it has been built (see
+    // _compactTree()_). These hold a node for each interior node, with
+    // its children's bounds quantized relative to its own; trees whose
+    // root is a leaf have no compact nodes at all.
+    const int boundsBits;
+    Bounds3f compactRootBounds;
+    int nCompactNodes = 0;
+    CompactBVHNode<uint8_t> *nodes8 = nullptr;
+    CompactBVHNode<uint16_t> *nodes16 = nullptr;
+    // If all of the primitives are opaque triangles, _triangles_ holds
+    // their vertices, in the same order as _primitives_, so that leaves
+    // can be intersected without going through the primitives and shapes.
+    LeafTriangle *triangles = nullptr;
 };
 
+// Returns the split method given by the "splitmethod" parameter.
+BVHAccel::SplitMethod BVHSplitMethod(const ParamSet &ps);
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps);
 
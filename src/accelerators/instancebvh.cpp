@@ -0,0 +1,183 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// accelerators/instancebvh.cpp*
+#include "accelerators/instancebvh.h"
+#include "interaction.h"
+#include "stats.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Object instances", instanceBytes);
+STAT_COUNTER("Instancing/Instances in BVHs", nInstances);
+STAT_COUNTER("Instancing/Animated instances", nAnimatedInstances);
+STAT_COUNTER("Instancing/Shared prototypes", nPrototypes);
+STAT_INT_DISTRIBUTION("Instancing/Instances entered per ray",
+                      instancesEnteredPerRay);
+
+// InstanceBVHAccel Local Declarations
+
+// The number of instances the current ray has been tested against
+static PBRT_THREAD_LOCAL int instancesEntered;
+
+// A single use of an object instance, as stored in the leaves of the
+// top-level BVH.
+class Instance : public Primitive {
+  public:
+    Instance(const Primitive *prototype, const InstanceUse &use,
+             const AnimatedTransform *animatedInstanceToWorld)
+        : prototype(prototype),
+          instanceToWorld(use.instanceToWorld[0]),
+          animatedInstanceToWorld(animatedInstanceToWorld) {}
+    Bounds3f WorldBound() const {
+        if (animatedInstanceToWorld)
+            return animatedInstanceToWorld->MotionBounds(
+                prototype->WorldBound());
+        return (*instanceToWorld)(prototype->WorldBound());
+    }
+    bool Intersect(const Ray &r, SurfaceInteraction *isect) const {
+        ++instancesEntered;
+        if (animatedInstanceToWorld) {
+            // Compute _ray_ after transformation by the interpolated
+            // instance transformation
+            Transform interpolatedInstanceToWorld;
+            animatedInstanceToWorld->Interpolate(r.time,
+                                                 &interpolatedInstanceToWorld);
+            Ray ray = Inverse(interpolatedInstanceToWorld)(r);
+            if (!prototype->Intersect(ray, isect)) return false;
+            r.tMax = ray.tMax;
+            if (!interpolatedInstanceToWorld.IsIdentity())
+                *isect = interpolatedInstanceToWorld(*isect);
+        } else {
+            Ray ray = Inverse(*instanceToWorld)(r);
+            if (!prototype->Intersect(ray, isect)) return false;
+            r.tMax = ray.tMax;
+            if (!instanceToWorld->IsIdentity())
+                *isect = (*instanceToWorld)(*isect);
+        }
+        CHECK_GE(Dot(isect->n, isect->shading.n), 0);
+        return true;
+    }
+    bool IntersectP(const Ray &r) const {
+        ++instancesEntered;
+        if (animatedInstanceToWorld) {
+            Transform interpolatedInstanceToWorld;
+            animatedInstanceToWorld->Interpolate(r.time,
+                                                 &interpolatedInstanceToWorld);
+            return prototype->IntersectP(
+                Inverse(interpolatedInstanceToWorld)(r));
+        }
+        return prototype->IntersectP(Inverse(*instanceToWorld)(r));
+    }
+    const AreaLight *GetAreaLight() const { return nullptr; }
+    const Material *GetMaterial() const { return nullptr; }
+    void ComputeScatteringFunctions(SurfaceInteraction *isect,
+                                    MemoryArena &arena, TransportMode mode,
+                                    bool allowMultipleLobes) const {
+        LOG(FATAL) << "Instance::ComputeScatteringFunctions() shouldn't be "
+                      "called";
+    }
+
+  private:
+    const Primitive *prototype;
+    const Transform *instanceToWorld;
+    // Only set for instances whose transformation is animated
+    const AnimatedTransform *animatedInstanceToWorld;
+};
+
+// InstanceBVHAccel Method Definitions
+InstanceBVHAccel::InstanceBVHAccel(std::vector<InstanceUse> uses,
+                                   BVHAccel::SplitMethod splitMethod) {
+    ProfilePhase _(Prof::AccelConstruction);
+    // Create _AnimatedTransform_s for the animated instances; the vector
+    // is sized up front so that the instances can point into it
+    auto isAnimated = [](const InstanceUse &use) {
+        return *use.instanceToWorld[0] != *use.instanceToWorld[1];
+    };
+    animatedTransforms.reserve(
+        std::count_if(uses.begin(), uses.end(), isAnimated));
+    for (const InstanceUse &use : uses)
+        if (isAnimated(use))
+            animatedTransforms.push_back(AnimatedTransform(
+                use.instanceToWorld[0], use.startTime, use.instanceToWorld[1],
+                use.endTime));
+
+    // Create an _Instance_ for each use, keeping one reference to each
+    // prototype
+    std::vector<std::shared_ptr<Primitive>> instances;
+    instances.reserve(uses.size());
+    std::unordered_set<const Primitive *> seenPrototypes;
+    int animatedIndex = 0;
+    for (const InstanceUse &use : uses) {
+        if (seenPrototypes.insert(use.prototype.get()).second)
+            prototypes.push_back(use.prototype);
+        const AnimatedTransform *animated =
+            isAnimated(use) ? &animatedTransforms[animatedIndex++] : nullptr;
+        instances.push_back(
+            std::make_shared<Instance>(use.prototype.get(), use, animated));
+    }
+    nInstances += instances.size();
+    nAnimatedInstances += animatedTransforms.size();
+    nPrototypes += prototypes.size();
+    instanceBytes +=
+        sizeof(*this) +
+        instances.size() * (sizeof(Instance) + sizeof(instances[0])) +
+        animatedTransforms.size() * sizeof(AnimatedTransform) +
+        prototypes.size() * sizeof(prototypes[0]);
+
+    // Build the top-level BVH over the instances. Intersecting an instance
+    // is far more expensive than visiting a node, so each leaf holds a
+    // single instance.
+    bvh.reset(new BVHAccel(std::move(instances), 1, splitMethod));
+}
+
+Bounds3f InstanceBVHAccel::WorldBound() const { return bvh->WorldBound(); }
+
+bool InstanceBVHAccel::Intersect(const Ray &ray,
+                                 SurfaceInteraction *isect) const {
+    instancesEntered = 0;
+    bool hit = bvh->Intersect(ray, isect);
+    ReportValue(instancesEnteredPerRay, instancesEntered);
+    return hit;
+}
+
+bool InstanceBVHAccel::IntersectP(const Ray &ray) const {
+    instancesEntered = 0;
+    bool hit = bvh->IntersectP(ray);
+    ReportValue(instancesEnteredPerRay, instancesEntered);
+    return hit;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,84 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_ACCELERATORS_INSTANCEBVH_H
+#define PBRT_ACCELERATORS_INSTANCEBVH_H
+
+// accelerators/instancebvh.h*
+#include "pbrt.h"
+#include "accelerators/bvh.h"
+#include "transform.h"
+
+namespace pbrt {
+
+// InstanceBVHAccel Declarations
+
+// A use of an object instance: the primitive for the instance's shapes,
+// which is usually an accelerator shared by all of its uses, and the
+// instance's placement in the scene. The transformations are owned by the
+// caller and must outlive the _InstanceBVHAccel_.
+struct InstanceUse {
+    std::shared_ptr<Primitive> prototype;
+    const Transform *instanceToWorld[2];
+    Float startTime, endTime;
+};
+
+// A two-level acceleration structure for object instances: a BVH over the
+// instances' world-space bounds whose leaves refer to the instances'
+// shared prototype accelerators. Each instance only stores a pointer to
+// its transformation; an _AnimatedTransform_ is only created for the
+// instances whose transformation actually changes over time.
+class InstanceBVHAccel : public Aggregate {
+  public:
+    // InstanceBVHAccel Public Methods
+    InstanceBVHAccel(std::vector<InstanceUse> uses,
+                     BVHAccel::SplitMethod splitMethod =
+                         BVHAccel::SplitMethod::SAH);
+    Bounds3f WorldBound() const;
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // InstanceBVHAccel Private Data
+    std::vector<std::shared_ptr<Primitive>> prototypes;
+    std::vector<AnimatedTransform> animatedTransforms;
+    std::unique_ptr<BVHAccel> bvh;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_ACCELERATORS_INSTANCEBVH_H
@@ -0,0 +1,364 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// accelerators/widebvh.cpp*
+#include "accelerators/widebvh.h"
+#include "interaction.h"
+#include "memory.h"
+#include "paramset.h"
+#include "stats.h"
+#ifdef PBRT_HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Wide BVH tree", treeBytes);
+STAT_RATIO("Wide BVH/Children per node", totalChildren, totalNodes);
+
+// WideBVHAccel Local Declarations
+
+// A node of the binary BVH subtree that is collapsed into a single wide
+// node; _children_ are indices of other _CollapseEntry_s, or -1 for the
+// subtrees that become the wide node's children.
+struct CollapseEntry {
+    int binaryIndex;
+    int children[2];
+};
+
+// Ray data used for testing a ray against all of a node's children
+struct WideRay {
+    WideRay(const Ray &ray) {
+        for (int a = 0; a < 3; ++a) {
+            Float inv = 1 / ray.d[a];
+            o[a] = ray.o[a];
+            invDir[a] = inv;
+            // Conservatively extend the far end of each slab, as in
+            // _Bounds3::IntersectP()_
+            invDirFar[a] = inv * (1 + 2 * gamma(3));
+            dirIsNeg[a] = inv < 0;
+        }
+        octant = dirIsNeg[0] | (dirIsNeg[1] << 1) | (dirIsNeg[2] << 2);
+    }
+    float o[3], invDir[3], invDirFar[3];
+    int dirIsNeg[3], octant;
+};
+
+// WideBVHAccel Utility Functions
+static float roundDown(Float v) {
+    float f = v;
+    return f > v ? NextFloatDown(f) : f;
+}
+
+static float roundUp(Float v) {
+    float f = v;
+    return f < v ? NextFloatUp(f) : f;
+}
+
+// Appends the indices of the entries in the collapsed subtree rooted at
+// _e_ that become children of the wide node, in front-to-back order for
+// rays in the given octant.
+static void orderChildren(const CollapseEntry *entries,
+                          const LinearBVHNode *binaryNodes, int e, int octant,
+                          int *order, int *n) {
+    const CollapseEntry &entry = entries[e];
+    if (entry.children[0] == -1) {
+        order[(*n)++] = e;
+        return;
+    }
+    // Visit the second child first if the ray direction along the split
+    // axis is negative
+    int axis = binaryNodes[entry.binaryIndex].axis;
+    int first = (octant >> axis) & 1;
+    orderChildren(entries, binaryNodes, entry.children[first], octant, order,
+                  n);
+    orderChildren(entries, binaryNodes, entry.children[first ^ 1], octant,
+                  order, n);
+}
+
+// Returns a bit mask with bit _i_ set if the ray overlaps the _i_th child
+// of _node_ before _tMax_. Slab distances that are NaN (as when the ray
+// lies in a slab's plane) are ignored.
+template <int Width>
+static inline int intersectChildren(const WideBVHNode<Width> &node,
+                                    const WideRay &r, float tMax) {
+    static_assert(Width % 4 == 0, "Wide BVH width must be a multiple of 4");
+    int mask = 0;
+#ifdef PBRT_HAVE_SSE2
+    for (int first = 0; first < Width; first += 4) {
+        __m128 tEntry = _mm_setzero_ps(), tExit = _mm_set1_ps(tMax);
+        for (int a = 0; a < 3; ++a) {
+            __m128 o = _mm_set1_ps(r.o[a]);
+            __m128 pNear = _mm_loadu_ps(&node.bounds[r.dirIsNeg[a]][a][first]);
+            __m128 pFar =
+                _mm_loadu_ps(&node.bounds[1 - r.dirIsNeg[a]][a][first]);
+            __m128 tNear =
+                _mm_mul_ps(_mm_sub_ps(pNear, o), _mm_set1_ps(r.invDir[a]));
+            __m128 tFar =
+                _mm_mul_ps(_mm_sub_ps(pFar, o), _mm_set1_ps(r.invDirFar[a]));
+            // If either operand is NaN, these return the second one.
+            tEntry = _mm_max_ps(tNear, tEntry);
+            tExit = _mm_min_ps(tFar, tExit);
+        }
+        mask |= _mm_movemask_ps(_mm_cmple_ps(tEntry, tExit)) << first;
+    }
+#else
+    for (int i = 0; i < Width; ++i) {
+        float tEntry = 0, tExit = tMax;
+        for (int a = 0; a < 3; ++a) {
+            float tNear = (node.bounds[r.dirIsNeg[a]][a][i] - r.o[a]) *
+                          r.invDir[a];
+            float tFar = (node.bounds[1 - r.dirIsNeg[a]][a][i] - r.o[a]) *
+                         r.invDirFar[a];
+            tEntry = tNear > tEntry ? tNear : tEntry;
+            tExit = tFar < tExit ? tFar : tExit;
+        }
+        if (tEntry <= tExit) mask |= 1 << i;
+    }
+#endif
+    return mask;
+}
+
+#ifdef PBRT_HAVE_AVX
+static inline int intersectChildren(const WideBVHNode<8> &node,
+                                    const WideRay &r, float tMax) {
+    __m256 tEntry = _mm256_setzero_ps(), tExit = _mm256_set1_ps(tMax);
+    for (int a = 0; a < 3; ++a) {
+        __m256 o = _mm256_set1_ps(r.o[a]);
+        __m256 pNear = _mm256_loadu_ps(node.bounds[r.dirIsNeg[a]][a]);
+        __m256 pFar = _mm256_loadu_ps(node.bounds[1 - r.dirIsNeg[a]][a]);
+        __m256 tNear =
+            _mm256_mul_ps(_mm256_sub_ps(pNear, o), _mm256_set1_ps(r.invDir[a]));
+        __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(pFar, o),
+                                    _mm256_set1_ps(r.invDirFar[a]));
+        tEntry = _mm256_max_ps(tNear, tEntry);
+        tExit = _mm256_min_ps(tFar, tExit);
+    }
+    return _mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ));
+}
+#endif  // PBRT_HAVE_AVX
+
+// WideBVHAccel Method Definitions
+template <int Width>
+WideBVHAccel<Width>::WideBVHAccel(std::vector<std::shared_ptr<Primitive>> p,
+                                  int maxPrimsInNode,
+                                  BVHAccel::SplitMethod splitMethod) {
+    ProfilePhase _(Prof::AccelConstruction);
+    if (p.empty()) return;
+    // Build a binary BVH and collapse its nodes into wide ones; only its
+    // nodes and primitives are used, so it doesn't need leaf triangles
+    BVHAccel bvh(std::move(p), maxPrimsInNode, splitMethod, 32, false);
+    bounds = bvh.WorldBound();
+    std::vector<WideBVHNode<Width>> wideNodes;
+    collapse(bvh.nodes, 0, wideNodes);
+    primitives.swap(bvh.primitives);
+
+    nodes = AllocAligned<WideBVHNode<Width>>(wideNodes.size());
+    std::copy(wideNodes.begin(), wideNodes.end(), nodes);
+    treeBytes += wideNodes.size() * sizeof(WideBVHNode<Width>) +
+                 sizeof(*this) + primitives.size() * sizeof(primitives[0]);
+    LOG(INFO) << StringPrintf("%d-wide BVH created with %d nodes for %d "
+                              "primitives (%.2f MB)",
+                              Width, (int)wideNodes.size(),
+                              (int)primitives.size(),
+                              float(wideNodes.size() *
+                                    sizeof(WideBVHNode<Width>)) /
+                                  (1024.f * 1024.f));
+}
+
+template <int Width>
+int WideBVHAccel<Width>::collapse(const LinearBVHNode *binaryNodes,
+                                  int binaryIndex,
+                                  std::vector<WideBVHNode<Width>> &wideNodes) {
+    // Choose the wide node's children by repeatedly replacing the interior
+    // node with the largest surface area with its two children
+    CollapseEntry entries[2 * Width - 1];
+    entries[0] = {binaryIndex, {-1, -1}};
+    int nEntries = 1, leaves[Width], nLeaves = 1;
+    leaves[0] = 0;
+    while (nLeaves < Width) {
+        int best = -1;
+        Float bestArea = -1;
+        for (int i = 0; i < nLeaves; ++i) {
+            const LinearBVHNode &n = binaryNodes[entries[leaves[i]].binaryIndex];
+            if (n.nPrimitives == 0 && n.bounds.SurfaceArea() > bestArea) {
+                best = i;
+                bestArea = n.bounds.SurfaceArea();
+            }
+        }
+        if (best == -1) break;
+        CollapseEntry &entry = entries[leaves[best]];
+        entry.children[0] = nEntries;
+        entries[nEntries++] = {entry.binaryIndex + 1, {-1, -1}};
+        entry.children[1] = nEntries;
+        entries[nEntries++] = {
+            binaryNodes[entry.binaryIndex].secondChildOffset, {-1, -1}};
+        leaves[best] = entry.children[0];
+        leaves[nLeaves++] = entry.children[1];
+    }
+
+    // Store children in the order that positive-direction rays visit them
+    // and record the order for each octant of ray directions
+    int order[8][Width];
+    for (int octant = 0; octant < 8; ++octant) {
+        int n = 0;
+        orderChildren(entries, binaryNodes, 0, octant, order[octant], &n);
+        CHECK_EQ(n, nLeaves);
+    }
+    int slot[2 * Width - 1];
+    for (int i = 0; i < nLeaves; ++i) slot[order[0][i]] = i;
+
+    // Collapse interior children recursively and initialize the node
+    int nodeIndex = wideNodes.size();
+    wideNodes.push_back(WideBVHNode<Width>());
+    int childOffset[Width];
+    for (int i = 0; i < nLeaves; ++i) {
+        int childIndex = entries[order[0][i]].binaryIndex;
+        const LinearBVHNode &child = binaryNodes[childIndex];
+        childOffset[i] = child.nPrimitives > 0
+                             ? child.primitivesOffset
+                             : collapse(binaryNodes, childIndex, wideNodes);
+    }
+    WideBVHNode<Width> &node = wideNodes[nodeIndex];
+    for (int i = 0; i < Width; ++i) {
+        if (i < nLeaves) {
+            const LinearBVHNode &child =
+                binaryNodes[entries[order[0][i]].binaryIndex];
+            for (int a = 0; a < 3; ++a) {
+                node.bounds[0][a][i] = roundDown(child.bounds.pMin[a]);
+                node.bounds[1][a][i] = roundUp(child.bounds.pMax[a]);
+            }
+            node.childOffset[i] = childOffset[i];
+            node.nPrimitives[i] = child.nPrimitives;
+        } else {
+            // Give unused slots empty bounds so that rays never hit them
+            for (int a = 0; a < 3; ++a) {
+                node.bounds[0][a][i] = std::numeric_limits<float>::infinity();
+                node.bounds[1][a][i] = -std::numeric_limits<float>::infinity();
+            }
+            node.childOffset[i] = -1;
+            node.nPrimitives[i] = 0;
+        }
+        for (int octant = 0; octant < 8; ++octant)
+            node.order[octant][i] = i < nLeaves ? slot[order[octant][i]] : i;
+    }
+    totalChildren += nLeaves;
+    ++totalNodes;
+    return nodeIndex;
+}
+
+template <int Width>
+WideBVHAccel<Width>::~WideBVHAccel() {
+    FreeAligned(nodes);
+}
+
+template <int Width>
+bool WideBVHAccel<Width>::Intersect(const Ray &ray,
+                                    SurfaceInteraction *isect) const {
+    if (!nodes) return false;
+    ProfilePhase p(Prof::AccelIntersect);
+    WideRay wideRay(ray);
+    bool hit = false;
+    // Follow ray through BVH nodes to find primitive intersections
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64 * (Width - 1)];
+    while (true) {
+        const WideBVHNode<Width> &node = nodes[currentNodeIndex];
+        int hitMask = intersectChildren(node, wideRay, ray.tMax);
+        // Intersect the ray with the primitives in leaf children and gather
+        // interior children, front to back
+        int interior[Width], nInterior = 0;
+        for (int i = 0; i < Width; ++i) {
+            int c = node.order[wideRay.octant][i];
+            if (!(hitMask & (1 << c))) continue;
+            if (node.nPrimitives[c] > 0) {
+                for (int j = 0; j < node.nPrimitives[c]; ++j)
+                    if (primitives[node.childOffset[c] + j]->Intersect(ray,
+                                                                      isect))
+                        hit = true;
+            } else
+                interior[nInterior++] = node.childOffset[c];
+        }
+        // Push interior children so that the nearest one is visited next
+        while (nInterior > 0)
+            nodesToVisit[toVisitOffset++] = interior[--nInterior];
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+    return hit;
+}
+
+template <int Width>
+bool WideBVHAccel<Width>::IntersectP(const Ray &ray) const {
+    if (!nodes) return false;
+    ProfilePhase p(Prof::AccelIntersectP);
+    WideRay wideRay(ray);
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64 * (Width - 1)];
+    while (true) {
+        const WideBVHNode<Width> &node = nodes[currentNodeIndex];
+        int hitMask = intersectChildren(node, wideRay, ray.tMax);
+        for (int i = Width - 1; i >= 0; --i) {
+            int c = node.order[wideRay.octant][i];
+            if (!(hitMask & (1 << c))) continue;
+            if (node.nPrimitives[c] > 0) {
+                for (int j = 0; j < node.nPrimitives[c]; ++j)
+                    if (primitives[node.childOffset[c] + j]->IntersectP(ray))
+                        return true;
+            } else
+                nodesToVisit[toVisitOffset++] = node.childOffset[c];
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+    return false;
+}
+
+template class WideBVHAccel<4>;
+template class WideBVHAccel<8>;
+
+std::shared_ptr<Primitive> CreateWideBVHAccelerator(
+    std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
+    BVHAccel::SplitMethod splitMethod = BVHSplitMethod(ps);
+    int maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
+    int width = ps.FindOneInt("width", 4);
+    if (width == 8)
+        return std::make_shared<WideBVHAccel<8>>(std::move(prims),
+                                                 maxPrimsInNode, splitMethod);
+    if (width != 4)
+        Warning("Wide BVH width %d unsupported.  Using 4.", width);
+    return std::make_shared<WideBVHAccel<4>>(std::move(prims), maxPrimsInNode,
+                                             splitMethod);
+}
+
+}  // namespace pbrt
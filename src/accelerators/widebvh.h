@@ -0,0 +1,95 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_ACCELERATORS_WIDEBVH_H
+#define PBRT_ACCELERATORS_WIDEBVH_H
+
+// accelerators/widebvh.h*
+#include "pbrt.h"
+#include "accelerators/bvh.h"
+
+namespace pbrt {
+
+// WideBVHAccel Declarations
+
+// Each node of a wide BVH has up to _Width_ children, all of whose bounds
+// are tested against a ray at once using SIMD instructions where
+// available. Bounds are stored as [min/max][axis][child] so that each
+// slab of all the children can be loaded together.
+template <int Width>
+struct WideBVHNode {
+    float bounds[2][3][Width];
+    // Interior children: index of the child node; leaf children: offset
+    // of the first primitive; unused slots: -1.
+    int32_t childOffset[Width];
+    uint16_t nPrimitives[Width];  // 0 -> interior child or unused slot
+    // Front-to-back order to visit the children in for rays in each
+    // octant of directions, indexed by the sign bits of the direction.
+    uint8_t order[8][Width];
+};
+
+template <int Width>
+class WideBVHAccel : public Aggregate {
+  public:
+    // WideBVHAccel Public Methods
+    WideBVHAccel(std::vector<std::shared_ptr<Primitive>> p,
+                 int maxPrimsInNode = 1,
+                 BVHAccel::SplitMethod splitMethod =
+                     BVHAccel::SplitMethod::SAH);
+    Bounds3f WorldBound() const { return bounds; }
+    ~WideBVHAccel();
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // WideBVHAccel Private Methods
+    int collapse(const LinearBVHNode *binaryNodes, int binaryIndex,
+                 std::vector<WideBVHNode<Width>> &wideNodes);
+
+    // WideBVHAccel Private Data
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    Bounds3f bounds;
+    WideBVHNode<Width> *nodes = nullptr;
+};
+
+// Creates a 4-wide BVH, or an 8-wide one if the "width" parameter is 8.
+std::shared_ptr<Primitive> CreateWideBVHAccelerator(
+    std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps);
+
+}  // namespace pbrt
+
+#endif  // PBRT_ACCELERATORS_WIDEBVH_H
@@ -33,16 +33,21 @@
 // core/api.cpp*
 #include "api.h"
 #include "parallel.h"
+#include "distributed.h"
 #include "paramset.h"
 #include "spectrum.h"
 #include "scene.h"
 #include "film.h"
 #include "medium.h"
 #include "stats.h"
+#include "texcache.h"
+#include "parser.h"
 
 // API Additional Headers
 #include "accelerators/bvh.h"
+#include "accelerators/instancebvh.h"
 #include "accelerators/kdtreeaccel.h"
+#include "accelerators/widebvh.h"
 #include "cameras/environment.h"
 #include "cameras/orthographic.h"
 #include "cameras/perspective.h"
@@ -59,6 +64,7 @@
 #include "integrators/path.h"
 #include "integrators/sppm.h"
 #include "integrators/volpath.h"
+#include "integrators/wavefront.h"
 #include "integrators/whitted.h"
 #include "lights/diffuse.h"
 #include "lights/distant.h"
@@ -115,7 +121,9 @@
 #include "media/grid.h"
 #include "media/homogeneous.h"
 
+#include <iterator>
 #include <map>
+#include <mutex>
 #include <stdio.h>
 
 namespace pbrt {
@@ -181,6 +189,7 @@ struct RenderOptions {
     std::vector<std::shared_ptr<Primitive>> primitives;
     std::map<std::string, std::vector<std::shared_ptr<Primitive>>> instances;
     std::vector<std::shared_ptr<Primitive>> *currentInstance = nullptr;
+    std::vector<InstanceUse> instanceUses;
     bool haveScatteringMedia = false;
 };
 
@@ -263,6 +272,8 @@ class TransformCache {
 
     // TransformCache Public Methods
     Transform *Lookup(const Transform &t) {
+        // Files given to Import may be parsed on multiple threads
+        std::lock_guard<std::mutex> lock(mutex);
         ++nTransformCacheLookups;
 
         int offset = Hash(t) & (hashTable.size() - 1);
@@ -289,9 +300,10 @@ class TransformCache {
     }
 
     void Clear() {
+        std::lock_guard<std::mutex> lock(mutex);
         transformCacheBytes += arena.TotalAllocated() + hashTable.size() * sizeof(Transform *);
-        hashTable.resize(512);
         hashTable.clear();
+        hashTable.resize(512);
         hashTableOccupancy = 0;
         arena.Reset();
     }
@@ -317,6 +329,7 @@ class TransformCache {
     std::vector<Transform *> hashTable;
     int hashTableOccupancy;
     MemoryArena arena;
+    std::mutex mutex;
 };
 
 void TransformCache::Insert(Transform *tNew) {
@@ -361,21 +374,53 @@ void TransformCache::Grow() {
 }
 
 
+// APIContext holds the state that the scene description directives
+// modify. Files given to Import are parsed with contexts of their own,
+// possibly on worker threads; each starts out with the graphics state and
+// transformation at its Import directive, and the primitives, lights and
+// named objects created while parsing it are merged into the importing
+// file's _RenderOptions_ afterward.
+struct ImportedFile;
+struct APIContext {
+    std::unique_ptr<RenderOptions> renderOptions;
+    TransformSet curTransform;
+    uint32_t activeTransformBits = AllTransformsBits;
+    GraphicsState graphicsState;
+    std::vector<GraphicsState> pushedGraphicsStates;
+    std::vector<TransformSet> pushedTransforms;
+    std::vector<uint32_t> pushedActiveTransformBits;
+    // Import directives that haven't been parsed yet, in order, and the
+    // context of the file that imported this one, if any
+    std::vector<std::unique_ptr<ImportedFile>> pendingImports;
+    APIContext *parent = nullptr;
+};
+
+// ImportedFile records an Import directive whose file hasn't been merged
+// yet, along with where the file's primitives, lights and instance uses
+// go in the importing context's lists.
+struct ImportedFile {
+    std::string filename;
+    // Where the Import directive was, if it was parsed from a file; errors
+    // about the imported file as a whole are reported there.
+    std::unique_ptr<Loc> importLoc;
+    APIContext context;
+    size_t primitiveOffset, lightOffset, instanceUseOffset;
+};
+
 // API Static Data
 enum class APIState { Uninitialized, OptionsBlock, WorldBlock };
 static APIState currentApiState = APIState::Uninitialized;
-static TransformSet curTransform;
-static uint32_t activeTransformBits = AllTransformsBits;
+static APIContext mainContext;
+static PBRT_THREAD_LOCAL APIContext *context = &mainContext;
 static std::map<std::string, TransformSet> namedCoordinateSystems;
-static std::unique_ptr<RenderOptions> renderOptions;
-static GraphicsState graphicsState;
-static std::vector<GraphicsState> pushedGraphicsStates;
-static std::vector<TransformSet> pushedTransforms;
-static std::vector<uint32_t> pushedActiveTransformBits;
 static TransformCache transformCache;
+// Protects the object instances of importing files' contexts, which
+// ObjectInstance directives in imported files may use
+static std::mutex importedInstancesMutex;
 int catIndentCount = 0;
 
 // API Forward Declarations
+static void runImports(APIContext *ctx);
 std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
                                                const Transform *ObjectToWorld,
                                                const Transform *WorldToObject,
@@ -412,14 +457,21 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
             func);                                           \
         return;                                              \
     } else /* swallow trailing semicolon */
-#define FOR_ACTIVE_TRANSFORMS(expr)           \
-    for (int i = 0; i < MaxTransforms; ++i)   \
-        if (activeTransformBits & (1 << i)) { \
-            expr                              \
+#define VERIFY_NOT_IMPORTED(func)                        \
+    if (context != &mainContext) {                       \
+        Error("\"%s\" not allowed in imported files. "   \
+              "Ignoring.",                               \
+              func);                                     \
+        return;                                          \
+    } else /* swallow trailing semicolon */
+#define FOR_ACTIVE_TRANSFORMS(expr)                    \
+    for (int i = 0; i < MaxTransforms; ++i)            \
+        if (context->activeTransformBits & (1 << i)) { \
+            expr                                       \
         }
 #define WARN_IF_ANIMATED_TRANSFORM(func)                             \
     do {                                                             \
-        if (curTransform.IsAnimated())                               \
+        if (context->curTransform.IsAnimated())                      \
             Warning(                                                 \
                 "Animated transformations set; ignoring for \"%s\" " \
                 "and using the start transform only",                \
@@ -518,10 +570,12 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
         } else
             shapes = CreateTriangleMeshShape(object2world, world2object,
                                              reverseOrientation, paramSet,
-                                             &*graphicsState.floatTextures);
+                                             &*context->graphicsState
+                                                   .floatTextures);
     } else if (name == "plymesh")
-        shapes = CreatePLYMesh(object2world, world2object, reverseOrientation,
-                               paramSet, &*graphicsState.floatTextures);
+        shapes = CreatePLYMesh(
+            object2world, world2object, reverseOrientation, paramSet,
+            &*context->graphicsState.floatTextures);
     else if (name == "heightfield")
         shapes = CreateHeightfield(object2world, world2object,
                                    reverseOrientation, paramSet);
@@ -561,21 +615,21 @@ std::shared_ptr<Material> MakeMaterial(const std::string &name,
         std::string m1 = mp.FindString("namedmaterial1", "");
         std::string m2 = mp.FindString("namedmaterial2", "");
         std::shared_ptr<Material> mat1, mat2;
-        if (graphicsState.namedMaterials->find(m1) ==
-            graphicsState.namedMaterials->end()) {
+        if (context->graphicsState.namedMaterials->find(m1) ==
+            context->graphicsState.namedMaterials->end()) {
             Error("Named material \"%s\" undefined.  Using \"matte\"",
                   m1.c_str());
             mat1 = MakeMaterial("matte", mp);
         } else
-            mat1 = (*graphicsState.namedMaterials)[m1]->material;
+            mat1 = (*context->graphicsState.namedMaterials)[m1]->material;
 
-        if (graphicsState.namedMaterials->find(m2) ==
-            graphicsState.namedMaterials->end()) {
+        if (context->graphicsState.namedMaterials->find(m2) ==
+            context->graphicsState.namedMaterials->end()) {
             Error("Named material \"%s\" undefined.  Using \"matte\"",
                   m2.c_str());
             mat2 = MakeMaterial("matte", mp);
         } else
-            mat2 = (*graphicsState.namedMaterials)[m2]->material;
+            mat2 = (*context->graphicsState.namedMaterials)[m2]->material;
 
         material = CreateMixMaterial(mp, mat1, mat2);
     } else if (name == "metal")
@@ -596,13 +650,14 @@ std::shared_ptr<Material> MakeMaterial(const std::string &name,
     }
 
     if ((name == "subsurface" || name == "kdsubsurface") &&
-        (renderOptions->IntegratorName != "path" &&
-         (renderOptions->IntegratorName != "volpath")))
+        (context->renderOptions->IntegratorName != "path" &&
+         context->renderOptions->IntegratorName != "wavefront" &&
+         (context->renderOptions->IntegratorName != "volpath")))
         Warning(
             "Subsurface scattering material \"%s\" used, but \"%s\" "
             "integrator doesn't support subsurface scattering. "
             "Use \"path\" or \"volpath\".",
-            name.c_str(), renderOptions->IntegratorName.c_str());
+            name.c_str(), context->renderOptions->IntegratorName.c_str());
 
     mp.ReportUnused();
     if (!material) Error("Unable to create material \"%s\"", name.c_str());
@@ -780,6 +835,8 @@ std::shared_ptr<Primitive> MakeAccelerator(
         accel = CreateBVHAccelerator(std::move(prims), paramSet);
     else if (name == "kdtree")
         accel = CreateKdTreeAccelerator(std::move(prims), paramSet);
+    else if (name == "qbvh")
+        accel = CreateWideBVHAccelerator(std::move(prims), paramSet);
     else
         Warning("Accelerator \"%s\" unknown.", name.c_str());
     paramSet.ReportUnused();
@@ -790,7 +847,8 @@ Camera *MakeCamera(const std::string &name, const ParamSet &paramSet,
                    const TransformSet &cam2worldSet, Float transformStart,
                    Float transformEnd, Film *film) {
     Camera *camera = nullptr;
-    MediumInterface mediumInterface = graphicsState.CreateMediumInterface();
+    MediumInterface mediumInterface =
+        context->graphicsState.CreateMediumInterface();
     static_assert(MaxTransforms == 2,
                   "TransformCache assumes only two transforms");
     Transform *cam2world[2] = {
@@ -878,12 +936,13 @@ void pbrtInit(const Options &opt) {
     if (currentApiState != APIState::Uninitialized)
         Error("pbrtInit() has already been called.");
     currentApiState = APIState::OptionsBlock;
-    renderOptions.reset(new RenderOptions);
-    graphicsState = GraphicsState();
+    context->renderOptions.reset(new RenderOptions);
+    context->graphicsState = GraphicsState();
     catIndentCount = 0;
 
     // General \pbrt Initialization
     SampledSpectrum::Init();
+    SetTextureCacheSize(size_t(PbrtOptions.textureCacheMB * 1024 * 1024));
     ParallelInit();  // Threads must be launched before the profiler is
                      // initialized.
     InitProfiler();
@@ -897,19 +956,20 @@ void pbrtCleanup() {
         Error("pbrtCleanup() called while inside world block.");
     currentApiState = APIState::Uninitialized;
     ParallelCleanup();
+    DistributedCleanup();
     CleanupProfiler();
 }
 
 void pbrtIdentity() {
     VERIFY_INITIALIZED("Identity");
-    FOR_ACTIVE_TRANSFORMS(curTransform[i] = Transform();)
+    FOR_ACTIVE_TRANSFORMS(context->curTransform[i] = Transform();)
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sIdentity\n", catIndentCount, "");
 }
 
 void pbrtTranslate(Float dx, Float dy, Float dz) {
     VERIFY_INITIALIZED("Translate");
-    FOR_ACTIVE_TRANSFORMS(curTransform[i] = curTransform[i] *
+    FOR_ACTIVE_TRANSFORMS(context->curTransform[i] = context->curTransform[i] *
                                             Translate(Vector3f(dx, dy, dz));)
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sTranslate %.9g %.9g %.9g\n", catIndentCount, "", dx, dy,
@@ -919,7 +979,7 @@ void pbrtTranslate(Float dx, Float dy, Float dz) {
 void pbrtTransform(Float tr[16]) {
     VERIFY_INITIALIZED("Transform");
     FOR_ACTIVE_TRANSFORMS(
-        curTransform[i] = Transform(Matrix4x4(
+        context->curTransform[i] = Transform(Matrix4x4(
             tr[0], tr[4], tr[8], tr[12], tr[1], tr[5], tr[9], tr[13], tr[2],
             tr[6], tr[10], tr[14], tr[3], tr[7], tr[11], tr[15]));)
     if (PbrtOptions.cat || PbrtOptions.toPly) {
@@ -932,8 +992,8 @@ void pbrtTransform(Float tr[16]) {
 void pbrtConcatTransform(Float tr[16]) {
     VERIFY_INITIALIZED("ConcatTransform");
     FOR_ACTIVE_TRANSFORMS(
-        curTransform[i] =
-            curTransform[i] *
+        context->curTransform[i] =
+            context->curTransform[i] *
             Transform(Matrix4x4(tr[0], tr[4], tr[8], tr[12], tr[1], tr[5],
                                 tr[9], tr[13], tr[2], tr[6], tr[10], tr[14],
                                 tr[3], tr[7], tr[11], tr[15]));)
@@ -946,8 +1006,8 @@ void pbrtConcatTransform(Float tr[16]) {
 
 void pbrtRotate(Float angle, Float dx, Float dy, Float dz) {
     VERIFY_INITIALIZED("Rotate");
-    FOR_ACTIVE_TRANSFORMS(curTransform[i] =
-                              curTransform[i] *
+    FOR_ACTIVE_TRANSFORMS(context->curTransform[i] =
+                              context->curTransform[i] *
                               Rotate(angle, Vector3f(dx, dy, dz));)
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sRotate %.9g %.9g %.9g %.9g\n", catIndentCount, "", angle,
@@ -956,8 +1016,8 @@ void pbrtRotate(Float angle, Float dx, Float dy, Float dz) {
 
 void pbrtScale(Float sx, Float sy, Float sz) {
     VERIFY_INITIALIZED("Scale");
-    FOR_ACTIVE_TRANSFORMS(curTransform[i] =
-                              curTransform[i] * Scale(sx, sy, sz);)
+    FOR_ACTIVE_TRANSFORMS(context->curTransform[i] =
+                              context->curTransform[i] * Scale(sx, sy, sz);)
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sScale %.9g %.9g %.9g\n", catIndentCount, "", sx, sy, sz);
 }
@@ -967,7 +1027,8 @@ void pbrtLookAt(Float ex, Float ey, Float ez, Float lx, Float ly, Float lz,
     VERIFY_INITIALIZED("LookAt");
     Transform lookAt =
         LookAt(Point3f(ex, ey, ez), Point3f(lx, ly, lz), Vector3f(ux, uy, uz));
-    FOR_ACTIVE_TRANSFORMS(curTransform[i] = curTransform[i] * lookAt;);
+    FOR_ACTIVE_TRANSFORMS(
+        context->curTransform[i] = context->curTransform[i] * lookAt;);
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf(
             "%*sLookAt %.9g %.9g %.9g\n%*s%.9g %.9g %.9g\n"
@@ -978,7 +1039,11 @@ void pbrtLookAt(Float ex, Float ey, Float ez, Float lx, Float ly, Float lz,
 
 void pbrtCoordinateSystem(const std::string &name) {
     VERIFY_INITIALIZED("CoordinateSystem");
-    namedCoordinateSystems[name] = curTransform;
+    VERIFY_NOT_IMPORTED("CoordinateSystem");
+    // Pending imports must see only the coordinate systems defined before
+    // their Import directives
+    runImports(context);
+    namedCoordinateSystems[name] = context->curTransform;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sCoordinateSystem \"%s\"\n", catIndentCount, "",
                name.c_str());
@@ -987,7 +1052,7 @@ void pbrtCoordinateSystem(const std::string &name) {
 void pbrtCoordSysTransform(const std::string &name) {
     VERIFY_INITIALIZED("CoordSysTransform");
     if (namedCoordinateSystems.find(name) != namedCoordinateSystems.end())
-        curTransform = namedCoordinateSystems[name];
+        context->curTransform = namedCoordinateSystems[name];
     else
         Warning("Couldn't find named coordinate system \"%s\"", name.c_str());
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -996,27 +1061,27 @@ void pbrtCoordSysTransform(const std::string &name) {
 }
 
 void pbrtActiveTransformAll() {
-    activeTransformBits = AllTransformsBits;
+    context->activeTransformBits = AllTransformsBits;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sActiveTransform All\n", catIndentCount, "");
 }
 
 void pbrtActiveTransformEndTime() {
-    activeTransformBits = EndTransformBits;
+    context->activeTransformBits = EndTransformBits;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sActiveTransform EndTime\n", catIndentCount, "");
 }
 
 void pbrtActiveTransformStartTime() {
-    activeTransformBits = StartTransformBits;
+    context->activeTransformBits = StartTransformBits;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sActiveTransform StartTime\n", catIndentCount, "");
 }
 
 void pbrtTransformTimes(Float start, Float end) {
     VERIFY_OPTIONS("TransformTimes");
-    renderOptions->transformStartTime = start;
-    renderOptions->transformEndTime = end;
+    context->renderOptions->transformStartTime = start;
+    context->renderOptions->transformEndTime = end;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sTransformTimes %.9g %.9g\n", catIndentCount, "", start,
                end);
@@ -1024,8 +1089,8 @@ void pbrtTransformTimes(Float start, Float end) {
 
 void pbrtPixelFilter(const std::string &name, const ParamSet &params) {
     VERIFY_OPTIONS("PixelFilter");
-    renderOptions->FilterName = name;
-    renderOptions->FilterParams = params;
+    context->renderOptions->FilterName = name;
+    context->renderOptions->FilterParams = params;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sPixelFilter \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1035,8 +1100,8 @@ void pbrtPixelFilter(const std::string &name, const ParamSet &params) {
 
 void pbrtFilm(const std::string &type, const ParamSet &params) {
     VERIFY_OPTIONS("Film");
-    renderOptions->FilmParams = params;
-    renderOptions->FilmName = type;
+    context->renderOptions->FilmParams = params;
+    context->renderOptions->FilmName = type;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sFilm \"%s\" ", catIndentCount, "", type.c_str());
         params.Print(catIndentCount);
@@ -1046,8 +1111,8 @@ void pbrtFilm(const std::string &type, const ParamSet &params) {
 
 void pbrtSampler(const std::string &name, const ParamSet &params) {
     VERIFY_OPTIONS("Sampler");
-    renderOptions->SamplerName = name;
-    renderOptions->SamplerParams = params;
+    context->renderOptions->SamplerName = name;
+    context->renderOptions->SamplerParams = params;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sSampler \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1057,8 +1122,8 @@ void pbrtSampler(const std::string &name, const ParamSet &params) {
 
 void pbrtAccelerator(const std::string &name, const ParamSet &params) {
     VERIFY_OPTIONS("Accelerator");
-    renderOptions->AcceleratorName = name;
-    renderOptions->AcceleratorParams = params;
+    context->renderOptions->AcceleratorName = name;
+    context->renderOptions->AcceleratorParams = params;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sAccelerator \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1068,8 +1133,8 @@ void pbrtAccelerator(const std::string &name, const ParamSet &params) {
 
 void pbrtIntegrator(const std::string &name, const ParamSet &params) {
     VERIFY_OPTIONS("Integrator");
-    renderOptions->IntegratorName = name;
-    renderOptions->IntegratorParams = params;
+    context->renderOptions->IntegratorName = name;
+    context->renderOptions->IntegratorParams = params;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sIntegrator \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1079,10 +1144,10 @@ void pbrtIntegrator(const std::string &name, const ParamSet &params) {
 
 void pbrtCamera(const std::string &name, const ParamSet &params) {
     VERIFY_OPTIONS("Camera");
-    renderOptions->CameraName = name;
-    renderOptions->CameraParams = params;
-    renderOptions->CameraToWorld = Inverse(curTransform);
-    namedCoordinateSystems["camera"] = renderOptions->CameraToWorld;
+    context->renderOptions->CameraName = name;
+    context->renderOptions->CameraParams = params;
+    context->renderOptions->CameraToWorld = Inverse(context->curTransform);
+    namedCoordinateSystems["camera"] = context->renderOptions->CameraToWorld;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sCamera \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1092,14 +1157,15 @@ void pbrtCamera(const std::string &name, const ParamSet &params) {
 
 void pbrtMakeNamedMedium(const std::string &name, const ParamSet &params) {
     VERIFY_INITIALIZED("MakeNamedMedium");
+    VERIFY_NOT_IMPORTED("MakeNamedMedium");
     WARN_IF_ANIMATED_TRANSFORM("MakeNamedMedium");
     std::string type = params.FindOneString("type", "");
     if (type == "")
         Error("No parameter string \"type\" found in MakeNamedMedium");
     else {
         std::shared_ptr<Medium> medium =
-            MakeMedium(type, params, curTransform[0]);
-        if (medium) renderOptions->namedMedia[name] = medium;
+            MakeMedium(type, params, context->curTransform[0]);
+        if (medium) context->renderOptions->namedMedia[name] = medium;
     }
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sMakeNamedMedium \"%s\" ", catIndentCount, "", name.c_str());
@@ -1111,9 +1177,9 @@ void pbrtMakeNamedMedium(const std::string &name, const ParamSet &params) {
 void pbrtMediumInterface(const std::string &insideName,
                          const std::string &outsideName) {
     VERIFY_INITIALIZED("MediumInterface");
-    graphicsState.currentInsideMedium = insideName;
-    graphicsState.currentOutsideMedium = outsideName;
-    renderOptions->haveScatteringMedia = true;
+    context->graphicsState.currentInsideMedium = insideName;
+    context->graphicsState.currentOutsideMedium = outsideName;
+    context->renderOptions->haveScatteringMedia = true;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sMediumInterface \"%s\" \"%s\"\n", catIndentCount, "",
                insideName.c_str(), outsideName.c_str());
@@ -1122,20 +1188,22 @@ void pbrtMediumInterface(const std::string &insideName,
 void pbrtWorldBegin() {
     VERIFY_OPTIONS("WorldBegin");
     currentApiState = APIState::WorldBlock;
-    for (int i = 0; i < MaxTransforms; ++i) curTransform[i] = Transform();
-    activeTransformBits = AllTransformsBits;
-    namedCoordinateSystems["world"] = curTransform;
+    for (int i = 0; i < MaxTransforms; ++i)
+        context->curTransform[i] = Transform();
+    context->activeTransformBits = AllTransformsBits;
+    namedCoordinateSystems["world"] = context->curTransform;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("\n\nWorldBegin\n\n");
 }
 
 void pbrtAttributeBegin() {
     VERIFY_WORLD("AttributeBegin");
-    pushedGraphicsStates.push_back(graphicsState);
-    graphicsState.floatTexturesShared = graphicsState.spectrumTexturesShared =
-        graphicsState.namedMaterialsShared = true;
-    pushedTransforms.push_back(curTransform);
-    pushedActiveTransformBits.push_back(activeTransformBits);
+    context->pushedGraphicsStates.push_back(context->graphicsState);
+    context->graphicsState.floatTexturesShared =
+        context->graphicsState.spectrumTexturesShared =
+            context->graphicsState.namedMaterialsShared = true;
+    context->pushedTransforms.push_back(context->curTransform);
+    context->pushedActiveTransformBits.push_back(context->activeTransformBits);
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("\n%*sAttributeBegin\n", catIndentCount, "");
         catIndentCount += 4;
@@ -1144,18 +1212,18 @@ void pbrtAttributeBegin() {
 
 void pbrtAttributeEnd() {
     VERIFY_WORLD("AttributeEnd");
-    if (!pushedGraphicsStates.size()) {
+    if (!context->pushedGraphicsStates.size()) {
         Error(
             "Unmatched pbrtAttributeEnd() encountered. "
             "Ignoring it.");
         return;
     }
-    graphicsState = std::move(pushedGraphicsStates.back());
-    pushedGraphicsStates.pop_back();
-    curTransform = pushedTransforms.back();
-    pushedTransforms.pop_back();
-    activeTransformBits = pushedActiveTransformBits.back();
-    pushedActiveTransformBits.pop_back();
+    context->graphicsState = std::move(context->pushedGraphicsStates.back());
+    context->pushedGraphicsStates.pop_back();
+    context->curTransform = context->pushedTransforms.back();
+    context->pushedTransforms.pop_back();
+    context->activeTransformBits = context->pushedActiveTransformBits.back();
+    context->pushedActiveTransformBits.pop_back();
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         catIndentCount -= 4;
         printf("%*sAttributeEnd\n", catIndentCount, "");
@@ -1164,8 +1232,8 @@ void pbrtAttributeEnd() {
 
 void pbrtTransformBegin() {
     VERIFY_WORLD("TransformBegin");
-    pushedTransforms.push_back(curTransform);
-    pushedActiveTransformBits.push_back(activeTransformBits);
+    context->pushedTransforms.push_back(context->curTransform);
+    context->pushedActiveTransformBits.push_back(context->activeTransformBits);
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sTransformBegin\n", catIndentCount, "");
         catIndentCount += 4;
@@ -1174,16 +1242,16 @@ void pbrtTransformBegin() {
 
 void pbrtTransformEnd() {
     VERIFY_WORLD("TransformEnd");
-    if (!pushedTransforms.size()) {
+    if (!context->pushedTransforms.size()) {
         Error(
             "Unmatched pbrtTransformEnd() encountered. "
             "Ignoring it.");
         return;
     }
-    curTransform = pushedTransforms.back();
-    pushedTransforms.pop_back();
-    activeTransformBits = pushedActiveTransformBits.back();
-    pushedActiveTransformBits.pop_back();
+    context->curTransform = context->pushedTransforms.back();
+    context->pushedTransforms.pop_back();
+    context->activeTransformBits = context->pushedActiveTransformBits.back();
+    context->pushedActiveTransformBits.pop_back();
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         catIndentCount -= 4;
         printf("%*sTransformEnd\n", catIndentCount, "");
@@ -1201,41 +1269,43 @@ void pbrtTexture(const std::string &name, const std::string &type,
         return;
     }
 
-    TextureParams tp(params, params, *graphicsState.floatTextures,
-                     *graphicsState.spectrumTextures);
+    TextureParams tp(params, params, *context->graphicsState.floatTextures,
+                     *context->graphicsState.spectrumTextures);
     if (type == "float") {
         // Create _Float_ texture and store in _floatTextures_
-        if (graphicsState.floatTextures->find(name) !=
-            graphicsState.floatTextures->end())
+        if (context->graphicsState.floatTextures->find(name) !=
+            context->graphicsState.floatTextures->end())
             Warning("Texture \"%s\" being redefined", name.c_str());
         WARN_IF_ANIMATED_TRANSFORM("Texture");
         std::shared_ptr<Texture<Float>> ft =
-            MakeFloatTexture(texname, curTransform[0], tp);
+            MakeFloatTexture(texname, context->curTransform[0], tp);
         if (ft) {
             // TODO: move this to be a GraphicsState method, also don't
             // provide direct floatTextures access?
-            if (graphicsState.floatTexturesShared) {
-                graphicsState.floatTextures =
-                    std::make_shared<GraphicsState::FloatTextureMap>(*graphicsState.floatTextures);
-                graphicsState.floatTexturesShared = false;
+            if (context->graphicsState.floatTexturesShared) {
+                context->graphicsState.floatTextures =
+                    std::make_shared<GraphicsState::FloatTextureMap>(
+                        *context->graphicsState.floatTextures);
+                context->graphicsState.floatTexturesShared = false;
             }
-            (*graphicsState.floatTextures)[name] = ft;
+            (*context->graphicsState.floatTextures)[name] = ft;
         }
     } else if (type == "color" || type == "spectrum") {
         // Create _color_ texture and store in _spectrumTextures_
-        if (graphicsState.spectrumTextures->find(name) !=
-            graphicsState.spectrumTextures->end())
+        if (context->graphicsState.spectrumTextures->find(name) !=
+            context->graphicsState.spectrumTextures->end())
             Warning("Texture \"%s\" being redefined", name.c_str());
         WARN_IF_ANIMATED_TRANSFORM("Texture");
         std::shared_ptr<Texture<Spectrum>> st =
-            MakeSpectrumTexture(texname, curTransform[0], tp);
+            MakeSpectrumTexture(texname, context->curTransform[0], tp);
         if (st) {
-            if (graphicsState.spectrumTexturesShared) {
-                graphicsState.spectrumTextures =
-                    std::make_shared<GraphicsState::SpectrumTextureMap>(*graphicsState.spectrumTextures);
-                graphicsState.spectrumTexturesShared = false;
+            if (context->graphicsState.spectrumTexturesShared) {
+                context->graphicsState.spectrumTextures =
+                    std::make_shared<GraphicsState::SpectrumTextureMap>(
+                        *context->graphicsState.spectrumTextures);
+                context->graphicsState.spectrumTexturesShared = false;
             }
-            (*graphicsState.spectrumTextures)[name] = st;
+            (*context->graphicsState.spectrumTextures)[name] = st;
         }
     } else
         Error("Texture type \"%s\" unknown.", type.c_str());
@@ -1244,10 +1314,10 @@ void pbrtTexture(const std::string &name, const std::string &type,
 void pbrtMaterial(const std::string &name, const ParamSet &params) {
     VERIFY_WORLD("Material");
     ParamSet emptyParams;
-    TextureParams mp(params, emptyParams, *graphicsState.floatTextures,
-                     *graphicsState.spectrumTextures);
+    TextureParams mp(params, emptyParams, *context->graphicsState.floatTextures,
+                     *context->graphicsState.spectrumTextures);
     std::shared_ptr<Material> mtl = MakeMaterial(name, mp);
-    graphicsState.currentMaterial =
+    context->graphicsState.currentMaterial =
         std::make_shared<MaterialInstance>(name, mtl, params);
 
     if (PbrtOptions.cat || PbrtOptions.toPly) {
@@ -1261,8 +1331,8 @@ void pbrtMakeNamedMaterial(const std::string &name, const ParamSet &params) {
     VERIFY_WORLD("MakeNamedMaterial");
     // error checking, warning if replace, what to use for transform?
     ParamSet emptyParams;
-    TextureParams mp(params, emptyParams, *graphicsState.floatTextures,
-                     *graphicsState.spectrumTextures);
+    TextureParams mp(params, emptyParams, *context->graphicsState.floatTextures,
+                     *context->graphicsState.spectrumTextures);
     std::string matName = mp.FindString("type");
     WARN_IF_ANIMATED_TRANSFORM("MakeNamedMaterial");
     if (matName == "")
@@ -1275,15 +1345,16 @@ void pbrtMakeNamedMaterial(const std::string &name, const ParamSet &params) {
         printf("\n");
     } else {
         std::shared_ptr<Material> mtl = MakeMaterial(matName, mp);
-        if (graphicsState.namedMaterials->find(name) !=
-            graphicsState.namedMaterials->end())
+        if (context->graphicsState.namedMaterials->find(name) !=
+            context->graphicsState.namedMaterials->end())
             Warning("Named material \"%s\" redefined.", name.c_str());
-        if (graphicsState.namedMaterialsShared) {
-            graphicsState.namedMaterials =
-                std::make_shared<GraphicsState::NamedMaterialMap>(*graphicsState.namedMaterials);
-            graphicsState.namedMaterialsShared = false;
+        if (context->graphicsState.namedMaterialsShared) {
+            context->graphicsState.namedMaterials =
+                std::make_shared<GraphicsState::NamedMaterialMap>(
+                    *context->graphicsState.namedMaterials);
+            context->graphicsState.namedMaterialsShared = false;
         }
-        (*graphicsState.namedMaterials)[name] =
+        (*context->graphicsState.namedMaterials)[name] =
             std::make_shared<MaterialInstance>(matName, mtl, params);
     }
 }
@@ -1295,23 +1366,24 @@ void pbrtNamedMaterial(const std::string &name) {
         return;
     }
 
-    auto iter = graphicsState.namedMaterials->find(name);
-    if (iter == graphicsState.namedMaterials->end()) {
+    auto iter = context->graphicsState.namedMaterials->find(name);
+    if (iter == context->graphicsState.namedMaterials->end()) {
         Error("NamedMaterial \"%s\" unknown.", name.c_str());
         return;
     }
-    graphicsState.currentMaterial = iter->second;
+    context->graphicsState.currentMaterial = iter->second;
 }
 
 void pbrtLightSource(const std::string &name, const ParamSet &params) {
     VERIFY_WORLD("LightSource");
     WARN_IF_ANIMATED_TRANSFORM("LightSource");
-    MediumInterface mi = graphicsState.CreateMediumInterface();
-    std::shared_ptr<Light> lt = MakeLight(name, params, curTransform[0], mi);
+    MediumInterface mi = context->graphicsState.CreateMediumInterface();
+    std::shared_ptr<Light> lt =
+        MakeLight(name, params, context->curTransform[0], mi);
     if (!lt)
         Error("LightSource: light type \"%s\" unknown.", name.c_str());
     else
-        renderOptions->lights.push_back(lt);
+        context->renderOptions->lights.push_back(lt);
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sLightSource \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1321,8 +1393,8 @@ void pbrtLightSource(const std::string &name, const ParamSet &params) {
 
 void pbrtAreaLightSource(const std::string &name, const ParamSet &params) {
     VERIFY_WORLD("AreaLightSource");
-    graphicsState.areaLight = name;
-    graphicsState.areaLightParams = params;
+    context->graphicsState.areaLight = name;
+    context->graphicsState.areaLightParams = params;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sAreaLightSource \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1340,26 +1412,30 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
         printf("\n");
     }
 
-    if (!curTransform.IsAnimated()) {
+    if (!context->curTransform.IsAnimated()) {
         // Initialize _prims_ and _areaLights_ for static shape
 
         // Create shapes for shape _name_
-        Transform *ObjToWorld = transformCache.Lookup(curTransform[0]);
-        Transform *WorldToObj = transformCache.Lookup(Inverse(curTransform[0]));
+        Transform *ObjToWorld = transformCache.Lookup(context->curTransform[0]);
+        Transform *WorldToObj =
+            transformCache.Lookup(Inverse(context->curTransform[0]));
         std::vector<std::shared_ptr<Shape>> shapes =
             MakeShapes(name, ObjToWorld, WorldToObj,
-                       graphicsState.reverseOrientation, params);
+                       context->graphicsState.reverseOrientation, params);
         if (shapes.empty()) return;
-        std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
+        std::shared_ptr<Material> mtl =
+            context->graphicsState.GetMaterialForShape(params);
         params.ReportUnused();
-        MediumInterface mi = graphicsState.CreateMediumInterface();
+        MediumInterface mi = context->graphicsState.CreateMediumInterface();
         prims.reserve(shapes.size());
         for (auto s : shapes) {
             // Possibly create area light for shape
             std::shared_ptr<AreaLight> area;
-            if (graphicsState.areaLight != "") {
-                area = MakeAreaLight(graphicsState.areaLight, curTransform[0],
-                                     mi, graphicsState.areaLightParams, s);
+            if (context->graphicsState.areaLight != "") {
+                area = MakeAreaLight(context->graphicsState.areaLight,
+                                     context->curTransform[0], mi,
+                                     context->graphicsState.areaLightParams,
+                                     s);
                 if (area) areaLights.push_back(area);
             }
             prims.push_back(
@@ -1369,19 +1445,21 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
         // Initialize _prims_ and _areaLights_ for animated shape
 
         // Create initial shape or shapes for animated shape
-        if (graphicsState.areaLight != "")
+        if (context->graphicsState.areaLight != "")
             Warning(
                 "Ignoring currently set area light when creating "
                 "animated shape");
         Transform *identity = transformCache.Lookup(Transform());
-        std::vector<std::shared_ptr<Shape>> shapes = MakeShapes(
-            name, identity, identity, graphicsState.reverseOrientation, params);
+        std::vector<std::shared_ptr<Shape>> shapes =
+            MakeShapes(name, identity, identity,
+                       context->graphicsState.reverseOrientation, params);
         if (shapes.empty()) return;
 
         // Create _GeometricPrimitive_(s) for animated shape
-        std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
+        std::shared_ptr<Material> mtl =
+            context->graphicsState.GetMaterialForShape(params);
         params.ReportUnused();
-        MediumInterface mi = graphicsState.CreateMediumInterface();
+        MediumInterface mi = context->graphicsState.CreateMediumInterface();
         prims.reserve(shapes.size());
         for (auto s : shapes)
             prims.push_back(
@@ -1393,12 +1471,12 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
         static_assert(MaxTransforms == 2,
                       "TransformCache assumes only two transforms");
         Transform *ObjToWorld[2] = {
-            transformCache.Lookup(curTransform[0]),
-            transformCache.Lookup(curTransform[1])
+            transformCache.Lookup(context->curTransform[0]),
+            transformCache.Lookup(context->curTransform[1])
         };
         AnimatedTransform animatedObjectToWorld(
-            ObjToWorld[0], renderOptions->transformStartTime, ObjToWorld[1],
-            renderOptions->transformEndTime);
+            ObjToWorld[0], context->renderOptions->transformStartTime,
+            ObjToWorld[1], context->renderOptions->transformEndTime);
         if (prims.size() > 1) {
             std::shared_ptr<Primitive> bvh = std::make_shared<BVHAccel>(prims);
             prims.clear();
@@ -1408,17 +1486,20 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
             prims[0], animatedObjectToWorld);
     }
     // Add _prims_ and _areaLights_ to scene or current instance
-    if (renderOptions->currentInstance) {
+    if (context->renderOptions->currentInstance) {
         if (areaLights.size())
             Warning("Area lights not supported with object instancing");
-        renderOptions->currentInstance->insert(
-            renderOptions->currentInstance->end(), prims.begin(), prims.end());
+        context->renderOptions->currentInstance->insert(
+            context->renderOptions->currentInstance->end(), prims.begin(),
+            prims.end());
     } else {
-        renderOptions->primitives.insert(renderOptions->primitives.end(),
-                                         prims.begin(), prims.end());
+        context->renderOptions->primitives.insert(
+            context->renderOptions->primitives.end(), prims.begin(),
+            prims.end());
         if (areaLights.size())
-            renderOptions->lights.insert(renderOptions->lights.end(),
-                                         areaLights.begin(), areaLights.end());
+            context->renderOptions->lights.insert(
+                context->renderOptions->lights.end(), areaLights.begin(),
+                areaLights.end());
     }
 }
 
@@ -1496,17 +1577,19 @@ std::shared_ptr<Material> GraphicsState::GetMaterialForShape(
 MediumInterface GraphicsState::CreateMediumInterface() {
     MediumInterface m;
     if (currentInsideMedium != "") {
-        if (renderOptions->namedMedia.find(currentInsideMedium) !=
-            renderOptions->namedMedia.end())
-            m.inside = renderOptions->namedMedia[currentInsideMedium].get();
+        if (context->renderOptions->namedMedia.find(currentInsideMedium) !=
+            context->renderOptions->namedMedia.end())
+            m.inside =
+                context->renderOptions->namedMedia[currentInsideMedium].get();
         else
             Error("Named medium \"%s\" undefined.",
                   currentInsideMedium.c_str());
     }
     if (currentOutsideMedium != "") {
-        if (renderOptions->namedMedia.find(currentOutsideMedium) !=
-            renderOptions->namedMedia.end())
-            m.outside = renderOptions->namedMedia[currentOutsideMedium].get();
+        if (context->renderOptions->namedMedia.find(currentOutsideMedium) !=
+            context->renderOptions->namedMedia.end())
+            m.outside =
+                context->renderOptions->namedMedia[currentOutsideMedium].get();
         else
             Error("Named medium \"%s\" undefined.",
                   currentOutsideMedium.c_str());
@@ -1516,18 +1599,24 @@ MediumInterface GraphicsState::CreateMediumInterface() {
 
 void pbrtReverseOrientation() {
     VERIFY_WORLD("ReverseOrientation");
-    graphicsState.reverseOrientation = !graphicsState.reverseOrientation;
+    context->graphicsState.reverseOrientation =
+        !context->graphicsState.reverseOrientation;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sReverseOrientation\n", catIndentCount, "");
 }
 
 void pbrtObjectBegin(const std::string &name) {
     VERIFY_WORLD("ObjectBegin");
+    // Merge pending imports first so that instance definitions with the
+    // same name are applied in order
+    runImports(context);
     pbrtAttributeBegin();
-    if (renderOptions->currentInstance)
+    if (context->renderOptions->currentInstance)
         Error("ObjectBegin called inside of instance definition");
-    renderOptions->instances[name] = std::vector<std::shared_ptr<Primitive>>();
-    renderOptions->currentInstance = &renderOptions->instances[name];
+    context->renderOptions->instances[name] =
+        std::vector<std::shared_ptr<Primitive>>();
+    context->renderOptions->currentInstance =
+        &context->renderOptions->instances[name];
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sObjectBegin \"%s\"\n", catIndentCount, "", name.c_str());
 }
@@ -1536,9 +1625,9 @@ STAT_COUNTER("Scene/Object instances created", nObjectInstancesCreated);
 
 void pbrtObjectEnd() {
     VERIFY_WORLD("ObjectEnd");
-    if (!renderOptions->currentInstance)
+    if (!context->renderOptions->currentInstance)
         Error("ObjectEnd called outside of instance definition");
-    renderOptions->currentInstance = nullptr;
+    context->renderOptions->currentInstance = nullptr;
     pbrtAttributeEnd();
     ++nObjectInstancesCreated;
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -1555,61 +1644,199 @@ void pbrtObjectInstance(const std::string &name) {
     }
 
     // Perform object instance error checking
-    if (renderOptions->currentInstance) {
+    if (context->renderOptions->currentInstance) {
         Error("ObjectInstance can't be called inside instance definition");
         return;
     }
-    if (renderOptions->instances.find(name) == renderOptions->instances.end()) {
+    // Pending imports may define the instance
+    runImports(context);
+    // Look for the instance in the current file's context and then in the
+    // contexts of the files that imported it
+    APIContext *ctx = context;
+    auto iter = ctx->renderOptions->instances.find(name);
+    while (iter == ctx->renderOptions->instances.end() && ctx->parent) {
+        ctx = ctx->parent;
+        iter = ctx->renderOptions->instances.find(name);
+    }
+    if (iter == ctx->renderOptions->instances.end()) {
         Error("Unable to find instance named \"%s\"", name.c_str());
         return;
     }
-    std::vector<std::shared_ptr<Primitive>> &in =
-        renderOptions->instances[name];
+    std::vector<std::shared_ptr<Primitive>> &in = iter->second;
+    // Other files imported by the same file may be using its instances
+    // concurrently
+    std::unique_lock<std::mutex> lock(importedInstancesMutex,
+                                      std::defer_lock);
+    if (ctx != context) lock.lock();
     if (in.empty()) return;
     ++nObjectInstancesUsed;
     if (in.size() > 1) {
-        // Create aggregate for instance _Primitive_s
+        // Create aggregate for instance _Primitive_s. The lock is released
+        // while building it, since the threads that help with its parallel
+        // loops may go on to parse imported files that use instances.
+        std::vector<std::shared_ptr<Primitive>> prims = in;
+        bool locked = lock.owns_lock();
+        if (locked) lock.unlock();
         std::shared_ptr<Primitive> accel(
-            MakeAccelerator(renderOptions->AcceleratorName, std::move(in),
-                            renderOptions->AcceleratorParams));
-        if (!accel) accel = std::make_shared<BVHAccel>(in);
-        in.clear();
-        in.push_back(accel);
+            MakeAccelerator(context->renderOptions->AcceleratorName, prims,
+                            context->renderOptions->AcceleratorParams));
+        if (!accel) accel = std::make_shared<BVHAccel>(prims);
+        if (locked) lock.lock();
+        // Another file may have built the aggregate in the meantime
+        if (in.size() > 1) {
+            in.clear();
+            in.push_back(accel);
+        }
     }
     static_assert(MaxTransforms == 2,
                   "TransformCache assumes only two transforms");
-    // Create _animatedInstanceToWorld_ transform for instance
+    // Look up the instance's transformations in the cache
     Transform *InstanceToWorld[2] = {
-        transformCache.Lookup(curTransform[0]),
-        transformCache.Lookup(curTransform[1])
+        transformCache.Lookup(context->curTransform[0]),
+        transformCache.Lookup(context->curTransform[1])
     };
-    AnimatedTransform animatedInstanceToWorld(
-        InstanceToWorld[0], renderOptions->transformStartTime,
-        InstanceToWorld[1], renderOptions->transformEndTime);
-    std::shared_ptr<Primitive> prim(
-        std::make_shared<TransformedPrimitive>(in[0], animatedInstanceToWorld));
-    renderOptions->primitives.push_back(prim);
+    // Record the instance's use; all uses are gathered into a two-level
+    // acceleration structure in _RenderOptions::MakeScene()_
+    context->renderOptions->instanceUses.push_back(
+        {in[0],
+         {InstanceToWorld[0], InstanceToWorld[1]},
+         context->renderOptions->transformStartTime,
+         context->renderOptions->transformEndTime});
+}
+
+void pbrtImport(const std::string &filename) {
+    VERIFY_WORLD("Import");
+    // Set up the context that the imported file will be parsed with
+    std::unique_ptr<ImportedFile> file(new ImportedFile);
+    file->filename = filename;
+    if (parserLoc) file->importLoc.reset(new Loc(*parserLoc));
+    APIContext &ic = file->context;
+    const RenderOptions &ro = *context->renderOptions;
+    ic.renderOptions.reset(new RenderOptions);
+    ic.renderOptions->transformStartTime = ro.transformStartTime;
+    ic.renderOptions->transformEndTime = ro.transformEndTime;
+    ic.renderOptions->AcceleratorName = ro.AcceleratorName;
+    ic.renderOptions->AcceleratorParams = ro.AcceleratorParams;
+    ic.renderOptions->namedMedia = ro.namedMedia;
+    ic.curTransform = context->curTransform;
+    ic.activeTransformBits = context->activeTransformBits;
+    // Both contexts must copy the named texture and material maps before
+    // modifying them from here on.
+    context->graphicsState.floatTexturesShared =
+        context->graphicsState.spectrumTexturesShared =
+            context->graphicsState.namedMaterialsShared = true;
+    ic.graphicsState = context->graphicsState;
+    ic.parent = context;
+
+    // Record where the file's primitives go; they're merged in after all
+    // of the ones that precede the Import directive
+    file->primitiveOffset = ro.currentInstance ? ro.currentInstance->size()
+                                               : ro.primitives.size();
+    file->lightOffset = ro.lights.size();
+    file->instanceUseOffset = ro.instanceUses.size();
+    context->pendingImports.push_back(std::move(file));
+
+    // Files imported inside an object definition are merged right away so
+    // that their primitives are added to the right instance.
+    if (ro.currentInstance) runImports(context);
+}
+
+// Moves the items that the imported files added to the list given by
+// _member_ into _items_, at the positions of their Import directives.
+template <typename T>
+static void spliceImports(
+    const std::vector<std::unique_ptr<ImportedFile>> &files,
+    size_t ImportedFile::*offset, std::vector<T> RenderOptions::*member,
+    std::vector<T> *items) {
+    std::vector<T> merged;
+    size_t start = 0;
+    for (const std::unique_ptr<ImportedFile> &file : files) {
+        size_t end = (*file).*offset;
+        std::move(items->begin() + start, items->begin() + end,
+                  std::back_inserter(merged));
+        std::vector<T> &fileItems = (*file->context.renderOptions).*member;
+        std::move(fileItems.begin(), fileItems.end(),
+                  std::back_inserter(merged));
+        fileItems.clear();
+        start = end;
+    }
+    std::move(items->begin() + start, items->end(),
+              std::back_inserter(merged));
+    *items = std::move(merged);
+}
+
+STAT_COUNTER("Scene/Files imported", nFilesImported);
+
+// Parses the files given to the Import directives that _ctx_ has seen
+// since the last call, in parallel, and merges what they created into
+// _ctx_'s _RenderOptions_ in the order of the directives.
+static void runImports(APIContext *ctx) {
+    if (ctx->pendingImports.empty()) return;
+    std::vector<std::unique_ptr<ImportedFile>> files =
+        std::move(ctx->pendingImports);
+    ctx->pendingImports.clear();
+
+    ParallelFor([&](int64_t i) {
+        // The thread running this item may be in the middle of parsing
+        // another file, so its parser location is restored afterward.
+        Loc *threadLoc = parserLoc;
+        APIContext *importingContext = context;
+        context = &files[i]->context;
+        parserLoc = files[i]->importLoc.get();
+        ParseImportedFile(files[i]->filename);
+        parserLoc = files[i]->importLoc.get();
+        runImports(context);
+        if (!context->pushedGraphicsStates.empty() ||
+            !context->pushedTransforms.empty())
+            Warning("\"%s\": missing end to AttributeBegin or "
+                    "TransformBegin", files[i]->filename.c_str());
+        if (context->renderOptions->currentInstance)
+            Error("\"%s\": missing ObjectEnd",
+                  files[i]->filename.c_str());
+        context = importingContext;
+        parserLoc = threadLoc;
+        ++nFilesImported;
+    }, files.size(), 1);
+
+    // Merge the imported files' scene elements into _ctx_
+    RenderOptions &ro = *ctx->renderOptions;
+    spliceImports(files, &ImportedFile::primitiveOffset,
+                  &RenderOptions::primitives,
+                  ro.currentInstance ? ro.currentInstance : &ro.primitives);
+    spliceImports(files, &ImportedFile::lightOffset, &RenderOptions::lights,
+                  &ro.lights);
+    spliceImports(files, &ImportedFile::instanceUseOffset,
+                  &RenderOptions::instanceUses, &ro.instanceUses);
+    for (const std::unique_ptr<ImportedFile> &file : files) {
+        for (auto &instance : file->context.renderOptions->instances)
+            ro.instances[instance.first] = std::move(instance.second);
+        ro.haveScatteringMedia |=
+            file->context.renderOptions->haveScatteringMedia;
+    }
 }
 
 void pbrtWorldEnd() {
     VERIFY_WORLD("WorldEnd");
+    VERIFY_NOT_IMPORTED("WorldEnd");
+    runImports(context);
     // Ensure there are no pushed graphics states
-    while (pushedGraphicsStates.size()) {
+    while (context->pushedGraphicsStates.size()) {
         Warning("Missing end to pbrtAttributeBegin()");
-        pushedGraphicsStates.pop_back();
-        pushedTransforms.pop_back();
+        context->pushedGraphicsStates.pop_back();
+        context->pushedTransforms.pop_back();
     }
-    while (pushedTransforms.size()) {
+    while (context->pushedTransforms.size()) {
         Warning("Missing end to pbrtTransformBegin()");
-        pushedTransforms.pop_back();
+        context->pushedTransforms.pop_back();
     }
 
     // Create scene and render
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sWorldEnd\n", catIndentCount, "");
     } else {
-        std::unique_ptr<Integrator> integrator(renderOptions->MakeIntegrator());
-        std::unique_ptr<Scene> scene(renderOptions->MakeScene());
+        std::unique_ptr<Integrator> integrator(
+            context->renderOptions->MakeIntegrator());
+        std::unique_ptr<Scene> scene(context->renderOptions->MakeScene());
 
         // This is kind of ugly; we directly override the current profiler
         // state to switch from parsing/scene construction related stuff to
@@ -1620,6 +1847,20 @@ void pbrtWorldEnd() {
         CHECK_EQ(CurrentProfilerState(), ProfToBits(Prof::SceneConstruction));
         ProfilerState = ProfToBits(Prof::IntegratorRender);
 
+        if (integrator && (IsDistributedWorker() ||
+                           IsDistributedCoordinator()) &&
+            !dynamic_cast<SamplerIntegrator *>(integrator.get())) {
+            // Only _SamplerIntegrator_s know how to split their work into
+            // tiles; workers have nothing to do for other integrators,
+            // while the coordinator renders the image itself.
+            if (IsDistributedWorker()) {
+                Warning("Distributed rendering is only supported for "
+                        "tile-based integrators; skipping this image.");
+                integrator.reset();
+            } else
+                Warning("Distributed rendering is only supported for "
+                        "tile-based integrators; rendering locally.");
+        }
         if (scene && integrator) integrator->Render(*scene);
 
         CHECK_EQ(CurrentProfilerState(), ProfToBits(Prof::IntegratorRender));
@@ -1628,12 +1869,13 @@ void pbrtWorldEnd() {
 
     // Clean up after rendering. Do this before reporting stats so that
     // destructors can run and update stats as needed.
-    graphicsState = GraphicsState();
+    context->graphicsState = GraphicsState();
     transformCache.Clear();
     currentApiState = APIState::OptionsBlock;
     ImageTexture<Float, Float>::ClearCache();
     ImageTexture<RGBSpectrum, Spectrum>::ClearCache();
-    renderOptions.reset(new RenderOptions);
+    ClearTextureCache();
+    context->renderOptions.reset(new RenderOptions);
 
     if (!PbrtOptions.cat && !PbrtOptions.toPly) {
         MergeWorkerThreadStats();
@@ -1646,13 +1888,21 @@ void pbrtWorldEnd() {
         }
     }
 
-    for (int i = 0; i < MaxTransforms; ++i) curTransform[i] = Transform();
-    activeTransformBits = AllTransformsBits;
+    for (int i = 0; i < MaxTransforms; ++i)
+        context->curTransform[i] = Transform();
+    context->activeTransformBits = AllTransformsBits;
     namedCoordinateSystems.erase(namedCoordinateSystems.begin(),
                                  namedCoordinateSystems.end());
 }
 
 Scene *RenderOptions::MakeScene() {
+    // Object instances are intersected using their own BVH, which is then
+    // one of the primitives of the top-level accelerator
+    if (!instanceUses.empty()) {
+        primitives.push_back(
+            std::make_shared<InstanceBVHAccel>(std::move(instanceUses)));
+        instanceUses.clear();
+    }
     std::shared_ptr<Primitive> accelerator =
         MakeAccelerator(AcceleratorName, std::move(primitives), AcceleratorParams);
     if (!accelerator) accelerator = std::make_shared<BVHAccel>(primitives);
@@ -1687,6 +1937,9 @@ Integrator *RenderOptions::MakeIntegrator() const {
         integrator = CreatePathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "volpath")
         integrator = CreateVolPathIntegrator(IntegratorParams, sampler, camera);
+    else if (IntegratorName == "wavefront")
+        integrator =
+            CreateWavefrontPathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "bdpt") {
         integrator = CreateBDPTIntegrator(IntegratorParams, sampler, camera);
     } else if (IntegratorName == "mlt") {
@@ -1700,7 +1953,7 @@ Integrator *RenderOptions::MakeIntegrator() const {
         return nullptr;
     }
 
-    if (renderOptions->haveScatteringMedia && IntegratorName != "volpath" &&
+    if (haveScatteringMedia && IntegratorName != "volpath" &&
         IntegratorName != "bdpt" && IntegratorName != "mlt") {
         Warning(
             "Scene has scattering media but \"%s\" integrator doesn't support "
@@ -1725,8 +1978,7 @@ Camera *RenderOptions::MakeCamera() const {
         return nullptr;
     }
     Camera *camera = pbrt::MakeCamera(CameraName, CameraParams, CameraToWorld,
-                                  renderOptions->transformStartTime,
-                                  renderOptions->transformEndTime, film);
+                                  transformStartTime, transformEndTime, film);
     return camera;
 }
 
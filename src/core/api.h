@@ -86,10 +86,14 @@ void pbrtReverseOrientation();
 void pbrtObjectBegin(const std::string &name);
 void pbrtObjectEnd();
 void pbrtObjectInstance(const std::string &name);
+void pbrtImport(const std::string &filename);
 void pbrtWorldEnd();
 
 void pbrtParseFile(std::string filename);
 void pbrtParseString(std::string str);
+// Parses a file given to Import; the directives in it are applied to the
+// calling thread's current API context.
+void ParseImportedFile(const std::string &filename);
 
 }  // namespace pbrt
 
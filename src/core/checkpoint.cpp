@@ -0,0 +1,229 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/checkpoint.cpp*
+#include "checkpoint.h"
+#include "film.h"
+#include "stats.h"
+#include <chrono>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace pbrt {
+
+STAT_COUNTER("Checkpoint/Checkpoints written", nCheckpointsWritten);
+STAT_FLOAT_DISTRIBUTION("Checkpoint/Write time (seconds)",
+                        checkpointWriteSeconds);
+
+// RenderCheckpoint Local Declarations
+static const char checkpointMagic[8] = {'p', 'b', 'r', 't', 'c', 'k', 'p',
+                                        '2'};
+
+// A checkpoint holds its header, each tile's sample count, the film's
+// pixel values and then the pixels' moments, if the film tracks them for
+// adaptive sampling
+struct CheckpointHeader {
+    char magic[8];
+    uint64_t renderId;
+    int32_t floatSize;
+    int32_t nTiles;
+    uint64_t nPixelValues;
+    uint64_t nPixelMoments;
+};
+
+// RenderCheckpoint Method Definitions
+RenderCheckpoint::RenderCheckpoint(const std::string &filename, Film *film,
+                                   int nTiles, uint64_t renderId,
+                                   Float intervalSeconds, bool resume)
+    : filename(filename),
+      film(film),
+      renderId(renderId),
+      tileSamples(nTiles, 0) {
+    if (resume) this->resume();
+    if (intervalSeconds <= 0) return;
+    writerThread = std::thread([this, intervalSeconds]() {
+        std::unique_lock<std::mutex> lock(stopMutex);
+        auto interval = std::chrono::duration<double>(intervalSeconds);
+        while (!stopCondition.wait_for(lock, interval,
+                                       [this]() { return stopping; })) {
+            lock.unlock();
+            Write();
+            lock.lock();
+        }
+        ReportThreadStats();
+    });
+}
+
+RenderCheckpoint::~RenderCheckpoint() { stopWriter(); }
+
+void RenderCheckpoint::stopWriter() {
+    if (!writerThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopCondition.notify_one();
+    writerThread.join();
+}
+
+bool RenderCheckpoint::resume() {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        Warning("%s: unable to open checkpoint to resume from: %s. "
+                "Starting from the beginning.", filename.c_str(),
+                strerror(errno));
+        return false;
+    }
+    CheckpointHeader header;
+    std::vector<int64_t> samples;
+    std::vector<Float> data;
+    std::vector<PixelMoments> moments;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) ==
+                  0 &&
+              header.floatSize == sizeof(Float) &&
+              header.nTiles == int32_t(tileSamples.size());
+    if (ok && header.renderId != renderId) {
+        fclose(f);
+        Warning("%s: checkpoint is for a different image. Starting from the "
+                "beginning.", filename.c_str());
+        return false;
+    }
+    if (ok) {
+        samples.resize(header.nTiles);
+        data.resize(header.nPixelValues);
+        moments.resize(header.nPixelMoments);
+        ok = fread(samples.data(), sizeof(int64_t), samples.size(), f) ==
+                 samples.size() &&
+             fread(data.data(), sizeof(Float), data.size(), f) ==
+                 data.size() &&
+             fread(moments.data(), sizeof(PixelMoments), moments.size(), f) ==
+                 moments.size();
+    }
+    fclose(f);
+    if (ok) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ok = film->LoadAccumulation(data, moments);
+        if (ok) tileSamples = samples;
+    }
+    if (!ok) {
+        Warning("%s: checkpoint is corrupt or for a different image. "
+                "Starting from the beginning.", filename.c_str());
+        return false;
+    }
+    LOG(INFO) << "Resuming render from checkpoint " << filename;
+    return true;
+}
+
+int64_t RenderCheckpoint::TileSamples(int tileIndex) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tileSamples[tileIndex];
+}
+
+void RenderCheckpoint::MergeTile(int tileIndex, std::unique_ptr<FilmTile> tile,
+                                 int64_t samples) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        mergeCondition.wait(lock, [&]() { return !copying; });
+        ++nMerging;
+    }
+    film->MergeFilmTile(std::move(tile));
+    std::lock_guard<std::mutex> lock(mutex);
+    tileSamples[tileIndex] = samples;
+    if (--nMerging == 0 && copying) mergeCondition.notify_all();
+}
+
+bool RenderCheckpoint::Write() {
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    auto startTime = std::chrono::steady_clock::now();
+    // Copy the film and the tiles' progress; merging tiles only waits for
+    // the copy, not for the write
+    CheckpointHeader header;
+    memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.renderId = renderId;
+    header.floatSize = sizeof(Float);
+    std::vector<int64_t> samples;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        copying = true;
+        mergeCondition.wait(lock, [&]() { return nMerging == 0; });
+        film->SaveAccumulation(&pixelData, &pixelMoments);
+        samples = tileSamples;
+        copying = false;
+    }
+    mergeCondition.notify_all();
+    header.nTiles = samples.size();
+    header.nPixelValues = pixelData.size();
+    header.nPixelMoments = pixelMoments.size();
+
+    // Write the checkpoint to a temporary file and then rename it
+    std::string tmpFilename = filename + ".tmp";
+    FILE *f = fopen(tmpFilename.c_str(), "wb");
+    if (!f) {
+        Warning("%s: %s", tmpFilename.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(samples.data(), sizeof(int64_t), samples.size(), f) ==
+                  samples.size() &&
+              fwrite(pixelData.data(), sizeof(Float), pixelData.size(), f) ==
+                  pixelData.size() &&
+              fwrite(pixelMoments.data(), sizeof(PixelMoments),
+                     pixelMoments.size(), f) == pixelMoments.size();
+    ok &= fclose(f) == 0;
+#ifdef PBRT_IS_WINDOWS
+    // rename() won't replace an existing file on Windows.
+    if (ok) remove(filename.c_str());
+#endif
+    if (!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        Warning("%s: unable to write checkpoint: %s", filename.c_str(),
+                strerror(errno));
+        remove(tmpFilename.c_str());
+        return false;
+    }
+    ++nCheckpointsWritten;
+    std::chrono::duration<double> writeTime =
+        std::chrono::steady_clock::now() - startTime;
+    ReportValue(checkpointWriteSeconds, writeTime.count());
+    LOG(INFO) << "Wrote checkpoint " << filename;
+    return true;
+}
+
+void RenderCheckpoint::Finish() {
+    stopWriter();
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    remove(filename.c_str());
+}
+
+}  // namespace pbrt
@@ -0,0 +1,117 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_CHECKPOINT_H
+#define PBRT_CORE_CHECKPOINT_H
+
+// core/checkpoint.h*
+#include "pbrt.h"
+#include "film.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pbrt {
+
+// RenderCheckpoint Declarations
+
+// Periodically saves the state of an in-progress render to a file: the
+// film's accumulated pixel values and moments and, for each image tile,
+// the number of samples per pixel that have been merged into them. A render that is
+// started again with the same checkpoint file can resume from that state
+// and produce the same image as if it hadn't been interrupted.
+//
+// Tiles are merged into the film through the checkpoint, so that it can
+// take a consistent copy of the film and the tiles' progress: merges run
+// concurrently with each other but not with taking the copy. The copy is
+// then written by a background thread while the workers keep merging
+// tiles into the film; it goes to a temporary file that replaces the
+// checkpoint once it's complete, so that the last checkpoint survives a
+// failure during the write.
+class RenderCheckpoint {
+  public:
+    // RenderCheckpoint Public Methods
+    // _renderId_ identifies the image being rendered, so that checkpoints
+    // of other images aren't resumed. If _resume_ is true, the film and
+    // the tiles' progress are first restored from the checkpoint file, if
+    // it holds a checkpoint of the same image. A checkpoint is then
+    // written every _intervalSeconds_ seconds if it's positive.
+    RenderCheckpoint(const std::string &filename, Film *film, int nTiles,
+                     uint64_t renderId, Float intervalSeconds, bool resume);
+    ~RenderCheckpoint();
+    int64_t TileSamples(int tileIndex) const;
+    // Merges _tile_ into the film and records that the tile's pixels now
+    // have _samples_ samples each.
+    void MergeTile(int tileIndex, std::unique_ptr<FilmTile> tile,
+                   int64_t samples);
+    bool Write();
+    // Stops writing checkpoints and removes the checkpoint file; called
+    // once the final image has been written.
+    void Finish();
+
+  private:
+    // RenderCheckpoint Private Methods
+    bool resume();
+    void stopWriter();
+
+    // RenderCheckpoint Private Data
+    const std::string filename;
+    Film *film;
+    const uint64_t renderId;
+    // _mutex_ protects _tileSamples_ and the count of tiles being merged,
+    // and is held while copying the film once no tiles are being merged
+    mutable std::mutex mutex;
+    std::vector<int64_t> tileSamples;
+    std::condition_variable mergeCondition;
+    int nMerging = 0;
+    bool copying = false;
+    // Only one checkpoint is written at a time; _pixelData_ and
+    // _pixelMoments_ hold the copy of the film being written
+    std::mutex writeMutex;
+    std::vector<Float> pixelData;
+    std::vector<PixelMoments> pixelMoments;
+    std::thread writerThread;
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopping = false;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_CHECKPOINT_H
@@ -0,0 +1,567 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/distributed.cpp*
+#include "distributed.h"
+#include "film.h"
+#include "parallel.h"
+#include "stats.h"
+#include <deque>
+#include <mutex>
+#ifndef PBRT_IS_WINDOWS
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif  // !PBRT_IS_WINDOWS
+
+namespace pbrt {
+
+STAT_COUNTER("Distributed/Tiles received from workers", nTilesReceived);
+STAT_COUNTER("Distributed/Tiles reassigned after worker loss", nTilesReassigned);
+STAT_COUNTER("Distributed/Workers connected", nWorkersConnected);
+STAT_COUNTER("Distributed/Workers lost", nWorkersLost);
+STAT_COUNTER("Distributed/Tiles rendered by coordinator", nTilesRenderedLocally);
+
+// Distributed Local Definitions
+static PBRT_CONSTEXPR uint32_t ProtocolMagic = 0x70627274;  // "pbrt"
+static PBRT_CONSTEXPR uint32_t ProtocolVersion = 1;
+
+// Every message starts with a _MessageHeader_ followed by _length_ bytes
+// of payload. All values are sent in the host's byte order; the
+// coordinator and workers are expected to run on the same architecture.
+enum class MessageType : uint32_t {
+    // worker -> coordinator: magic, version, nTiles, jobId
+    Hello = 1,
+    // coordinator -> worker: count, then _count_ tile indices
+    AssignTiles,
+    // worker -> coordinator: tile index, then the serialized tile
+    TileResult,
+    // coordinator -> worker: no payload
+    Done
+};
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t length;
+};
+
+// Upper bound on a message's payload size; it's well beyond what a film
+// tile of any reasonable size needs, and connections that claim to be
+// sending more are dropped rather than allocating the memory for it.
+static PBRT_CONSTEXPR uint32_t MaxMessageLength = 1u << 28;
+
+struct HelloMessage {
+    uint32_t magic;
+    uint32_t version;
+    int32_t nTiles;
+    int32_t pad;
+    uint64_t jobId;
+};
+
+static int listenSocket = -1;
+static std::vector<int> localWorkerPids;
+
+#ifndef PBRT_IS_WINDOWS
+static bool WriteFully(int fd, const void *data, size_t size) {
+    const char *ptr = (const char *)data;
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool ReadFully(int fd, void *data, size_t size) {
+    char *ptr = (char *)data;
+    while (size > 0) {
+        ssize_t n = read(fd, ptr, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool SendMessage(int fd, MessageType type, const void *payload0,
+                        size_t size0, const void *payload1 = nullptr,
+                        size_t size1 = 0) {
+    if (size0 + size1 > MaxMessageLength) {
+        LOG(ERROR) << "Message of " << size0 + size1 << " bytes is too "
+                   << "large to send";
+        return false;
+    }
+    MessageHeader header{(uint32_t)type, (uint32_t)(size0 + size1)};
+    return WriteFully(fd, &header, sizeof(header)) &&
+           WriteFully(fd, payload0, size0) && WriteFully(fd, payload1, size1);
+}
+
+static bool ReceiveMessage(int fd, MessageType *type,
+                           std::vector<char> *payload) {
+    MessageHeader header;
+    if (!ReadFully(fd, &header, sizeof(header))) return false;
+    if (header.length > MaxMessageLength) {
+        LOG(WARNING) << "Peer sent a message claiming " << header.length
+                     << " bytes of payload";
+        return false;
+    }
+    *type = (MessageType)header.type;
+    payload->resize(header.length);
+    return header.length == 0 || ReadFully(fd, payload->data(), header.length);
+}
+
+// Per-connection state kept by the coordinator
+struct WorkerConnection {
+    WorkerConnection(int fd) : fd(fd) {}
+    int fd;
+    bool helloReceived = false;
+    // Tiles assigned to this worker that it hasn't returned yet
+    std::vector<int> outstanding;
+};
+#endif  // !PBRT_IS_WINDOWS
+
+// Distributed Definitions
+int DistributedListen(int port, bool loopbackOnly) {
+#ifdef PBRT_IS_WINDOWS
+    Error("Distributed rendering is not supported on Windows.");
+    return -1;
+#else
+    CHECK_EQ(listenSocket, -1);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        Error("Unable to create socket for workers: %s", strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        Error("Unable to listen for workers on port %d: %s", port,
+              strerror(errno));
+        close(fd);
+        return -1;
+    }
+    socklen_t addrLen = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &addrLen);
+    listenSocket = fd;
+    port = ntohs(addr.sin_port);
+    LOG(INFO) << "Listening for distributed rendering workers on port "
+              << port;
+    return port;
+#endif  // PBRT_IS_WINDOWS
+}
+
+void SpawnLocalWorkers(int nWorkers, const std::vector<std::string> &args) {
+#ifdef PBRT_IS_WINDOWS
+    Error("Distributed rendering is not supported on Windows.");
+#else
+    // Build the argument vector before forking, since only
+    // async-signal-safe functions may be called in the child.
+    std::vector<char *> argv;
+    for (const std::string &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    const char *exe = "/proc/self/exe";
+    if (access(exe, X_OK) != 0) exe = argv[0];
+
+    for (int i = 0; i < nWorkers; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execv(exe, argv.data());
+            _exit(127);
+        } else if (pid < 0)
+            Error("Unable to launch worker process: %s", strerror(errno));
+        else {
+            LOG(INFO) << "Launched local worker process " << pid;
+            localWorkerPids.push_back(pid);
+        }
+    }
+#endif  // PBRT_IS_WINDOWS
+}
+
+bool IsDistributedCoordinator() { return listenSocket != -1; }
+
+bool IsDistributedWorker() { return !PbrtOptions.coordinator.empty(); }
+
+void DistributedCleanup() {
+#ifndef PBRT_IS_WINDOWS
+    if (listenSocket != -1) {
+        close(listenSocket);
+        listenSocket = -1;
+    }
+    // Wait for local workers to finish up and exit
+    for (int pid : localWorkerPids) waitpid(pid, nullptr, 0);
+    localWorkerPids.clear();
+#endif  // !PBRT_IS_WINDOWS
+}
+
+bool CoordinateTiles(int listenFd, std::vector<int> workerFds, int nTiles,
+                     uint64_t jobId, int tilesPerBatch,
+                     const TileMergeFunction &mergeTile,
+                     const TileRenderFunction &renderLocally) {
+#ifdef PBRT_IS_WINDOWS
+    Error("Distributed rendering is not supported on Windows.");
+    return false;
+#else
+    CHECK_GT(tilesPerBatch, 0);
+    // Writes to workers that have died should fail rather than raising
+    // SIGPIPE, so that their tiles can be reassigned.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::deque<int> pending;
+    for (int i = 0; i < nTiles; ++i) pending.push_back(i);
+    std::vector<bool> tileDone(nTiles, false);
+    int nTilesDone = 0;
+
+    std::vector<WorkerConnection> workers;
+    for (int fd : workerFds) workers.push_back(WorkerConnection(fd));
+    bool warnedNoWorkers = false, hadWorkers = !workers.empty();
+
+    // Closes the connection to _workers[i]_, returning its outstanding
+    // tiles to the front of the queue of pending tiles.
+    auto dropWorker = [&](size_t i, const char *reason) {
+        WorkerConnection &w = workers[i];
+        LOG(WARNING) << "Dropping worker connection " << w.fd << ": " << reason
+                     << "; reassigning " << w.outstanding.size() << " tiles";
+        for (auto iter = w.outstanding.rbegin(); iter != w.outstanding.rend();
+             ++iter)
+            pending.push_front(*iter);
+        nTilesReassigned += w.outstanding.size();
+        ++nWorkersLost;
+        close(w.fd);
+        workers.erase(workers.begin() + i);
+    };
+
+    while (nTilesDone < nTiles) {
+        // Give each worker a new batch of tiles as soon as it has fewer
+        // than a batch's worth outstanding; this way, the next batch is
+        // already waiting when it finishes the current one.
+        for (size_t i = 0; i < workers.size(); ++i) {
+            WorkerConnection &w = workers[i];
+            if (!w.helloReceived || pending.empty() ||
+                w.outstanding.size() >= (size_t)tilesPerBatch)
+                continue;
+            std::vector<int32_t> batch;
+            while (!pending.empty() && batch.size() < (size_t)tilesPerBatch) {
+                batch.push_back(pending.front());
+                pending.pop_front();
+            }
+            int32_t count = batch.size();
+            w.outstanding.insert(w.outstanding.end(), batch.begin(),
+                                 batch.end());
+            if (!SendMessage(w.fd, MessageType::AssignTiles, &count,
+                             sizeof(count), batch.data(),
+                             batch.size() * sizeof(int32_t)))
+                dropWorker(i--, "write failed");
+        }
+
+        if (workers.empty() && (hadWorkers || listenFd == -1)) {
+            // Every worker has been lost; there's no telling whether more
+            // will ever connect, so either finish the image here or give up.
+            if (!renderLocally) {
+                Error("All distributed rendering workers were lost with %d "
+                      "tiles left to render.", nTiles - nTilesDone);
+                return false;
+            }
+            Warning("All distributed rendering workers were lost; rendering "
+                    "the remaining %d tiles locally.", nTiles - nTilesDone);
+            std::vector<int> remaining;
+            for (int tile : pending)
+                if (!tileDone[tile]) remaining.push_back(tile);
+            std::mutex mergeMutex;
+            ParallelFor([&](int64_t i) {
+                std::vector<char> data;
+                renderLocally(remaining[i], &data);
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                mergeTile(remaining[i], data);
+                ++nTilesRenderedLocally;
+            }, remaining.size());
+            return true;
+        }
+        if (workers.empty() && !warnedNoWorkers) {
+            Warning("No distributed rendering workers are connected; waiting "
+                    "for one to connect.");
+            warnedNoWorkers = true;
+        }
+
+        // Wait for a new connection or a message from a worker
+        std::vector<pollfd> pfds;
+        size_t nPolled = workers.size();
+        for (const WorkerConnection &w : workers)
+            pfds.push_back({w.fd, POLLIN, 0});
+        if (listenFd != -1) pfds.push_back({listenFd, POLLIN, 0});
+        if (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            Error("poll(): %s", strerror(errno));
+            return false;
+        }
+
+        // Process messages from workers. Iterate in reverse so that
+        // dropping a worker doesn't disturb the indices still to visit.
+        for (int i = (int)nPolled - 1; i >= 0; --i) {
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            WorkerConnection &w = workers[i];
+            MessageType type;
+            std::vector<char> payload;
+            if (!ReceiveMessage(w.fd, &type, &payload)) {
+                dropWorker(i, "connection lost");
+                continue;
+            }
+            if (type == MessageType::Hello) {
+                HelloMessage hello;
+                if (payload.size() != sizeof(hello)) {
+                    dropWorker(i, "malformed hello");
+                    continue;
+                }
+                memcpy(&hello, payload.data(), sizeof(hello));
+                if (hello.magic != ProtocolMagic ||
+                    hello.version != ProtocolVersion ||
+                    hello.nTiles != nTiles || hello.jobId != jobId) {
+                    dropWorker(i, "worker is rendering a different image");
+                    continue;
+                }
+                w.helloReceived = true;
+                ++nWorkersConnected;
+            } else if (type == MessageType::TileResult &&
+                       payload.size() >= sizeof(int32_t)) {
+                int32_t tileIndex;
+                memcpy(&tileIndex, payload.data(), sizeof(tileIndex));
+                auto iter = std::find(w.outstanding.begin(),
+                                      w.outstanding.end(), tileIndex);
+                if (iter == w.outstanding.end()) {
+                    dropWorker(i, "unexpected tile");
+                    continue;
+                }
+                w.outstanding.erase(iter);
+                if (tileDone[tileIndex]) continue;
+                tileDone[tileIndex] = true;
+                ++nTilesDone;
+                ++nTilesReceived;
+                payload.erase(payload.begin(),
+                              payload.begin() + sizeof(int32_t));
+                mergeTile(tileIndex, payload);
+            } else
+                dropWorker(i, "unexpected message");
+        }
+
+        if (listenFd != -1 && (pfds.back().revents & POLLIN)) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                workers.push_back(WorkerConnection(fd));
+                warnedNoWorkers = false;
+                hadWorkers = true;
+            }
+        }
+    }
+
+    // Let the workers know that the image is finished
+    for (WorkerConnection &w : workers) {
+        SendMessage(w.fd, MessageType::Done, nullptr, 0);
+        close(w.fd);
+    }
+    return true;
+#endif  // PBRT_IS_WINDOWS
+}
+
+bool ServeTiles(int fd, int nTiles, uint64_t jobId,
+                const TileRenderFunction &renderTile) {
+#ifdef PBRT_IS_WINDOWS
+    Error("Distributed rendering is not supported on Windows.");
+    return false;
+#else
+    // Handle a lost coordinator by returning an error, not via SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    HelloMessage hello{ProtocolMagic, ProtocolVersion, nTiles, 0, jobId};
+    if (!SendMessage(fd, MessageType::Hello, &hello, sizeof(hello)))
+        return false;
+
+    std::mutex writeMutex;
+    std::atomic<bool> writeFailed{false};
+    while (true) {
+        MessageType type;
+        std::vector<char> payload;
+        if (!ReceiveMessage(fd, &type, &payload)) return false;
+        if (type == MessageType::Done) return true;
+
+        int32_t count;
+        if (type != MessageType::AssignTiles || payload.size() < sizeof(count))
+            return false;
+        memcpy(&count, payload.data(), sizeof(count));
+        if (count < 0 || payload.size() != (count + 1) * sizeof(int32_t))
+            return false;
+        std::vector<int32_t> batch(count);
+        memcpy(batch.data(), payload.data() + sizeof(count),
+               count * sizeof(int32_t));
+
+        // Render the batch's tiles in parallel, sending each one back as
+        // soon as it's done.
+        ParallelFor([&](int64_t i) {
+            int32_t tileIndex = batch[i];
+            if (writeFailed || tileIndex < 0 || tileIndex >= nTiles) return;
+            std::vector<char> data;
+            renderTile(tileIndex, &data);
+            std::lock_guard<std::mutex> lock(writeMutex);
+            if (!SendMessage(fd, MessageType::TileResult, &tileIndex,
+                             sizeof(tileIndex), data.data(), data.size()))
+                writeFailed = true;
+        }, batch.size());
+        if (writeFailed) return false;
+    }
+#endif  // PBRT_IS_WINDOWS
+}
+
+bool CoordinateTiles(int nTiles, uint64_t jobId,
+                     const TileMergeFunction &mergeTile,
+                     const TileRenderFunction &renderLocally) {
+    CHECK(IsDistributedCoordinator());
+    // Batches should be large enough to amortize the round trip to each
+    // worker but small enough that there's plenty to go around.
+    int tilesPerBatch = std::max(1, std::min(16, nTiles / 64));
+    return CoordinateTiles(listenSocket, {}, nTiles, jobId, tilesPerBatch,
+                           mergeTile, renderLocally);
+}
+
+bool ServeTiles(int nTiles, uint64_t jobId,
+                const TileRenderFunction &renderTile) {
+#ifdef PBRT_IS_WINDOWS
+    Error("Distributed rendering is not supported on Windows.");
+    return false;
+#else
+    CHECK(IsDistributedWorker());
+    // Split _PbrtOptions.coordinator_ into host and port
+    const std::string &address = PbrtOptions.coordinator;
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        Error("Coordinator address \"%s\" should be of the form host:port.",
+              address.c_str());
+        return false;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+        Error("Unable to resolve coordinator address \"%s\".",
+              address.c_str());
+        return false;
+    }
+    int fd = -1;
+    for (addrinfo *ai = addrs; ai && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (fd == -1) {
+        Error("Unable to connect to coordinator \"%s\": %s", address.c_str(),
+              strerror(errno));
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    bool ok = ServeTiles(fd, nTiles, jobId, renderTile);
+    close(fd);
+    return ok;
+#endif  // PBRT_IS_WINDOWS
+}
+
+void SerializeFilmTile(const FilmTile &tile, std::vector<char> *data) {
+    Bounds2i bounds = tile.GetPixelBounds();
+    int32_t b[4] = {bounds.pMin.x, bounds.pMin.y, bounds.pMax.x,
+                    bounds.pMax.y};
+    const size_t pixelSize = (Spectrum::nSamples + 1) * sizeof(Float);
+    data->resize(sizeof(b) + std::max(0, bounds.Area()) * pixelSize);
+    char *ptr = data->data();
+    memcpy(ptr, b, sizeof(b));
+    ptr += sizeof(b);
+    for (Point2i p : bounds) {
+        const FilmTilePixel &pixel = tile.GetPixel(p);
+        Float values[Spectrum::nSamples + 1];
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            values[c] = pixel.contribSum[c];
+        values[Spectrum::nSamples] = pixel.filterWeightSum;
+        memcpy(ptr, values, pixelSize);
+        ptr += pixelSize;
+    }
+}
+
+bool DeserializeFilmTile(const std::vector<char> &data, FilmTile *tile) {
+    int32_t b[4];
+    if (data.size() < sizeof(b)) return false;
+    memcpy(b, data.data(), sizeof(b));
+    Bounds2i bounds = tile->GetPixelBounds();
+    if (b[0] != bounds.pMin.x || b[1] != bounds.pMin.y ||
+        b[2] != bounds.pMax.x || b[3] != bounds.pMax.y)
+        return false;
+    const size_t pixelSize = (Spectrum::nSamples + 1) * sizeof(Float);
+    if (data.size() != sizeof(b) + std::max(0, bounds.Area()) * pixelSize)
+        return false;
+
+    const char *ptr = data.data() + sizeof(b);
+    for (Point2i p : bounds) {
+        FilmTilePixel &pixel = tile->GetPixel(p);
+        Float values[Spectrum::nSamples + 1];
+        memcpy(values, ptr, pixelSize);
+        ptr += pixelSize;
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            pixel.contribSum[c] = values[c];
+        pixel.filterWeightSum = values[Spectrum::nSamples];
+    }
+    return true;
+}
+
+}  // namespace pbrt
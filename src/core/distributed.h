@@ -0,0 +1,107 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_DISTRIBUTED_H
+#define PBRT_CORE_DISTRIBUTED_H
+
+// core/distributed.h*
+#include "pbrt.h"
+#include <functional>
+#include <vector>
+
+namespace pbrt {
+
+// Distributed Declarations
+
+// Distributed rendering splits an image's tiles across worker processes,
+// possibly running on other machines. The coordinator process listens for
+// connections from workers, each of which has parsed the same scene; it
+// hands out batches of tile indices and merges the tiles that the workers
+// send back. Tiles assigned to a worker whose connection is lost are
+// handed out again to the remaining workers.
+
+// Coordinator setup: starts accepting worker connections on the given TCP
+// port (zero selects an unused one) and returns the port number used.
+// If _loopbackOnly_ is true, only connections from the local machine are
+// accepted.
+int DistributedListen(int port, bool loopbackOnly);
+// Launches _nWorkers_ copies of this executable, each run with the given
+// command-line arguments followed by options that make it connect to
+// the coordinator as a worker.
+void SpawnLocalWorkers(int nWorkers, const std::vector<std::string> &args);
+bool IsDistributedCoordinator();
+bool IsDistributedWorker();
+void DistributedCleanup();
+
+// Tile protocol. _jobId_ identifies the image being rendered (e.g. a hash
+// of its sample bounds and tile size); workers that report a different
+// job id or tile count than the coordinator's are disconnected.
+typedef std::function<void(int tileIndex, const std::vector<char> &data)>
+    TileMergeFunction;
+typedef std::function<void(int tileIndex, std::vector<char> *data)>
+    TileRenderFunction;
+
+// Hands out the tiles in _[0, nTiles)_ to the workers connected via
+// _workerFds_ and any that later connect to _listenFd_ (which may be -1),
+// calling _mergeTile_ exactly once for each tile. If all workers are lost
+// after at least one connected, the remaining tiles are rendered with
+// _renderLocally_ in this process; without it, false is returned instead.
+bool CoordinateTiles(int listenFd, std::vector<int> workerFds, int nTiles,
+                     uint64_t jobId, int tilesPerBatch,
+                     const TileMergeFunction &mergeTile,
+                     const TileRenderFunction &renderLocally = nullptr);
+// Worker side of CoordinateTiles(): renders the tiles the coordinator
+// assigns, in parallel, until told that the job is done. Returns false
+// if the connection was lost first.
+bool ServeTiles(int fd, int nTiles, uint64_t jobId,
+                const TileRenderFunction &renderTile);
+
+// Convenience wrappers around the above for the connections set up by
+// DistributedListen() and the _--worker_ command-line option.
+bool CoordinateTiles(int nTiles, uint64_t jobId,
+                     const TileMergeFunction &mergeTile,
+                     const TileRenderFunction &renderLocally = nullptr);
+bool ServeTiles(int nTiles, uint64_t jobId,
+                const TileRenderFunction &renderTile);
+
+// _FilmTile_ wire format
+void SerializeFilmTile(const FilmTile &tile, std::vector<char> *data);
+bool DeserializeFilmTile(const std::vector<char> &data, FilmTile *tile);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_DISTRIBUTED_H
@@ -38,6 +38,13 @@
 #ifndef PBRT_IS_WINDOWS
 #include <libgen.h>
 #endif
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
 
 namespace pbrt {
 
@@ -126,4 +133,36 @@ void SetSearchDirectory(const std::string &dirname) {
     searchDirectory = dirname;
 }
 
+MappedFile::~MappedFile() {
+#ifdef PBRT_HAVE_MMAP
+    if (ptr) munmap(ptr, length);
+#endif
+}
+
+bool MappedFile::Open(const std::string &filename) {
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    length = st.st_size;
+    void *p = mmap(0, length, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    ptr = p;
+    return true;
+#else
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) contents.append(buf, n);
+    fclose(f);
+    return !contents.empty();
+#endif
+}
+
 }  // namespace pbrt
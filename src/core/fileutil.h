@@ -60,6 +60,39 @@ inline bool HasExtension(const std::string &value, const std::string &ending) {
         [](char a, char b) { return std::tolower(a) == std::tolower(b); });
 }
 
+// MappedFile provides read-only access to the contents of a file, using
+// a memory mapping where available.
+class MappedFile {
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+    bool Open(const std::string &filename);
+    const char *Data() const {
+#ifdef PBRT_HAVE_MMAP
+        return (const char *)ptr;
+#else
+        return contents.data();
+#endif
+    }
+    size_t Size() const {
+#ifdef PBRT_HAVE_MMAP
+        return length;
+#else
+        return contents.size();
+#endif
+    }
+
+  private:
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+#ifdef PBRT_HAVE_MMAP
+    void *ptr = nullptr;
+    size_t length = 0;
+#else
+    std::string contents;
+#endif
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_FILEUTIL_H
@@ -40,15 +40,18 @@
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
+STAT_COUNTER("Film/Splat buffer flushes", nSplatBufferFlushes);
 
 // Film Method Definitions
 Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
            std::unique_ptr<Filter> filt, Float diagonal,
-           const std::string &filename, Float scale, Float maxSampleLuminance)
+           const std::string &filename, Float scale, Float maxSampleLuminance,
+           size_t splatBufferBytes)
     : fullResolution(resolution),
       diagonal(diagonal * .001),
       filter(std::move(filt)),
       filename(filename),
+      splatBufferBytes(splatBufferBytes),
       scale(scale),
       maxSampleLuminance(maxSampleLuminance) {
     // Compute film image bounds
@@ -64,6 +67,21 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
     // Allocate film image storage
     pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
     filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    rowMutexes.reset(new std::mutex[std::max(0, height)]);
+
+    // Allocate per-thread splat buffers, if they can hold at least a block
+    if (splatBufferBytes >= splatBlockBytes) {
+        int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+        splatBlocksX = (width + splatBlockSize - 1) / splatBlockSize;
+        int splatBlocksY = (height + splatBlockSize - 1) / splatBlockSize;
+        for (int i = 0; i < MaxThreadIndex(); ++i) {
+            splatBuffers.push_back(
+                std::unique_ptr<SplatBuffer>(new SplatBuffer));
+            splatBuffers.back()->blocks.resize(
+                std::max(0, splatBlocksX * splatBlocksY));
+        }
+    }
 
     // Precompute filter weight table
     int offset = 0;
@@ -100,9 +118,11 @@ std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds) {
     Point2i p1 = (Point2i)Floor(floatBounds.pMax - halfPixel + filter->radius) +
                  Point2i(1, 1);
     Bounds2i tilePixelBounds = Intersect(Bounds2i(p0, p1), croppedPixelBounds);
-    return std::unique_ptr<FilmTile>(new FilmTile(
-        tilePixelBounds, filter->radius, filterTable, filterTableWidth,
-        maxSampleLuminance));
+    std::unique_ptr<FilmTile> tile(new FilmTile(tilePixelBounds, filter->radius,
+                                                filterTable, filterTableWidth,
+                                                maxSampleLuminance));
+    if (moments) tile->moments.resize(std::max(0, tilePixelBounds.Area()));
+    return tile;
 }
 
 void Film::Clear() {
@@ -112,21 +132,108 @@ void Film::Clear() {
             pixel.splatXYZ[c] = pixel.xyz[c] = 0;
         pixel.filterWeightSum = 0;
     }
+    if (moments)
+        for (int i = 0; i < croppedPixelBounds.Area(); ++i)
+            moments[i] = PixelMoments();
+    for (std::unique_ptr<SplatBuffer> &buffer : splatBuffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        for (std::unique_ptr<Float[]> &block : buffer->blocks) block.reset();
+        buffer->bytes = 0;
+    }
+}
+
+void Film::TrackPixelMoments() {
+    if (!moments) {
+        moments.reset(new PixelMoments[croppedPixelBounds.Area()]);
+        filmPixelMemory += croppedPixelBounds.Area() * sizeof(PixelMoments);
+    }
+}
+
+PixelMoments Film::GetPixelMoments(const Point2i &p) const {
+    if (!moments || !InsideExclusive(p, croppedPixelBounds))
+        return PixelMoments();
+    return moments[PixelOffset(p)];
 }
 
 void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile) {
     ProfilePhase p(Prof::MergeFilmTile);
     VLOG(1) << "Merging film tile " << tile->pixelBounds;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (Point2i pixel : tile->GetPixelBounds()) {
-        // Merge _pixel_ into _Film::pixels_
-        const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
-        Pixel &mergePixel = GetPixel(pixel);
-        Float xyz[3];
-        tilePixel.contribSum.ToXYZ(xyz);
-        for (int i = 0; i < 3; ++i) mergePixel.xyz[i] += xyz[i];
-        mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+    Bounds2i bounds = tile->GetPixelBounds();
+    if (bounds.pMin.x >= bounds.pMax.x || bounds.pMin.y >= bounds.pMax.y)
+        return;
+    bool mergeMoments = moments && !tile->moments.empty();
+    for (int y = bounds.pMin.y; y < bounds.pMax.y; ++y) {
+        // Merge the tile's pixels in row _y_ into _Film::pixels_
+        Point2i rowStart(bounds.pMin.x, y);
+        const FilmTilePixel *tilePixel = &tile->GetPixel(rowStart);
+        Pixel *mergePixel = &GetPixel(rowStart);
+        std::lock_guard<std::mutex> lock(
+            rowMutexes[y - croppedPixelBounds.pMin.y]);
+        for (int x = bounds.pMin.x; x < bounds.pMax.x;
+             ++x, ++tilePixel, ++mergePixel) {
+            Float xyz[3];
+            tilePixel->contribSum.ToXYZ(xyz);
+            for (int i = 0; i < 3; ++i) mergePixel->xyz[i] += xyz[i];
+            mergePixel->filterWeightSum += tilePixel->filterWeightSum;
+        }
+        if (mergeMoments) {
+            PixelMoments *m = &moments[PixelOffset(rowStart)];
+            const PixelMoments *tileMoments =
+                &tile->moments[tile->PixelOffset(rowStart)];
+            for (int x = bounds.pMin.x; x < bounds.pMax.x; ++x)
+                (m++)->Add(*tileMoments++);
+        }
+    }
+}
+
+void Film::SaveAccumulation(std::vector<Float> *data,
+                            std::vector<PixelMoments> *pixelMoments) {
+    flushSplatBuffers();
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    data->resize(nAccumulationValues * croppedPixelBounds.Area());
+    bool saveMoments = moments && pixelMoments;
+    if (pixelMoments)
+        pixelMoments->resize(saveMoments ? croppedPixelBounds.Area() : 0);
+    Float *d = data->data();
+    for (int y = 0; y < height; ++y) {
+        // Take the lock used by _MergeFilmTile()_ for the row, so that no
+        // pixel is partially merged in the copy
+        std::lock_guard<std::mutex> lock(rowMutexes[y]);
+        for (int x = 0; x < width; ++x) {
+            const Pixel &p = pixels[y * width + x];
+            for (int c = 0; c < 3; ++c) *d++ = p.xyz[c];
+            *d++ = p.filterWeightSum;
+            for (int c = 0; c < 3; ++c) *d++ = p.splatXYZ[c];
+        }
+        if (saveMoments)
+            std::copy(&moments[y * width], &moments[(y + 1) * width],
+                      &(*pixelMoments)[y * width]);
+    }
+}
+
+bool Film::LoadAccumulation(const std::vector<Float> &data,
+                            const std::vector<PixelMoments> &pixelMoments) {
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    if (data.size() != size_t(nAccumulationValues * width * height) ||
+        pixelMoments.size() != size_t(moments ? width * height : 0))
+        return false;
+    const Float *d = data.data();
+    for (int y = 0; y < height; ++y) {
+        std::lock_guard<std::mutex> lock(rowMutexes[y]);
+        for (int x = 0; x < width; ++x) {
+            Pixel &p = pixels[y * width + x];
+            for (int c = 0; c < 3; ++c) p.xyz[c] = *d++;
+            p.filterWeightSum = *d++;
+            for (int c = 0; c < 3; ++c) p.splatXYZ[c] = *d++;
+        }
+        if (moments)
+            std::copy(pixelMoments.begin() + y * width,
+                      pixelMoments.begin() + (y + 1) * width,
+                      &moments[y * width]);
     }
+    return true;
 }
 
 void Film::SetImage(const Spectrum *img) const {
@@ -161,11 +268,68 @@ void Film::AddSplat(const Point2f &p, Spectrum v) {
         v *= maxSampleLuminance / v.y();
     Float xyz[3];
     v.ToXYZ(xyz);
-    Pixel &pixel = GetPixel((Point2i)p);
-    for (int i = 0; i < 3; ++i) pixel.splatXYZ[i].Add(xyz[i]);
+    if (splatBuffers.empty()) {
+        Pixel &pixel = GetPixel((Point2i)p);
+        for (int i = 0; i < 3; ++i) pixel.splatXYZ[i].Add(xyz[i]);
+        return;
+    }
+
+    // Add the splat to the calling thread's splat buffer; its mutex is only
+    // contended when the buffers are being flushed
+    SplatBuffer &buffer = *splatBuffers[ThreadIndex % splatBuffers.size()];
+    Vector2i pi = (Point2i)p - croppedPixelBounds.pMin;
+    int blockIndex =
+        pi.y / splatBlockSize * splatBlocksX + pi.x / splatBlockSize;
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    std::unique_ptr<Float[]> &block = buffer.blocks[blockIndex];
+    if (!block) {
+        if (buffer.bytes + splatBlockBytes > splatBufferBytes) {
+            ++nSplatBufferFlushes;
+            flushSplatBuffer(buffer);
+        }
+        block.reset(new Float[3 * splatBlockSize * splatBlockSize]());
+        buffer.bytes += splatBlockBytes;
+    }
+    Float *sum = &block[3 * (pi.y % splatBlockSize * splatBlockSize +
+                             pi.x % splatBlockSize)];
+    for (int i = 0; i < 3; ++i) sum[i] += xyz[i];
+}
+
+void Film::flushSplatBuffer(SplatBuffer &buffer) {
+    // Add the sums in each of _buffer_'s blocks to the film's pixels
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    for (size_t blockIndex = 0; blockIndex < buffer.blocks.size();
+         ++blockIndex) {
+        std::unique_ptr<Float[]> &block = buffer.blocks[blockIndex];
+        if (!block) continue;
+        int x0 = blockIndex % splatBlocksX * splatBlockSize;
+        int y0 = blockIndex / splatBlocksX * splatBlockSize;
+        int x1 = std::min(x0 + splatBlockSize, width);
+        int y1 = std::min(y0 + splatBlockSize, height);
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x) {
+                const Float *sum = &block[3 * ((y - y0) * splatBlockSize +
+                                               (x - x0))];
+                Pixel &pixel = pixels[y * width + x];
+                for (int i = 0; i < 3; ++i)
+                    if (sum[i] != 0) pixel.splatXYZ[i].Add(sum[i]);
+            }
+        block.reset();
+    }
+    buffer.bytes = 0;
+}
+
+void Film::flushSplatBuffers() {
+    for (std::unique_ptr<SplatBuffer> &buffer : splatBuffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        flushSplatBuffer(*buffer);
+    }
 }
 
 void Film::WriteImage(Float splatScale) {
+    flushSplatBuffers();
+
     // Convert image to RGB and compute final pixel values
     LOG(INFO) <<
         "Converting image to RGB and computing final weighted pixel values";
@@ -246,8 +410,32 @@ Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter) {
     Float diagonal = params.FindOneFloat("diagonal", 35.);
     Float maxSampleLuminance = params.FindOneFloat("maxsampleluminance",
                                                    Infinity);
-    return new Film(Point2i(xres, yres), crop, std::move(filter), diagonal,
-                    filename, scale, maxSampleLuminance);
+    // Memory for each thread's splat buffer, in MB; zero, the default,
+    // disables them. Light tracing and MLT splat all over the image, so
+    // buffers only pay off if they're large enough to cover most of it.
+    Float splatBufferMB = params.FindOneFloat("splatbuffermb", 0);
+    Film *film = new Film(
+        Point2i(xres, yres), crop, std::move(filter), diagonal, filename,
+        scale, maxSampleLuminance,
+        size_t(std::max(Float(0), splatBufferMB) * 1024 * 1024));
+
+    // Get the film's tile size and order, which the command line overrides
+    film->tileSize = PbrtOptions.tileSize > 0
+                         ? PbrtOptions.tileSize
+                         : std::max(0, params.FindOneInt("tilesize", 0));
+    std::string tileOrder = PbrtOptions.tileOrder.empty()
+                                ? params.FindOneString("tileorder", "hilbert")
+                                : PbrtOptions.tileOrder;
+    if (tileOrder == "scanline")
+        film->tileOrder = TileOrder::Scanline;
+    else if (tileOrder == "hilbert")
+        film->tileOrder = TileOrder::Hilbert;
+    else if (tileOrder == "spiral")
+        film->tileOrder = TileOrder::Spiral;
+    else
+        Error("%s: unknown tile order. Using \"hilbert\".",
+              tileOrder.c_str());
+    return film;
 }
 
 }  // namespace pbrt
@@ -54,6 +54,34 @@ struct FilmTilePixel {
     Float filterWeightSum = 0.f;
 };
 
+// PixelMoments Declarations
+struct PixelMoments {
+    void Add(Float y) {
+        ++n;
+        sum += y;
+        sumSq += (double)y * y;
+    }
+    void Add(const PixelMoments &m) {
+        n += m.n;
+        sum += m.sum;
+        sumSq += m.sumSq;
+    }
+    // Returns the estimated standard error of the pixel's mean luminance,
+    // relative to the mean
+    Float RelativeError() const {
+        if (n < 2) return Infinity;
+        double mean = sum / n;
+        double variance = std::max(0., (sumSq - sum * mean) / (n - 1));
+        return std::sqrt(variance / n) / std::max(mean, 1e-3);
+    }
+    int64_t n = 0;
+    double sum = 0, sumSq = 0;
+};
+
+// Orders in which the image's tiles can be rendered: by rows, along a
+// Hilbert curve, or in a spiral out from the center of the image
+enum class TileOrder { Scanline, Hilbert, Spiral };
+
 // Film Declarations
 class Film {
   public:
@@ -61,15 +89,34 @@ class Film {
     Film(const Point2i &resolution, const Bounds2f &cropWindow,
          std::unique_ptr<Filter> filter, Float diagonal,
          const std::string &filename, Float scale,
-         Float maxSampleLuminance = Infinity);
+         Float maxSampleLuminance = Infinity, size_t splatBufferBytes = 0);
     Bounds2i GetSampleBounds() const;
     Bounds2f GetPhysicalExtent() const;
     std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds);
     void MergeFilmTile(std::unique_ptr<FilmTile> tile);
     void SetImage(const Spectrum *img) const;
+    // Adds _v_ to the pixel containing _p_; if the film has splat
+    // buffers, it's accumulated in the calling thread's buffer until the
+    // buffers are flushed.
     void AddSplat(const Point2f &p, Spectrum v);
     void WriteImage(Float splatScale = 1);
     void Clear();
+    // Starts accumulating the moments of the luminance of the samples taken
+    // in each pixel, for adaptive sampling; they are recorded by the
+    // _FilmTile_s returned afterward.
+    void TrackPixelMoments();
+    PixelMoments GetPixelMoments(const Point2i &p) const;
+    // Copies the accumulated values of all of the pixels to _data_ and
+    // restores them from it, for checkpointing renders; each pixel is
+    // stored as _nAccumulationValues_ values. If the film tracks pixel
+    // moments, they're copied to _moments_ too, if it's given; otherwise
+    // it's left empty. Tiles merged concurrently may be partially
+    // included.
+    void SaveAccumulation(std::vector<Float> *data,
+                          std::vector<PixelMoments> *moments = nullptr);
+    bool LoadAccumulation(const std::vector<Float> &data,
+                          const std::vector<PixelMoments> &moments);
+    static const int nAccumulationValues = 7;
 
     // Film Public Data
     const Point2i fullResolution;
@@ -77,6 +124,11 @@ class Film {
     std::unique_ptr<Filter> filter;
     const std::string filename;
     Bounds2i croppedPixelBounds;
+    // Size of the square tiles that the image is rendered in (zero to
+    // choose one based on the image size and the number of threads) and
+    // the order in which they are rendered
+    int tileSize = 0;
+    TileOrder tileOrder = TileOrder::Hilbert;
 
   private:
     // Film Private Data
@@ -88,19 +140,43 @@ class Film {
         Float pad;
     };
     std::unique_ptr<Pixel[]> pixels;
+    std::unique_ptr<PixelMoments[]> moments;
+    // Each thread's splats are summed in its own _SplatBuffer_ so that
+    // threads don't contend for the cache lines of _Pixel::splatXYZ_. A
+    // buffer holds the sums for the blocks of _splatBlockSize_^2 pixels
+    // that the thread has splatted to, allocated as needed; once they'd
+    // take more than _splatBufferBytes_, the buffer is added to the
+    // pixels and emptied. Buffers are also flushed before the image is
+    // written. Blocks are small, since a scattered splat that starts a
+    // new block has to zero it and later flush it.
+    struct SplatBuffer {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Float[]>> blocks;
+        size_t bytes = 0;
+    };
+    static PBRT_CONSTEXPR int splatBlockSize = 8;
+    static PBRT_CONSTEXPR size_t splatBlockBytes =
+        3 * sizeof(Float) * splatBlockSize * splatBlockSize;
+    const size_t splatBufferBytes;
+    std::vector<std::unique_ptr<SplatBuffer>> splatBuffers;
+    int splatBlocksX = 0;
     static PBRT_CONSTEXPR int filterTableWidth = 16;
     Float filterTable[filterTableWidth * filterTableWidth];
-    std::mutex mutex;
+    // Merging a tile locks each of the rows it adds to in turn, so that
+    // merges of tiles with disjoint rows never contend
+    std::unique_ptr<std::mutex[]> rowMutexes;
     const Float scale;
     const Float maxSampleLuminance;
 
     // Film Private Methods
-    Pixel &GetPixel(const Point2i &p) {
+    void flushSplatBuffer(SplatBuffer &buffer);
+    void flushSplatBuffers();
+    Pixel &GetPixel(const Point2i &p) { return pixels[PixelOffset(p)]; }
+    int PixelOffset(const Point2i &p) const {
         CHECK(InsideExclusive(p, croppedPixelBounds));
         int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
-        int offset = (p.x - croppedPixelBounds.pMin.x) +
-                     (p.y - croppedPixelBounds.pMin.y) * width;
-        return pixels[offset];
+        return (p.x - croppedPixelBounds.pMin.x) +
+               (p.y - croppedPixelBounds.pMin.y) * width;
     }
 };
 
@@ -158,6 +234,14 @@ class FilmTile {
                 pixel.filterWeightSum += filterWeight;
             }
         }
+
+        // Record sample's luminance in the moments of the pixel it was taken
+        // for
+        if (!moments.empty()) {
+            Point2i pPixel = (Point2i)Floor(pFilm);
+            if (InsideExclusive(pPixel, pixelBounds))
+                moments[PixelOffset(pPixel)].Add(L.y() * sampleWeight);
+        }
     }
     FilmTilePixel &GetPixel(const Point2i &p) {
         CHECK(InsideExclusive(p, pixelBounds));
@@ -174,14 +258,28 @@ class FilmTile {
         return pixels[offset];
     }
     Bounds2i GetPixelBounds() const { return pixelBounds; }
+    // Returns the moments of the luminance of the samples taken for pixel
+    // _p_ in this tile, if the film is tracking them
+    PixelMoments GetPixelMoments(const Point2i &p) const {
+        if (moments.empty() || !InsideExclusive(p, pixelBounds))
+            return PixelMoments();
+        return moments[PixelOffset(p)];
+    }
 
   private:
+    // FilmTile Private Methods
+    int PixelOffset(const Point2i &p) const {
+        int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+        return (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * width;
+    }
+
     // FilmTile Private Data
     const Bounds2i pixelBounds;
     const Vector2f filterRadius, invFilterRadius;
     const Float *filterTable;
     const int filterTableSize;
     std::vector<FilmTilePixel> pixels;
+    std::vector<PixelMoments> moments;
     const Float maxSampleLuminance;
     friend class Film;
 };
@@ -925,6 +925,43 @@ class RayDifferential : public Ray {
     Vector3f rxDirection, ryDirection;
 };
 
+// RayBatch stores a set of rays in structure-of-arrays layout, so that
+// the same component of several rays can be loaded at once.
+class RayBatch {
+  public:
+    // RayBatch Public Methods
+    int Size() const { return tMax.size(); }
+    void Clear() {
+        for (int a = 0; a < 3; ++a) {
+            o[a].clear();
+            d[a].clear();
+        }
+        tMax.clear();
+        time.clear();
+        medium.clear();
+    }
+    void Add(const Ray &ray) {
+        for (int a = 0; a < 3; ++a) {
+            o[a].push_back(ray.o[a]);
+            d[a].push_back(ray.d[a]);
+        }
+        tMax.push_back(ray.tMax);
+        time.push_back(ray.time);
+        medium.push_back(ray.medium);
+    }
+    Ray GetRay(int i) const {
+        return Ray(Point3f(o[0][i], o[1][i], o[2][i]),
+                   Vector3f(d[0][i], d[1][i], d[2][i]), tMax[i], time[i],
+                   medium[i]);
+    }
+
+    // RayBatch Public Data
+    std::vector<Float> o[3], d[3];
+    mutable std::vector<Float> tMax;
+    std::vector<Float> time;
+    std::vector<const Medium *> medium;
+};
+
 // Geometry Inline Functions
 template <typename T>
 inline Vector3<T>::Vector3(const Point3<T> &p)
@@ -42,10 +42,15 @@
 #include "progressreporter.h"
 #include "camera.h"
 #include "stats.h"
+#include "distributed.h"
+#include "checkpoint.h"
+#include <chrono>
 
 namespace pbrt {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_COUNTER("Integrator/Samples saved by adaptive sampling",
+             nAdaptiveSamplesSaved);
 
 // Integrator Method Definitions
 Integrator::~Integrator() {}
@@ -224,6 +229,73 @@ std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
         new Distribution1D(&lightPower[0], lightPower.size()));
 }
 
+// SamplerIntegrator Local Definitions
+
+// Returns the tile size to use if the film doesn't specify one: the
+// largest power of two from 8 to 32 that gives each thread at least 16
+// tiles, so that the load stays balanced. Distributed and checkpointed
+// renders must split the image the same way whatever the number of
+// threads, so they use 16.
+static int DefaultTileSize(const Vector2i &sampleExtent) {
+    if (IsDistributedWorker() || IsDistributedCoordinator() ||
+        !PbrtOptions.checkpointFile.empty())
+        return 16;
+    int tileSize = 32;
+    while (tileSize > 8 &&
+           int64_t((sampleExtent.x + tileSize - 1) / tileSize) *
+                   ((sampleExtent.y + tileSize - 1) / tileSize) <
+               16 * MaxThreadIndex())
+        tileSize /= 2;
+    return tileSize;
+}
+
+// Returns the tiles of a grid of _nTiles_ tiles in the given order.
+static std::vector<Point2i> OrderTiles(const Point2i &nTiles,
+                                       TileOrder order) {
+    std::vector<Point2i> tiles;
+    tiles.reserve(nTiles.x * nTiles.y);
+    auto inside = [&](const Point2i &t) {
+        return t.x >= 0 && t.x < nTiles.x && t.y >= 0 && t.y < nTiles.y;
+    };
+    if (order == TileOrder::Hilbert) {
+        // Follow the Hilbert curve over the smallest power-of-two sized
+        // grid that covers the tiles, skipping the positions outside them
+        int n = 1;
+        while (n < std::max(nTiles.x, nTiles.y)) n *= 2;
+        for (int64_t d = 0; d < int64_t(n) * n; ++d) {
+            // Compute the position _t_ of point _d_ along the curve
+            Point2i t(0, 0);
+            int64_t rem = d;
+            for (int s = 1; s < n; s *= 2) {
+                int rx = 1 & (rem / 2), ry = 1 & (rem ^ rx);
+                if (ry == 0) {
+                    if (rx == 1) t = Point2i(s - 1 - t.x, s - 1 - t.y);
+                    std::swap(t.x, t.y);
+                }
+                t += Vector2i(s * rx, s * ry);
+                rem /= 4;
+            }
+            if (inside(t)) tiles.push_back(t);
+        }
+    } else if (order == TileOrder::Spiral) {
+        // Walk a square spiral out from the center tile, taking runs of 1,
+        // 1, 2, 2, 3, 3, ... steps and turning after each run
+        Point2i t(nTiles.x / 2, nTiles.y / 2);
+        const Vector2i directions[4] = {Vector2i(1, 0), Vector2i(0, 1),
+                                        Vector2i(-1, 0), Vector2i(0, -1)};
+        tiles.push_back(t);
+        for (int run = 0; tiles.size() < size_t(nTiles.x * nTiles.y); ++run)
+            for (int step = 0; step < run / 2 + 1; ++step) {
+                t += directions[run % 4];
+                if (inside(t)) tiles.push_back(t);
+            }
+    } else {
+        for (int y = 0; y < nTiles.y; ++y)
+            for (int x = 0; x < nTiles.x; ++x) tiles.push_back(Point2i(x, y));
+    }
+    return tiles;
+}
+
 // SamplerIntegrator Method Definitions
 void SamplerIntegrator::Render(const Scene &scene) {
     Preprocess(scene, *sampler);
@@ -231,111 +303,484 @@ void SamplerIntegrator::Render(const Scene &scene) {
 
     // Compute number of tiles, _nTiles_, to use for parallel rendering
     Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    if (PbrtOptions.adaptiveThreshold > 0) camera->film->TrackPixelMoments();
     Vector2i sampleExtent = sampleBounds.Diagonal();
-    const int tileSize = 16;
+    const int tileSize = camera->film->tileSize > 0
+                             ? camera->film->tileSize
+                             : DefaultTileSize(sampleExtent);
     Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
                    (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
-    {
-        ParallelFor2D([&](Point2i tile) {
-            // Render section of image corresponding to _tile_
-
-            // Allocate _MemoryArena_ for tile
-            MemoryArena arena;
-
-            // Get sampler instance for tile
-            int seed = tile.y * nTiles.x + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-
-            // Compute sample bounds for tile
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
-            LOG(INFO) << "Starting image tile " << tileBounds;
-
-            // Get _FilmTile_ for tile
+    int nTileCount = nTiles.x * nTiles.y;
+    auto tileFromIndex = [&](int index) {
+        return Point2i(index % nTiles.x, index / nTiles.x);
+    };
+
+    // Identify the image's tiles, so that distributed rendering workers
+    // and checkpoints for other images aren't used
+    uint64_t imageId = 14695981039346656037ull;
+    for (int v : {sampleBounds.pMin.x, sampleBounds.pMin.y,
+                  sampleBounds.pMax.x, sampleBounds.pMax.y, tileSize,
+                  (int)sampler->samplesPerPixel})
+        imageId = (imageId ^ (uint32_t)v) * 1099511628211ull;
+
+    std::unique_ptr<RenderCheckpoint> checkpoint;
+    if (IsDistributedWorker() || IsDistributedCoordinator()) {
+        // The coordinator also detects workers that are rendering a
+        // different image from the same scene file
+        static int renderCount = 0;
+        uint64_t jobId =
+            (imageId ^ (uint32_t)++renderCount) * 1099511628211ull;
+
+        auto renderTile = [&](int index, std::vector<char> *data) {
             std::unique_ptr<FilmTile> filmTile =
-                camera->film->GetFilmTile(tileBounds);
-
-            // Loop over pixels in tile to render them
-            for (Point2i pixel : tileBounds) {
-                {
-                    ProfilePhase pp(Prof::StartPixel);
-                    tileSampler->StartPixel(pixel);
-                }
-
-                // Do this check after the StartPixel() call; this keeps
-                // the usage of RNG values from (most) Samplers that use
-                // RNGs consistent, which improves reproducability /
-                // debugging.
-                if (!InsideExclusive(pixel, pixelBounds))
-                    continue;
-
-                do {
-                    // Initialize _CameraSample_ for current sample
-                    CameraSample cameraSample =
-                        tileSampler->GetCameraSample(pixel);
-
-                    // Generate camera ray for current sample
-                    RayDifferential ray;
-                    Float rayWeight =
-                        camera->GenerateRayDifferential(cameraSample, &ray);
-                    ray.ScaleDifferentials(
-                        1 / std::sqrt((Float)tileSampler->samplesPerPixel));
-                    ++nCameraRays;
-
-                    // Evaluate radiance along camera ray
-                    Spectrum L(0.f);
-                    if (rayWeight > 0) L = Li(ray, scene, *tileSampler, arena);
-
-                    // Issue warning if unexpected radiance value returned
-                    if (L.HasNaNs()) {
-                        LOG(ERROR) << StringPrintf(
-                            "Not-a-number radiance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (L.y() < -1e-5) {
-                        LOG(ERROR) << StringPrintf(
-                            "Negative luminance value, %f, returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            L.y(), pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (std::isinf(L.y())) {
-                          LOG(ERROR) << StringPrintf(
-                            "Infinite luminance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    }
-                    VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
-                        ray << " -> L = " << L;
-
-                    // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
-
-                    // Free _MemoryArena_ memory from computing image sample
-                    // value
-                    arena.Reset();
-                } while (tileSampler->StartNextSample());
-            }
-            LOG(INFO) << "Finished image tile " << tileBounds;
+                RenderTile(scene, tileFromIndex(index), nTiles, tileSize,
+                           sampleBounds, 0, sampler->samplesPerPixel);
+            SerializeFilmTile(*filmTile, data);
+        };
+        if (IsDistributedWorker()) {
+            // Render the tiles assigned by the coordinator and send them back
+            LOG(INFO) << "Rendering tiles for coordinator " <<
+                PbrtOptions.coordinator;
+            if (!ServeTiles(nTileCount, jobId, renderTile))
+                Error("Lost connection to coordinator \"%s\" before the "
+                      "image was finished.", PbrtOptions.coordinator.c_str());
+            LOG(INFO) << "Rendering finished";
+            return;
+        }
 
-            // Merge image tile into _Film_
-            camera->film->MergeFilmTile(std::move(filmTile));
+        // Have workers render the tiles and merge them into the film; if
+        // they're all lost, the tiles they didn't finish are rendered here
+        ProgressReporter reporter(nTileCount, "Rendering");
+        auto mergeTile = [&](int index, const std::vector<char> &data) {
+            std::unique_ptr<FilmTile> filmTile = camera->film->GetFilmTile(
+                TileBounds(tileFromIndex(index), tileSize, sampleBounds));
+            if (!DeserializeFilmTile(data, filmTile.get()))
+                Error("Received malformed tile %d from worker.", index);
+            else
+                camera->film->MergeFilmTile(std::move(filmTile));
             reporter.Update();
-        }, nTiles);
+        };
+        bool finished =
+            CoordinateTiles(nTileCount, jobId, mergeTile, renderTile);
         reporter.Done();
+        if (!finished) return;
+    } else {
+        if (!PbrtOptions.checkpointFile.empty()) {
+            // Checkpoints are identified by the image's tiles, its
+            // filename, which usually differs between the images rendered
+            // for a scene file, and the adaptive sampling settings, which
+            // determine which samples are taken
+            uint64_t checkpointId = imageId;
+            for (char c : camera->film->filename)
+                checkpointId = (checkpointId ^ (uint8_t)c) * 1099511628211ull;
+            for (uint32_t v :
+                 {FloatToBits(float(PbrtOptions.adaptiveThreshold)),
+                  (uint32_t)PbrtOptions.adaptiveMinSamples})
+                checkpointId = (checkpointId ^ v) * 1099511628211ull;
+            checkpoint.reset(new RenderCheckpoint(
+                PbrtOptions.checkpointFile, camera->film, nTileCount,
+                checkpointId, PbrtOptions.checkpointSeconds,
+                PbrtOptions.resume));
+        }
+
+        // Render samples [_firstSample_, _endSample_) of _tile_, apart from
+        // those that a resumed checkpoint already has, and merge them into
+        // _Film_
+        auto renderTile = [&](const Point2i &tile, int64_t firstSample,
+                              int64_t endSample) {
+            int tileIndex = tile.y * nTiles.x + tile.x;
+            if (checkpoint)
+                firstSample =
+                    std::max(firstSample, checkpoint->TileSamples(tileIndex));
+            if (firstSample >= endSample) return;
+            std::unique_ptr<FilmTile> filmTile =
+                RenderTile(scene, tile, nTiles, tileSize, sampleBounds,
+                           firstSample, endSample);
+            if (checkpoint)
+                checkpoint->MergeTile(tileIndex, std::move(filmTile),
+                                      endSample);
+            else
+                camera->film->MergeFilmTile(std::move(filmTile));
+        };
+
+        // Hand out the tiles in the film's tile order, so that the tiles
+        // being rendered at the same time are near each other and share
+        // more of the geometry and textures they access
+        std::vector<Point2i> tiles =
+            OrderTiles(nTiles, camera->film->tileOrder);
+        if (PbrtOptions.progressive)
+            RenderProgressive(tiles, renderTile);
+        else {
+            ProgressReporter reporter(nTileCount, "Rendering");
+            ParallelFor([&](int64_t i) {
+                renderTile(tiles[i], 0, sampler->samplesPerPixel);
+                reporter.Update();
+            }, nTileCount);
+            reporter.Done();
+        }
     }
     LOG(INFO) << "Rendering finished";
 
     // Save final image after rendering
     camera->film->WriteImage();
+
+    // Remove the checkpoint once the image is complete; that of a render
+    // that ran out of time is updated so that it can be resumed later
+    if (checkpoint) {
+        bool complete = true;
+        for (int i = 0; i < nTileCount; ++i)
+            if (checkpoint->TileSamples(i) < sampler->samplesPerPixel)
+                complete = false;
+        if (complete)
+            checkpoint->Finish();
+        else
+            checkpoint->Write();
+    }
+}
+
+void SamplerIntegrator::RenderProgressive(
+    const std::vector<Point2i> &tiles,
+    const std::function<void(const Point2i &, int64_t, int64_t)>
+        &renderTile) {
+    auto startTime = std::chrono::steady_clock::now();
+    auto elapsedSeconds = [&]() {
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - startTime;
+        return elapsed.count();
+    };
+    auto outOfTime = [&]() {
+        return PbrtOptions.timeBudget > 0 &&
+               elapsedSeconds() >= PbrtOptions.timeBudget;
+    };
+
+    // Render passes over all of the tiles; after the first, each one takes
+    // as many samples in every pixel as all of the earlier passes did
+    int64_t samplesPerPixel = sampler->samplesPerPixel;
+    double lastSnapshotTime = 0;
+    int64_t firstSample = 0;
+    for (int pass = 0; firstSample < samplesPerPixel && !outOfTime();
+         ++pass) {
+        int64_t endSample =
+            std::min(samplesPerPixel, std::max<int64_t>(1, 2 * firstSample));
+        LOG(INFO) << "Starting progressive pass " << pass << ", samples " <<
+            firstSample << " to " << endSample;
+        ProgressReporter reporter(
+            tiles.size(),
+            StringPrintf("Rendering pass %d (%d/%d spp)", pass + 1,
+                         (int)endSample, (int)samplesPerPixel));
+        ParallelFor([&](int64_t i) {
+            // Skip the tiles that haven't been started once the time budget
+            // is used up; pixel values are normalized by their filter
+            // weights, so pixels with fewer samples are still correct.
+            if (!outOfTime())
+                renderTile(tiles[i], firstSample, endSample);
+            reporter.Update();
+        }, tiles.size());
+        reporter.Done();
+        firstSample = endSample;
+
+        // Write a snapshot of the image if one is due; the final image is
+        // written by _Render()_
+        if (firstSample == samplesPerPixel || outOfTime() ||
+            pass + 1 == PbrtOptions.maxPasses)
+            break;
+        bool snapshotDue =
+            (PbrtOptions.snapshotPasses > 0 &&
+             (pass + 1) % PbrtOptions.snapshotPasses == 0) ||
+            (PbrtOptions.snapshotSeconds > 0 &&
+             elapsedSeconds() - lastSnapshotTime >=
+                 PbrtOptions.snapshotSeconds);
+        if (snapshotDue) {
+            LOG(INFO) << "Writing snapshot after " << firstSample <<
+                " samples per pixel";
+            camera->film->WriteImage();
+            lastSnapshotTime = elapsedSeconds();
+        }
+    }
+    if (firstSample < samplesPerPixel && outOfTime())
+        Warning("Time budget of %f seconds used up after %d of %d samples "
+                "per pixel.", PbrtOptions.timeBudget, (int)firstSample,
+                (int)samplesPerPixel);
+    else if (firstSample < samplesPerPixel)
+        LOG(INFO) << "Stopping after " << PbrtOptions.maxPasses <<
+            " passes with " << firstSample << " of " << samplesPerPixel <<
+            " samples per pixel";
+}
+
+Bounds2i SamplerIntegrator::TileBounds(const Point2i &tile, int tileSize,
+                                       const Bounds2i &sampleBounds) {
+    // Compute sample bounds for tile
+    int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+    int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+    int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+    int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+    return Bounds2i(Point2i(x0, y0), Point2i(x1, y1));
+}
+
+// Returns whether adaptive sampling is done with a pixel whose samples
+// have luminance moments _prior_ from earlier passes and _current_ from
+// this one: it must have taken a multiple of the minimum number of samples
+// and have a low enough error.
+static bool AdaptiveConverged(const PixelMoments &prior,
+                              const PixelMoments &current) {
+    PixelMoments m = prior;
+    m.Add(current);
+    return m.n > 0 && m.n % PbrtOptions.adaptiveMinSamples == 0 &&
+           m.RelativeError() <= PbrtOptions.adaptiveThreshold;
+}
+
+// Replaces radiance values that would corrupt the image with black,
+// logging an error for each.
+static Spectrum CheckRadiance(const Spectrum &L, const Point2i &pixel,
+                              int64_t sampleNumber) {
+    if (L.HasNaNs()) {
+        LOG(ERROR) << StringPrintf(
+            "Not-a-number radiance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNumber);
+        return Spectrum(0.f);
+    } else if (L.y() < -1e-5) {
+        LOG(ERROR) << StringPrintf(
+            "Negative luminance value, %f, returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            L.y(), pixel.x, pixel.y, (int)sampleNumber);
+        return Spectrum(0.f);
+    } else if (std::isinf(L.y())) {
+        LOG(ERROR) << StringPrintf(
+            "Infinite luminance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNumber);
+        return Spectrum(0.f);
+    }
+    return L;
+}
+
+std::unique_ptr<FilmTile> SamplerIntegrator::RenderTile(
+    const Scene &scene, const Point2i &tile, const Point2i &nTiles,
+    int tileSize, const Bounds2i &sampleBounds, int64_t firstSample,
+    int64_t endSample) const {
+    if (BatchCameraRays())
+        return RenderTileBatched(scene, tile, nTiles, tileSize, sampleBounds,
+                                 firstSample, endSample);
+
+    // Allocate _MemoryArena_ for tile
+    MemoryArena arena;
+
+    // Get sampler instance for tile; its seed doesn't depend on the pass,
+    // so that a progressive render's passes take the same samples as a
+    // single-pass render would
+    int seed = tile.y * nTiles.x + tile.x;
+    std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+
+    Bounds2i tileBounds = TileBounds(tile, tileSize, sampleBounds);
+    LOG(INFO) << "Starting image tile " << tileBounds;
+
+    // Get _FilmTile_ for tile
+    std::unique_ptr<FilmTile> filmTile = camera->film->GetFilmTile(tileBounds);
+    bool adaptive = PbrtOptions.adaptiveThreshold > 0;
+
+    // Loop over pixels in tile to render them
+    for (Point2i pixel : tileBounds) {
+        {
+            ProfilePhase pp(Prof::StartPixel);
+            tileSampler->StartPixel(pixel);
+        }
+
+        // Do this check after the StartPixel() call; this keeps
+        // the usage of RNG values from (most) Samplers that use
+        // RNGs consistent, which improves reproducability /
+        // debugging.
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+        PixelMoments prior;
+        if (adaptive) {
+            prior = camera->film->GetPixelMoments(pixel);
+            if (AdaptiveConverged(prior, PixelMoments())) {
+                nAdaptiveSamplesSaved += endSample - firstSample;
+                continue;
+            }
+        }
+        if (firstSample > 0) tileSampler->SetSampleNumber(firstSample);
+
+        do {
+            // Initialize _CameraSample_ for current sample
+            CameraSample cameraSample = tileSampler->GetCameraSample(pixel);
+
+            // Generate camera ray for current sample
+            RayDifferential ray;
+            Float rayWeight =
+                camera->GenerateRayDifferential(cameraSample, &ray);
+            ray.ScaleDifferentials(
+                1 / std::sqrt((Float)tileSampler->samplesPerPixel));
+            ++nCameraRays;
+
+            // Evaluate radiance along camera ray
+            Spectrum L(0.f);
+            if (rayWeight > 0) L = Li(ray, scene, *tileSampler, arena);
+
+            // Issue warning if unexpected radiance value returned
+            L = CheckRadiance(L, pixel, tileSampler->CurrentSampleNumber());
+            VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
+                ray << " -> L = " << L;
+
+            // Add camera ray's contribution to image
+            filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
+
+            // Free _MemoryArena_ memory from computing image sample
+            // value
+            arena.Reset();
+
+            // Stop sampling the pixel once adaptive sampling is done with it
+            if (adaptive &&
+                AdaptiveConverged(prior, filmTile->GetPixelMoments(pixel))) {
+                nAdaptiveSamplesSaved +=
+                    endSample - tileSampler->CurrentSampleNumber() - 1;
+                break;
+            }
+        } while (tileSampler->StartNextSample() &&
+                 tileSampler->CurrentSampleNumber() < endSample);
+    }
+    LOG(INFO) << "Finished image tile " << tileBounds;
+    return filmTile;
+}
+
+std::unique_ptr<FilmTile> SamplerIntegrator::RenderTileBatched(
+    const Scene &scene, const Point2i &tile, const Point2i &nTiles,
+    int tileSize, const Bounds2i &sampleBounds, int64_t firstSample,
+    int64_t endSample) const {
+    MemoryArena arena;
+    Bounds2i tileBounds = TileBounds(tile, tileSize, sampleBounds);
+    LOG(INFO) << "Starting image tile " << tileBounds << " (batched)";
+    std::unique_ptr<FilmTile> filmTile = camera->film->GetFilmTile(tileBounds);
+    bool adaptive = PbrtOptions.adaptiveThreshold > 0;
+
+    // Find the pixels in the tile that need samples
+    std::vector<Point2i> pixels;
+    std::vector<PixelMoments> priorMoments;
+    for (Point2i pixel : tileBounds) {
+        if (!InsideExclusive(pixel, pixelBounds)) continue;
+        PixelMoments prior;
+        if (adaptive) {
+            prior = camera->film->GetPixelMoments(pixel);
+            if (AdaptiveConverged(prior, PixelMoments())) {
+                nAdaptiveSamplesSaved += endSample - firstSample;
+                continue;
+            }
+        }
+        pixels.push_back(pixel);
+        priorMoments.push_back(prior);
+    }
+
+    // Render the pixels in batches of up to _maxBatchPixels_, tracing the
+    // camera rays for one sample of every pixel in the batch together.
+    // Each pixel of a batch needs a sampler of its own; these are cloned
+    // with the same seed as _RenderTile()_'s sampler and reused for later
+    // batches. A sampler's samples only depend on its seed, the pixel, and
+    // the sample number, so the image matches _RenderTile()_'s.
+    const int maxBatchPixels = 64;
+    int seed = tile.y * nTiles.x + tile.x;
+    std::vector<std::unique_ptr<Sampler>> pixelSamplers;
+    std::vector<int> active;
+    std::vector<RayDifferential> cameraRays;
+    std::vector<CameraSample> cameraSamples(maxBatchPixels);
+    std::vector<Float> rayWeights;
+    std::vector<Sampler *> samplers;
+    Spectrum L[maxBatchPixels];
+    for (size_t batchStart = 0; batchStart < pixels.size();
+         batchStart += maxBatchPixels) {
+        // Start sampling each pixel in the batch
+        int nPixels =
+            std::min<size_t>(maxBatchPixels, pixels.size() - batchStart);
+        active.resize(nPixels);
+        for (int i = 0; i < nPixels; ++i) {
+            if (i == (int)pixelSamplers.size())
+                pixelSamplers.push_back(sampler->Clone(seed));
+            {
+                ProfilePhase pp(Prof::StartPixel);
+                pixelSamplers[i]->StartPixel(pixels[batchStart + i]);
+            }
+            if (firstSample > 0) pixelSamplers[i]->SetSampleNumber(firstSample);
+            active[i] = i;
+        }
+
+        // Take samples in all of the pixels in _active_ until they're done
+        while (!active.empty()) {
+            // Generate camera rays for the current sample of each active
+            // pixel
+            int nActive = active.size();
+            cameraRays.resize(nActive);
+            rayWeights.resize(nActive);
+            samplers.resize(nActive);
+            for (int j = 0; j < nActive; ++j) {
+                int i = active[j];
+                samplers[j] = pixelSamplers[i].get();
+                cameraSamples[j] =
+                    samplers[j]->GetCameraSample(pixels[batchStart + i]);
+                rayWeights[j] = camera->GenerateRayDifferential(
+                    cameraSamples[j], &cameraRays[j]);
+                cameraRays[j].ScaleDifferentials(
+                    1 / std::sqrt((Float)samplers[j]->samplesPerPixel));
+                L[j] = Spectrum(0.f);
+            }
+            nCameraRays += nActive;
+
+            // Evaluate radiance along the camera rays and add their
+            // contributions to the image
+            BatchLi(cameraRays, rayWeights, samplers, scene, arena, L);
+            int nStillActive = 0;
+            for (int j = 0; j < nActive; ++j) {
+                int i = active[j];
+                const Point2i &pixel = pixels[batchStart + i];
+                Spectrum Li = CheckRadiance(L[j], pixel,
+                                            samplers[j]->CurrentSampleNumber());
+                filmTile->AddSample(cameraSamples[j].pFilm, Li,
+                                    rayWeights[j]);
+                if (adaptive &&
+                    AdaptiveConverged(priorMoments[batchStart + i],
+                                      filmTile->GetPixelMoments(pixel))) {
+                    nAdaptiveSamplesSaved +=
+                        endSample - samplers[j]->CurrentSampleNumber() - 1;
+                    continue;
+                }
+                if (samplers[j]->StartNextSample() &&
+                    samplers[j]->CurrentSampleNumber() < endSample)
+                    active[nStillActive++] = i;
+            }
+            active.resize(nStillActive);
+            arena.Reset();
+        }
+    }
+    LOG(INFO) << "Finished image tile " << tileBounds;
+    return filmTile;
+}
+
+void SamplerIntegrator::BatchLi(const std::vector<RayDifferential> &rays,
+                                const std::vector<Float> &rayWeights,
+                                const std::vector<Sampler *> &samplers,
+                                const Scene &scene, MemoryArena &arena,
+                                Spectrum *L) const {
+    // Find the first intersections of the camera rays together
+    RayBatch batch;
+    std::vector<int> rayIndices;
+    for (size_t i = 0; i < rays.size(); ++i)
+        if (rayWeights[i] > 0) {
+            batch.Add(rays[i]);
+            rayIndices.push_back(i);
+        }
+    std::unique_ptr<SurfaceInteraction[]> isects(
+        new SurfaceInteraction[batch.Size()]);
+    std::unique_ptr<bool[]> hits(new bool[batch.Size()]);
+    scene.IntersectBatch(batch, isects.get(), hits.get());
+
+    // Evaluate radiance along each ray from its intersection
+    for (int j = 0; j < batch.Size(); ++j) {
+        int i = rayIndices[j];
+        RayDifferential ray = rays[i];
+        ray.tMax = batch.tMax[j];
+        L[i] = LiFromIntersection(ray, hits[j], isects[j], scene, *samplers[i],
+                                  arena);
+        arena.Reset();
+    }
 }
 
 Spectrum SamplerIntegrator::SpecularReflect(
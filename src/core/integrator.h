@@ -46,6 +46,7 @@
 #include "reflection.h"
 #include "sampler.h"
 #include "material.h"
+#include <functional>
 
 namespace pbrt {
 
@@ -86,6 +87,16 @@ class SamplerIntegrator : public Integrator {
     virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
                         Sampler &sampler, MemoryArena &arena,
                         int depth = 0) const = 0;
+    // Computes the radiance along a camera ray whose closest intersection
+    // has already been found (e.g. by _Scene::IntersectBatch()); the
+    // default implementation ignores it and calls _Li()_.
+    virtual Spectrum LiFromIntersection(const RayDifferential &ray,
+                                        bool foundIntersection,
+                                        SurfaceInteraction &isect,
+                                        const Scene &scene, Sampler &sampler,
+                                        MemoryArena &arena) const {
+        return Li(ray, scene, sampler, arena);
+    }
     Spectrum SpecularReflect(const RayDifferential &ray,
                              const SurfaceInteraction &isect,
                              const Scene &scene, Sampler &sampler,
@@ -96,10 +107,47 @@ class SamplerIntegrator : public Integrator {
                               MemoryArena &arena, int depth) const;
 
   protected:
+    // SamplerIntegrator Protected Methods
+    virtual bool BatchCameraRays() const {
+        return PbrtOptions.batchCameraRays;
+    }
+    // Computes the radiance _L[i]_ along each camera ray _rays[i]_ with
+    // positive _rayWeights[i]_ using _samplers[i]_, which is positioned at
+    // the ray's pixel sample; used for all tiles if _BatchCameraRays()_.
+    virtual void BatchLi(const std::vector<RayDifferential> &rays,
+                         const std::vector<Float> &rayWeights,
+                         const std::vector<Sampler *> &samplers,
+                         const Scene &scene, MemoryArena &arena,
+                         Spectrum *L) const;
+
     // SamplerIntegrator Protected Data
     std::shared_ptr<const Camera> camera;
 
   private:
+    // SamplerIntegrator Private Methods
+    static Bounds2i TileBounds(const Point2i &tile, int tileSize,
+                               const Bounds2i &sampleBounds);
+    // Renders the image in passes, calling _renderTile(tile, firstSample,
+    // endSample)_ for each of _tiles_ in each pass.
+    void RenderProgressive(
+        const std::vector<Point2i> &tiles,
+        const std::function<void(const Point2i &, int64_t, int64_t)>
+            &renderTile);
+    // Renders samples [_firstSample_, _endSample_) of each pixel in _tile_;
+    // the samples don't depend on how a pixel's samples are split up.
+    std::unique_ptr<FilmTile> RenderTile(const Scene &scene,
+                                         const Point2i &tile,
+                                         const Point2i &nTiles, int tileSize,
+                                         const Bounds2i &sampleBounds,
+                                         int64_t firstSample,
+                                         int64_t endSample) const;
+    // Renders the same samples as _RenderTile()_, batching camera rays
+    // for _BatchLi()_.
+    std::unique_ptr<FilmTile> RenderTileBatched(
+        const Scene &scene, const Point2i &tile, const Point2i &nTiles,
+        int tileSize, const Bounds2i &sampleBounds, int64_t firstSample,
+        int64_t endSample) const;
+
     // SamplerIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
     const Bounds2i pixelBounds;
@@ -0,0 +1,225 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/mipfile.cpp*
+#include "mipfile.h"
+#include "mipmap.h"
+#include "stats.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Mapped MIP map files", mipFileBytes);
+
+// MIP Map File Local Declarations
+static const char mipFileMagic[8] = {'p', 'b', 'r', 't', 'm', 'i', 'p', 0};
+static const uint32_t mipFileVersion = 1;
+static PBRT_CONSTEXPR int MIPFileLogTileSize = 6;
+
+struct MIPFileHeader {
+    char magic[8];
+    uint32_t version;
+    // Texels are stored as native _Float_s, so a file can only be used by
+    // a build of pbrt that uses the same representation.
+    uint32_t floatSize;
+    uint32_t nChannels;
+    uint32_t wrapMode;
+    uint32_t nLevels;
+    uint32_t logTileSize;
+};
+
+// The header is followed by one of these for each level, finest first,
+// and then by the levels' texels, each level starting at a multiple of
+// _MIPFileAlignment_ bytes.
+struct MIPFileLevel {
+    int32_t res[2];
+    uint64_t offset;
+};
+
+static PBRT_CONSTEXPR size_t MIPFileAlignment = 64;
+
+static size_t AlignUp(size_t offset) {
+    return (offset + MIPFileAlignment - 1) & ~(MIPFileAlignment - 1);
+}
+
+static size_t LevelBytes(const Point2i &res, int nChannels) {
+    return size_t(res.x) * res.y * nChannels * sizeof(Float);
+}
+
+// MIP Map File Method Definitions
+std::unique_ptr<MIPMapFile> MIPMapFile::Open(const std::string &filename) {
+    std::unique_ptr<MIPMapFile> mf(new MIPMapFile);
+    if (!mf->file.Open(filename)) {
+        Error("%s: unable to read MIP map file", filename.c_str());
+        return nullptr;
+    }
+    const char *data = mf->file.Data();
+    size_t size = mf->file.Size();
+
+    // Read and check the file's header
+    MIPFileHeader header;
+    if (size < sizeof(header)) {
+        Error("%s: MIP map file is truncated", filename.c_str());
+        return nullptr;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, mipFileMagic, sizeof(mipFileMagic)) != 0 ||
+        header.version != mipFileVersion) {
+        Error("%s: not a MIP map file made by this version of pbrt",
+              filename.c_str());
+        return nullptr;
+    }
+    if (header.floatSize != sizeof(Float)) {
+        Error("%s: MIP map file was made by a build of pbrt with %d-byte "
+              "Floats", filename.c_str(), int(header.floatSize));
+        return nullptr;
+    }
+    if ((header.nChannels != 1 && header.nChannels != 3) ||
+        header.wrapMode > uint32_t(ImageWrap::Clamp) || header.nLevels == 0 ||
+        header.nLevels > 32 || header.logTileSize > 12 ||
+        size < sizeof(header) + header.nLevels * sizeof(MIPFileLevel)) {
+        Error("%s: MIP map file is corrupt", filename.c_str());
+        return nullptr;
+    }
+    mf->nChannels = header.nChannels;
+    mf->wrapMode = ImageWrap(header.wrapMode);
+
+    // Read the levels, checking that they're all inside the file
+    const char *levelData = data + sizeof(header);
+    for (uint32_t i = 0; i < header.nLevels; ++i) {
+        MIPFileLevel fl;
+        memcpy(&fl, levelData + i * sizeof(fl), sizeof(fl));
+        Level l;
+        l.res = Point2i(fl.res[0], fl.res[1]);
+        Point2i expected = l.res;
+        if (i > 0)
+            expected = Point2i(std::max(1, mf->levels[i - 1].res.x / 2),
+                               std::max(1, mf->levels[i - 1].res.y / 2));
+        size_t bytes = LevelBytes(l.res, header.nChannels);
+        if (l.res.x <= 0 || l.res.y <= 0 || !IsPowerOf2(l.res.x) ||
+            !IsPowerOf2(l.res.y) || l.res != expected ||
+            fl.offset % MIPFileAlignment != 0 || fl.offset > size ||
+            bytes > size - fl.offset) {
+            Error("%s: MIP map file is corrupt", filename.c_str());
+            return nullptr;
+        }
+        for (int c = 0; c < 2; ++c)
+            l.logTileSize[c] =
+                std::min<int>(header.logTileSize, Log2Int(l.res[c]));
+        l.nTiles = l.res.x >> l.logTileSize[0];
+        l.texels = (const Float *)(data + fl.offset);
+        mf->levels.push_back(l);
+    }
+    if (mf->levels.back().res != Point2i(1, 1)) {
+        Error("%s: MIP map file is corrupt", filename.c_str());
+        return nullptr;
+    }
+    mipFileBytes += size;
+    return mf;
+}
+
+bool WriteMIPMapFile(
+    const std::string &filename, const std::vector<Point2i> &levelResolution,
+    int nChannels, ImageWrap wrapMode,
+    const std::function<void(int level, int s, int t, Float *values)> &texel) {
+    // Write the file to a temporary file and then rename it, so that a
+    // partially written file is never left with the given name
+    std::string tmpFilename = filename + ".tmp";
+    FILE *f = fopen(tmpFilename.c_str(), "wb");
+    if (!f) {
+        Error("%s: %s", tmpFilename.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Write the header and the levels' resolutions and offsets
+    MIPFileHeader header;
+    memcpy(header.magic, mipFileMagic, sizeof(mipFileMagic));
+    header.version = mipFileVersion;
+    header.floatSize = sizeof(Float);
+    header.nChannels = nChannels;
+    header.wrapMode = uint32_t(wrapMode);
+    header.nLevels = levelResolution.size();
+    header.logTileSize = MIPFileLogTileSize;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    size_t offset =
+        AlignUp(sizeof(header) + levelResolution.size() * sizeof(MIPFileLevel));
+    std::vector<size_t> offsets;
+    for (const Point2i &res : levelResolution) {
+        MIPFileLevel fl;
+        fl.res[0] = res.x;
+        fl.res[1] = res.y;
+        fl.offset = offset;
+        ok &= fwrite(&fl, sizeof(fl), 1, f) == 1;
+        offsets.push_back(offset);
+        offset = AlignUp(offset + LevelBytes(res, nChannels));
+    }
+
+    // Write each level's tiles in scanline order
+    size_t pos = sizeof(header) + levelResolution.size() * sizeof(MIPFileLevel);
+    const char zeros[MIPFileAlignment] = {0};
+    std::vector<Float> tile;
+    for (size_t level = 0; level < levelResolution.size() && ok; ++level) {
+        ok &= fwrite(zeros, 1, offsets[level] - pos, f) == offsets[level] - pos;
+        Point2i res = levelResolution[level];
+        int tileSize[2] = {std::min(res.x, 1 << MIPFileLogTileSize),
+                           std::min(res.y, 1 << MIPFileLogTileSize)};
+        tile.resize(tileSize[0] * tileSize[1] * nChannels);
+        for (int t0 = 0; t0 < res.y; t0 += tileSize[1])
+            for (int s0 = 0; s0 < res.x; s0 += tileSize[0]) {
+                Float *v = tile.data();
+                for (int t = t0; t < t0 + tileSize[1]; ++t)
+                    for (int s = s0; s < s0 + tileSize[0]; ++s) {
+                        texel(level, s, t, v);
+                        v += nChannels;
+                    }
+                ok &= fwrite(tile.data(), sizeof(Float), tile.size(), f) ==
+                      tile.size();
+            }
+        pos = offsets[level] + LevelBytes(res, nChannels);
+    }
+    ok &= fclose(f) == 0;
+#ifdef PBRT_IS_WINDOWS
+    // rename() won't replace an existing file on Windows.
+    if (ok) remove(filename.c_str());
+#endif
+    if (!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        Error("%s: error writing MIP map file", filename.c_str());
+        remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace pbrt
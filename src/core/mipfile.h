@@ -0,0 +1,108 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_MIPFILE_H
+#define PBRT_CORE_MIPFILE_H
+
+// core/mipfile.h*
+#include "pbrt.h"
+#include "fileutil.h"
+#include "geometry.h"
+#include <functional>
+#include <vector>
+
+namespace pbrt {
+
+// MIP Map File Declarations
+
+// A MIP map file holds the complete MIP pyramid of an image, already
+// resampled to a power-of-two resolution and filtered, as made by "imgtool
+// makemip". Each level is stored in square tiles of texels, so that the
+// texels used by nearby lookups are close together in the file. Textures
+// that use such files get their texels from a memory mapping of the file,
+// so they don't need to be read or filtered when they're loaded; the
+// tiles that are in use are kept in the texture cache if it's enabled.
+enum class ImageWrap;
+
+class MIPMapFile {
+  public:
+    // MIPMapFile Public Methods
+    static std::unique_ptr<MIPMapFile> Open(const std::string &filename);
+    int Levels() const { return levels.size(); }
+    Point2i LevelResolution(int level) const { return levels[level].res; }
+    int Channels() const { return nChannels; }
+    ImageWrap WrapMode() const { return wrapMode; }
+
+    // Returns the values of the given texel, which must be inside the
+    // level's resolution.
+    const Float *Texel(int level, int s, int t) const {
+        const Level &l = levels[level];
+        int ls = l.logTileSize[0], lt = l.logTileSize[1];
+        size_t tile = size_t(t >> lt) * l.nTiles + (s >> ls);
+        size_t offset = (tile << (ls + lt)) + ((t & ((1 << lt) - 1)) << ls) +
+                        (s & ((1 << ls) - 1));
+        return l.texels + offset * nChannels;
+    }
+
+  private:
+    // MIPMapFile Private Declarations
+    struct Level {
+        Point2i res;
+        // Tiles are $2^{logTileSize}$ texels wide and high; levels smaller
+        // than the file's tile size are stored in a single tile.
+        int logTileSize[2];
+        int nTiles;  // in $s$
+        const Float *texels;
+    };
+
+    // MIPMapFile Private Data
+    MappedFile file;
+    int nChannels;
+    ImageWrap wrapMode;
+    std::vector<Level> levels;
+};
+
+// Writes a MIP map file with the given levels; _texel_ is called to get
+// the values of each of their texels.
+bool WriteMIPMapFile(
+    const std::string &filename, const std::vector<Point2i> &levelResolution,
+    int nChannels, ImageWrap wrapMode,
+    const std::function<void(int level, int s, int t, Float *values)> &texel);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_MIPFILE_H
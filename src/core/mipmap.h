@@ -44,6 +44,11 @@
 #include "texture.h"
 #include "stats.h"
 #include "parallel.h"
+#include "texcache.h"
+#include "mipfile.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
 
 namespace pbrt {
 
@@ -56,6 +61,10 @@ enum class ImageWrap { Repeat, Black, Clamp };
 struct ResampleWeight {
     int firstTexel;
     Float weight[4];
+    // Source texels for each of the weights, with the image's wrap mode
+    // applied; texels outside of images with ImageWrap::Black have zero
+    // weight.
+    int texel[4];
 };
 
 // MIPMap Declarations
@@ -65,16 +74,58 @@ class MIPMap {
     // MIPMap Public Methods
     MIPMap(const Point2i &resolution, const T *data, bool doTri = false,
            Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat);
-    int Width() const { return resolution[0]; }
-    int Height() const { return resolution[1]; }
-    int Levels() const { return pyramid.size(); }
-    const T &Texel(int level, int s, int t) const;
+    // Creates a MIPMap whose texels are kept in the texture cache rather
+    // than in memory. The image is read with _readImage_ the first time
+    // that the MIPMap is used; all of the pyramid's tiles are added to the
+    // cache then and are also written to a temporary file, from which
+    // tiles that are later evicted are read back one at a time.
+    MIPMap(std::function<std::unique_ptr<T[]>(Point2i *)> readImage,
+           bool doTri = false, Float maxAniso = 8.f,
+           ImageWrap wrapMode = ImageWrap::Repeat);
+    // Creates a MIPMap that looks up texels in a MIP map file, scaling
+    // their values by _scale_. If the texture cache is enabled, the file's
+    // tiles are converted to _T_ texels when they're first used and kept
+    // in the cache; otherwise each lookup converts the texels it uses.
+    MIPMap(std::unique_ptr<MIPMapFile> file, Float scale = 1.f,
+           bool doTri = false, Float maxAniso = 8.f,
+           ImageWrap wrapMode = ImageWrap::Repeat);
+    int Width() const {
+        initialize();
+        return resolution[0];
+    }
+    int Height() const {
+        initialize();
+        return resolution[1];
+    }
+    int Levels() const {
+        initialize();
+        return levelResolution.size();
+    }
+    T Texel(int level, int s, int t) const;
     T Lookup(const Point2f &st, Float width = 0.f) const;
     T Lookup(const Point2f &st, Vector2f dstdx, Vector2f dstdy) const;
 
   private:
+    // MIPMap Private Declarations
+    static PBRT_CONSTEXPR int LogTileSize = 6;
+    static PBRT_CONSTEXPR int TileSize = 1 << LogTileSize;
+    typedef std::vector<std::unique_ptr<BlockedArray<T>>> Pyramid;
+    class Tiles : public TextureTileSource {
+      public:
+        Tiles(const MIPMap *mipmap)
+            : TextureTileSource(TileSize * TileSize * sizeof(T)),
+              mipmap(mipmap) {}
+        void LoadTile(int level, int s, int t, void *texels) const {
+            mipmap->loadTile(level, s, t, (T *)texels);
+        }
+
+      private:
+        const MIPMap *mipmap;
+    };
+
     // MIPMap Private Methods
-    std::unique_ptr<ResampleWeight[]> resampleWeights(int oldRes, int newRes) {
+    static std::unique_ptr<ResampleWeight[]> resampleWeights(
+        int oldRes, int newRes, ImageWrap wrapMode) {
         CHECK_GE(newRes, oldRes);
         std::unique_ptr<ResampleWeight[]> wt(new ResampleWeight[newRes]);
         Float filterwidth = 2.f;
@@ -91,13 +142,41 @@ class MIPMap {
             Float invSumWts = 1 / (wt[i].weight[0] + wt[i].weight[1] +
                                    wt[i].weight[2] + wt[i].weight[3]);
             for (int j = 0; j < 4; ++j) wt[i].weight[j] *= invSumWts;
+
+            // Find the texels that the weights apply to
+            for (int j = 0; j < 4; ++j) {
+                int texel = wt[i].firstTexel + j;
+                if (wrapMode == ImageWrap::Repeat)
+                    texel = Mod(texel, oldRes);
+                else if (wrapMode == ImageWrap::Clamp)
+                    texel = Clamp(texel, 0, oldRes - 1);
+                if (texel < 0 || texel >= oldRes) {
+                    wt[i].weight[j] = 0;
+                    texel = 0;
+                }
+                wt[i].texel[j] = texel;
+            }
         }
         return wt;
     }
-    Float clamp(Float v) { return Clamp(v, 0.f, Infinity); }
-    RGBSpectrum clamp(const RGBSpectrum &v) { return v.Clamp(0.f, Infinity); }
-    SampledSpectrum clamp(const SampledSpectrum &v) {
-        return v.Clamp(0.f, Infinity);
+    static bool wrapTexel(ImageWrap wrapMode, const Point2i &res, int *s,
+                          int *t);
+    static Pyramid makePyramid(Point2i *resolution, const T *img,
+                               ImageWrap wrapMode);
+    static void initWeightLut();
+    void setLevelResolutions(const Pyramid &pyramid) const;
+    void initialize() const {
+        if (!initialized.load(std::memory_order_acquire)) loadImage();
+    }
+    void loadImage() const;
+    void loadTile(int level, int s, int t, T *texels) const;
+    static void copyTile(const BlockedArray<T> &l, int s, int t, T *texels);
+    static void convertTexel(const Float *v, int nChannels, Float *texel) {
+        *texel = (nChannels == 1) ? v[0] : RGBSpectrum::FromRGB(v).y();
+    }
+    static void convertTexel(const Float *v, int nChannels,
+                             RGBSpectrum *texel) {
+        *texel = (nChannels == 1) ? RGBSpectrum(v[0]) : RGBSpectrum::FromRGB(v);
     }
     T triangle(int level, const Point2f &st) const;
     T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const;
@@ -106,8 +185,21 @@ class MIPMap {
     const bool doTrilinear;
     const Float maxAnisotropy;
     const ImageWrap wrapMode;
-    Point2i resolution;
-    std::vector<std::unique_ptr<BlockedArray<T>>> pyramid;
+    // Cached MIPMaps' resolutions aren't known until their image has been
+    // read, which happens in the first call to initialize().
+    mutable Point2i resolution;
+    mutable std::vector<Point2i> levelResolution;
+    // Cached MIPMaps only keep their pyramid in memory if their tiles
+    // couldn't be written to a temporary file.
+    mutable Pyramid pyramid;
+    const std::function<std::unique_ptr<T[]>(Point2i *)> readImage;
+    mutable std::atomic<bool> initialized;
+    mutable std::mutex loadMutex;
+    std::unique_ptr<Tiles> tiles;
+    mutable std::unique_ptr<TextureTileFile> tileFile;
+    mutable std::vector<size_t> levelFirstTile;
+    std::unique_ptr<MIPMapFile> file;
+    const Float fileScale = 1;
     static PBRT_CONSTEXPR int WeightLUTSize = 128;
     static Float weightLut[WeightLUTSize];
 };
@@ -119,126 +211,287 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
     : doTrilinear(doTrilinear),
       maxAnisotropy(maxAnisotropy),
       wrapMode(wrapMode),
-      resolution(res) {
+      resolution(res),
+      initialized(true) {
     ProfilePhase _(Prof::MIPMapCreation);
+    pyramid = makePyramid(&resolution, img, wrapMode);
+    setLevelResolutions(pyramid);
+    initWeightLut();
+    mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+}
 
-    std::unique_ptr<T[]> resampledImage = nullptr;
-    if (!IsPowerOf2(resolution[0]) || !IsPowerOf2(resolution[1])) {
+template <typename T>
+MIPMap<T>::MIPMap(std::function<std::unique_ptr<T[]>(Point2i *)> readImage,
+                  bool doTrilinear, Float maxAnisotropy, ImageWrap wrapMode)
+    : doTrilinear(doTrilinear),
+      maxAnisotropy(maxAnisotropy),
+      wrapMode(wrapMode),
+      readImage(std::move(readImage)),
+      initialized(false),
+      tiles(new Tiles(this)) {
+    initWeightLut();
+}
+
+template <typename T>
+MIPMap<T>::MIPMap(std::unique_ptr<MIPMapFile> f, Float scale,
+                  bool doTrilinear, Float maxAnisotropy, ImageWrap wrapMode)
+    : doTrilinear(doTrilinear),
+      maxAnisotropy(maxAnisotropy),
+      wrapMode(wrapMode),
+      resolution(f->LevelResolution(0)),
+      initialized(true),
+      tiles(TextureCacheSize() > 0 ? new Tiles(this) : nullptr),
+      file(std::move(f)),
+      fileScale(scale) {
+    for (int level = 0; level < file->Levels(); ++level)
+        levelResolution.push_back(file->LevelResolution(level));
+    initWeightLut();
+}
+
+template <typename T>
+typename MIPMap<T>::Pyramid MIPMap<T>::makePyramid(Point2i *resolution,
+                                                   const T *img,
+                                                   ImageWrap wrapMode) {
+    // The levels are computed in arrays of texels in scanline order, which
+    // lets the filtering loops over each row work on consecutive texels,
+    // and then copied to the pyramid's _BlockedArray_s. _T_ is treated as
+    // an array of _Float_s where that's all that's needed.
+    static_assert(sizeof(T) % sizeof(Float) == 0,
+                  "MIPMap texels must be made of Floats");
+    const int nFloats = sizeof(T) / sizeof(Float);
+    Point2i res = *resolution;
+    std::unique_ptr<T[]> level;
+    if (!IsPowerOf2(res[0]) || !IsPowerOf2(res[1])) {
         // Resample image to power-of-two resolution
-        Point2i resPow2(RoundUpPow2(resolution[0]), RoundUpPow2(resolution[1]));
-        LOG(INFO) << "Resampling MIPMap from " << resolution << " to " <<
+        Point2i resPow2(RoundUpPow2(res[0]), RoundUpPow2(res[1]));
+        LOG(INFO) << "Resampling MIPMap from " << res << " to " <<
             resPow2 << ". Ratio= " << (Float(resPow2.x * resPow2.y) /
-                                       Float(resolution.x * resolution.y));
+                                       Float(res.x * res.y));
         // Resample image in $s$ direction
         std::unique_ptr<ResampleWeight[]> sWeights =
-            resampleWeights(resolution[0], resPow2[0]);
-        resampledImage.reset(new T[resPow2[0] * resPow2[1]]);
+            resampleWeights(res[0], resPow2[0], wrapMode);
+        std::unique_ptr<T[]> sZoomed(new T[resPow2[0] * res[1]]);
 
         // Apply _sWeights_ to zoom in $s$ direction
         ParallelFor([&](int t) {
+            const T *in = img + t * res[0];
+            T *out = &sZoomed[t * resPow2[0]];
             for (int s = 0; s < resPow2[0]; ++s) {
                 // Compute texel $(s,t)$ in $s$-zoomed image
-                resampledImage[t * resPow2[0] + s] = 0.f;
-                for (int j = 0; j < 4; ++j) {
-                    int origS = sWeights[s].firstTexel + j;
-                    if (wrapMode == ImageWrap::Repeat)
-                        origS = Mod(origS, resolution[0]);
-                    else if (wrapMode == ImageWrap::Clamp)
-                        origS = Clamp(origS, 0, resolution[0] - 1);
-                    if (origS >= 0 && origS < (int)resolution[0])
-                        resampledImage[t * resPow2[0] + s] +=
-                            sWeights[s].weight[j] *
-                            img[t * resolution[0] + origS];
-                }
+                const ResampleWeight &w = sWeights[s];
+                out[s] = 0.f;
+                for (int j = 0; j < 4; ++j)
+                    out[s] += w.weight[j] * in[w.texel[j]];
             }
-        }, resolution[1], 16);
+        }, res[1], 16);
 
-        // Resample image in $t$ direction
+        // Resample image in $t$ direction, a row at a time
         std::unique_ptr<ResampleWeight[]> tWeights =
-            resampleWeights(resolution[1], resPow2[1]);
-        std::vector<T *> resampleBufs;
-        int nThreads = MaxThreadIndex();
-        for (int i = 0; i < nThreads; ++i)
-            resampleBufs.push_back(new T[resPow2[1]]);
-        ParallelFor([&](int s) {
-            T *workData = resampleBufs[ThreadIndex];
-            for (int t = 0; t < resPow2[1]; ++t) {
-                workData[t] = 0.f;
-                for (int j = 0; j < 4; ++j) {
-                    int offset = tWeights[t].firstTexel + j;
-                    if (wrapMode == ImageWrap::Repeat)
-                        offset = Mod(offset, resolution[1]);
-                    else if (wrapMode == ImageWrap::Clamp)
-                        offset = Clamp(offset, 0, (int)resolution[1] - 1);
-                    if (offset >= 0 && offset < (int)resolution[1])
-                        workData[t] += tWeights[t].weight[j] *
-                                       resampledImage[offset * resPow2[0] + s];
-                }
+            resampleWeights(res[1], resPow2[1], wrapMode);
+        level.reset(new T[resPow2[0] * resPow2[1]]);
+        int rowFloats = resPow2[0] * nFloats;
+        ParallelFor([&](int t) {
+            const ResampleWeight &w = tWeights[t];
+            const Float *in[4];
+            for (int j = 0; j < 4; ++j)
+                in[j] = (const Float *)&sZoomed[w.texel[j] * resPow2[0]];
+            Float *out = (Float *)&level[t * resPow2[0]];
+            for (int i = 0; i < rowFloats; ++i) {
+                Float v = 0;
+                for (int j = 0; j < 4; ++j) v += w.weight[j] * in[j][i];
+                out[i] = v < 0 ? 0 : v;
             }
-            for (int t = 0; t < resPow2[1]; ++t)
-                resampledImage[t * resPow2[0] + s] = clamp(workData[t]);
-        }, resPow2[0], 32);
-        for (auto ptr : resampleBufs) delete[] ptr;
-        resolution = resPow2;
+        }, resPow2[1], 16);
+        res = resPow2;
+        img = level.get();
     }
     // Initialize levels of MIPMap from image
-    int nLevels = 1 + Log2Int(std::max(resolution[0], resolution[1]));
-    pyramid.resize(nLevels);
+    int nLevels = 1 + Log2Int(std::max(res[0], res[1]));
+    Pyramid pyramid(nLevels);
+    auto makeLevel = [&](int i, const T *texels, Point2i levelRes) {
+        pyramid[i].reset(new BlockedArray<T>(levelRes[0], levelRes[1]));
+        BlockedArray<T> &l = *pyramid[i];
+        ParallelFor([&](int t) {
+            for (int s = 0; s < levelRes[0]; ++s)
+                l(s, t) = texels[t * levelRes[0] + s];
+        }, levelRes[1], 64);
+    };
 
     // Initialize most detailed level of MIPMap
-    pyramid[0].reset(
-        new BlockedArray<T>(resolution[0], resolution[1],
-                            resampledImage ? resampledImage.get() : img));
+    makeLevel(0, img, res);
+    Point2i prevRes = res;
     for (int i = 1; i < nLevels; ++i) {
         // Initialize $i$th MIPMap level from $i-1$st level
-        int sRes = std::max(1, pyramid[i - 1]->uSize() / 2);
-        int tRes = std::max(1, pyramid[i - 1]->vSize() / 2);
-        pyramid[i].reset(new BlockedArray<T>(sRes, tRes));
-
-        // Filter four texels from finer level of pyramid
+        Point2i levelRes(std::max(1, prevRes[0] / 2),
+                         std::max(1, prevRes[1] / 2));
+        std::unique_ptr<T[]> next(new T[levelRes[0] * levelRes[1]]);
+
+        // Filter four texels from finer level of pyramid. Levels that are
+        // one texel wide or high need the wrap mode to find the second
+        // texel in that direction; it's black or the first one.
+        Float weight[2] = {1, 1};
+        int offset[2] = {nFloats, prevRes[0] * nFloats};
+        for (int c = 0; c < 2; ++c)
+            if (prevRes[c] == 1) {
+                offset[c] = 0;
+                if (wrapMode == ImageWrap::Black) weight[c] = 0;
+            }
         ParallelFor([&](int t) {
-            for (int s = 0; s < sRes; ++s)
-                (*pyramid[i])(s, t) =
-                    .25f * (Texel(i - 1, 2 * s, 2 * t) +
-                            Texel(i - 1, 2 * s + 1, 2 * t) +
-                            Texel(i - 1, 2 * s, 2 * t + 1) +
-                            Texel(i - 1, 2 * s + 1, 2 * t + 1));
-        }, tRes, 16);
+            const Float *in = (const Float *)&img[2 * t * prevRes[0]];
+            Float *out = (Float *)&next[t * levelRes[0]];
+            for (int s = 0; s < levelRes[0]; ++s, in += 2 * nFloats)
+                for (int f = 0; f < nFloats; ++f)
+                    *out++ = .25f * (in[f] + weight[0] * in[f + offset[0]] +
+                                     weight[1] * in[f + offset[1]] +
+                                     weight[0] * weight[1] *
+                                         in[f + offset[0] + offset[1]]);
+        }, levelRes[1], 16);
+        makeLevel(i, next.get(), levelRes);
+        level = std::move(next);
+        img = level.get();
+        prevRes = levelRes;
     }
+    *resolution = res;
+    return pyramid;
+}
 
-    // Initialize EWA filter weights if needed
-    if (weightLut[0] == 0.) {
+template <typename T>
+void MIPMap<T>::initWeightLut() {
+    // Initialize EWA filter weights the first time a MIPMap is created;
+    // initializing the local static is thread-safe.
+    static bool lutInitialized = []() {
         for (int i = 0; i < WeightLUTSize; ++i) {
             Float alpha = 2;
             Float r2 = Float(i) / Float(WeightLUTSize - 1);
             weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
         }
+        return true;
+    }();
+    (void)lutInitialized;
+}
+
+template <typename T>
+void MIPMap<T>::setLevelResolutions(const Pyramid &pyramid) const {
+    levelResolution.clear();
+    for (const auto &level : pyramid)
+        levelResolution.push_back(Point2i(level->uSize(), level->vSize()));
+}
+
+template <typename T>
+void MIPMap<T>::loadImage() const {
+    std::lock_guard<std::mutex> lock(loadMutex);
+    if (initialized) return;
+    ProfilePhase _(Prof::MIPMapCreation);
+    Point2i res;
+    std::unique_ptr<T[]> img = readImage(&res);
+    Pyramid levels = makePyramid(&res, img.get(), wrapMode);
+    img.reset();
+    resolution = res;
+    setLevelResolutions(levels);
+
+    // Add all of the pyramid's tiles to the cache, the coarsest ones last
+    // so that they're the last to be evicted, and write them to the tile
+    // file in the same order
+    tileFile.reset(new TextureTileFile(tiles->tileBytes));
+    bool written = tileFile->IsValid();
+    std::unique_ptr<T[]> texels(new T[TileSize * TileSize]);
+    size_t nTiles = 0;
+    for (int level = 0; level < (int)levels.size() && written; ++level) {
+        levelFirstTile.push_back(nTiles);
+        const BlockedArray<T> &l = *levels[level];
+        for (int t = 0; t < l.vSize() && written; t += TileSize)
+            for (int s = 0; s < l.uSize() && written; s += TileSize) {
+                copyTile(l, s, t, texels.get());
+                AddTextureTile(*tiles, level, s >> LogTileSize,
+                               t >> LogTileSize, texels.get());
+                written = tileFile->Append(texels.get());
+                ++nTiles;
+            }
     }
-    mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+    if (!written) {
+        Warning("Unable to write texture tiles to a temporary file; keeping "
+                "the texture in memory instead.");
+        tileFile.reset();
+        pyramid = std::move(levels);
+        mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+    }
+    initialized.store(true, std::memory_order_release);
 }
 
 template <typename T>
-const T &MIPMap<T>::Texel(int level, int s, int t) const {
-    CHECK_LT(level, pyramid.size());
-    const BlockedArray<T> &l = *pyramid[level];
-    // Compute texel $(s,t)$ accounting for boundary conditions
+void MIPMap<T>::loadTile(int level, int s, int t, T *texels) const {
+    if (file) {
+        // Convert the tile's texels from the mapped file
+        const Point2i &res = levelResolution[level];
+        for (int tt = t * TileSize; tt < (t + 1) * TileSize; ++tt)
+            for (int ss = s * TileSize; ss < (s + 1) * TileSize; ++ss) {
+                *texels = T(0.f);
+                if (ss < res[0] && tt < res[1]) {
+                    convertTexel(file->Texel(level, ss, tt),
+                                 file->Channels(), texels);
+                    *texels = fileScale * *texels;
+                }
+                ++texels;
+            }
+        return;
+    }
+
+    // The tile has been evicted from the cache; read it back from the tile
+    // file, where each level's tiles are in scanline order
+    CHECK_LT(level, levelFirstTile.size());
+    int nTilesS = (levelResolution[level][0] + TileSize - 1) >> LogTileSize;
+    size_t tile = levelFirstTile[level] + size_t(t) * nTilesS + s;
+    if (!tileFile->Read(tile, texels)) {
+        Error("Unable to read texture tile from temporary file.");
+        for (int i = 0; i < TileSize * TileSize; ++i) texels[i] = T(0.f);
+    }
+}
+
+template <typename T>
+void MIPMap<T>::copyTile(const BlockedArray<T> &l, int s0, int t0,
+                         T *texels) {
+    for (int t = t0; t < t0 + TileSize; ++t)
+        for (int s = s0; s < s0 + TileSize; ++s)
+            *texels++ = (s < l.uSize() && t < l.vSize()) ? l(s, t) : T(0.f);
+}
+
+template <typename T>
+bool MIPMap<T>::wrapTexel(ImageWrap wrapMode, const Point2i &res, int *s,
+                          int *t) {
     switch (wrapMode) {
     case ImageWrap::Repeat:
-        s = Mod(s, l.uSize());
-        t = Mod(t, l.vSize());
+        *s = Mod(*s, res[0]);
+        *t = Mod(*t, res[1]);
         break;
     case ImageWrap::Clamp:
-        s = Clamp(s, 0, l.uSize() - 1);
-        t = Clamp(t, 0, l.vSize() - 1);
+        *s = Clamp(*s, 0, res[0] - 1);
+        *t = Clamp(*t, 0, res[1] - 1);
         break;
-    case ImageWrap::Black: {
-        static const T black = 0.f;
-        if (s < 0 || s >= (int)l.uSize() || t < 0 || t >= (int)l.vSize())
-            return black;
+    case ImageWrap::Black:
+        if (*s < 0 || *s >= res[0] || *t < 0 || *t >= res[1]) return false;
         break;
     }
+    return true;
+}
+
+template <typename T>
+T MIPMap<T>::Texel(int level, int s, int t) const {
+    initialize();
+    CHECK_LT(level, levelResolution.size());
+    // Compute texel $(s,t)$ accounting for boundary conditions
+    if (!wrapTexel(wrapMode, levelResolution[level], &s, &t)) return T(0.f);
+    if (!pyramid.empty()) return (*pyramid[level])(s, t);
+    if (file && !tiles) {
+        // Convert the texel's values in the mapped file
+        T texel;
+        convertTexel(file->Texel(level, s, t), file->Channels(), &texel);
+        return fileScale * texel;
     }
-    return l(s, t);
+
+    // Look up the texel in its tile in the texture cache
+    const T *texels = (const T *)GetTextureTile(
+        *tiles, level, s >> LogTileSize, t >> LogTileSize);
+    return texels[(t & (TileSize - 1)) * TileSize + (s & (TileSize - 1))];
 }
 
 template <typename T>
@@ -263,8 +516,8 @@ T MIPMap<T>::Lookup(const Point2f &st, Float width) const {
 template <typename T>
 T MIPMap<T>::triangle(int level, const Point2f &st) const {
     level = Clamp(level, 0, Levels() - 1);
-    Float s = st[0] * pyramid[level]->uSize() - 0.5f;
-    Float t = st[1] * pyramid[level]->vSize() - 0.5f;
+    Float s = st[0] * levelResolution[level][0] - 0.5f;
+    Float t = st[1] * levelResolution[level][1] - 0.5f;
     int s0 = std::floor(s), t0 = std::floor(t);
     Float ds = s - s0, dt = t - t0;
     return (1 - ds) * (1 - dt) * Texel(level, s0, t0) +
@@ -306,12 +559,13 @@ template <typename T>
 T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     if (level >= Levels()) return Texel(Levels() - 1, 0, 0);
     // Convert EWA coordinates to appropriate scale for level
-    st[0] = st[0] * pyramid[level]->uSize() - 0.5f;
-    st[1] = st[1] * pyramid[level]->vSize() - 0.5f;
-    dst0[0] *= pyramid[level]->uSize();
-    dst0[1] *= pyramid[level]->vSize();
-    dst1[0] *= pyramid[level]->uSize();
-    dst1[1] *= pyramid[level]->vSize();
+    const Point2i &res = levelResolution[level];
+    st[0] = st[0] * res[0] - 0.5f;
+    st[1] = st[1] * res[1] - 0.5f;
+    dst0[0] *= res[0];
+    dst0[1] *= res[1];
+    dst1[0] *= res[0];
+    dst1[1] *= res[1];
 
     // Compute ellipse coefficients to bound EWA filter region
     Float A = dst0[1] * dst0[1] + dst1[1] * dst1[1] + 1;
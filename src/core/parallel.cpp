@@ -35,22 +35,51 @@
 #include "parallel.h"
 #include "memory.h"
 #include "stats.h"
-#include <list>
+#include <deque>
 #include <thread>
 #include <condition_variable>
 
 namespace pbrt {
 
 // Parallel Local Definitions
-static std::vector<std::thread> threads;
-static bool shutdownThreads = false;
 class ParallelForLoop;
-static ParallelForLoop *workList = nullptr;
-static std::mutex workListMutex;
+static std::vector<std::thread> threads;
+static std::atomic<bool> shutdownThreads{false};
+
+// Each thread (including the main thread, which has _ThreadIndex_ zero)
+// owns a _WorkQueue_ holding the loops that it has started and is
+// responsible for. The owner works from the back of its queue (which
+// holds the most deeply nested loop it has started), while idle threads
+// steal from the front of other threads' queues, where the oldest (and
+// generally largest) loops are found.
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<ParallelForLoop *> loops;
+    // Number of entries in _loops_; it's read without holding _mutex_ so
+    // that threads looking for work can skip empty queues without
+    // contending for their locks.
+    std::atomic<int> size{0};
+};
+static std::vector<std::unique_ptr<WorkQueue>> workQueues;
+
+// Idle threads sleep on _workCondition_. _workEpoch_ is incremented
+// whenever something happens that a sleeping thread may care about: a new
+// loop is started, a loop's last helper finishes, or the threads are
+// asked to shut down or report their stats.
+static std::mutex workMutex;
+static std::condition_variable workCondition;
+static std::atomic<uint64_t> workEpoch{0};
+
+// Sequence number assigned to each loop as it is started; see
+// ParallelForLoop::WaitForHelpers().
+static std::atomic<uint64_t> nextLoopSequence{1};
 
 // Bookkeeping variables to help with the implementation of
 // MergeWorkerThreadStats().
 static std::atomic<bool> reportWorkerStats{false};
+// Incremented each time stats are requested so that each worker reports
+// exactly once per request.
+static std::atomic<int> reportGeneration{0};
 // Number of workers that still need to report their stats.
 static std::atomic<int> reporterCount;
 // After kicking the workers to report their stats, the main thread waits
@@ -58,6 +87,15 @@ static std::atomic<int> reporterCount;
 static std::condition_variable reportDoneCondition;
 static std::mutex reportDoneMutex;
 
+STAT_COUNTER("Parallel/Loops started", nLoopsStarted);
+STAT_COUNTER("Parallel/Loops joined by other threads", nLoopsStolen);
+
+static void WakeWorkers() {
+    std::lock_guard<std::mutex> lock(workMutex);
+    ++workEpoch;
+    workCondition.notify_all();
+}
+
 class ParallelForLoop {
   public:
     // ParallelForLoop Public Methods
@@ -66,34 +104,144 @@ class ParallelForLoop {
         : func1D(std::move(func1D)),
           maxIndex(maxIndex),
           chunkSize(chunkSize),
-          profilerState(profilerState) {}
-    ParallelForLoop(const std::function<void(Point2i)> &f, const Point2i &count,
+          profilerState(profilerState),
+          sequence(nextLoopSequence++) {}
+    ParallelForLoop(std::function<void(Point2i)> f, const Point2i &count,
                     uint64_t profilerState)
-        : func2D(f),
-          maxIndex(count.x * count.y),
+        : func2D(std::move(f)),
+          maxIndex((int64_t)count.x * (int64_t)count.y),
           chunkSize(1),
-          profilerState(profilerState) {
-        nX = count.x;
-    }
-
-  public:
-    // ParallelForLoop Private Data
+          profilerState(profilerState),
+          sequence(nextLoopSequence++),
+          nX(count.x) {}
+    bool Exhausted() const { return nextIndex >= maxIndex; }
+    bool RunChunk();
+    void Run();
+    void WaitForHelpers();
+
+    // ParallelForLoop Public Data
     std::function<void(int64_t)> func1D;
     std::function<void(Point2i)> func2D;
     const int64_t maxIndex;
     const int chunkSize;
-    uint64_t profilerState;
-    int64_t nextIndex = 0;
-    int activeWorkers = 0;
-    ParallelForLoop *next = nullptr;
-    int nX = -1;
-
-    // ParallelForLoop Private Methods
-    bool Finished() const {
-        return nextIndex >= maxIndex && activeWorkers == 0;
-    }
+    const uint64_t profilerState;
+    const uint64_t sequence;
+    const int nX = -1;
+    std::atomic<int64_t> nextIndex{0};
+    // Number of threads other than the loop's owner that have acquired a
+    // reference to the loop via AcquireLoop() and not yet released it.
+    std::atomic<int> activeHelpers{0};
 };
 
+// Claims the next chunk of loop iterations and runs them; returns false
+// if there were no more iterations left to claim. Claiming a chunk is a
+// single atomic add, so threads working on the same loop never need to
+// take a lock.
+bool ParallelForLoop::RunChunk() {
+    // Find the set of loop iterations to run next
+    int64_t indexStart = nextIndex.fetch_add(chunkSize);
+    if (indexStart >= maxIndex) return false;
+    int64_t indexEnd = std::min(indexStart + chunkSize, maxIndex);
+
+    // Run loop indices in _[indexStart, indexEnd)_
+    uint64_t oldState = ProfilerState;
+    ProfilerState = profilerState;
+    for (int64_t index = indexStart; index < indexEnd; ++index) {
+        if (func1D) {
+            func1D(index);
+        }
+        // Handle other types of loops
+        else {
+            CHECK(func2D);
+            func2D(Point2i(index % nX, index / nX));
+        }
+    }
+    ProfilerState = oldState;
+    return true;
+}
+
+void ParallelForLoop::Run() {
+    while (RunChunk())
+        ;
+}
+
+// Looks for a loop that still has iterations left to claim, first in the
+// calling thread's own queue and then by stealing from the other threads'
+// queues. Only loops started after _minSequence_ are considered. If one
+// is found, it is returned with its _activeHelpers_ count incremented;
+// the caller must call ReleaseLoop() once it's done with it.
+static ParallelForLoop *AcquireLoop(uint64_t minSequence) {
+    int nQueues = workQueues.size();
+    for (int i = 0; i < nQueues; ++i) {
+        // Visit our own queue first, then the others in order starting
+        // with our neighbor so that thieves spread out across victims.
+        int q = (ThreadIndex + i) % nQueues;
+        WorkQueue &queue = *workQueues[q];
+        if (queue.size.load(std::memory_order_relaxed) == 0) continue;
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto tryLoop = [&](ParallelForLoop *loop) {
+            if (loop->sequence <= minSequence || loop->Exhausted())
+                return false;
+            // Incrementing _activeHelpers_ while holding the queue lock
+            // ensures that the loop's owner can't return (and free the
+            // loop) until we've released it.
+            ++loop->activeHelpers;
+            return true;
+        };
+        if (i == 0) {
+            for (auto iter = queue.loops.rbegin(); iter != queue.loops.rend();
+                 ++iter)
+                if (tryLoop(*iter)) return *iter;
+        } else {
+            for (ParallelForLoop *loop : queue.loops)
+                if (tryLoop(loop)) {
+                    ++nLoopsStolen;
+                    return loop;
+                }
+        }
+    }
+    return nullptr;
+}
+
+static void ReleaseLoop(ParallelForLoop *loop) {
+    // _loop_ may be freed by its owner as soon as _activeHelpers_ reaches
+    // zero, so it must not be accessed after the decrement.
+    if (--loop->activeHelpers == 0) WakeWorkers();
+}
+
+// Called by a loop's owner once all of its iterations have been claimed.
+// While other threads are still finishing their chunks, the owner helps
+// with any loops that they started in turn (i.e., nested parallelism),
+// and otherwise sleeps until the last helper is done. Only loops started
+// after this one are eligible, which bounds the depth of recursion on
+// the owner's stack.
+void ParallelForLoop::WaitForHelpers() {
+    // Remove the loop from its owner's queue; after this, no other
+    // threads can start helping with it.
+    WorkQueue &queue = *workQueues[ThreadIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto iter = std::find(queue.loops.begin(), queue.loops.end(), this);
+        CHECK(iter != queue.loops.end());
+        queue.loops.erase(iter);
+        --queue.size;
+    }
+
+    while (activeHelpers > 0) {
+        uint64_t epoch = workEpoch;
+        if (ParallelForLoop *loop = AcquireLoop(sequence)) {
+            loop->Run();
+            ReleaseLoop(loop);
+        } else {
+            std::unique_lock<std::mutex> lock(workMutex);
+            workCondition.wait(lock, [&] {
+                return activeHelpers == 0 || workEpoch != epoch;
+            });
+        }
+    }
+}
+
 void Barrier::Wait() {
     std::unique_lock<std::mutex> lock(mutex);
     CHECK_GT(count, 0);
@@ -107,8 +255,6 @@ void Barrier::Wait() {
         cv.wait(lock, [this] { return count == 0; });
 }
 
-static std::condition_variable workListCondition;
-
 static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     LOG(INFO) << "Started execution in worker thread " << tIndex;
     ThreadIndex = tIndex;
@@ -126,60 +272,51 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     // the threads have cleared it.
     barrier.reset();
 
-    std::unique_lock<std::mutex> lock(workListMutex);
+    int reportedGeneration = 0;
     while (!shutdownThreads) {
-        if (reportWorkerStats) {
+        // Note the epoch before looking for work so that a loop that's
+        // started after we've looked won't be missed when we go to sleep.
+        uint64_t epoch = workEpoch;
+        if (reportWorkerStats && reportedGeneration != reportGeneration) {
+            reportedGeneration = reportGeneration;
             ReportThreadStats();
-            if (--reporterCount == 0)
+            if (--reporterCount == 0) {
                 // Once all worker threads have merged their stats, wake up
                 // the main thread.
+                std::lock_guard<std::mutex> lock(reportDoneMutex);
                 reportDoneCondition.notify_one();
-            // Now sleep again.
-            workListCondition.wait(lock);
-        } else if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
-        } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop &loop = *workList;
-
-            // Run a chunk of loop iterations for _loop_
-
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd =
-                std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
-
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                uint64_t oldState = ProfilerState;
-                ProfilerState = loop.profilerState;
-                if (loop.func1D) {
-                    loop.func1D(index);
-                }
-                // Handle other types of loops
-                else {
-                    CHECK(loop.func2D);
-                    loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-                }
-                ProfilerState = oldState;
             }
-            lock.lock();
-
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) workListCondition.notify_all();
+        } else if (ParallelForLoop *loop = AcquireLoop(0)) {
+            // Run loop iterations until none are left to claim
+            loop->Run();
+            ReleaseLoop(loop);
+        } else {
+            // Sleep until there are more tasks to run
+            std::unique_lock<std::mutex> lock(workMutex);
+            workCondition.wait(lock, [&] { return workEpoch != epoch; });
         }
     }
     LOG(INFO) << "Exiting worker thread " << tIndex;
 }
 
+// Runs _loop_ to completion in the calling thread, making it available to
+// the other threads for as long as it has iterations left to claim.
+static void RunLoop(ParallelForLoop &loop) {
+    ++nLoopsStarted;
+    // Add _loop_ to the back of our queue and notify worker threads
+    WorkQueue &queue = *workQueues[ThreadIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.loops.push_back(&loop);
+        ++queue.size;
+    }
+    WakeWorkers();
+
+    // Help out with parallel loop iterations in the current thread
+    loop.Run();
+    loop.WaitForHelpers();
+}
+
 // Parallel Definitions
 void ParallelFor(std::function<void(int64_t)> func, int64_t count,
                  int chunkSize) {
@@ -191,51 +328,9 @@ void ParallelFor(std::function<void(int64_t)> func, int64_t count,
         return;
     }
 
-    // Create and enqueue _ParallelForLoop_ for this loop
     ParallelForLoop loop(std::move(func), count, chunkSize,
                          CurrentProfilerState());
-    workListMutex.lock();
-    loop.next = workList;
-    workList = &loop;
-    workListMutex.unlock();
-
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    RunLoop(loop);
 }
 
 PBRT_THREAD_LOCAL int ThreadIndex;
@@ -254,48 +349,21 @@ void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count) {
     }
 
     ParallelForLoop loop(std::move(func), count, CurrentProfilerState());
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList = &loop;
-    }
-
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
+    RunLoop(loop);
+}
 
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
+bool ParallelRunning() { return !threads.empty(); }
 
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
+void ParallelForRanges(std::function<void(int64_t, int64_t)> func,
+                       int64_t count, int64_t rangeSize) {
+    if (count <= rangeSize || !ParallelRunning()) {
+        if (count > 0) func(0, count);
+        return;
     }
+    ParallelFor([&](int64_t range) {
+        int64_t start = range * rangeSize;
+        func(start, std::min(start + rangeSize, count));
+    }, (count + rangeSize - 1) / rangeSize);
 }
 
 int NumSystemCores() {
@@ -307,6 +375,10 @@ void ParallelInit() {
     int nThreads = MaxThreadIndex();
     ThreadIndex = 0;
 
+    // Allocate a work queue for each thread, including the main thread
+    for (int i = 0; i < nThreads; ++i)
+        workQueues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+
     // Create a barrier so that we can be sure all worker threads get past
     // their call to ProfilerWorkerThreadInit() before we return from this
     // function.  In turn, we can be sure that the profiling system isn't
@@ -322,32 +394,33 @@ void ParallelInit() {
 }
 
 void ParallelCleanup() {
-    if (threads.empty()) return;
-
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        shutdownThreads = true;
-        workListCondition.notify_all();
+    if (threads.empty()) {
+        workQueues.clear();
+        return;
     }
 
+    shutdownThreads = true;
+    WakeWorkers();
+
     for (std::thread &thread : threads) thread.join();
     threads.erase(threads.begin(), threads.end());
+    workQueues.clear();
     shutdownThreads = false;
 }
 
 void MergeWorkerThreadStats() {
-    std::unique_lock<std::mutex> lock(workListMutex);
     std::unique_lock<std::mutex> doneLock(reportDoneMutex);
     // Set up state so that the worker threads will know that we would like
     // them to report their thread-specific stats when they wake up.
-    reportWorkerStats = true;
     reporterCount = threads.size();
+    ++reportGeneration;
+    reportWorkerStats = true;
 
     // Wake up the worker threads.
-    workListCondition.notify_all();
+    WakeWorkers();
 
     // Wait for all of them to merge their stats.
-    reportDoneCondition.wait(lock, []() { return reporterCount == 0; });
+    reportDoneCondition.wait(doneLock, []() { return reporterCount == 0; });
 
     reportWorkerStats = false;
 }
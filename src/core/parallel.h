@@ -104,6 +104,15 @@ extern PBRT_THREAD_LOCAL int ThreadIndex;
 void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count);
 int MaxThreadIndex();
 int NumSystemCores();
+// Returns true once ParallelInit() has started the worker threads; code
+// that may run before then (e.g. in tests) can use it to decide whether
+// to call ParallelFor().
+bool ParallelRunning();
+// Calls _func_ with consecutive ranges [start, end) of at most _rangeSize_
+// iterations that together cover [0, count); the ranges are processed in
+// parallel if there's more than one of them and ParallelRunning().
+void ParallelForRanges(std::function<void(int64_t, int64_t)> func,
+                       int64_t count, int64_t rangeSize);
 
 void ParallelInit();
 void ParallelCleanup();
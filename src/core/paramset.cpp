@@ -35,34 +35,58 @@
 #include "paramset.h"
 #include "floatfile.h"
 #include "textures/constant.h"
+#include <mutex>
 
 namespace pbrt {
 
 // ParamSet Macros
 #define ADD_PARAM_TYPE(T, vec) \
-    (vec).emplace_back(new ParamSetItem<T>(name, std::move(values), nValues));
-#define LOOKUP_PTR(vec)             \
-    for (const auto &v : vec)       \
-        if (v->name == name) {      \
-            *nValues = v->nValues;  \
-            v->lookedUp = true;     \
-            return v->values.get(); \
-        }                           \
+    addItem(vec, new ParamSetItem<T>(name, std::move(values), nValues));
+#define LOOKUP_PTR(vec)                                         \
+    if (const auto *v = findItem(vec, name)) {                  \
+        *nValues = v->nValues;                                  \
+        v->lookedUp.store(true, std::memory_order_relaxed);     \
+        return v->values.get();                                 \
+    }                                                           \
     return nullptr
-#define LOOKUP_ONE(vec)                           \
-    for (const auto &v : vec)                     \
-        if (v->name == name && v->nValues == 1) { \
-            v->lookedUp = true;                   \
-            return v->values[0];                  \
-        }                                         \
+#define LOOKUP_ONE(vec)                                         \
+    if (const auto *v = findItem(vec, name))                    \
+        if (v->nValues == 1) {                                  \
+            v->lookedUp.store(true, std::memory_order_relaxed); \
+            return v->values[0];                                \
+        }                                                       \
     return d
 
 // ParamSet Methods
+// Each name in a ParamSet sets one bit of _nameBits_, chosen by its hash,
+// so that most lookups of parameters that aren't there (most of those of
+// TextureParams in a shape's parameters, for example) return right away.
+static inline uint64_t nameBit(uint64_t hash) {
+    return uint64_t(1) << (hash >> 58);
+}
+
+template <typename T>
+void ParamSet::addItem(std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+                       ParamSetItem<T> *item) {
+    nameBits |= nameBit(item->nameHash);
+    items.emplace_back(item);
+}
+
+template <typename T>
+const ParamSetItem<T> *ParamSet::findItem(
+    const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+    const std::string &name) const {
+    uint64_t hash = HashParamName(name);
+    if (!(nameBits & nameBit(hash))) return nullptr;
+    for (const auto &item : items)
+        if (item->nameHash == hash && item->name == name) return item.get();
+    return nullptr;
+}
+
 void ParamSet::AddFloat(const std::string &name,
                         std::unique_ptr<Float[]> values, int nValues) {
     EraseFloat(name);
-    floats.emplace_back(
-        new ParamSetItem<Float>(name, std::move(values), nValues));
+    ADD_PARAM_TYPE(Float, floats);
 }
 
 void ParamSet::AddInt(const std::string &name, std::unique_ptr<int[]> values,
@@ -114,9 +138,7 @@ void ParamSet::AddRGBSpectrum(const std::string &name,
     nValues /= 3;
     std::unique_ptr<Spectrum[]> s(new Spectrum[nValues]);
     for (int i = 0; i < nValues; ++i) s[i] = Spectrum::FromRGB(&values[3 * i]);
-    std::shared_ptr<ParamSetItem<Spectrum>> psi(
-        new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    addItem(spectra, new ParamSetItem<Spectrum>(name, std::move(s), nValues));
 }
 
 void ParamSet::AddXYZSpectrum(const std::string &name,
@@ -126,9 +148,7 @@ void ParamSet::AddXYZSpectrum(const std::string &name,
     nValues /= 3;
     std::unique_ptr<Spectrum[]> s(new Spectrum[nValues]);
     for (int i = 0; i < nValues; ++i) s[i] = Spectrum::FromXYZ(&values[3 * i]);
-    std::shared_ptr<ParamSetItem<Spectrum>> psi(
-        new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    addItem(spectra, new ParamSetItem<Spectrum>(name, std::move(s), nValues));
 }
 
 void ParamSet::AddBlackbodySpectrum(const std::string &name,
@@ -144,9 +164,7 @@ void ParamSet::AddBlackbodySpectrum(const std::string &name,
         s[i] = values[2 * i + 1] *
                Spectrum::FromSampled(CIE_lambda, v.get(), nCIESamples);
     }
-    std::shared_ptr<ParamSetItem<Spectrum>> psi(
-        new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    addItem(spectra, new ParamSetItem<Spectrum>(name, std::move(s), nValues));
 }
 
 void ParamSet::AddSampledSpectrum(const std::string &name,
@@ -163,15 +181,17 @@ void ParamSet::AddSampledSpectrum(const std::string &name,
     }
     std::unique_ptr<Spectrum[]> s(new Spectrum[1]);
     s[0] = Spectrum::FromSampled(wl.get(), v.get(), nValues);
-    std::shared_ptr<ParamSetItem<Spectrum>> psi(
-        new ParamSetItem<Spectrum>(name, std::move(s), 1));
-    spectra.push_back(psi);
+    addItem(spectra, new ParamSetItem<Spectrum>(name, std::move(s), 1));
 }
 
+static std::mutex cachedSpectraMutex;
+
 void ParamSet::AddSampledSpectrumFiles(const std::string &name,
                                        const char **names, int nValues) {
     EraseSpectrum(name);
     std::unique_ptr<Spectrum[]> s(new Spectrum[nValues]);
+    // Files given to Import are parsed in parallel
+    std::lock_guard<std::mutex> lock(cachedSpectraMutex);
     for (int i = 0; i < nValues; ++i) {
         std::string fn = AbsolutePath(ResolveFilename(names[i]));
         if (cachedSpectra.find(fn) != cachedSpectra.end()) {
@@ -202,9 +222,7 @@ void ParamSet::AddSampledSpectrumFiles(const std::string &name,
         cachedSpectra[fn] = s[i];
     }
 
-    std::shared_ptr<ParamSetItem<Spectrum>> psi(
-        new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    addItem(spectra, new ParamSetItem<Spectrum>(name, std::move(s), nValues));
 }
 
 std::map<std::string, Spectrum> ParamSet::cachedSpectra;
@@ -218,9 +236,7 @@ void ParamSet::AddTexture(const std::string &name, const std::string &value) {
     EraseTexture(name);
     std::unique_ptr<std::string[]> str(new std::string[1]);
     str[0] = value;
-    std::shared_ptr<ParamSetItem<std::string>> psi(
-        new ParamSetItem<std::string>(name, std::move(str), 1));
-    textures.push_back(psi);
+    addItem(textures, new ParamSetItem<std::string>(name, std::move(str), 1));
 }
 
 bool ParamSet::EraseInt(const std::string &n) {
@@ -323,22 +339,12 @@ bool ParamSet::EraseTexture(const std::string &n) {
 }
 
 Float ParamSet::FindOneFloat(const std::string &name, Float d) const {
-    for (const auto &f : floats)
-        if (f->name == name && f->nValues == 1) {
-            f->lookedUp = true;
-            return f->values[0];
-        }
-    return d;
+    LOOKUP_ONE(floats);
 }
 
-const Float *ParamSet::FindFloat(const std::string &name, int *n) const {
-    for (const auto &f : floats)
-        if (f->name == name) {
-            *n = f->nValues;
-            f->lookedUp = true;
-            return f->values.get();
-        }
-    return nullptr;
+const Float *ParamSet::FindFloat(const std::string &name,
+                                 int *nValues) const {
+    LOOKUP_PTR(floats);
 }
 
 const int *ParamSet::FindInt(const std::string &name, int *nValues) const {
@@ -443,7 +449,7 @@ std::string ParamSet::FindTexture(const std::string &name) const {
 void ParamSet::ReportUnused() const {
 #define CHECK_UNUSED(v)                                                 \
     for (size_t i = 0; i < (v).size(); ++i)                             \
-        if (!(v)[i]->lookedUp)                                          \
+        if (!(v)[i]->lookedUp.load(std::memory_order_relaxed))          \
             Warning("Parameter \"%s\" not used", (v)[i]->name.c_str())
     CHECK_UNUSED(ints);
     CHECK_UNUSED(bools);
@@ -472,6 +478,7 @@ void ParamSet::Clear() {
     DEL_PARAMS(strings);
     DEL_PARAMS(textures);
 #undef DEL_PARAMS
+    nameBits = 0;
 }
 
 std::string ParamSet::ToString() const {
@@ -716,6 +723,117 @@ void ParamSet::Print(int indent) const {
     printItems("rgb", indent, spectra);
 }
 
+// ParamSet binary serialization. Values are written in the host's native
+// representation, so data is only portable across machines with the same
+// architecture and _Float_ and _Spectrum_ types.
+static void writeBytes(std::string *out, const void *data, size_t size) {
+    out->append((const char *)data, size);
+}
+static void writeString(std::string *out, const std::string &s) {
+    uint32_t len = s.size();
+    writeBytes(out, &len, sizeof(len));
+    writeBytes(out, s.data(), len);
+}
+static bool readBytes(const char **ptr, const char *end, void *data,
+                      size_t size) {
+    if (size > size_t(end - *ptr)) return false;
+    memcpy(data, *ptr, size);
+    *ptr += size;
+    return true;
+}
+static bool readString(const char **ptr, const char *end, std::string *s) {
+    uint32_t len;
+    if (!readBytes(ptr, end, &len, sizeof(len)) || len > size_t(end - *ptr))
+        return false;
+    s->assign(*ptr, len);
+    *ptr += len;
+    return true;
+}
+
+template <typename T>
+static void writeValues(std::string *out, const T *values, int nValues) {
+    writeBytes(out, values, nValues * sizeof(T));
+}
+static void writeValues(std::string *out, const std::string *values,
+                        int nValues) {
+    for (int i = 0; i < nValues; ++i) writeString(out, values[i]);
+}
+template <typename T>
+static bool readValues(const char **ptr, const char *end, T *values,
+                       int nValues) {
+    return readBytes(ptr, end, values, nValues * sizeof(T));
+}
+static bool readValues(const char **ptr, const char *end,
+                       std::string *values, int nValues) {
+    for (int i = 0; i < nValues; ++i)
+        if (!readString(ptr, end, &values[i])) return false;
+    return true;
+}
+
+template <typename T>
+static void serializeItems(
+    std::string *out,
+    const std::vector<std::shared_ptr<ParamSetItem<T>>> &items) {
+    uint32_t count = items.size();
+    writeBytes(out, &count, sizeof(count));
+    for (const auto &item : items) {
+        writeString(out, item->name);
+        int32_t nValues = item->nValues;
+        writeBytes(out, &nValues, sizeof(nValues));
+        writeValues(out, item->values.get(), nValues);
+    }
+}
+
+template <typename T>
+static bool deserializeItems(
+    const char **ptr, const char *end,
+    std::vector<std::shared_ptr<ParamSetItem<T>>> &items, uint64_t *nameBits) {
+    uint32_t count;
+    if (!readBytes(ptr, end, &count, sizeof(count))) return false;
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string name;
+        int32_t nValues;
+        if (!readString(ptr, end, &name) ||
+            !readBytes(ptr, end, &nValues, sizeof(nValues)) || nValues < 0 ||
+            size_t(nValues) > size_t(end - *ptr))
+            return false;
+        std::unique_ptr<T[]> values(new T[nValues]);
+        if (!readValues(ptr, end, values.get(), nValues)) return false;
+        items.emplace_back(
+            new ParamSetItem<T>(name, std::move(values), nValues));
+        *nameBits |= nameBit(items.back()->nameHash);
+    }
+    return true;
+}
+
+void ParamSet::Serialize(std::string *out) const {
+    serializeItems(out, ints);
+    serializeItems(out, bools);
+    serializeItems(out, floats);
+    serializeItems(out, point2fs);
+    serializeItems(out, vector2fs);
+    serializeItems(out, point3fs);
+    serializeItems(out, vector3fs);
+    serializeItems(out, normals);
+    serializeItems(out, spectra);
+    serializeItems(out, strings);
+    serializeItems(out, textures);
+}
+
+bool ParamSet::Deserialize(const char **ptr, const char *end) {
+    return deserializeItems(ptr, end, ints, &nameBits) &&
+           deserializeItems(ptr, end, bools, &nameBits) &&
+           deserializeItems(ptr, end, floats, &nameBits) &&
+           deserializeItems(ptr, end, point2fs, &nameBits) &&
+           deserializeItems(ptr, end, vector2fs, &nameBits) &&
+           deserializeItems(ptr, end, point3fs, &nameBits) &&
+           deserializeItems(ptr, end, vector3fs, &nameBits) &&
+           deserializeItems(ptr, end, normals, &nameBits) &&
+           deserializeItems(ptr, end, spectra, &nameBits) &&
+           deserializeItems(ptr, end, strings, &nameBits) &&
+           deserializeItems(ptr, end, textures, &nameBits);
+}
+
 // TextureParams Method Definitions
 std::shared_ptr<Texture<Spectrum>> TextureParams::GetSpectrumTexture(
     const std::string &n, const Spectrum &def) const {
@@ -822,7 +940,7 @@ reportUnusedMaterialParams(
     const std::vector<std::shared_ptr<ParamSetItem<T>>> &mtl,
     const std::vector<std::shared_ptr<ParamSetItem<T>>> &geom) {
     for (const auto &param : mtl) {
-        if (param->lookedUp)
+        if (param->lookedUp.load(std::memory_order_relaxed))
             continue;
 
         // Don't complain about any unused material parameters if their
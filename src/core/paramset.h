@@ -45,10 +45,23 @@
 #include "texture.h"
 #include "spectrum.h"
 #include <stdio.h>
+#include <atomic>
 #include <map>
 
 namespace pbrt {
 
+// Hashes the names of parameters (64-bit FNV-1a); _ParamSetItem_s store the
+// hash of their name so that lookups only compare the names of items whose
+// hashes match.
+inline uint64_t HashParamName(const std::string &name) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : name) {
+        hash ^= uint8_t(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
 // ParamSet Declarations
 class ParamSet {
   public:
@@ -119,11 +132,25 @@ class ParamSet {
     void Clear();
     std::string ToString() const;
     void Print(int indent) const;
+    // Appends a binary representation of the parameters to _out_;
+    // Deserialize() adds the parameters it reads starting at _*ptr_ and
+    // advances it past them, returning false if the data is malformed.
+    void Serialize(std::string *out) const;
+    bool Deserialize(const char **ptr, const char *end);
 
   private:
     friend class TextureParams;
     friend bool shapeMaySetMaterialParameters(const ParamSet &ps);
 
+    // ParamSet Private Methods
+    template <typename T>
+    void addItem(std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+                 ParamSetItem<T> *item);
+    template <typename T>
+    const ParamSetItem<T> *findItem(
+        const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+        const std::string &name) const;
+
     // ParamSet Private Data
     std::vector<std::shared_ptr<ParamSetItem<bool>>> bools;
     std::vector<std::shared_ptr<ParamSetItem<int>>> ints;
@@ -137,6 +164,8 @@ class ParamSet {
     std::vector<std::shared_ptr<ParamSetItem<std::string>>> strings;
     std::vector<std::shared_ptr<ParamSetItem<std::string>>> textures;
     static std::map<std::string, Spectrum> cachedSpectra;
+    // One bit for each parameter name, selected by its hash
+    uint64_t nameBits = 0;
 };
 
 template <typename T>
@@ -147,16 +176,22 @@ struct ParamSetItem {
 
     // ParamSetItem Data
     const std::string name;
+    const uint64_t nameHash;
     const std::unique_ptr<T[]> values;
     const int nValues;
-    mutable bool lookedUp = false;
+    // Set by lookups and read by ReportUnused(); items may be shared
+    // between ParamSets used concurrently (e.g. by parallel Imports).
+    mutable std::atomic<bool> lookedUp{false};
 };
 
 // ParamSetItem Methods
 template <typename T>
 ParamSetItem<T>::ParamSetItem(const std::string &name, std::unique_ptr<T[]> v,
                               int nValues)
-    : name(name), values(std::move(v)), nValues(nValues) {}
+    : name(name),
+      nameHash(HashParamName(name)),
+      values(std::move(v)),
+      nValues(nValues) {}
 
 // TextureParams Declarations
 class TextureParams {
@@ -36,6 +36,7 @@
 #include "fileutil.h"
 #include "memory.h"
 #include "paramset.h"
+#include "scenecache.h"
 #include "stats.h"
 
 #include <ctype.h>
@@ -59,7 +60,7 @@
 
 namespace pbrt {
 
-Loc *parserLoc;
+PBRT_THREAD_LOCAL Loc *parserLoc;
 
 static std::string toString(string_view s) {
     return std::string(s.data(), s.size());
@@ -317,7 +318,87 @@ string_view Tokenizer::Next() {
     }
 }
 
-static double parseNumber(string_view str) {
+// Powers of ten that are exactly representable as doubles.
+static PBRT_CONSTEXPR double exactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Converts the common forms of numbers in scene files (an optional sign,
+// at most 19 significant digits, an optional fraction and a small
+// exponent) without going through strto[ld](). When both the digits and
+// the power of ten are exactly representable as doubles, a single
+// multiplication or division gives the correctly rounded result.  Returns
+// false for anything else, which is then left to the C library.
+static bool parseNumberFast(string_view str, double *val) {
+    const char *ptr = str.begin(), *end = str.end();
+    bool negative = false, isInteger = true;
+    if (ptr != end && (*ptr == '-' || *ptr == '+')) {
+        negative = *ptr++ == '-';
+        isInteger = false;
+    }
+
+    uint64_t digits = 0;
+    int nDigits = 0, nSignificant = 0, exponent = 0;
+    auto addDigit = [&](char ch) {
+        ++nDigits;
+        if (nSignificant > 0 || ch != '0') ++nSignificant;
+        digits = 10 * digits + (ch - '0');
+    };
+    while (ptr != end && *ptr >= '0' && *ptr <= '9') addDigit(*ptr++);
+    if (ptr != end && *ptr == '.') {
+        isInteger = false;
+        for (++ptr; ptr != end && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+            addDigit(*ptr);
+            --exponent;
+        }
+    }
+    if (nDigits == 0 || nSignificant > 19) return false;
+
+    if (ptr != end && (*ptr == 'e' || *ptr == 'E')) {
+        isInteger = false;
+        ++ptr;
+        bool negativeExponent = false;
+        if (ptr != end && (*ptr == '-' || *ptr == '+'))
+            negativeExponent = *ptr++ == '-';
+        if (ptr == end || *ptr < '0' || *ptr > '9') return false;
+        int e = 0;
+        for (; ptr != end && *ptr >= '0' && *ptr <= '9'; ++ptr)
+            if (e < 10000) e = 10 * e + (*ptr - '0');
+        exponent += negativeExponent ? -e : e;
+    }
+    if (ptr != end) return false;
+
+    if (digits == 0) {
+        *val = negative ? -0. : 0.;
+        return true;
+    }
+    if (digits > (uint64_t(1) << 53) || exponent < -22 || exponent > 22)
+        return false;
+
+    double v = (exponent < 0) ? double(digits) / exactPowersOfTen[-exponent]
+                              : double(digits) * exactPowersOfTen[exponent];
+    // Plain integers are returned exactly, as strtol() would give them, so
+    // that large integer parameters survive; everything else is rounded
+    // the way strtof() would when Floats are floats.
+    if (sizeof(Float) == sizeof(float) && !isInteger) {
+        // Rounding to a double and then to a float only differs from
+        // rounding directly to a float if the double lands exactly halfway
+        // between two floats; leave those and values outside the range of
+        // normal floats to strtof().
+        if (v > std::numeric_limits<float>::max() ||
+            v < std::numeric_limits<float>::min())
+            return false;
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(double));
+        const uint64_t halfwayMask = (uint64_t(1) << 29) - 1;
+        if ((bits & halfwayMask) == (uint64_t(1) << 28)) return false;
+        v = float(v);
+    }
+    *val = negative ? -v : v;
+    return true;
+}
+
+double ParseNumber(string_view str) {
     // Fast path for a single digit
     if (str.size() == 1) {
         if (!(str[0] >= '0' && str[0] <= '9')) {
@@ -327,6 +408,9 @@ static double parseNumber(string_view str) {
         return str[0] - '0';
     }
 
+    double val;
+    if (parseNumberFast(str, &val)) return val;
+
     // Copy to a buffer so we can NUL-terminate it, as strto[idf]() expect.
     char buf[64];
     char *bufp = buf;
@@ -349,7 +433,6 @@ static double parseNumber(string_view str) {
     };
 
     char *endptr = nullptr;
-    double val;
     if (isInteger(str))
         val = double(strtol(bufp, &endptr, 10));
     else if (sizeof(Float) == sizeof(float))
@@ -382,7 +465,15 @@ static string_view dequoteString(string_view str) {
 
 struct ParamListItem {
     std::string name;
-    double *doubleValues = nullptr;
+    // The parameter's type and name, as found by lookupType()
+    bool typeKnown = false;
+    int type;
+    std::string paramName;
+    // Numeric values are converted to the parameter's element type as
+    // they are parsed; integer parameters use _intValues_ and all others
+    // _floatValues_.
+    int *intValues = nullptr;
+    Float *floatValues = nullptr;
     const char **stringValues = nullptr;
     size_t size = 0;
     bool isString = false;
@@ -520,9 +611,9 @@ static const char *paramTypeToName(int type) {
 
 static void AddParam(ParamSet &ps, const ParamListItem &item,
                      SpectrumType spectrumType) {
-    int type;
-    std::string name;
-    if (lookupType(item.name, &type, name)) {
+    int type = item.type;
+    const std::string &name = item.paramName;
+    if (item.typeKnown) {
         if (type == PARAM_TYPE_TEXTURE || type == PARAM_TYPE_STRING ||
             type == PARAM_TYPE_BOOL) {
             if (!item.stringValues) {
@@ -545,11 +636,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
 
         int nItems = item.size;
         if (type == PARAM_TYPE_INT) {
-            // parser doesn't handle ints, so convert from doubles here....
-            int nAlloc = nItems;
-            std::unique_ptr<int[]> idata(new int[nAlloc]);
-            for (int j = 0; j < nAlloc; ++j)
-                idata[j] = int(item.doubleValues[j]);
+            std::unique_ptr<int[]> idata(new int[nItems]);
+            std::copy(item.intValues, item.intValues + nItems, idata.get());
             ps.AddInt(name, std::move(idata), nItems);
         } else if (type == PARAM_TYPE_BOOL) {
             // strings -> bools
@@ -572,7 +660,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
             ps.AddBool(name, std::move(bdata), nItems);
         } else if (type == PARAM_TYPE_FLOAT) {
             std::unique_ptr<Float[]> floats(new Float[nItems]);
-            for (int i = 0; i < nItems; ++i) floats[i] = item.doubleValues[i];
+            std::copy(item.floatValues, item.floatValues + nItems,
+                      floats.get());
             ps.AddFloat(name, std::move(floats), nItems);
         } else if (type == PARAM_TYPE_POINT2) {
             if ((nItems % 2) != 0)
@@ -582,8 +671,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     item.name.c_str());
             std::unique_ptr<Point2f[]> pts(new Point2f[nItems / 2]);
             for (int i = 0; i < nItems / 2; ++i) {
-                pts[i].x = item.doubleValues[2 * i];
-                pts[i].y = item.doubleValues[2 * i + 1];
+                pts[i].x = item.floatValues[2 * i];
+                pts[i].y = item.floatValues[2 * i + 1];
             }
             ps.AddPoint2f(name, std::move(pts), nItems / 2);
         } else if (type == PARAM_TYPE_VECTOR2) {
@@ -594,8 +683,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     item.name.c_str());
             std::unique_ptr<Vector2f[]> vecs(new Vector2f[nItems / 2]);
             for (int i = 0; i < nItems / 2; ++i) {
-                vecs[i].x = item.doubleValues[2 * i];
-                vecs[i].y = item.doubleValues[2 * i + 1];
+                vecs[i].x = item.floatValues[2 * i];
+                vecs[i].y = item.floatValues[2 * i + 1];
             }
             ps.AddVector2f(name, std::move(vecs), nItems / 2);
         } else if (type == PARAM_TYPE_POINT3) {
@@ -606,9 +695,9 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     item.name.c_str(), nItems % 3);
             std::unique_ptr<Point3f[]> pts(new Point3f[nItems / 3]);
             for (int i = 0; i < nItems / 3; ++i) {
-                pts[i].x = item.doubleValues[3 * i];
-                pts[i].y = item.doubleValues[3 * i + 1];
-                pts[i].z = item.doubleValues[3 * i + 2];
+                pts[i].x = item.floatValues[3 * i];
+                pts[i].y = item.floatValues[3 * i + 1];
+                pts[i].z = item.floatValues[3 * i + 2];
             }
             ps.AddPoint3f(name, std::move(pts), nItems / 3);
         } else if (type == PARAM_TYPE_VECTOR3) {
@@ -619,9 +708,9 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     item.name.c_str(), nItems % 3);
             std::unique_ptr<Vector3f[]> vecs(new Vector3f[nItems / 3]);
             for (int j = 0; j < nItems / 3; ++j) {
-                vecs[j].x = item.doubleValues[3 * j];
-                vecs[j].y = item.doubleValues[3 * j + 1];
-                vecs[j].z = item.doubleValues[3 * j + 2];
+                vecs[j].x = item.floatValues[3 * j];
+                vecs[j].y = item.floatValues[3 * j + 1];
+                vecs[j].z = item.floatValues[3 * j + 2];
             }
             ps.AddVector3f(name, std::move(vecs), nItems / 3);
         } else if (type == PARAM_TYPE_NORMAL) {
@@ -632,9 +721,9 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     item.name.c_str(), nItems % 3);
             std::unique_ptr<Normal3f[]> normals(new Normal3f[nItems / 3]);
             for (int j = 0; j < nItems / 3; ++j) {
-                normals[j].x = item.doubleValues[3 * j];
-                normals[j].y = item.doubleValues[3 * j + 1];
-                normals[j].z = item.doubleValues[3 * j + 2];
+                normals[j].x = item.floatValues[3 * j];
+                normals[j].y = item.floatValues[3 * j + 1];
+                normals[j].z = item.floatValues[3 * j + 2];
             }
             ps.AddNormal3f(name, std::move(normals), nItems / 3);
         } else if (type == PARAM_TYPE_RGB) {
@@ -646,7 +735,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 nItems -= nItems % 3;
             }
             std::unique_ptr<Float[]> floats(new Float[nItems]);
-            for (int j = 0; j < nItems; ++j) floats[j] = item.doubleValues[j];
+            std::copy(item.floatValues, item.floatValues + nItems,
+                      floats.get());
             ps.AddRGBSpectrum(name, std::move(floats), nItems);
         } else if (type == PARAM_TYPE_XYZ) {
             if ((nItems % 3) != 0) {
@@ -657,7 +747,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 nItems -= nItems % 3;
             }
             std::unique_ptr<Float[]> floats(new Float[nItems]);
-            for (int j = 0; j < nItems; ++j) floats[j] = item.doubleValues[j];
+            std::copy(item.floatValues, item.floatValues + nItems,
+                      floats.get());
             ps.AddXYZSpectrum(name, std::move(floats), nItems);
         } else if (type == PARAM_TYPE_BLACKBODY) {
             if ((nItems % 2) != 0) {
@@ -668,7 +759,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 nItems -= nItems % 2;
             }
             std::unique_ptr<Float[]> floats(new Float[nItems]);
-            for (int j = 0; j < nItems; ++j) floats[j] = item.doubleValues[j];
+            std::copy(item.floatValues, item.floatValues + nItems,
+                      floats.get());
             ps.AddBlackbodySpectrum(name, std::move(floats), nItems);
         } else if (type == PARAM_TYPE_SPECTRUM) {
             if (item.stringValues) {
@@ -683,8 +775,8 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     nItems -= nItems % 2;
                 }
                 std::unique_ptr<Float[]> floats(new Float[nItems]);
-                for (int j = 0; j < nItems; ++j)
-                    floats[j] = item.doubleValues[j];
+                std::copy(item.floatValues, item.floatValues + nItems,
+                          floats.get());
                 ps.AddSampledSpectrum(name, std::move(floats), nItems);
             }
         } else if (type == PARAM_TYPE_STRING) {
@@ -706,6 +798,19 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
         Warning("Type of parameter \"%s\" is unknown", item.name.c_str());
 }
 
+// Doubles the size of *_values_, an array allocated in _arena_ that holds
+// _size_ values, once it is full.  The new elements aren't constructed,
+// since they are all assigned by the caller.
+template <typename T>
+static void growParamValues(MemoryArena &arena, T **values, size_t size,
+                            size_t *nAlloc) {
+    if (size < *nAlloc) return;
+    *nAlloc = std::max<size_t>(2 * size, 16);
+    T *newValues = arena.Alloc<T>(*nAlloc, false);
+    std::copy(*values, *values + size, newValues);
+    *values = newValues;
+}
+
 template <typename Next, typename Unget>
 ParamSet parseParams(Next nextToken, Unget ungetToken, MemoryArena &arena,
                      SpectrumType spectrumType) {
@@ -721,22 +826,18 @@ ParamSet parseParams(Next nextToken, Unget ungetToken, MemoryArena &arena,
 
         ParamListItem item;
         item.name = toString(dequoteString(decl));
+        item.typeKnown = lookupType(item.name, &item.type, item.paramName);
+        bool isInt = item.typeKnown && item.type == PARAM_TYPE_INT;
         size_t nAlloc = 0;
 
         auto addVal = [&](string_view val) {
             if (isQuotedString(val)) {
-                if (item.doubleValues) {
+                if (item.intValues || item.floatValues) {
                     Error("mixed string and numeric parameters");
                     exit(1);
                 }
-                if (item.size == nAlloc) {
-                    nAlloc = std::max<size_t>(2 * item.size, 4);
-                    const char **newData = arena.Alloc<const char *>(nAlloc);
-                    std::copy(item.stringValues, item.stringValues + item.size,
-                              newData);
-                    item.stringValues = newData;
-                }
-
+                growParamValues(arena, &item.stringValues, item.size,
+                                &nAlloc);
                 val = dequoteString(val);
                 char *buf = arena.Alloc<char>(val.size() + 1);
                 memcpy(buf, val.data(), val.size());
@@ -748,14 +849,15 @@ ParamSet parseParams(Next nextToken, Unget ungetToken, MemoryArena &arena,
                     exit(1);
                 }
 
-                if (item.size == nAlloc) {
-                    nAlloc = std::max<size_t>(2 * item.size, 4);
-                    double *newData = arena.Alloc<double>(nAlloc);
-                    std::copy(item.doubleValues, item.doubleValues + item.size,
-                              newData);
-                    item.doubleValues = newData;
+                if (isInt) {
+                    growParamValues(arena, &item.intValues, item.size,
+                                    &nAlloc);
+                    item.intValues[item.size++] = int(ParseNumber(val));
+                } else {
+                    growParamValues(arena, &item.floatValues, item.size,
+                                    &nAlloc);
+                    item.floatValues[item.size++] = ParseNumber(val);
                 }
-                item.doubleValues[item.size++] = parseNumber(val);
             }
         };
 
@@ -820,6 +922,7 @@ static void parse(std::unique_ptr<Tokenizer> t) {
             std::string filename =
                 toString(dequoteString(nextToken(TokenRequired)));
             filename = AbsolutePath(ResolveFilename(filename));
+            AddSceneCacheDependency(filename);
             auto tokError = [](const char *msg) { Error("%s", msg); };
             std::unique_ptr<Tokenizer> tinc =
                 Tokenizer::CreateFromFile(filename, tokError);
@@ -848,15 +951,22 @@ static void parse(std::unique_ptr<Tokenizer> t) {
     MemoryArena arena;
 
     // Helper function for pbrt API entrypoints that take a single string
-    // parameter and a ParamSet (e.g. pbrtShape()).
+    // parameter and a ParamSet (e.g. pbrtShape()). Any additional strings
+    // that were passed to the entrypoint are given in _cacheStrings_ for
+    // the scene cache.
     auto basicParamListEntrypoint = [&](
-        SpectrumType spectrumType,
-        std::function<void(const std::string &n, ParamSet p)> apiFunc) {
+        SpectrumType spectrumType, SceneCacheOp op,
+        std::function<void(const std::string &n, ParamSet p)> apiFunc,
+        std::vector<std::string> cacheStrings = {}) {
         string_view token = nextToken(TokenRequired);
         string_view dequoted = dequoteString(token);
         std::string n = toString(dequoted);
         ParamSet params =
             parseParams(nextToken, ungetToken, arena, spectrumType);
+        if (SceneCacheRecording()) {
+            cacheStrings.push_back(n);
+            RecordSceneCacheCall(op, cacheStrings, nullptr, 0, &params);
+        }
         apiFunc(n, std::move(params));
     };
 
@@ -871,25 +981,33 @@ static void parse(std::unique_ptr<Tokenizer> t) {
 
         switch (tok[0]) {
         case 'A':
-            if (tok == "AttributeBegin")
+            if (tok == "AttributeBegin") {
+                RecordSceneCacheCall(SceneCacheOp::AttributeBegin);
                 pbrtAttributeBegin();
-            else if (tok == "AttributeEnd")
+            } else if (tok == "AttributeEnd") {
+                RecordSceneCacheCall(SceneCacheOp::AttributeEnd);
                 pbrtAttributeEnd();
-            else if (tok == "ActiveTransform") {
+            } else if (tok == "ActiveTransform") {
                 string_view a = nextToken(TokenRequired);
-                if (a == "All")
+                if (a == "All") {
+                    RecordSceneCacheCall(SceneCacheOp::ActiveTransformAll);
                     pbrtActiveTransformAll();
-                else if (a == "EndTime")
+                } else if (a == "EndTime") {
+                    RecordSceneCacheCall(SceneCacheOp::ActiveTransformEndTime);
                     pbrtActiveTransformEndTime();
-                else if (a == "StartTime")
+                } else if (a == "StartTime") {
+                    RecordSceneCacheCall(
+                        SceneCacheOp::ActiveTransformStartTime);
                     pbrtActiveTransformStartTime();
-                else
+                } else
                     syntaxError(tok);
             } else if (tok == "AreaLightSource")
                 basicParamListEntrypoint(SpectrumType::Illuminant,
+                                         SceneCacheOp::AreaLightSource,
                                          pbrtAreaLightSource);
             else if (tok == "Accelerator")
                 basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::Accelerator,
                                          pbrtAccelerator);
             else
                 syntaxError(tok);
@@ -900,24 +1018,33 @@ static void parse(std::unique_ptr<Tokenizer> t) {
                 if (nextToken(TokenRequired) != "[") syntaxError(tok);
                 Float m[16];
                 for (int i = 0; i < 16; ++i)
-                    m[i] = parseNumber(nextToken(TokenRequired));
+                    m[i] = ParseNumber(nextToken(TokenRequired));
                 if (nextToken(TokenRequired) != "]") syntaxError(tok);
+                RecordSceneCacheCall(SceneCacheOp::ConcatTransform, {}, m, 16);
                 pbrtConcatTransform(m);
             } else if (tok == "CoordinateSystem") {
                 string_view n = dequoteString(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::CoordinateSystem,
+                                     {toString(n)});
                 pbrtCoordinateSystem(toString(n));
             } else if (tok == "CoordSysTransform") {
                 string_view n = dequoteString(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::CoordSysTransform,
+                                     {toString(n)});
                 pbrtCoordSysTransform(toString(n));
             } else if (tok == "Camera")
-                basicParamListEntrypoint(SpectrumType::Reflectance, pbrtCamera);
+                basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::Camera,
+                                         pbrtCamera);
             else
                 syntaxError(tok);
             break;
 
         case 'F':
             if (tok == "Film")
-                basicParamListEntrypoint(SpectrumType::Reflectance, pbrtFilm);
+                basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::Film,
+                                         pbrtFilm);
             else
                 syntaxError(tok);
             break;
@@ -925,21 +1052,44 @@ static void parse(std::unique_ptr<Tokenizer> t) {
         case 'I':
             if (tok == "Integrator")
                 basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::Integrator,
                                          pbrtIntegrator);
-            else if (tok == "Identity")
+            else if (tok == "Identity") {
+                RecordSceneCacheCall(SceneCacheOp::Identity);
                 pbrtIdentity();
-            else
+            } else if (tok == "Import") {
+                std::string filename =
+                    toString(dequoteString(nextToken(TokenRequired)));
+                filename = AbsolutePath(ResolveFilename(filename));
+                AddSceneCacheDependency(filename);
+                if (SceneCacheRecording() || PbrtOptions.cat ||
+                    PbrtOptions.toPly) {
+                    // Parse the file in place, so that its directives are
+                    // recorded or printed in order; the attribute block
+                    // gives it the same scoping that _pbrtImport()_ does.
+                    RecordSceneCacheCall(SceneCacheOp::AttributeBegin);
+                    pbrtAttributeBegin();
+                    Loc *loc = parserLoc;
+                    ParseImportedFile(filename);
+                    parserLoc = loc;
+                    RecordSceneCacheCall(SceneCacheOp::AttributeEnd);
+                    pbrtAttributeEnd();
+                } else
+                    pbrtImport(filename);
+            } else
                 syntaxError(tok);
             break;
 
         case 'L':
             if (tok == "LightSource")
                 basicParamListEntrypoint(SpectrumType::Illuminant,
+                                         SceneCacheOp::LightSource,
                                          pbrtLightSource);
             else if (tok == "LookAt") {
                 Float v[9];
                 for (int i = 0; i < 9; ++i)
-                    v[i] = parseNumber(nextToken(TokenRequired));
+                    v[i] = ParseNumber(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::LookAt, {}, v, 9);
                 pbrtLookAt(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
                            v[8]);
             } else
@@ -949,12 +1099,15 @@ static void parse(std::unique_ptr<Tokenizer> t) {
         case 'M':
             if (tok == "MakeNamedMaterial")
                 basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::MakeNamedMaterial,
                                          pbrtMakeNamedMaterial);
             else if (tok == "MakeNamedMedium")
                 basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::MakeNamedMedium,
                                          pbrtMakeNamedMedium);
             else if (tok == "Material")
                 basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::Material,
                                          pbrtMaterial);
             else if (tok == "MediumInterface") {
                 string_view n = dequoteString(nextToken(TokenRequired));
@@ -973,6 +1126,8 @@ static void parse(std::unique_ptr<Tokenizer> t) {
                 } else
                     names[1] = names[0];
 
+                RecordSceneCacheCall(SceneCacheOp::MediumInterface,
+                                     {names[0], names[1]});
                 pbrtMediumInterface(names[0], names[1]);
             } else
                 syntaxError(tok);
@@ -981,6 +1136,8 @@ static void parse(std::unique_ptr<Tokenizer> t) {
         case 'N':
             if (tok == "NamedMaterial") {
                 string_view n = dequoteString(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::NamedMaterial,
+                                     {toString(n)});
                 pbrtNamedMaterial(toString(n));
             } else
                 syntaxError(tok);
@@ -989,11 +1146,15 @@ static void parse(std::unique_ptr<Tokenizer> t) {
         case 'O':
             if (tok == "ObjectBegin") {
                 string_view n = dequoteString(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::ObjectBegin, {toString(n)});
                 pbrtObjectBegin(toString(n));
-            } else if (tok == "ObjectEnd")
+            } else if (tok == "ObjectEnd") {
+                RecordSceneCacheCall(SceneCacheOp::ObjectEnd);
                 pbrtObjectEnd();
-            else if (tok == "ObjectInstance") {
+            } else if (tok == "ObjectInstance") {
                 string_view n = dequoteString(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::ObjectInstance,
+                                     {toString(n)});
                 pbrtObjectInstance(toString(n));
             } else
                 syntaxError(tok);
@@ -1002,18 +1163,21 @@ static void parse(std::unique_ptr<Tokenizer> t) {
         case 'P':
             if (tok == "PixelFilter")
                 basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::PixelFilter,
                                          pbrtPixelFilter);
             else
                 syntaxError(tok);
             break;
 
         case 'R':
-            if (tok == "ReverseOrientation")
+            if (tok == "ReverseOrientation") {
+                RecordSceneCacheCall(SceneCacheOp::ReverseOrientation);
                 pbrtReverseOrientation();
-            else if (tok == "Rotate") {
+            } else if (tok == "Rotate") {
                 Float v[4];
                 for (int i = 0; i < 4; ++i)
-                    v[i] = parseNumber(nextToken(TokenRequired));
+                    v[i] = ParseNumber(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::Rotate, {}, v, 4);
                 pbrtRotate(v[0], v[1], v[2], v[3]);
             } else
                 syntaxError(tok);
@@ -1021,40 +1185,49 @@ static void parse(std::unique_ptr<Tokenizer> t) {
 
         case 'S':
             if (tok == "Shape")
-                basicParamListEntrypoint(SpectrumType::Reflectance, pbrtShape);
+                basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::Shape,
+                                         pbrtShape);
             else if (tok == "Sampler")
                 basicParamListEntrypoint(SpectrumType::Reflectance,
+                                         SceneCacheOp::Sampler,
                                          pbrtSampler);
             else if (tok == "Scale") {
                 Float v[3];
                 for (int i = 0; i < 3; ++i)
-                    v[i] = parseNumber(nextToken(TokenRequired));
+                    v[i] = ParseNumber(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::Scale, {}, v, 3);
                 pbrtScale(v[0], v[1], v[2]);
             } else
                 syntaxError(tok);
             break;
 
         case 'T':
-            if (tok == "TransformBegin")
+            if (tok == "TransformBegin") {
+                RecordSceneCacheCall(SceneCacheOp::TransformBegin);
                 pbrtTransformBegin();
-            else if (tok == "TransformEnd")
+            } else if (tok == "TransformEnd") {
+                RecordSceneCacheCall(SceneCacheOp::TransformEnd);
                 pbrtTransformEnd();
-            else if (tok == "Transform") {
+            } else if (tok == "Transform") {
                 if (nextToken(TokenRequired) != "[") syntaxError(tok);
                 Float m[16];
                 for (int i = 0; i < 16; ++i)
-                    m[i] = parseNumber(nextToken(TokenRequired));
+                    m[i] = ParseNumber(nextToken(TokenRequired));
                 if (nextToken(TokenRequired) != "]") syntaxError(tok);
+                RecordSceneCacheCall(SceneCacheOp::Transform, {}, m, 16);
                 pbrtTransform(m);
             } else if (tok == "Translate") {
                 Float v[3];
                 for (int i = 0; i < 3; ++i)
-                    v[i] = parseNumber(nextToken(TokenRequired));
+                    v[i] = ParseNumber(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::Translate, {}, v, 3);
                 pbrtTranslate(v[0], v[1], v[2]);
             } else if (tok == "TransformTimes") {
                 Float v[2];
                 for (int i = 0; i < 2; ++i)
-                    v[i] = parseNumber(nextToken(TokenRequired));
+                    v[i] = ParseNumber(nextToken(TokenRequired));
+                RecordSceneCacheCall(SceneCacheOp::TransformTimes, {}, v, 2);
                 pbrtTransformTimes(v[0], v[1]);
             } else if (tok == "Texture") {
                 string_view n = dequoteString(nextToken(TokenRequired));
@@ -1063,20 +1236,23 @@ static void parse(std::unique_ptr<Tokenizer> t) {
                 std::string type = toString(n);
 
                 basicParamListEntrypoint(
-                    SpectrumType::Reflectance,
+                    SpectrumType::Reflectance, SceneCacheOp::Texture,
                     [&](const std::string &texName, const ParamSet &params) {
                         pbrtTexture(name, type, texName, params);
-                    });
+                    },
+                    {name, type});
             } else
                 syntaxError(tok);
             break;
 
         case 'W':
-            if (tok == "WorldBegin")
+            if (tok == "WorldBegin") {
+                RecordSceneCacheCall(SceneCacheOp::WorldBegin);
                 pbrtWorldBegin();
-            else if (tok == "WorldEnd")
+            } else if (tok == "WorldEnd") {
+                RecordSceneCacheCall(SceneCacheOp::WorldEnd);
                 pbrtWorldEnd();
-            else
+            } else
                 syntaxError(tok);
             break;
 
@@ -1087,7 +1263,12 @@ static void parse(std::unique_ptr<Tokenizer> t) {
 }
 
 void pbrtParseFile(std::string filename) {
-    if (filename != "-") SetSearchDirectory(DirectoryContaining(filename));
+    if (filename != "-") {
+        SetSearchDirectory(DirectoryContaining(filename));
+        AddSceneCacheDependency(filename);
+        RecordSceneCacheCall(SceneCacheOp::SearchDirectory,
+                             {DirectoryContaining(AbsolutePath(filename))});
+    }
 
     auto tokError = [](const char *msg) { Error("%s", msg); exit(1); };
     std::unique_ptr<Tokenizer> t =
@@ -1096,6 +1277,14 @@ void pbrtParseFile(std::string filename) {
     parse(std::move(t));
 }
 
+void ParseImportedFile(const std::string &filename) {
+    auto tokError = [](const char *msg) { Error("%s", msg); };
+    std::unique_ptr<Tokenizer> t =
+        Tokenizer::CreateFromFile(filename, tokError);
+    if (!t) return;
+    parse(std::move(t));
+}
+
 void pbrtParseString(std::string str) {
     auto tokError = [](const char *msg) { Error("%s", msg); exit(1); };
     std::unique_ptr<Tokenizer> t =
@@ -57,8 +57,9 @@ struct Loc {
     int line = 1, column = 0;
 };
 
-// If not nullptr, stores the current file location of the parser.
-extern Loc *parserLoc;
+// If not nullptr, stores the current file location of the parser. Each
+// thread has its own, since files given to Import are parsed in parallel.
+extern PBRT_THREAD_LOCAL Loc *parserLoc;
 
 // Reimplement enough of absl/std::string_view as needed for the below
 // (Bringing on the abseil dependency at this point just for this seems
@@ -99,6 +100,11 @@ class string_view {
     size_t length;
 };
 
+// Converts a numeric token to a double. Unsigned integers are converted
+// exactly; other numbers are rounded to a Float as strtof() or strtod()
+// would.  Exits with an error if the token isn't a number.
+double ParseNumber(string_view str);
+
 // Tokenizer converts a single pbrt scene file into a series of tokens.
 class Tokenizer {
   public:
@@ -76,6 +76,15 @@
   #define PBRT_L1_CACHE_LINE_SIZE 64
 #endif
 
+// SIMD instruction sets that the compiler has been told it may use
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define PBRT_HAVE_SSE2
+#endif
+#if defined(__AVX__)
+  #define PBRT_HAVE_AVX
+#endif
+
 #include <stdint.h>
 #if defined(PBRT_IS_MSVC)
 #include <float.h>
@@ -105,6 +114,7 @@ class Point2;
 template <typename T>
 class Normal3;
 class Ray;
+class RayBatch;
 class RayDifferential;
 template <typename T>
 class Bounds2;
@@ -121,8 +131,11 @@ template <int nSpectrumSamples>
 class CoefficientSpectrum;
 class RGBSpectrum;
 class SampledSpectrum;
+#ifdef PBRT_SAMPLED_SPECTRUM
+typedef SampledSpectrum Spectrum;
+#else
 typedef RGBSpectrum Spectrum;
-// typedef SampledSpectrum Spectrum;
+#endif  // PBRT_SAMPLED_SPECTRUM
 class Camera;
 struct CameraSample;
 class ProjectiveCamera;
@@ -155,6 +168,11 @@ typedef double Float;
 #else
 typedef float Float;
 #endif  // PBRT_FLOAT_AS_DOUBLE
+// Vectorized spectra need 4-wide float vectors
+#if defined(PBRT_SPECTRUM_SIMD) && \
+    (!defined(PBRT_HAVE_SSE2) || defined(PBRT_FLOAT_AS_DOUBLE))
+  #undef PBRT_SPECTRUM_SIMD
+#endif
 class RNG;
 class ProgressReporter;
 class MemoryArena;
@@ -175,7 +193,40 @@ struct Options {
     bool quickRender = false;
     bool quiet = false;
     bool cat = false, toPly = false;
+    // Find the first intersections of each tile's camera rays with
+    // Scene::IntersectBatch() rather than one ray at a time
+    bool batchCameraRays = false;
+    // Override the film's tile size and order, if given
+    int tileSize = 0;
+    std::string tileOrder;
+    // Stop sampling pixels once the relative error of their luminance is
+    // below _adaptiveThreshold_ (zero disables adaptive sampling), checking
+    // every _adaptiveMinSamples_ samples
+    Float adaptiveThreshold = 0;
+    int adaptiveMinSamples = 16;
+    // Render the image in passes over all of its tiles, each of which
+    // doubles the number of samples taken in every pixel, optionally
+    // writing the image every so many seconds or passes and stopping once
+    // _timeBudget_ seconds have passed or _maxPasses_ passes are done
+    // (zero means no limit)
+    bool progressive = false;
+    Float snapshotSeconds = 0;
+    int snapshotPasses = 0;
+    Float timeBudget = 0;
+    int maxPasses = 0;
+    // File to periodically save the state of the render to, every
+    // _checkpointSeconds_ seconds, and whether to resume from it
+    std::string checkpointFile;
+    Float checkpointSeconds = 600;
+    bool resume = false;
     std::string imageFile;
+    // Keep image textures' texels in a cache of at most this many
+    // megabytes, reading each texture when it's first used, rather than
+    // in memory in their entirety (zero)
+    Float textureCacheMB = 0;
+    // Address (host:port) of the distributed rendering coordinator to
+    // render tiles for, if running as a worker
+    std::string coordinator;
     // x0, x1, y0, y1
     Float cropWindow[2][2];
 };
@@ -43,6 +43,19 @@ STAT_MEMORY_COUNTER("Memory/Primitives", primitiveMemory);
 
 // Primitive Method Definitions
 Primitive::~Primitive() {}
+void Primitive::IntersectBatch(const RayBatch &rays, SurfaceInteraction *isects,
+                               bool *hits) const {
+    for (int i = 0; i < rays.Size(); ++i) {
+        Ray ray = rays.GetRay(i);
+        hits[i] = Intersect(ray, &isects[i]);
+        rays.tMax[i] = ray.tMax;
+    }
+}
+
+void Primitive::IntersectPBatch(const RayBatch &rays, bool *hits) const {
+    for (int i = 0; i < rays.Size(); ++i) hits[i] = IntersectP(rays.GetRay(i));
+}
+
 const AreaLight *Aggregate::GetAreaLight() const {
     LOG(FATAL) <<
         "Aggregate::GetAreaLight() method"
@@ -137,6 +150,8 @@ const Material *GeometricPrimitive::GetMaterial() const {
     return material.get();
 }
 
+const Shape *GeometricPrimitive::GetShape() const { return shape.get(); }
+
 void GeometricPrimitive::ComputeScatteringFunctions(
     SurfaceInteraction *isect, MemoryArena &arena, TransportMode mode,
     bool allowMultipleLobes) const {
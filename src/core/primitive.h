@@ -55,6 +55,13 @@ class Primitive {
     virtual Bounds3f WorldBound() const = 0;
     virtual bool Intersect(const Ray &r, SurfaceInteraction *) const = 0;
     virtual bool IntersectP(const Ray &r) const = 0;
+    // Batch versions of Intersect() and IntersectP(): _hits[i]_ and
+    // _isects[i]_ are set and the _i_th ray's _tMax_ is updated as they
+    // would be for the _i_th ray on its own. The default implementations
+    // trace the rays one at a time.
+    virtual void IntersectBatch(const RayBatch &rays,
+                                SurfaceInteraction *isects, bool *hits) const;
+    virtual void IntersectPBatch(const RayBatch &rays, bool *hits) const;
     virtual const AreaLight *GetAreaLight() const = 0;
     virtual const Material *GetMaterial() const = 0;
     virtual void ComputeScatteringFunctions(SurfaceInteraction *isect,
@@ -76,6 +83,7 @@ class GeometricPrimitive : public Primitive {
                        const MediumInterface &mediumInterface);
     const AreaLight *GetAreaLight() const;
     const Material *GetMaterial() const;
+    const Shape *GetShape() const;
     void ComputeScatteringFunctions(SurfaceInteraction *isect,
                                     MemoryArena &arena, TransportMode mode,
                                     bool allowMultipleLobes) const;
@@ -71,6 +71,22 @@ bool Sampler::SetSampleNumber(int64_t sampleNum) {
     return currentPixelSampleIndex < samplesPerPixel;
 }
 
+uint64_t Sampler::PixelSampleSequence(int seed, int64_t sampleIndex) const {
+    // Hash the seed, pixel, and sample index together
+    auto mixBits = [](uint64_t v) {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185ull;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44dull;
+        v ^= v >> 33;
+        return v;
+    };
+    uint64_t h = mixBits(uint32_t(seed));
+    h = mixBits(h ^ (uint64_t(uint32_t(currentPixel.x)) << 32 |
+                     uint32_t(currentPixel.y)));
+    return mixBits(h ^ uint64_t(sampleIndex));
+}
+
 void Sampler::Request1DArray(int n) {
     CHECK_EQ(RoundCount(n), n);
     samples1DArraySizes.push_back(n);
@@ -105,14 +121,30 @@ PixelSampler::PixelSampler(int64_t samplesPerPixel, int nSampledDimensions)
     }
 }
 
+void PixelSampler::SetSeed(int seed) { this->seed = seed; }
+
+void PixelSampler::StartPixel(const Point2i &p) {
+    Sampler::StartPixel(p);
+    current1DDimension = current2DDimension = 0;
+    // Index -1 gives the pattern generator a stream of its own
+    rng.SetSequence(PixelSampleSequence(seed, -1));
+    fallbackRng.SetSequence(PixelSampleSequence(seed, 0));
+}
+
 bool PixelSampler::StartNextSample() {
     current1DDimension = current2DDimension = 0;
-    return Sampler::StartNextSample();
+    bool more = Sampler::StartNextSample();
+    fallbackRng.SetSequence(
+        PixelSampleSequence(seed, currentPixelSampleIndex));
+    return more;
 }
 
 bool PixelSampler::SetSampleNumber(int64_t sampleNum) {
     current1DDimension = current2DDimension = 0;
-    return Sampler::SetSampleNumber(sampleNum);
+    bool valid = Sampler::SetSampleNumber(sampleNum);
+    fallbackRng.SetSequence(
+        PixelSampleSequence(seed, currentPixelSampleIndex));
+    return valid;
 }
 
 Float PixelSampler::Get1D() {
@@ -121,7 +153,7 @@ Float PixelSampler::Get1D() {
     if (current1DDimension < samples1D.size())
         return samples1D[current1DDimension++][currentPixelSampleIndex];
     else
-        return rng.UniformFloat();
+        return fallbackRng.UniformFloat();
 }
 
 Point2f PixelSampler::Get2D() {
@@ -130,7 +162,7 @@ Point2f PixelSampler::Get2D() {
     if (current2DDimension < samples2D.size())
         return samples2D[current2DDimension++][currentPixelSampleIndex];
     else
-        return Point2f(rng.UniformFloat(), rng.UniformFloat());
+        return Point2f(fallbackRng.UniformFloat(), fallbackRng.UniformFloat());
 }
 
 void GlobalSampler::StartPixel(const Point2i &p) {
@@ -74,6 +74,9 @@ class Sampler {
     const int64_t samplesPerPixel;
 
   protected:
+    // Sampler Protected Methods
+    uint64_t PixelSampleSequence(int seed, int64_t sampleIndex) const;
+
     // Sampler Protected Data
     Point2i currentPixel;
     int64_t currentPixelSampleIndex;
@@ -90,17 +93,28 @@ class PixelSampler : public Sampler {
   public:
     // PixelSampler Public Methods
     PixelSampler(int64_t samplesPerPixel, int nSampledDimensions);
+    void StartPixel(const Point2i &p);
     bool StartNextSample();
     bool SetSampleNumber(int64_t);
     Float Get1D();
     Point2f Get2D();
 
   protected:
+    // PixelSampler Protected Methods
+    void SetSeed(int seed);
+
     // PixelSampler Protected Data
     std::vector<std::vector<Float>> samples1D;
     std::vector<std::vector<Point2f>> samples2D;
     int current1DDimension = 0, current2DDimension = 0;
-    RNG rng;
+    // _rng_ generates the pixel sample patterns in _StartPixel()_, while
+    // _fallbackRng_ provides the dimensions past those. They're reseeded
+    // for each pixel and pixel sample respectively, so that the samples
+    // only depend on the seed, the pixel, and the sample number, not on
+    // which pixels and samples were taken before (e.g. in earlier passes
+    // of a progressive render, or by other clones).
+    RNG rng, fallbackRng;
+    int seed = 0;
 };
 
 class GlobalSampler : public Sampler {
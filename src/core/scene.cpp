@@ -54,6 +54,17 @@ bool Scene::IntersectP(const Ray &ray) const {
     return aggregate->IntersectP(ray);
 }
 
+void Scene::IntersectBatch(const RayBatch &rays, SurfaceInteraction *isects,
+                           bool *hits) const {
+    nIntersectionTests += rays.Size();
+    aggregate->IntersectBatch(rays, isects, hits);
+}
+
+void Scene::IntersectPBatch(const RayBatch &rays, bool *hits) const {
+    nShadowTests += rays.Size();
+    aggregate->IntersectPBatch(rays, hits);
+}
+
 bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                         Spectrum *Tr) const {
     *Tr = Spectrum(1.f);
@@ -64,6 +64,11 @@ class Scene {
     const Bounds3f &WorldBound() const { return worldBound; }
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    // Intersect all of the rays in _rays_ with the scene; see
+    // Primitive::IntersectBatch().
+    void IntersectBatch(const RayBatch &rays, SurfaceInteraction *isects,
+                        bool *hits) const;
+    void IntersectPBatch(const RayBatch &rays, bool *hits) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
 
@@ -0,0 +1,524 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/scenecache.cpp*
+#include "scenecache.h"
+#include "api.h"
+#include "fileutil.h"
+#include "paramset.h"
+#include "spectrum.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace pbrt {
+
+STAT_COUNTER("Scene cache/API calls replayed", nCallsReplayed);
+STAT_MEMORY_COUNTER("Memory/Scene cache", sceneCacheBytes);
+
+// SceneCache Local Declarations
+static const char sceneCacheMagic[8] = {'p', 'b', 'r', 't', 's', 'c', 'n', 0};
+static const uint32_t sceneCacheVersion = 1;
+
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    // The cache stores _Float_s and _Spectrum_s in their native
+    // representations, so it can only be used by a build of pbrt that
+    // uses the same ones.
+    uint32_t floatSize;
+    uint32_t spectrumSize;
+    uint32_t pad;
+};
+
+struct SceneCacheDependency {
+    std::string filename;
+    int64_t size, modificationTime;
+};
+
+struct SceneCacheWriter {
+    std::string filename;
+    std::vector<std::string> inputFiles;
+    std::vector<SceneCacheDependency> dependencies;
+    std::string records;
+    std::mutex acceleratorMutex;
+    std::map<uint64_t, std::string> accelerators;
+};
+
+static std::unique_ptr<SceneCacheWriter> sceneCacheWriter;
+// Accelerator blobs in the cache that is currently being replayed.
+static std::unordered_map<uint64_t, std::pair<const char *, size_t>>
+    *cachedAccelerators;
+
+// SceneCache Utility Functions
+static bool statFile(const std::string &filename,
+                     SceneCacheDependency *dep) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return false;
+    dep->filename = filename;
+    dep->size = st.st_size;
+    dep->modificationTime = st.st_mtime;
+    return true;
+}
+
+static void writeBytes(std::string *out, const void *data, size_t size) {
+    out->append((const char *)data, size);
+}
+
+template <typename T>
+static void writeValue(std::string *out, T value) {
+    writeBytes(out, &value, sizeof(T));
+}
+
+static void writeString(std::string *out, const std::string &s) {
+    writeValue<uint32_t>(out, s.size());
+    writeBytes(out, s.data(), s.size());
+}
+
+// SceneCacheReader reads values from a buffer holding a cache file,
+// recording whether it ever ran past the end of the buffer.
+class SceneCacheReader {
+  public:
+    SceneCacheReader(const char *ptr, const char *end) : ptr(ptr), end(end) {}
+    bool Read(void *data, size_t size) {
+        if (!ok || size > size_t(end - ptr)) return ok = false;
+        memcpy(data, ptr, size);
+        ptr += size;
+        return true;
+    }
+    template <typename T>
+    T Read() {
+        T value{};
+        Read(&value, sizeof(T));
+        return value;
+    }
+    std::string ReadString() {
+        uint32_t len = Read<uint32_t>();
+        if (!ok || len > size_t(end - ptr)) {
+            ok = false;
+            return {};
+        }
+        std::string s(ptr, len);
+        ptr += len;
+        return s;
+    }
+    // Returns a pointer to the next _size_ bytes and skips past them.
+    const char *Skip(size_t size) {
+        if (!ok || size > size_t(end - ptr)) {
+            ok = false;
+            return nullptr;
+        }
+        const char *p = ptr;
+        ptr += size;
+        return p;
+    }
+    bool ReadParams(ParamSet *params) {
+        return ok && (ok = params->Deserialize(&ptr, end));
+    }
+    bool Ok() const { return ok; }
+    bool AtEnd() const { return ptr == end; }
+
+  private:
+    const char *ptr, *end;
+    bool ok = true;
+};
+
+static std::vector<std::string> absolutePaths(
+    const std::vector<std::string> &filenames) {
+    std::vector<std::string> paths;
+    for (const std::string &f : filenames) paths.push_back(AbsolutePath(f));
+    return paths;
+}
+
+static bool replayCall(SceneCacheReader &r) {
+    SceneCacheOp op = SceneCacheOp(r.Read<uint8_t>());
+    std::vector<std::string> s(r.Read<uint8_t>());
+    for (std::string &str : s) str = r.ReadString();
+    Float f[16];
+    uint8_t nFloats = r.Read<uint8_t>();
+    if (nFloats > 16) return false;
+    r.Read(f, nFloats * sizeof(Float));
+    ParamSet params;
+    if (r.Read<uint8_t>()) r.ReadParams(&params);
+    if (!r.Ok()) return false;
+
+    // Make sure that the call has the arguments it needs
+    auto check = [&](size_t nStrings, int nf) {
+        return s.size() == nStrings && nFloats == nf;
+    };
+    ++nCallsReplayed;
+    switch (op) {
+    case SceneCacheOp::SearchDirectory:
+        if (!check(1, 0)) return false;
+        SetSearchDirectory(s[0]);
+        break;
+    case SceneCacheOp::Identity:
+        pbrtIdentity();
+        break;
+    case SceneCacheOp::Translate:
+        if (!check(0, 3)) return false;
+        pbrtTranslate(f[0], f[1], f[2]);
+        break;
+    case SceneCacheOp::Rotate:
+        if (!check(0, 4)) return false;
+        pbrtRotate(f[0], f[1], f[2], f[3]);
+        break;
+    case SceneCacheOp::Scale:
+        if (!check(0, 3)) return false;
+        pbrtScale(f[0], f[1], f[2]);
+        break;
+    case SceneCacheOp::LookAt:
+        if (!check(0, 9)) return false;
+        pbrtLookAt(f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8]);
+        break;
+    case SceneCacheOp::ConcatTransform:
+        if (!check(0, 16)) return false;
+        pbrtConcatTransform(f);
+        break;
+    case SceneCacheOp::Transform:
+        if (!check(0, 16)) return false;
+        pbrtTransform(f);
+        break;
+    case SceneCacheOp::CoordinateSystem:
+        if (!check(1, 0)) return false;
+        pbrtCoordinateSystem(s[0]);
+        break;
+    case SceneCacheOp::CoordSysTransform:
+        if (!check(1, 0)) return false;
+        pbrtCoordSysTransform(s[0]);
+        break;
+    case SceneCacheOp::ActiveTransformAll:
+        pbrtActiveTransformAll();
+        break;
+    case SceneCacheOp::ActiveTransformEndTime:
+        pbrtActiveTransformEndTime();
+        break;
+    case SceneCacheOp::ActiveTransformStartTime:
+        pbrtActiveTransformStartTime();
+        break;
+    case SceneCacheOp::TransformTimes:
+        if (!check(0, 2)) return false;
+        pbrtTransformTimes(f[0], f[1]);
+        break;
+    case SceneCacheOp::PixelFilter:
+        if (!check(1, 0)) return false;
+        pbrtPixelFilter(s[0], params);
+        break;
+    case SceneCacheOp::Film:
+        if (!check(1, 0)) return false;
+        pbrtFilm(s[0], params);
+        break;
+    case SceneCacheOp::Sampler:
+        if (!check(1, 0)) return false;
+        pbrtSampler(s[0], params);
+        break;
+    case SceneCacheOp::Accelerator:
+        if (!check(1, 0)) return false;
+        pbrtAccelerator(s[0], params);
+        break;
+    case SceneCacheOp::Integrator:
+        if (!check(1, 0)) return false;
+        pbrtIntegrator(s[0], params);
+        break;
+    case SceneCacheOp::Camera:
+        if (!check(1, 0)) return false;
+        pbrtCamera(s[0], params);
+        break;
+    case SceneCacheOp::MakeNamedMedium:
+        if (!check(1, 0)) return false;
+        pbrtMakeNamedMedium(s[0], params);
+        break;
+    case SceneCacheOp::MediumInterface:
+        if (!check(2, 0)) return false;
+        pbrtMediumInterface(s[0], s[1]);
+        break;
+    case SceneCacheOp::WorldBegin:
+        pbrtWorldBegin();
+        break;
+    case SceneCacheOp::AttributeBegin:
+        pbrtAttributeBegin();
+        break;
+    case SceneCacheOp::AttributeEnd:
+        pbrtAttributeEnd();
+        break;
+    case SceneCacheOp::TransformBegin:
+        pbrtTransformBegin();
+        break;
+    case SceneCacheOp::TransformEnd:
+        pbrtTransformEnd();
+        break;
+    case SceneCacheOp::Texture:
+        if (!check(3, 0)) return false;
+        pbrtTexture(s[0], s[1], s[2], params);
+        break;
+    case SceneCacheOp::Material:
+        if (!check(1, 0)) return false;
+        pbrtMaterial(s[0], params);
+        break;
+    case SceneCacheOp::MakeNamedMaterial:
+        if (!check(1, 0)) return false;
+        pbrtMakeNamedMaterial(s[0], params);
+        break;
+    case SceneCacheOp::NamedMaterial:
+        if (!check(1, 0)) return false;
+        pbrtNamedMaterial(s[0]);
+        break;
+    case SceneCacheOp::LightSource:
+        if (!check(1, 0)) return false;
+        pbrtLightSource(s[0], params);
+        break;
+    case SceneCacheOp::AreaLightSource:
+        if (!check(1, 0)) return false;
+        pbrtAreaLightSource(s[0], params);
+        break;
+    case SceneCacheOp::Shape:
+        if (!check(1, 0)) return false;
+        pbrtShape(s[0], params);
+        break;
+    case SceneCacheOp::ReverseOrientation:
+        pbrtReverseOrientation();
+        break;
+    case SceneCacheOp::ObjectBegin:
+        if (!check(1, 0)) return false;
+        pbrtObjectBegin(s[0]);
+        break;
+    case SceneCacheOp::ObjectEnd:
+        pbrtObjectEnd();
+        break;
+    case SceneCacheOp::ObjectInstance:
+        if (!check(1, 0)) return false;
+        pbrtObjectInstance(s[0]);
+        break;
+    case SceneCacheOp::WorldEnd:
+        pbrtWorldEnd();
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// SceneCache Function Definitions
+bool ReplaySceneCache(const std::string &filename,
+                      const std::vector<std::string> &inputFiles) {
+    MappedFile file;
+    if (!file.Open(filename)) return false;
+    SceneCacheReader r(file.Data(), file.Data() + file.Size());
+
+    // Make sure that the cache is usable before making any API calls
+    SceneCacheHeader header;
+    if (!r.Read(&header, sizeof(header)) ||
+        memcmp(header.magic, sceneCacheMagic, sizeof(sceneCacheMagic)) != 0) {
+        Warning("%s: not a pbrt scene cache file.", filename.c_str());
+        return false;
+    }
+    if (header.version != sceneCacheVersion ||
+        header.floatSize != sizeof(Float) ||
+        header.spectrumSize != sizeof(Spectrum)) {
+        Warning("%s: scene cache was written by an incompatible version "
+                "of pbrt; ignoring it.",
+                filename.c_str());
+        return false;
+    }
+    std::vector<std::string> cachedInputs(r.Read<uint32_t>());
+    for (std::string &f : cachedInputs) f = r.ReadString();
+    if (!r.Ok()) return false;
+    if (cachedInputs != absolutePaths(inputFiles)) {
+        LOG(INFO) << filename << ": scene cache is for different input files";
+        return false;
+    }
+    uint32_t nDependencies = r.Read<uint32_t>();
+    for (uint32_t i = 0; i < nDependencies && r.Ok(); ++i) {
+        SceneCacheDependency cached, current;
+        cached.filename = r.ReadString();
+        cached.size = r.Read<int64_t>();
+        cached.modificationTime = r.Read<int64_t>();
+        if (r.Ok() && (!statFile(cached.filename, &current) ||
+                       current.size != cached.size ||
+                       current.modificationTime != cached.modificationTime)) {
+            LOG(INFO) << filename << ": scene cache is out of date; "
+                      << cached.filename << " has changed";
+            return false;
+        }
+    }
+    uint64_t recordsSize = r.Read<uint64_t>();
+    const char *records = r.Skip(recordsSize);
+    std::unordered_map<uint64_t, std::pair<const char *, size_t>> accels;
+    uint32_t nAccelerators = r.Read<uint32_t>();
+    for (uint32_t i = 0; i < nAccelerators && r.Ok(); ++i) {
+        uint64_t key = r.Read<uint64_t>();
+        uint64_t size = r.Read<uint64_t>();
+        const char *data = r.Skip(size);
+        accels[key] = std::make_pair(data, size_t(size));
+    }
+    if (!r.Ok() || !r.AtEnd()) {
+        Warning("%s: scene cache file is truncated or corrupt; ignoring it.",
+                filename.c_str());
+        return false;
+    }
+
+    // Replay the recorded API calls
+    LOG(INFO) << "Replaying scene from cache " << filename;
+    sceneCacheBytes += file.Size();
+    cachedAccelerators = &accels;
+    SceneCacheReader calls(records, records + recordsSize);
+    while (!calls.AtEnd()) {
+        if (!replayCall(calls)) {
+            // There's no way to undo the calls that have already been
+            // made, so the scene can't be parsed from scratch instead.
+            Error("%s: corrupt scene cache file.", filename.c_str());
+            exit(1);
+        }
+    }
+    cachedAccelerators = nullptr;
+    return true;
+}
+
+void BeginSceneCache(const std::string &filename,
+                     const std::vector<std::string> &inputFiles) {
+    CHECK(!sceneCacheWriter);
+    sceneCacheWriter.reset(new SceneCacheWriter);
+    sceneCacheWriter->filename = filename;
+    sceneCacheWriter->inputFiles = absolutePaths(inputFiles);
+}
+
+bool EndSceneCache() {
+    CHECK(sceneCacheWriter);
+    std::unique_ptr<SceneCacheWriter> writer = std::move(sceneCacheWriter);
+
+    SceneCacheHeader header;
+    memcpy(header.magic, sceneCacheMagic, sizeof(sceneCacheMagic));
+    header.version = sceneCacheVersion;
+    header.floatSize = sizeof(Float);
+    header.spectrumSize = sizeof(Spectrum);
+    header.pad = 0;
+    std::string prefix;
+    writeBytes(&prefix, &header, sizeof(header));
+    writeValue<uint32_t>(&prefix, writer->inputFiles.size());
+    for (const std::string &f : writer->inputFiles) writeString(&prefix, f);
+    writeValue<uint32_t>(&prefix, writer->dependencies.size());
+    for (const SceneCacheDependency &dep : writer->dependencies) {
+        writeString(&prefix, dep.filename);
+        writeValue<int64_t>(&prefix, dep.size);
+        writeValue<int64_t>(&prefix, dep.modificationTime);
+    }
+    writeValue<uint64_t>(&prefix, writer->records.size());
+
+    // Write to a temporary file and then rename it so that other pbrt
+    // processes never see a partially-written cache.
+    std::string tmpFilename = writer->filename + ".tmp";
+    FILE *f = fopen(tmpFilename.c_str(), "wb");
+    if (!f) {
+        Warning("%s: %s", tmpFilename.c_str(), strerror(errno));
+        return false;
+    }
+    auto write = [f](const std::string &s) {
+        return fwrite(s.data(), 1, s.size(), f) == s.size();
+    };
+    bool ok = write(prefix) && write(writer->records);
+    std::string count;
+    writeValue<uint32_t>(&count, writer->accelerators.size());
+    ok &= write(count);
+    for (const auto &accel : writer->accelerators) {
+        std::string accelHeader;
+        writeValue<uint64_t>(&accelHeader, accel.first);
+        writeValue<uint64_t>(&accelHeader, accel.second.size());
+        ok &= write(accelHeader) && write(accel.second);
+    }
+    ok &= fclose(f) == 0;
+#ifdef PBRT_IS_WINDOWS
+    // rename() won't replace an existing file on Windows.
+    if (ok) remove(writer->filename.c_str());
+#endif
+    if (!ok || rename(tmpFilename.c_str(), writer->filename.c_str()) != 0) {
+        Warning("%s: unable to write scene cache: %s",
+                writer->filename.c_str(), strerror(errno));
+        remove(tmpFilename.c_str());
+        return false;
+    }
+    LOG(INFO) << "Wrote scene cache " << writer->filename;
+    return true;
+}
+
+bool SceneCacheRecording() { return sceneCacheWriter != nullptr; }
+
+void RecordSceneCacheCall(SceneCacheOp op,
+                          const std::vector<std::string> &strings,
+                          const Float *floats, int nFloats,
+                          const ParamSet *params) {
+    if (!sceneCacheWriter) return;
+    CHECK_LT(strings.size(), 256);
+    CHECK_LE(nFloats, 16);
+    std::string *out = &sceneCacheWriter->records;
+    writeValue<uint8_t>(out, uint8_t(op));
+    writeValue<uint8_t>(out, strings.size());
+    for (const std::string &s : strings) writeString(out, s);
+    writeValue<uint8_t>(out, nFloats);
+    writeBytes(out, floats, nFloats * sizeof(Float));
+    writeValue<uint8_t>(out, params != nullptr);
+    if (params) params->Serialize(out);
+}
+
+void AddSceneCacheDependency(const std::string &filename) {
+    if (!sceneCacheWriter) return;
+    SceneCacheDependency dep;
+    if (statFile(AbsolutePath(filename), &dep))
+        sceneCacheWriter->dependencies.push_back(dep);
+}
+
+bool SceneCacheActive() {
+    return sceneCacheWriter != nullptr || cachedAccelerators != nullptr;
+}
+
+bool FindCachedAccelerator(uint64_t key, const char **data, size_t *size) {
+    if (!cachedAccelerators) return false;
+    auto iter = cachedAccelerators->find(key);
+    if (iter == cachedAccelerators->end()) return false;
+    *data = iter->second.first;
+    *size = iter->second.second;
+    return true;
+}
+
+void CacheAccelerator(uint64_t key, std::string data) {
+    if (!sceneCacheWriter) return;
+    std::lock_guard<std::mutex> lock(sceneCacheWriter->acceleratorMutex);
+    sceneCacheWriter->accelerators[key] = std::move(data);
+}
+
+}  // namespace pbrt
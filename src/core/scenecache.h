@@ -0,0 +1,136 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_SCENECACHE_H
+#define PBRT_CORE_SCENECACHE_H
+
+// core/scenecache.h*
+#include "pbrt.h"
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// SceneCache Declarations
+
+// The scene cache is a binary file that holds the sequence of pbrt API
+// calls made while parsing a scene along with their already-parsed
+// parameter lists, and the flattened node arrays of the BVHs built for
+// it. Later runs that are given the same input files replay the API calls
+// directly from the memory-mapped cache and reuse the stored BVHs instead
+// of tokenizing the scene and rebuilding its acceleration structures. The
+// cache is discarded if any of the scene files that were parsed to create
+// it have since changed.
+
+// API call types stored in the cache; each corresponds to a pbrt API
+// function, apart from _SearchDirectory_, which records the
+// SetSearchDirectory() call made when each input file is parsed.
+enum class SceneCacheOp : uint8_t {
+    SearchDirectory,
+    Identity,
+    Translate,
+    Rotate,
+    Scale,
+    LookAt,
+    ConcatTransform,
+    Transform,
+    CoordinateSystem,
+    CoordSysTransform,
+    ActiveTransformAll,
+    ActiveTransformEndTime,
+    ActiveTransformStartTime,
+    TransformTimes,
+    PixelFilter,
+    Film,
+    Sampler,
+    Accelerator,
+    Integrator,
+    Camera,
+    MakeNamedMedium,
+    MediumInterface,
+    WorldBegin,
+    AttributeBegin,
+    AttributeEnd,
+    TransformBegin,
+    TransformEnd,
+    Texture,
+    Material,
+    MakeNamedMaterial,
+    NamedMaterial,
+    LightSource,
+    AreaLightSource,
+    Shape,
+    ReverseOrientation,
+    ObjectBegin,
+    ObjectEnd,
+    ObjectInstance,
+    WorldEnd
+};
+
+// Replays the scene stored in the given cache file if it was created from
+// the given list of input files and none of the files it depends on have
+// changed; returns false without making any API calls otherwise.
+bool ReplaySceneCache(const std::string &filename,
+                      const std::vector<std::string> &inputFiles);
+
+// Starts recording API calls made by the parser; EndSceneCache() then
+// writes everything recorded to the given file.
+void BeginSceneCache(const std::string &filename,
+                     const std::vector<std::string> &inputFiles);
+bool EndSceneCache();
+bool SceneCacheRecording();
+
+// Recording functions used by the parser. Each scene file read adds a
+// dependency, identified by its size and modification time.
+void RecordSceneCacheCall(SceneCacheOp op,
+                          const std::vector<std::string> &strings = {},
+                          const Float *floats = nullptr, int nFloats = 0,
+                          const ParamSet *params = nullptr);
+void AddSceneCacheDependency(const std::string &filename);
+
+// Acceleration structures are stored as opaque blobs identified by a key
+// that their creator computes from its inputs. FindCachedAccelerator()
+// looks up a blob while a cache is being replayed; the returned memory is
+// only valid until replay finishes. CacheAccelerator() stores one while
+// recording.
+bool SceneCacheActive();
+bool FindCachedAccelerator(uint64_t key, const char **data, size_t *size);
+void CacheAccelerator(uint64_t key, std::string data);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_SCENECACHE_H
@@ -41,6 +41,9 @@
 // core/spectrum.h*
 #include "pbrt.h"
 #include "stringprint.h"
+#ifdef PBRT_SPECTRUM_SIMD
+#include <immintrin.h>
+#endif
 
 namespace pbrt {
 
@@ -96,6 +99,119 @@ extern const Float RGBIllum2SpectRed[nRGB2SpectSamples];
 extern const Float RGBIllum2SpectGreen[nRGB2SpectSamples];
 extern const Float RGBIllum2SpectBlue[nRGB2SpectSamples];
 
+// Spectrum SIMD Declarations
+template <int nSpectrumSamples>
+struct SpectrumLanes {
+#ifdef PBRT_SPECTRUM_SIMD
+    // RGB fills a 4-wide vector; longer spectra are padded to 8-wide ones
+    static const int value =
+        nSpectrumSamples <= 4 ? 4 : (nSpectrumSamples + 7) & ~7;
+#else
+    static const int value = nSpectrumSamples;
+#endif
+};
+
+#ifdef PBRT_SPECTRUM_SIMD
+#ifdef PBRT_HAVE_AVX
+#define PBRT_SPECTRUM_AVX_OP(name, ...) \
+    __m256 operator()(__VA_ARGS__) const { return name; }
+#else
+#define PBRT_SPECTRUM_AVX_OP(name, ...)
+#endif
+#define PBRT_SPECTRUM_SIMD_OPS(sse, avx)                        \
+    __m128 operator()(__m128 a, __m128 b) const { return sse; } \
+    PBRT_SPECTRUM_AVX_OP(avx, __m256 a, __m256 b)
+#define PBRT_SPECTRUM_SIMD_UNARY_OPS(sse, avx)        \
+    __m128 operator()(__m128 a) const { return sse; } \
+    PBRT_SPECTRUM_AVX_OP(avx, __m256 a)
+#else
+#define PBRT_SPECTRUM_SIMD_OPS(sse, avx)
+#define PBRT_SPECTRUM_SIMD_UNARY_OPS(sse, avx)
+#endif  // PBRT_SPECTRUM_SIMD
+
+struct SpectrumAdd {
+    Float operator()(Float a, Float b) const { return a + b; }
+    PBRT_SPECTRUM_SIMD_OPS(_mm_add_ps(a, b), _mm256_add_ps(a, b))
+};
+
+struct SpectrumSub {
+    Float operator()(Float a, Float b) const { return a - b; }
+    PBRT_SPECTRUM_SIMD_OPS(_mm_sub_ps(a, b), _mm256_sub_ps(a, b))
+};
+
+struct SpectrumMul {
+    Float operator()(Float a, Float b) const { return a * b; }
+    PBRT_SPECTRUM_SIMD_OPS(_mm_mul_ps(a, b), _mm256_mul_ps(a, b))
+};
+
+struct SpectrumDiv {
+    Float operator()(Float a, Float b) const { return a / b; }
+    PBRT_SPECTRUM_SIMD_OPS(_mm_div_ps(a, b), _mm256_div_ps(a, b))
+};
+
+struct SpectrumNeg {
+    Float operator()(Float a) const { return -a; }
+    PBRT_SPECTRUM_SIMD_UNARY_OPS(_mm_xor_ps(a, _mm_set1_ps(-0.f)),
+                                 _mm256_xor_ps(a, _mm256_set1_ps(-0.f)))
+};
+
+struct SpectrumSqrt {
+    Float operator()(Float a) const { return std::sqrt(a); }
+    PBRT_SPECTRUM_SIMD_UNARY_OPS(_mm_sqrt_ps(a), _mm256_sqrt_ps(a))
+};
+
+// Apply _op_ to each of the _nLanes_ values of _a_ and _b_ (or to each
+// value of _a_ and the scalar _b_), storing the results in _r_. The SIMD
+// versions use unaligned loads and stores, since arenas and containers
+// only guarantee 16-byte alignment.
+template <int nLanes, typename Op>
+inline void MapSpectrumLanes(Float *r, const Float *a, const Float *b, Op op) {
+#ifdef PBRT_SPECTRUM_SIMD
+    static_assert(nLanes % 4 == 0, "Spectrum lanes must fill SIMD vectors");
+    int i = 0;
+#ifdef PBRT_HAVE_AVX
+    for (; i + 8 <= nLanes; i += 8)
+        _mm256_storeu_ps(r + i,
+                         op(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#endif
+    for (; i < nLanes; i += 4)
+        _mm_storeu_ps(r + i, op(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+#else
+    for (int i = 0; i < nLanes; ++i) r[i] = op(a[i], b[i]);
+#endif
+}
+
+template <int nLanes, typename Op>
+inline void MapSpectrumLanes(Float *r, const Float *a, Float b, Op op) {
+#ifdef PBRT_SPECTRUM_SIMD
+    int i = 0;
+#ifdef PBRT_HAVE_AVX
+    __m256 b8 = _mm256_set1_ps(b);
+    for (; i + 8 <= nLanes; i += 8)
+        _mm256_storeu_ps(r + i, op(_mm256_loadu_ps(a + i), b8));
+#endif
+    __m128 b4 = _mm_set1_ps(b);
+    for (; i < nLanes; i += 4)
+        _mm_storeu_ps(r + i, op(_mm_loadu_ps(a + i), b4));
+#else
+    for (int i = 0; i < nLanes; ++i) r[i] = op(a[i], b);
+#endif
+}
+
+template <int nLanes, typename Op>
+inline void MapSpectrumLanes(Float *r, const Float *a, Op op) {
+#ifdef PBRT_SPECTRUM_SIMD
+    int i = 0;
+#ifdef PBRT_HAVE_AVX
+    for (; i + 8 <= nLanes; i += 8)
+        _mm256_storeu_ps(r + i, op(_mm256_loadu_ps(a + i)));
+#endif
+    for (; i < nLanes; i += 4) _mm_storeu_ps(r + i, op(_mm_loadu_ps(a + i)));
+#else
+    for (int i = 0; i < nLanes; ++i) r[i] = op(a[i]);
+#endif
+}
+
 // Spectrum Declarations
 template <int nSpectrumSamples>
 class CoefficientSpectrum {
@@ -103,17 +219,18 @@ class CoefficientSpectrum {
     // CoefficientSpectrum Public Methods
     CoefficientSpectrum(Float v = 0.f) {
         for (int i = 0; i < nSpectrumSamples; ++i) c[i] = v;
+        for (int i = nSpectrumSamples; i < nLanes; ++i) c[i] = 0;
         DCHECK(!HasNaNs());
     }
 #ifdef DEBUG
     CoefficientSpectrum(const CoefficientSpectrum &s) {
         DCHECK(!s.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] = s.c[i];
+        for (int i = 0; i < nLanes; ++i) c[i] = s.c[i];
     }
 
     CoefficientSpectrum &operator=(const CoefficientSpectrum &s) {
         DCHECK(!s.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] = s.c[i];
+        for (int i = 0; i < nLanes; ++i) c[i] = s.c[i];
         return *this;
     }
 #endif  // DEBUG
@@ -127,19 +244,19 @@ class CoefficientSpectrum {
     }
     CoefficientSpectrum &operator+=(const CoefficientSpectrum &s2) {
         DCHECK(!s2.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] += s2.c[i];
+        MapSpectrumLanes<nLanes>(c, c, s2.c, SpectrumAdd());
         return *this;
     }
     CoefficientSpectrum operator+(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
-        CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] += s2.c[i];
+        CoefficientSpectrum ret;
+        MapSpectrumLanes<nLanes>(ret.c, c, s2.c, SpectrumAdd());
         return ret;
     }
     CoefficientSpectrum operator-(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
-        CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] -= s2.c[i];
+        CoefficientSpectrum ret;
+        MapSpectrumLanes<nLanes>(ret.c, c, s2.c, SpectrumSub());
         return ret;
     }
     CoefficientSpectrum operator/(const CoefficientSpectrum &s2) const {
@@ -153,23 +270,23 @@ class CoefficientSpectrum {
     }
     CoefficientSpectrum operator*(const CoefficientSpectrum &sp) const {
         DCHECK(!sp.HasNaNs());
-        CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] *= sp.c[i];
+        CoefficientSpectrum ret;
+        MapSpectrumLanes<nLanes>(ret.c, c, sp.c, SpectrumMul());
         return ret;
     }
     CoefficientSpectrum &operator*=(const CoefficientSpectrum &sp) {
         DCHECK(!sp.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] *= sp.c[i];
+        MapSpectrumLanes<nLanes>(c, c, sp.c, SpectrumMul());
         return *this;
     }
     CoefficientSpectrum operator*(Float a) const {
-        CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] *= a;
+        CoefficientSpectrum ret;
+        MapSpectrumLanes<nLanes>(ret.c, c, a, SpectrumMul());
         DCHECK(!ret.HasNaNs());
         return ret;
     }
     CoefficientSpectrum &operator*=(Float a) {
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] *= a;
+        MapSpectrumLanes<nLanes>(c, c, a, SpectrumMul());
         DCHECK(!HasNaNs());
         return *this;
     }
@@ -181,15 +298,15 @@ class CoefficientSpectrum {
     CoefficientSpectrum operator/(Float a) const {
         CHECK_NE(a, 0);
         DCHECK(!std::isnan(a));
-        CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] /= a;
+        CoefficientSpectrum ret;
+        MapSpectrumLanes<nLanes>(ret.c, c, a, SpectrumDiv());
         DCHECK(!ret.HasNaNs());
         return ret;
     }
     CoefficientSpectrum &operator/=(Float a) {
         CHECK_NE(a, 0);
         DCHECK(!std::isnan(a));
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] /= a;
+        MapSpectrumLanes<nLanes>(c, c, a, SpectrumDiv());
         return *this;
     }
     bool operator==(const CoefficientSpectrum &sp) const {
@@ -201,13 +318,24 @@ class CoefficientSpectrum {
         return !(*this == sp);
     }
     bool IsBlack() const {
+#ifdef PBRT_SPECTRUM_SIMD
+        // Only the low bits of each mask correspond to the spectrum's samples
+        for (int i = 0; i < nSpectrumSamples; i += 4) {
+            __m128 v = _mm_loadu_ps(c + i);
+            int nonZero = _mm_movemask_ps(_mm_cmpneq_ps(v, _mm_setzero_ps()));
+            if (i + 4 > nSpectrumSamples)
+                nonZero &= (1 << (nSpectrumSamples - i)) - 1;
+            if (nonZero) return false;
+        }
+#else
         for (int i = 0; i < nSpectrumSamples; ++i)
             if (c[i] != 0.) return false;
+#endif
         return true;
     }
     friend CoefficientSpectrum Sqrt(const CoefficientSpectrum &s) {
         CoefficientSpectrum ret;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] = std::sqrt(s.c[i]);
+        MapSpectrumLanes<nLanes>(ret.c, s.c, SpectrumSqrt());
         DCHECK(!ret.HasNaNs());
         return ret;
     }
@@ -216,7 +344,7 @@ class CoefficientSpectrum {
                                              Float e);
     CoefficientSpectrum operator-() const {
         CoefficientSpectrum ret;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] = -c[i];
+        MapSpectrumLanes<nLanes>(ret.c, c, SpectrumNeg());
         return ret;
     }
     friend CoefficientSpectrum Exp(const CoefficientSpectrum &s) {
@@ -283,7 +411,15 @@ class CoefficientSpectrum {
 
   protected:
     // CoefficientSpectrum Protected Data
+    // Lanes past _nSpectrumSamples_ pad _c_ to whole SIMD vectors; they
+    // start out zero and are otherwise only written by vectorized
+    // arithmetic, never read.
+    static const int nLanes = SpectrumLanes<nSpectrumSamples>::value;
+#ifdef PBRT_SPECTRUM_SIMD
+    alignas(16) Float c[nLanes];
+#else
     Float c[nSpectrumSamples];
+#endif
 };
 
 class SampledSpectrum : public CoefficientSpectrum<nSpectralSamples> {
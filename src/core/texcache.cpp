@@ -0,0 +1,261 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/texcache.cpp*
+#include "texcache.h"
+#include "stats.h"
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace pbrt {
+
+STAT_PERCENT("Texture/Tile lookups handled by thread caches", nThreadCacheHits,
+             nTileLookups);
+STAT_PERCENT("Texture/Tile cache hits", nTileCacheHits, nTileCacheLookups);
+STAT_COUNTER("Texture/Tile cache misses", nTileCacheMisses);
+STAT_COUNTER("Texture/Tile cache evictions", nTileCacheEvictions);
+STAT_COUNTER("Texture/Tile loads waited for", nTileLoadWaits);
+
+// TextureCache Local Declarations
+struct TextureTile {
+    TextureTile(size_t bytes) : texels(new char[bytes]), bytes(bytes) {}
+    std::unique_ptr<char[]> texels;
+    const size_t bytes;
+};
+
+// Tiles are shared between the shared cache and the threads' caches, so
+// that a tile that's evicted from the former while a thread is using it
+// isn't freed until the thread is done with it.
+struct CachedTile {
+    uint64_t key;
+    std::shared_ptr<TextureTile> tile;
+};
+
+// The shared cache's tiles are kept in _lruTiles_ in order from most to
+// least recently used.
+static std::mutex cacheMutex;
+static std::list<CachedTile> lruTiles;
+static std::unordered_map<uint64_t, std::list<CachedTile>::iterator> tileIndex;
+static size_t cacheBytes, cacheBudget;
+
+// Keys of the tiles that threads are loading; other threads that miss on
+// them wait on _tileLoaded_ until they've been added to the cache.
+static std::unordered_set<uint64_t> loadingTiles;
+static std::condition_variable tileLoaded;
+
+// Each thread's cache is direct-mapped. They're allocated the first time a
+// thread looks up a tile and are all kept in _threadCaches_ so that
+// ClearTextureCache() can release the tiles they hold.
+static PBRT_CONSTEXPR int ThreadCacheSize = 32;
+struct ThreadTileCache {
+    CachedTile tiles[ThreadCacheSize];
+};
+static PBRT_THREAD_LOCAL ThreadTileCache *threadCache;
+static std::mutex threadCachesMutex;
+static std::vector<std::unique_ptr<ThreadTileCache>> threadCaches;
+
+static std::atomic<uint32_t> nextSourceId{0};
+
+// TextureCache Utility Functions
+static uint64_t TileKey(const TextureTileSource &source, int level, int s,
+                        int t) {
+    DCHECK(level >= 0 && level < 64);
+    DCHECK(s >= 0 && s < (1 << 13) && t >= 0 && t < (1 << 13));
+    return (uint64_t(source.id) << 32) | (uint64_t(level) << 26) |
+           (uint64_t(t) << 13) | uint64_t(s);
+}
+
+static int ThreadCacheSlot(uint64_t key) {
+    // Neighboring tiles of the same level should map to different slots
+    uint64_t h = key ^ (key >> 11) ^ (key >> 26) ^ (key >> 32);
+    return (h ^ (h >> 5)) & (ThreadCacheSize - 1);
+}
+
+// Evicts tiles until the cache is within its budget, always leaving the
+// most recently used one; _cacheMutex_ must be held.
+static void evictTiles() {
+    while (cacheBytes > cacheBudget && lruTiles.size() > 1) {
+        CachedTile &lru = lruTiles.back();
+        cacheBytes -= lru.tile->bytes;
+        tileIndex.erase(lru.key);
+        lruTiles.pop_back();
+        ++nTileCacheEvictions;
+    }
+}
+
+// Returns the cached tile, or nullptr if it isn't cached, in which case the
+// calling thread must load it and add it with addTile(). If another thread
+// is already loading the tile, waits for it to do so instead.
+static std::shared_ptr<TextureTile> findTile(uint64_t key) {
+    std::unique_lock<std::mutex> lock(cacheMutex);
+    ++nTileCacheLookups;
+    while (true) {
+        auto iter = tileIndex.find(key);
+        if (iter != tileIndex.end()) {
+            ++nTileCacheHits;
+            lruTiles.splice(lruTiles.begin(), lruTiles, iter->second);
+            return iter->second->tile;
+        }
+        if (loadingTiles.insert(key).second) return nullptr;
+        // The tile may be evicted again before this thread gets to it, in
+        // which case it loads the tile itself.
+        ++nTileLoadWaits;
+        tileLoaded.wait(lock);
+    }
+}
+
+// Adds the tile to the cache and returns it, unless another thread added
+// one with the same key first, in which case that one is returned.
+static std::shared_ptr<TextureTile> addTile(
+    uint64_t key, std::shared_ptr<TextureTile> tile) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (loadingTiles.erase(key)) tileLoaded.notify_all();
+    auto iter = tileIndex.find(key);
+    if (iter != tileIndex.end()) {
+        lruTiles.splice(lruTiles.begin(), lruTiles, iter->second);
+        return iter->second->tile;
+    }
+    lruTiles.push_front({key, std::move(tile)});
+    tileIndex[key] = lruTiles.begin();
+    cacheBytes += lruTiles.front().tile->bytes;
+    evictTiles();
+    return lruTiles.front().tile;
+}
+
+// TextureCache Function Definitions
+TextureTileSource::TextureTileSource(size_t tileBytes)
+    : id(nextSourceId++), tileBytes(tileBytes) {}
+
+TextureTileSource::~TextureTileSource() {
+    // Free the source's tiles, which can't be looked up any more
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (auto iter = lruTiles.begin(); iter != lruTiles.end();) {
+        if ((iter->key >> 32) == id) {
+            cacheBytes -= iter->tile->bytes;
+            tileIndex.erase(iter->key);
+            iter = lruTiles.erase(iter);
+        } else
+            ++iter;
+    }
+}
+
+const void *GetTextureTile(const TextureTileSource &source, int level, int s,
+                           int t) {
+    uint64_t key = TileKey(source, level, s, t);
+    ++nTileLookups;
+    if (!threadCache) {
+        std::lock_guard<std::mutex> lock(threadCachesMutex);
+        threadCaches.push_back(
+            std::unique_ptr<ThreadTileCache>(new ThreadTileCache));
+        threadCache = threadCaches.back().get();
+    }
+    CachedTile &entry = threadCache->tiles[ThreadCacheSlot(key)];
+    if (entry.tile && entry.key == key) {
+        ++nThreadCacheHits;
+        return entry.tile->texels.get();
+    }
+
+    entry.key = key;
+    entry.tile = findTile(key);
+    if (!entry.tile) {
+        // Load the tile without holding the lock
+        ++nTileCacheMisses;
+        std::shared_ptr<TextureTile> tile =
+            std::make_shared<TextureTile>(source.tileBytes);
+        source.LoadTile(level, s, t, tile->texels.get());
+        entry.tile = addTile(key, std::move(tile));
+    }
+    return entry.tile->texels.get();
+}
+
+void AddTextureTile(const TextureTileSource &source, int level, int s, int t,
+                    const void *texels) {
+    std::shared_ptr<TextureTile> tile =
+        std::make_shared<TextureTile>(source.tileBytes);
+    memcpy(tile->texels.get(), texels, source.tileBytes);
+    addTile(TileKey(source, level, s, t), std::move(tile));
+}
+
+TextureTileFile::TextureTileFile(size_t tileBytes)
+    : file(tmpfile()), tileBytes(tileBytes) {}
+
+TextureTileFile::~TextureTileFile() {
+    if (file) fclose(file);
+}
+
+bool TextureTileFile::Append(const void *texels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return file && fseek(file, 0, SEEK_END) == 0 &&
+           fwrite(texels, tileBytes, 1, file) == 1;
+}
+
+bool TextureTileFile::Read(size_t tile, void *texels) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t offset = uint64_t(tile) * tileBytes;
+#if defined(PBRT_IS_MSVC)
+    bool seeked = file && _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    bool seeked = file && fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+    return seeked && fread(texels, tileBytes, 1, file) == 1;
+}
+
+void SetTextureCacheSize(size_t bytes) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cacheBudget = bytes;
+    evictTiles();
+}
+
+size_t TextureCacheSize() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return cacheBudget;
+}
+
+void ClearTextureCache() {
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        lruTiles.clear();
+        tileIndex.clear();
+        cacheBytes = 0;
+    }
+    std::lock_guard<std::mutex> lock(threadCachesMutex);
+    for (std::unique_ptr<ThreadTileCache> &cache : threadCaches)
+        for (CachedTile &entry : cache->tiles) entry.tile.reset();
+}
+
+}  // namespace pbrt
@@ -0,0 +1,113 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_TEXCACHE_H
+#define PBRT_CORE_TEXCACHE_H
+
+// core/texcache.h*
+#include "pbrt.h"
+#include <mutex>
+#include <stdio.h>
+
+namespace pbrt {
+
+// TextureCache Declarations
+
+// The texture cache holds square tiles of texels of textures that aren't
+// kept in memory in their entirety. Tiles are loaded the first time that
+// they're needed and the least recently used ones are evicted once the
+// total size of the cached tiles exceeds the cache's budget. Each thread
+// also keeps the last few tiles that it looked up in a small cache of its
+// own, so that most lookups don't need to take the shared cache's lock.
+
+// TextureTileSource provides the texels of one texture's tiles, which are
+// identified by their MIP level and their tile coordinates in it.
+class TextureTileSource {
+  public:
+    // TextureTileSource Public Methods
+    TextureTileSource(size_t tileBytes);
+    virtual ~TextureTileSource();
+    virtual void LoadTile(int level, int s, int t, void *texels) const = 0;
+
+    // TextureTileSource Public Data
+    const uint32_t id;
+    const size_t tileBytes;
+};
+
+// TextureTileFile is a temporary file of tiles for sources that can only
+// make all of their tiles at once: they're appended to it in order when
+// they're made, and evicted ones are read back from it one at a time.
+class TextureTileFile {
+  public:
+    // TextureTileFile Public Methods
+    TextureTileFile(size_t tileBytes);
+    ~TextureTileFile();
+    bool IsValid() const { return file != nullptr; }
+    bool Append(const void *texels);
+    bool Read(size_t tile, void *texels) const;
+
+  private:
+    // TextureTileFile Private Data
+    FILE *file;
+    const size_t tileBytes;
+    mutable std::mutex mutex;
+};
+
+// Returns the texels of the given tile, loading it if it isn't already
+// cached. Only one thread loads any given tile; others that look it up in
+// the meantime wait for it. The returned memory is only valid until the
+// calling thread's next call to GetTextureTile().
+const void *GetTextureTile(const TextureTileSource &source, int level, int s,
+                           int t);
+
+// Adds a tile to the cache if it isn't there already, for sources that
+// produce more than one tile at a time.
+void AddTextureTile(const TextureTileSource &source, int level, int s, int t,
+                    const void *texels);
+
+// The cache's budget, in bytes; textures should only be cached if it's
+// nonzero.
+void SetTextureCacheSize(size_t bytes);
+size_t TextureCacheSize();
+
+// Removes all tiles from the cache; must not be called while any other
+// threads may be looking up tiles.
+void ClearTextureCache();
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_TEXCACHE_H
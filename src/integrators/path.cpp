@@ -64,6 +64,24 @@ void PathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
 Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                             Sampler &sampler, MemoryArena &arena,
                             int depth) const {
+    return tracePath(r, nullptr, scene, sampler, arena);
+}
+
+Spectrum PathIntegrator::LiFromIntersection(const RayDifferential &r,
+                                            bool foundIntersection,
+                                            SurfaceInteraction &isect,
+                                            const Scene &scene,
+                                            Sampler &sampler,
+                                            MemoryArena &arena) const {
+    return tracePath(r, foundIntersection ? &isect : nullptr, scene, sampler,
+                     arena, true);
+}
+
+Spectrum PathIntegrator::tracePath(const RayDifferential &r,
+                                   SurfaceInteraction *firstIsect,
+                                   const Scene &scene, Sampler &sampler,
+                                   MemoryArena &arena,
+                                   bool firstIntersectionKnown) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
     Spectrum L(0.f), beta(1.f);
     RayDifferential ray(r);
@@ -85,7 +103,14 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
 
         // Intersect _ray_ with scene and store intersection in _isect_
         SurfaceInteraction isect;
-        bool foundIntersection = scene.Intersect(ray, &isect);
+        bool foundIntersection;
+        if (firstIntersectionKnown) {
+            // Use the camera ray's intersection found by the caller
+            foundIntersection = firstIsect != nullptr;
+            if (foundIntersection) isect = *firstIsect;
+            firstIntersectionKnown = false;
+        } else
+            foundIntersection = scene.Intersect(ray, &isect);
 
         // Possibly add emitted light at intersection
         if (bounces == 0 || specularBounce) {
@@ -57,8 +57,18 @@ class PathIntegrator : public SamplerIntegrator {
     void Preprocess(const Scene &scene, Sampler &sampler);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
+    Spectrum LiFromIntersection(const RayDifferential &ray,
+                                bool foundIntersection,
+                                SurfaceInteraction &isect, const Scene &scene,
+                                Sampler &sampler, MemoryArena &arena) const;
 
   private:
+    // PathIntegrator Private Methods
+    Spectrum tracePath(const RayDifferential &r,
+                       SurfaceInteraction *firstIsect, const Scene &scene,
+                       Sampler &sampler, MemoryArena &arena,
+                       bool firstIntersectionKnown = false) const;
+
     // PathIntegrator Private Data
     const int maxDepth;
     const Float rrThreshold;
@@ -57,6 +57,7 @@ STAT_INT_DISTRIBUTION(
     "Stochastic Progressive Photon Mapping/Grid cells per visible point",
     gridCellsPerVisiblePoint);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
+STAT_MEMORY_COUNTER("Memory/SPPM Grid", gridMemoryBytes);
 STAT_FLOAT_DISTRIBUTION("Memory/SPPM BSDF and Grid Memory", memoryArenaMB);
 
 // SPPM Local Definitions
@@ -84,9 +85,12 @@ struct SPPMPixel {
     Spectrum tau;
 };
 
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
+// Compact copies of the visible points' positions and squared radii, one
+// for each pixel, that photons are checked against before the (much
+// larger) _SPPMPixel_ is accessed.
+struct SPPMVisiblePointRecord {
+    Point3f p;
+    Float radius2;
 };
 
 static bool ToGrid(const Point3f &p, const Bounds3f &bounds,
@@ -107,6 +111,45 @@ inline unsigned int hash(const Point3i &p, int hashSize) {
            hashSize;
 }
 
+// Appends _~pixelIndex_, which is negative, to _entries_, followed by
+// each distinct hash of the grid cells that _pixel_'s visible point
+// overlaps, returning the number of cells. Different cells may have the
+// same hash; if the pixel were added to a hash bucket once for each of
+// them, photons in those cells would be counted more than once.
+static int addGridEntries(const SPPMPixel &pixel, int pixelIndex,
+                          const Bounds3f &gridBounds, const int gridRes[3],
+                          int hashSize, std::vector<int> *entries) {
+    Float radius = pixel.radius;
+    Point3i pMin, pMax;
+    ToGrid(pixel.vp.p - Vector3f(radius, radius, radius), gridBounds, gridRes,
+           &pMin);
+    ToGrid(pixel.vp.p + Vector3f(radius, radius, radius), gridBounds, gridRes,
+           &pMax);
+    entries->push_back(~pixelIndex);
+    size_t first = entries->size();
+    for (int z = pMin.z; z <= pMax.z; ++z)
+        for (int y = pMin.y; y <= pMax.y; ++y)
+            for (int x = pMin.x; x <= pMax.x; ++x)
+                entries->push_back(hash(Point3i(x, y, z), hashSize));
+    int nCells = int(entries->size() - first);
+
+    // Remove the duplicate hashes; visible points usually overlap only a
+    // few cells, for which checking the earlier hashes is faster than
+    // sorting them
+    auto begin = entries->begin() + first, end = entries->end();
+    if (nCells <= 32) {
+        auto unique = begin;
+        for (auto h = begin; h != entries->end(); ++h)
+            if (std::find(begin, unique, *h) == unique) *unique++ = *h;
+        end = unique;
+    } else {
+        std::sort(begin, end);
+        end = std::unique(begin, end);
+    }
+    entries->erase(end, entries->end());
+    return nCells;
+}
+
 // SPPM Method Definitions
 void SPPMIntegrator::Render(const Scene &scene) {
     ProfilePhase p(Prof::IntegratorRender);
@@ -116,6 +159,24 @@ void SPPMIntegrator::Render(const Scene &scene) {
     std::unique_ptr<SPPMPixel[]> pixels(new SPPMPixel[nPixels]);
     for (int i = 0; i < nPixels; ++i) pixels[i].radius = initialSearchRadius;
     const Float invSqrtSPP = 1.f / std::sqrt(nIterations);
+
+    // Allocate grid for SPPM visible points; the pixels whose visible
+    // points overlap grid cells that hash to _h_ are
+    // _gridPixels[gridOffsets[h]]_ up to _gridPixels[gridOffsets[h + 1]]_.
+    // The buckets that each range of _gridRangeSize_ pixels are added to
+    // are found once, recorded in an element of _gridEntries_ by
+    // _addGridEntries()_ while they're counted, and then read back from
+    // there to store the pixels at the ranks in _gridRanks_.
+    const int hashSize = nPixels;
+    std::unique_ptr<std::atomic<int>[]> gridCounts(
+        new std::atomic<int>[hashSize]);
+    std::vector<int> gridOffsets(hashSize + 1), gridPixels;
+    const int gridRangeSize = 4096;
+    std::vector<std::vector<int>> gridEntries(
+        (nPixels + gridRangeSize - 1) / gridRangeSize);
+    std::vector<std::vector<int>> gridRanks(gridEntries.size());
+    std::unique_ptr<SPPMVisiblePointRecord[]> visiblePoints(
+        new SPPMVisiblePointRecord[nPixels]);
     pixelMemoryBytes = nPixels * sizeof(SPPMPixel);
     // Compute _lightDistr_ for sampling lights proportional to power
     std::unique_ptr<Distribution1D> lightDistr =
@@ -241,63 +302,101 @@ void SPPMIntegrator::Render(const Scene &scene) {
         // Create grid of all SPPM visible points
         int gridRes[3];
         Bounds3f gridBounds;
-        // Allocate grid for SPPM visible points
-        const int hashSize = nPixels;
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
         {
             ProfilePhase _(Prof::SPPMGridConstruction);
 
             // Compute grid bounds for SPPM visible points
-            Float maxRadius = 0.;
+            Float maxRadius = 0., sumRadius = 0.;
+            int nVisiblePoints = 0;
             for (int i = 0; i < nPixels; ++i) {
                 const SPPMPixel &pixel = pixels[i];
                 if (pixel.vp.beta.IsBlack()) continue;
                 Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
                 gridBounds = Union(gridBounds, vpBound);
                 maxRadius = std::max(maxRadius, pixel.radius);
+                sumRadius += pixel.radius;
+                ++nVisiblePoints;
             }
 
             // Compute resolution of SPPM grid in each dimension
+            Float cellSize = maxRadius;
+            if (tuneGridResolution && nVisiblePoints > 0)
+                // Size the cells for the typical visible point rather than
+                // the largest, which may be one of few whose radius hasn't
+                // shrunk; limit how many cells the largest ones overlap.
+                cellSize = std::max(sumRadius / nVisiblePoints, maxRadius / 4);
             Vector3f diag = gridBounds.Diagonal();
             Float maxDiag = MaxComponent(diag);
-            int baseGridRes = (int)(maxDiag / maxRadius);
+            int baseGridRes = (int)(maxDiag / cellSize);
             CHECK_GT(baseGridRes, 0);
             for (int i = 0; i < 3; ++i)
                 gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
 
-            // Add visible points to SPPM grid
-            ParallelFor([&](int pixelIndex) {
-                MemoryArena &arena = perThreadArenas[ThreadIndex];
-                SPPMPixel &pixel = pixels[pixelIndex];
-                if (!pixel.vp.beta.IsBlack()) {
-                    // Add pixel's visible point to applicable grid cells
-                    Float radius = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMax);
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = hash(Point3i(x, y, z), hashSize);
-                                SPPMPixelListNode *node =
-                                    arena.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of
-                                // _grid[h]_'s linked list
-                                node->next = grid[h];
-                                while (grid[h].compare_exchange_weak(
-                                           node->next, node) == false)
-                                    ;
-                            }
-                    ReportValue(gridCellsPerVisiblePoint,
-                                (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
-                                    (1 + pMax.z - pMin.z));
+            // Add visible points to SPPM grid with a counting sort: find
+            // and count the entries in each hash bucket, compute the
+            // buckets' offsets, and then store each entry's pixel index at
+            // the next slot of its bucket.
+            ParallelForRanges([&](int64_t start, int64_t end) {
+                for (int64_t h = start; h < end; ++h)
+                    gridCounts[h].store(0, std::memory_order_relaxed);
+            }, hashSize, 65536);
+
+            ParallelFor([&](int64_t range) {
+                std::vector<int> &entries = gridEntries[range];
+                entries.clear();
+                int end = std::min<int>((range + 1) * gridRangeSize, nPixels);
+                for (int pixelIndex = range * gridRangeSize; pixelIndex < end;
+                     ++pixelIndex) {
+                    const SPPMPixel &pixel = pixels[pixelIndex];
+                    if (pixel.vp.beta.IsBlack()) continue;
+                    visiblePoints[pixelIndex] = {pixel.vp.p,
+                                                 pixel.radius * pixel.radius};
+                    int nCells = addGridEntries(pixel, pixelIndex, gridBounds,
+                                                gridRes, hashSize, &entries);
+                    ReportValue(gridCellsPerVisiblePoint, nCells);
                 }
-            }, nPixels, 4096);
+
+                // Count the entries, recording each one's rank in its
+                // bucket so that they can be stored without atomics
+                std::vector<int> &ranks = gridRanks[range];
+                ranks.resize(entries.size());
+                for (size_t e = 0; e < entries.size(); ++e)
+                    if (entries[e] >= 0)
+                        ranks[e] = gridCounts[entries[e]].fetch_add(
+                            1, std::memory_order_relaxed);
+            }, gridEntries.size());
+
+            // Compute _gridOffsets_ from the bucket counts
+            int64_t nEntries = 0;
+            for (int h = 0; h < hashSize; ++h) {
+                gridOffsets[h] = int(nEntries);
+                nEntries += gridCounts[h].load(std::memory_order_relaxed);
+            }
+            CHECK_LE(nEntries, std::numeric_limits<int>::max());
+            gridOffsets[hashSize] = int(nEntries);
+            gridPixels.resize(nEntries);
+            int64_t gridBytes =
+                nEntries * sizeof(int) +
+                hashSize * (sizeof(int) + sizeof(std::atomic<int>)) +
+                nPixels * sizeof(SPPMVisiblePointRecord);
+            for (size_t i = 0; i < gridEntries.size(); ++i)
+                gridBytes += (gridEntries[i].capacity() +
+                              gridRanks[i].capacity()) * sizeof(int);
+            gridMemoryBytes = std::max<int64_t>(gridMemoryBytes, gridBytes);
+
+            ParallelFor([&](int64_t range) {
+                int pixelIndex = -1;
+                const std::vector<int> &entries = gridEntries[range];
+                const std::vector<int> &ranks = gridRanks[range];
+                for (size_t e = 0; e < entries.size(); ++e) {
+                    int entry = entries[e];
+                    if (entry < 0) {
+                        pixelIndex = ~entry;
+                        continue;
+                    }
+                    gridPixels[gridOffsets[entry] + ranks[e]] = pixelIndex;
+                }
+            }, gridEntries.size());
         }
 
         // Trace photons and accumulate contributions
@@ -353,16 +452,17 @@ void SPPMIntegrator::Render(const Scene &scene) {
                                    &photonGridIndex)) {
                             int h = hash(photonGridIndex, hashSize);
                             // Add photon contribution to visible points in
-                            // _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
+                            // grid cells that hash to _h_
+                            for (int e = gridOffsets[h];
+                                 e < gridOffsets[h + 1]; ++e) {
                                 ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                Float radius = pixel.radius;
-                                if (DistanceSquared(pixel.vp.p, isect.p) >
-                                    radius * radius)
+                                int pixelIndex = gridPixels[e];
+                                const SPPMVisiblePointRecord &vp =
+                                    visiblePoints[pixelIndex];
+                                if (DistanceSquared(vp.p, isect.p) >
+                                    vp.radius2)
                                     continue;
+                                SPPMPixel &pixel = pixels[pixelIndex];
                                 // Update _pixel_ $\Phi$ and $M$ for nearby
                                 // photon
                                 Vector3f wi = -photonRay.d;
@@ -508,9 +608,10 @@ Integrator *CreateSPPMIntegrator(const ParamSet &params,
     int photonsPerIter = params.FindOneInt("photonsperiteration", -1);
     int writeFreq = params.FindOneInt("imagewritefrequency", 1 << 31);
     Float radius = params.FindOneFloat("radius", 1.f);
+    bool tuneGrid = params.FindOneBool("tunegridresolution", false);
     if (PbrtOptions.quickRender) nIterations = std::max(1, nIterations / 16);
     return new SPPMIntegrator(camera, nIterations, photonsPerIter, maxDepth,
-                              radius, writeFreq);
+                              radius, writeFreq, tuneGrid);
 }
 
 }  // namespace pbrt
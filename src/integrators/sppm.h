@@ -52,7 +52,8 @@ class SPPMIntegrator : public Integrator {
     // SPPMIntegrator Public Methods
     SPPMIntegrator(std::shared_ptr<const Camera> &camera, int nIterations,
                    int photonsPerIteration, int maxDepth,
-                   Float initialSearchRadius, int writeFrequency)
+                   Float initialSearchRadius, int writeFrequency,
+                   bool tuneGridResolution)
         : camera(camera),
           initialSearchRadius(initialSearchRadius),
           nIterations(nIterations),
@@ -60,7 +61,8 @@ class SPPMIntegrator : public Integrator {
           photonsPerIteration(photonsPerIteration > 0
                                   ? photonsPerIteration
                                   : camera->film->croppedPixelBounds.Area()),
-          writeFrequency(writeFrequency) {}
+          writeFrequency(writeFrequency),
+          tuneGridResolution(tuneGridResolution) {}
     void Render(const Scene &scene);
 
   private:
@@ -71,6 +73,9 @@ class SPPMIntegrator : public Integrator {
     const int maxDepth;
     const int photonsPerIteration;
     const int writeFrequency;
+    // If true, the visible point grid's resolution follows the average
+    // search radius rather than the largest one.
+    const bool tuneGridResolution;
 };
 
 Integrator *CreateSPPMIntegrator(const ParamSet &params,
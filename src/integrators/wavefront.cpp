@@ -0,0 +1,378 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// integrators/wavefront.cpp*
+#include "integrators/wavefront.h"
+#include "bssrdf.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "light.h"
+#include "material.h"
+#include "paramset.h"
+#include "sampler.h"
+#include "scene.h"
+#include "stats.h"
+#include <algorithm>
+#include <typeinfo>
+
+namespace pbrt {
+
+STAT_COUNTER("Integrator/Wavefront path states", nPathStates);
+STAT_INT_DISTRIBUTION("Integrator/Wavefront path length", pathLength);
+
+// WavefrontPathIntegrator Local Declarations
+
+// Path state that persists across bounces, stored as separate arrays
+// indexed by path.
+struct PathStates {
+    PathStates(const std::vector<RayDifferential> &rays)
+        : ray(rays),
+          beta(rays.size(), Spectrum(1.f)),
+          etaScale(rays.size(), 1),
+          bounces(rays.size(), 0),
+          specularBounce(rays.size(), 0) {}
+    std::vector<RayDifferential> ray;
+    std::vector<Spectrum> beta;
+    std::vector<Float> etaScale;
+    std::vector<int> bounces;
+    std::vector<uint8_t> specularBounce;
+};
+
+// The direct lighting estimate for one path vertex, which is completed
+// once its shadow ray and BSDF-sampled ray have been traced.
+struct DirectLightingSample {
+    const Light *light = nullptr;
+    Float lightChoicePdf = 0;
+    Spectrum lightContrib, bsdfF;
+    Float bsdfWeight = 0, bsdfPdf = 0;
+    Vector3f bsdfWi;
+    int shadowRay = -1, bsdfRay = -1;
+};
+
+// WavefrontPathIntegrator Method Definitions
+WavefrontPathIntegrator::WavefrontPathIntegrator(
+    int maxDepth, std::shared_ptr<const Camera> camera,
+    std::shared_ptr<Sampler> sampler, const Bounds2i &pixelBounds,
+    Float rrThreshold, const std::string &lightSampleStrategy)
+    : SamplerIntegrator(camera, sampler, pixelBounds),
+      maxDepth(maxDepth),
+      rrThreshold(rrThreshold),
+      lightSampleStrategy(lightSampleStrategy) {}
+
+void WavefrontPathIntegrator::Preprocess(const Scene &scene,
+                                         Sampler &sampler) {
+    lightDistribution =
+        CreateLightSampleDistribution(lightSampleStrategy, scene);
+}
+
+Spectrum WavefrontPathIntegrator::Li(const RayDifferential &ray,
+                                     const Scene &scene, Sampler &sampler,
+                                     MemoryArena &arena, int depth) const {
+    Spectrum L(0.f);
+    BatchLi({ray}, {Float(1)}, {&sampler}, scene, arena, &L);
+    return L;
+}
+
+void WavefrontPathIntegrator::BatchLi(const std::vector<RayDifferential> &rays,
+                                      const std::vector<Float> &rayWeights,
+                                      const std::vector<Sampler *> &samplers,
+                                      const Scene &scene, MemoryArena &arena,
+                                      Spectrum *L) const {
+    ProfilePhase p(Prof::SamplerIntegratorLi);
+    // The stages below follow _PathIntegrator::Li()_ for each path and
+    // consume its sampler's dimensions in the same order, so that both
+    // integrators compute the same radiance estimates.
+    PathStates paths(rays);
+    std::vector<int> active;
+    for (size_t i = 0; i < rays.size(); ++i)
+        if (rayWeights[i] > 0) active.push_back(i);
+    nPathStates += active.size();
+
+    RayBatch batch, shadowBatch, bsdfBatch;
+    std::vector<SurfaceInteraction> isects, bsdfIsects;
+    std::unique_ptr<bool[]> hits, shadowHits, bsdfHits;
+    std::vector<int> shading, next;
+    std::vector<DirectLightingSample> direct;
+    auto finishPath = [&](int i) { ReportValue(pathLength, paths.bounces[i]); };
+    while (!active.empty()) {
+        // Find the next vertex of all active paths
+        int nActive = active.size();
+        batch.Clear();
+        for (int i : active) batch.Add(paths.ray[i]);
+        isects.assign(nActive, SurfaceInteraction());
+        hits.reset(new bool[nActive]);
+        scene.IntersectBatch(batch, isects.data(), hits.get());
+
+        // Add emitted light and terminate paths that escaped or reached
+        // _maxDepth_
+        shading.clear();
+        for (int j = 0; j < nActive; ++j) {
+            int i = active[j];
+            RayDifferential &ray = paths.ray[i];
+            ray.tMax = batch.tMax[j];
+            if (paths.bounces[i] == 0 || paths.specularBounce[i]) {
+                if (hits[j])
+                    L[i] += paths.beta[i] * isects[j].Le(-ray.d);
+                else
+                    for (const auto &light : scene.infiniteLights)
+                        L[i] += paths.beta[i] * light->Le(ray);
+            }
+            if (!hits[j] || paths.bounces[i] >= maxDepth)
+                finishPath(i);
+            else
+                shading.push_back(j);
+        }
+
+        // Compute scattering functions, grouping the intersections by
+        // material so that each material's code runs over many of them
+        // in a row
+        auto materialKey = [&](int j) {
+            const Material *material = isects[j].primitive->GetMaterial();
+            return std::make_pair(material ? typeid(*material).hash_code() : 0,
+                                  material);
+        };
+        std::stable_sort(shading.begin(), shading.end(), [&](int a, int b) {
+            return materialKey(a) < materialKey(b);
+        });
+        next.clear();
+        int nShading = 0;
+        for (int j : shading) {
+            int i = active[j];
+            SurfaceInteraction &isect = isects[j];
+            isect.ComputeScatteringFunctions(paths.ray[i], arena, true);
+            if (!isect.bsdf) {
+                // Skip over medium boundaries without counting a bounce
+                paths.ray[i] = isect.SpawnRay(paths.ray[i].d);
+                next.push_back(i);
+            } else
+                shading[nShading++] = j;
+        }
+        shading.resize(nShading);
+
+        // Sample lights and queue the shadow and BSDF-sampled rays that
+        // direct lighting needs
+        const BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+        shadowBatch.Clear();
+        bsdfBatch.Clear();
+        direct.assign(nShading, DirectLightingSample());
+        int nLights = int(scene.lights.size());
+        for (int k = 0; k < nShading; ++k) {
+            const SurfaceInteraction &isect = isects[shading[k]];
+            Sampler &sampler = *samplers[active[shading[k]]];
+            if (isect.bsdf->NumComponents(bsdfFlags) == 0 || nLights == 0)
+                continue;
+            // Randomly choose a single light to sample
+            DirectLightingSample &ds = direct[k];
+            const Distribution1D *distrib = lightDistribution->Lookup(isect.p);
+            int lightNum =
+                distrib->SampleDiscrete(sampler.Get1D(), &ds.lightChoicePdf);
+            if (ds.lightChoicePdf == 0) continue;
+            ds.light = scene.lights[lightNum].get();
+            Point2f uLight = sampler.Get2D();
+            Point2f uScattering = sampler.Get2D();
+
+            // Sample light source with multiple importance sampling
+            Vector3f wi;
+            Float lightPdf = 0, scatteringPdf = 0;
+            VisibilityTester visibility;
+            Spectrum Li = ds.light->Sample_Li(isect, uLight, &wi, &lightPdf,
+                                              &visibility);
+            if (lightPdf > 0 && !Li.IsBlack()) {
+                Spectrum f = isect.bsdf->f(isect.wo, wi, bsdfFlags) *
+                             AbsDot(wi, isect.shading.n);
+                scatteringPdf = isect.bsdf->Pdf(isect.wo, wi, bsdfFlags);
+                if (!f.IsBlack()) {
+                    if (IsDeltaLight(ds.light->flags))
+                        ds.lightContrib = f * Li / lightPdf;
+                    else {
+                        Float weight =
+                            PowerHeuristic(1, lightPdf, 1, scatteringPdf);
+                        ds.lightContrib = f * Li * weight / lightPdf;
+                    }
+                    ds.shadowRay = shadowBatch.Size();
+                    shadowBatch.Add(visibility.P0().SpawnRayTo(visibility.P1()));
+                }
+            }
+
+            // Sample BSDF with multiple importance sampling
+            if (IsDeltaLight(ds.light->flags)) continue;
+            BxDFType sampledType;
+            ds.bsdfF = isect.bsdf->Sample_f(isect.wo, &wi, uScattering,
+                                            &scatteringPdf, bsdfFlags,
+                                            &sampledType);
+            ds.bsdfF *= AbsDot(wi, isect.shading.n);
+            if (ds.bsdfF.IsBlack() || scatteringPdf == 0) continue;
+            ds.bsdfWeight = 1;
+            if (!(sampledType & BSDF_SPECULAR)) {
+                lightPdf = ds.light->Pdf_Li(isect, wi);
+                if (lightPdf == 0) continue;
+                ds.bsdfWeight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
+            }
+            ds.bsdfPdf = scatteringPdf;
+            ds.bsdfWi = wi;
+            ds.bsdfRay = bsdfBatch.Size();
+            bsdfBatch.Add(isect.SpawnRay(wi));
+        }
+
+        // Trace the direct lighting rays and add their contributions
+        shadowHits.reset(new bool[shadowBatch.Size()]);
+        scene.IntersectPBatch(shadowBatch, shadowHits.get());
+        bsdfIsects.assign(bsdfBatch.Size(), SurfaceInteraction());
+        bsdfHits.reset(new bool[bsdfBatch.Size()]);
+        scene.IntersectBatch(bsdfBatch, bsdfIsects.data(), bsdfHits.get());
+        for (int k = 0; k < nShading; ++k) {
+            const DirectLightingSample &ds = direct[k];
+            if (!ds.light) continue;
+            int i = active[shading[k]];
+            Spectrum Ld(0.f);
+            if (ds.shadowRay >= 0 && !shadowHits[ds.shadowRay])
+                Ld += ds.lightContrib;
+            if (ds.bsdfRay >= 0) {
+                Spectrum Li(0.f);
+                const SurfaceInteraction &lightIsect = bsdfIsects[ds.bsdfRay];
+                if (bsdfHits[ds.bsdfRay]) {
+                    if (lightIsect.primitive->GetAreaLight() == ds.light)
+                        Li = lightIsect.Le(-ds.bsdfWi);
+                } else
+                    Li = ds.light->Le(bsdfBatch.GetRay(ds.bsdfRay));
+                if (!Li.IsBlack())
+                    Ld += ds.bsdfF * Li * ds.bsdfWeight / ds.bsdfPdf;
+            }
+            Ld = paths.beta[i] * (Ld / ds.lightChoicePdf);
+            CHECK_GE(Ld.y(), 0.f);
+            L[i] += Ld;
+        }
+
+        // Sample BSDFs to get new path directions
+        for (int j : shading) {
+            int i = active[j];
+            SurfaceInteraction &isect = isects[j];
+            Sampler &sampler = *samplers[i];
+            Spectrum &beta = paths.beta[i];
+            Vector3f wo = -paths.ray[i].d, wi;
+            Float pdf;
+            BxDFType flags;
+            Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf,
+                                              BSDF_ALL, &flags);
+            if (f.IsBlack() || pdf == 0.f) {
+                finishPath(i);
+                continue;
+            }
+            beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+            CHECK_GE(beta.y(), 0.f);
+            DCHECK(!std::isinf(beta.y()));
+            paths.specularBounce[i] = (flags & BSDF_SPECULAR) != 0;
+            if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+                Float eta = isect.bsdf->eta;
+                paths.etaScale[i] *=
+                    (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+            }
+            paths.ray[i] = isect.SpawnRay(wi);
+
+            // Account for subsurface scattering, if applicable; this is
+            // done for one path at a time, since the probe rays depend on
+            // one another
+            if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+                SurfaceInteraction pi;
+                Spectrum S = isect.bssrdf->Sample_S(
+                    scene, sampler.Get1D(), sampler.Get2D(), arena, &pi, &pdf);
+                DCHECK(!std::isinf(beta.y()));
+                if (S.IsBlack() || pdf == 0) {
+                    finishPath(i);
+                    continue;
+                }
+                beta *= S / pdf;
+                L[i] += beta * UniformSampleOneLight(
+                                   pi, scene, arena, sampler, false,
+                                   lightDistribution->Lookup(pi.p));
+                Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(),
+                                               &pdf, BSDF_ALL, &flags);
+                if (f.IsBlack() || pdf == 0) {
+                    finishPath(i);
+                    continue;
+                }
+                beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+                DCHECK(!std::isinf(beta.y()));
+                paths.specularBounce[i] = (flags & BSDF_SPECULAR) != 0;
+                paths.ray[i] = pi.SpawnRay(wi);
+            }
+
+            // Possibly terminate the path with Russian roulette
+            Spectrum rrBeta = beta * paths.etaScale[i];
+            if (rrBeta.MaxComponentValue() < rrThreshold &&
+                paths.bounces[i] > 3) {
+                Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+                if (sampler.Get1D() < q) {
+                    finishPath(i);
+                    continue;
+                }
+                beta /= 1 - q;
+                DCHECK(!std::isinf(beta.y()));
+            }
+            ++paths.bounces[i];
+            next.push_back(i);
+        }
+
+        // Free the scattering functions of this bounce's vertices
+        std::swap(active, next);
+        arena.Reset();
+    }
+}
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
+    std::string lightStrategy =
+        params.FindOneString("lightsamplestrategy", "spatial");
+    return new WavefrontPathIntegrator(maxDepth, camera, sampler, pixelBounds,
+                                       rrThreshold, lightStrategy);
+}
+
+}  // namespace pbrt
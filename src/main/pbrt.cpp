@@ -36,6 +36,8 @@
 #include "api.h"
 #include "parser.h"
 #include "parallel.h"
+#include "distributed.h"
+#include "scenecache.h"
 #include <glog/logging.h>
 
 using namespace pbrt;
@@ -46,13 +48,63 @@ static void usage(const char *msg = nullptr) {
 
     fprintf(stderr, R"(usage: pbrt [<options>] <filename.pbrt...>
 Rendering options:
+  --adaptive <err>     Stop sampling each pixel once the estimated relative
+                       error of its value is below <err> (e.g. 0.01); the
+                       sampler's pixel sample count is the maximum. With
+                       --timebudget, the time saved goes to noisier pixels.
+  --adaptiveminspp <num> Take at least <num> samples in each pixel with
+                       --adaptive, checking for convergence after every
+                       <num> samples. Default: 16.
+  --batchrays          Trace the camera rays for each tile in batches of
+                       packets through the acceleration structure.
+  --checkpoint <file>  Periodically save the state of the render to the
+                       given file, so that it can be resumed with --resume.
+                       The file is removed once the image is complete.
+  --checkpointsecs <sec> Save a checkpoint every <sec> seconds. Default: 600.
   --cropwindow <x0,x1,y0,y1> Specify an image crop window.
   --help               Print this help text.
   --nthreads <num>     Use specified number of threads for rendering.
   --outfile <filename> Write the final image to the given filename.
+  --passes <num>       Stop rendering after <num> progressive passes and
+                       write the image with the samples taken so far.
+                       Implies --progressive.
+  --progressive        Render the image in passes that each double the
+                       number of samples in every pixel, so that a preview
+                       is available early on. Works best with the "halton"
+                       and "sobol" samplers.
   --quick              Automatically reduce a number of quality settings to
                        render more quickly.
   --quiet              Suppress all text output other than error messages.
+  --resume             Continue the render saved in the --checkpoint file.
+  --scenecache <file>  Load the parsed scene and its acceleration structures
+                       from the given cache file if it is up to date with
+                       the scene files; otherwise write it after parsing.
+  --snapshotpasses <num> Write the image after every <num> progressive
+                       passes. Implies --progressive.
+  --snapshotsecs <sec> Write the image after the first progressive pass to
+                       finish at least <sec> seconds after the last one
+                       was written. Implies --progressive.
+  --texturecachemb <mb> Keep image textures in a cache of tiles of at most
+                       <mb> megabytes, reading each one when it's first
+                       used. Default: 0 (textures are kept in memory).
+  --tileorder <order>  Render the image's tiles in the given order:
+                       "hilbert" (along a Hilbert curve, the default),
+                       "spiral" (out from the center) or "scanline".
+  --tilesize <num>     Render the image in tiles of <num>x<num> pixels.
+                       Default: chosen based on the image size and the
+                       number of threads.
+  --timebudget <sec>   Stop rendering after <sec> seconds and write the
+                       image with the samples taken so far. Implies
+                       --progressive.
+
+Distributed rendering options:
+  --listen <port>      Act as a coordinator: accept connections from worker
+                       processes on the given TCP port and have them render
+                       the image's tiles.
+  --nworkers <num>     Act as a coordinator and launch the given number of
+                       worker processes on the local machine.
+  --worker <host:port> Act as a worker: render tiles for the coordinator at
+                       the given address instead of writing an image.
 
 Logging options:
   --logdir <dir>       Specify directory that log files should be written to.
@@ -79,6 +131,8 @@ int main(int argc, char *argv[]) {
 
     Options options;
     std::vector<std::string> filenames;
+    std::string sceneCacheFile;
+    int listenPort = -1, nLocalWorkers = 0;
     // Process command-line arguments
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "--nthreads") || !strcmp(argv[i], "-nthreads")) {
@@ -87,6 +141,25 @@ int main(int argc, char *argv[]) {
             options.nThreads = atoi(argv[++i]);
         } else if (!strncmp(argv[i], "--nthreads=", 11)) {
             options.nThreads = atoi(&argv[i][11]);
+        } else if (!strcmp(argv[i], "--listen") || !strcmp(argv[i], "-listen")) {
+            if (i + 1 == argc)
+                usage("missing value after --listen argument");
+            listenPort = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--listen=", 9)) {
+            listenPort = atoi(&argv[i][9]);
+        } else if (!strcmp(argv[i], "--nworkers") ||
+                   !strcmp(argv[i], "-nworkers")) {
+            if (i + 1 == argc)
+                usage("missing value after --nworkers argument");
+            nLocalWorkers = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--nworkers=", 11)) {
+            nLocalWorkers = atoi(&argv[i][11]);
+        } else if (!strcmp(argv[i], "--worker") || !strcmp(argv[i], "-worker")) {
+            if (i + 1 == argc)
+                usage("missing value after --worker argument");
+            options.coordinator = argv[++i];
+        } else if (!strncmp(argv[i], "--worker=", 9)) {
+            options.coordinator = &argv[i][9];
         } else if (!strcmp(argv[i], "--outfile") || !strcmp(argv[i], "-outfile")) {
             if (i + 1 == argc)
                 usage("missing value after --outfile argument");
@@ -113,6 +186,107 @@ int main(int argc, char *argv[]) {
             FLAGS_minloglevel = atoi(argv[++i]);
         } else if (!strncmp(argv[i], "--minloglevel=", 14)) {
             FLAGS_minloglevel = atoi(&argv[i][14]);
+        } else if (!strcmp(argv[i], "--scenecache") ||
+                   !strcmp(argv[i], "-scenecache")) {
+            if (i + 1 == argc)
+                usage("missing value after --scenecache argument");
+            sceneCacheFile = argv[++i];
+        } else if (!strncmp(argv[i], "--scenecache=", 13)) {
+            sceneCacheFile = &argv[i][13];
+        } else if (!strcmp(argv[i], "--adaptive") ||
+                   !strcmp(argv[i], "-adaptive")) {
+            if (i + 1 == argc)
+                usage("missing value after --adaptive argument");
+            options.adaptiveThreshold = atof(argv[++i]);
+        } else if (!strncmp(argv[i], "--adaptive=", 11)) {
+            options.adaptiveThreshold = atof(&argv[i][11]);
+        } else if (!strcmp(argv[i], "--adaptiveminspp") ||
+                   !strcmp(argv[i], "-adaptiveminspp")) {
+            if (i + 1 == argc)
+                usage("missing value after --adaptiveminspp argument");
+            options.adaptiveMinSamples = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--adaptiveminspp=", 17)) {
+            options.adaptiveMinSamples = atoi(&argv[i][17]);
+        } else if (!strcmp(argv[i], "--batchrays") ||
+                   !strcmp(argv[i], "-batchrays")) {
+            options.batchCameraRays = true;
+        } else if (!strcmp(argv[i], "--checkpoint") ||
+                   !strcmp(argv[i], "-checkpoint")) {
+            if (i + 1 == argc)
+                usage("missing value after --checkpoint argument");
+            options.checkpointFile = argv[++i];
+        } else if (!strncmp(argv[i], "--checkpoint=", 13)) {
+            options.checkpointFile = &argv[i][13];
+        } else if (!strcmp(argv[i], "--checkpointsecs") ||
+                   !strcmp(argv[i], "-checkpointsecs")) {
+            if (i + 1 == argc)
+                usage("missing value after --checkpointsecs argument");
+            options.checkpointSeconds = atof(argv[++i]);
+        } else if (!strncmp(argv[i], "--checkpointsecs=", 17)) {
+            options.checkpointSeconds = atof(&argv[i][17]);
+        } else if (!strcmp(argv[i], "--resume") ||
+                   !strcmp(argv[i], "-resume")) {
+            options.resume = true;
+        } else if (!strcmp(argv[i], "--passes") ||
+                   !strcmp(argv[i], "-passes")) {
+            if (i + 1 == argc)
+                usage("missing value after --passes argument");
+            options.maxPasses = atoi(argv[++i]);
+            options.progressive = true;
+        } else if (!strncmp(argv[i], "--passes=", 9)) {
+            options.maxPasses = atoi(&argv[i][9]);
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--progressive") ||
+                   !strcmp(argv[i], "-progressive")) {
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--snapshotpasses") ||
+                   !strcmp(argv[i], "-snapshotpasses")) {
+            if (i + 1 == argc)
+                usage("missing value after --snapshotpasses argument");
+            options.snapshotPasses = atoi(argv[++i]);
+            options.progressive = true;
+        } else if (!strncmp(argv[i], "--snapshotpasses=", 17)) {
+            options.snapshotPasses = atoi(&argv[i][17]);
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--snapshotsecs") ||
+                   !strcmp(argv[i], "-snapshotsecs")) {
+            if (i + 1 == argc)
+                usage("missing value after --snapshotsecs argument");
+            options.snapshotSeconds = atof(argv[++i]);
+            options.progressive = true;
+        } else if (!strncmp(argv[i], "--snapshotsecs=", 15)) {
+            options.snapshotSeconds = atof(&argv[i][15]);
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--texturecachemb") ||
+                   !strcmp(argv[i], "-texturecachemb")) {
+            if (i + 1 == argc)
+                usage("missing value after --texturecachemb argument");
+            options.textureCacheMB = atof(argv[++i]);
+        } else if (!strncmp(argv[i], "--texturecachemb=", 17)) {
+            options.textureCacheMB = atof(&argv[i][17]);
+        } else if (!strcmp(argv[i], "--tileorder") ||
+                   !strcmp(argv[i], "-tileorder")) {
+            if (i + 1 == argc)
+                usage("missing value after --tileorder argument");
+            options.tileOrder = argv[++i];
+        } else if (!strncmp(argv[i], "--tileorder=", 12)) {
+            options.tileOrder = &argv[i][12];
+        } else if (!strcmp(argv[i], "--tilesize") ||
+                   !strcmp(argv[i], "-tilesize")) {
+            if (i + 1 == argc)
+                usage("missing value after --tilesize argument");
+            options.tileSize = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--tilesize=", 11)) {
+            options.tileSize = atoi(&argv[i][11]);
+        } else if (!strcmp(argv[i], "--timebudget") ||
+                   !strcmp(argv[i], "-timebudget")) {
+            if (i + 1 == argc)
+                usage("missing value after --timebudget argument");
+            options.timeBudget = atof(argv[++i]);
+            options.progressive = true;
+        } else if (!strncmp(argv[i], "--timebudget=", 13)) {
+            options.timeBudget = atof(&argv[i][13]);
+            options.progressive = true;
         } else if (!strcmp(argv[i], "--quick") || !strcmp(argv[i], "-quick")) {
             options.quickRender = true;
         } else if (!strcmp(argv[i], "--quiet") || !strcmp(argv[i], "-quiet")) {
@@ -137,6 +311,32 @@ int main(int argc, char *argv[]) {
         } else
             filenames.push_back(argv[i]);
     }
+    if (!options.coordinator.empty() && (listenPort >= 0 || nLocalWorkers > 0))
+        usage("--worker can't be combined with --listen or --nworkers");
+    if (nLocalWorkers > 0 && (options.cat || options.toPly))
+        usage("--nworkers can't be combined with --cat or --toply");
+    if (nLocalWorkers > 0 && filenames.empty())
+        usage("--nworkers requires scene files to be given on the command "
+              "line");
+    if (options.progressive && (!options.coordinator.empty() ||
+                                listenPort >= 0 || nLocalWorkers > 0))
+        usage("progressive rendering can't be combined with distributed "
+              "rendering");
+    if (!options.checkpointFile.empty() && (!options.coordinator.empty() ||
+                                            listenPort >= 0 ||
+                                            nLocalWorkers > 0))
+        usage("--checkpoint can't be combined with distributed rendering");
+    if (options.textureCacheMB < 0)
+        usage("--texturecachemb must not be negative");
+    if (options.adaptiveMinSamples < 1)
+        usage("--adaptiveminspp must be at least 1");
+    if (options.resume && options.checkpointFile.empty())
+        usage("--resume requires a --checkpoint file");
+    if (!sceneCacheFile.empty() && (options.cat || options.toPly))
+        usage("--scenecache can't be combined with --cat or --toply");
+    if (!sceneCacheFile.empty() && filenames.empty())
+        usage("--scenecache requires scene files to be given on the command "
+              "line");
 
     // Print welcome banner
     if (!options.quiet && !options.cat && !options.toPly) {
@@ -159,14 +359,45 @@ int main(int argc, char *argv[]) {
         fflush(stdout);
     }
     pbrtInit(options);
+    if (listenPort >= 0 || nLocalWorkers > 0) {
+        // Listen only on the loopback interface if no port was given
+        // explicitly, since only local workers will know which one is used.
+        int port = DistributedListen(std::max(listenPort, 0), listenPort < 0);
+        if (port >= 0 && nLocalWorkers > 0) {
+            // Workers get the same arguments as this process, minus the
+            // coordinator options
+            std::vector<std::string> workerArgs;
+            for (int i = 0; i < argc; ++i) {
+                if (!strcmp(argv[i], "--listen") ||
+                    !strcmp(argv[i], "-listen") ||
+                    !strcmp(argv[i], "--nworkers") ||
+                    !strcmp(argv[i], "-nworkers"))
+                    ++i;
+                else if (strncmp(argv[i], "--listen=", 9) &&
+                         strncmp(argv[i], "--nworkers=", 11))
+                    workerArgs.push_back(argv[i]);
+            }
+            workerArgs.push_back("--quiet");
+            workerArgs.push_back("--worker");
+            workerArgs.push_back(StringPrintf("127.0.0.1:%d", port));
+            SpawnLocalWorkers(nLocalWorkers, workerArgs);
+        }
+    }
     // Process scene description
     if (filenames.empty()) {
         // Parse scene from standard input
         pbrtParseFile("-");
-    } else {
-        // Parse scene from input files
+    } else if (sceneCacheFile.empty() ||
+               !ReplaySceneCache(sceneCacheFile, filenames)) {
+        // Parse scene from input files. Workers don't write the scene
+        // cache, since the coordinator and any other workers would
+        // otherwise all write it at once.
+        bool writeSceneCache =
+            !sceneCacheFile.empty() && options.coordinator.empty();
+        if (writeSceneCache) BeginSceneCache(sceneCacheFile, filenames);
         for (const std::string &f : filenames)
             pbrtParseFile(f);
+        if (writeSceneCache) EndSceneCache();
     }
     pbrtCleanup();
     return 0;
@@ -34,11 +34,13 @@
 #include "materials/fourier.h"
 #include "interaction.h"
 #include "paramset.h"
+#include <mutex>
 
 namespace pbrt {
 
 std::map<std::string, std::unique_ptr<FourierBSDFTable>>
     FourierMaterial::loadedBSDFs;
+static std::mutex loadedBSDFsMutex;
 
 // FourierMaterial Method Definitions
 /*
@@ -201,6 +203,8 @@ fail:
 FourierMaterial::FourierMaterial(const std::string &filename,
                                  const std::shared_ptr<Texture<Float>> &bumpMap)
     : bumpMap(bumpMap) {
+    // Files given to Import are parsed in parallel
+    std::lock_guard<std::mutex> lock(loadedBSDFsMutex);
     if (loadedBSDFs.find(filename) == loadedBSDFs.end()) {
         std::unique_ptr<FourierBSDFTable> table(new FourierBSDFTable);
         FourierBSDFTable::Read(filename, table.get());
@@ -41,6 +41,7 @@ namespace pbrt {
 // MaxMinDistSampler Method Definitions
 void MaxMinDistSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    PixelSampler::StartPixel(p);
     Float invSPP = (Float)1 / samplesPerPixel;
     for (int i = 0; i < samplesPerPixel; ++i)
         samples2D[0][i] = Point2f(i * invSPP, SampleGeneratorMatrix(CPixel, i));
@@ -61,12 +62,11 @@ void MaxMinDistSampler::StartPixel(const Point2i &p) {
         int count = samples2DArraySizes[i];
         Sobol2D(count, samplesPerPixel, &sampleArray2D[i][0], rng);
     }
-    PixelSampler::StartPixel(p);
 }
 
 std::unique_ptr<Sampler> MaxMinDistSampler::Clone(int seed) {
     MaxMinDistSampler *mmds = new MaxMinDistSampler(*this);
-    mmds->rng.SetSequence(seed);
+    mmds->SetSeed(seed);
     return std::unique_ptr<Sampler>(mmds);
 }
 
@@ -39,7 +39,8 @@
 
 namespace pbrt {
 
-RandomSampler::RandomSampler(int ns, int seed) : Sampler(ns), rng(seed) {}
+RandomSampler::RandomSampler(int ns, int seed)
+    : Sampler(ns), rng(seed), seed(seed) {}
 
 Float RandomSampler::Get1D() {
     ProfilePhase _(Prof::GetSample);
@@ -55,12 +56,15 @@ Point2f RandomSampler::Get2D() {
 
 std::unique_ptr<Sampler> RandomSampler::Clone(int seed) {
     RandomSampler *rs = new RandomSampler(*this);
+    rs->seed = seed;
     rs->rng.SetSequence(seed);
     return std::unique_ptr<Sampler>(rs);
 }
 
 void RandomSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    Sampler::StartPixel(p);
+    rng.SetSequence(PixelSampleSequence(seed, 0));
     for (size_t i = 0; i < sampleArray1D.size(); ++i)
         for (size_t j = 0; j < sampleArray1D[i].size(); ++j)
             sampleArray1D[i][j] = rng.UniformFloat();
@@ -68,7 +72,18 @@ void RandomSampler::StartPixel(const Point2i &p) {
     for (size_t i = 0; i < sampleArray2D.size(); ++i)
         for (size_t j = 0; j < sampleArray2D[i].size(); ++j)
             sampleArray2D[i][j] = {rng.UniformFloat(), rng.UniformFloat()};
-    Sampler::StartPixel(p);
+}
+
+bool RandomSampler::StartNextSample() {
+    bool more = Sampler::StartNextSample();
+    rng.SetSequence(PixelSampleSequence(seed, currentPixelSampleIndex));
+    return more;
+}
+
+bool RandomSampler::SetSampleNumber(int64_t sampleNum) {
+    bool valid = Sampler::SetSampleNumber(sampleNum);
+    rng.SetSequence(PixelSampleSequence(seed, currentPixelSampleIndex));
+    return valid;
 }
 
 Sampler *CreateRandomSampler(const ParamSet &params) {
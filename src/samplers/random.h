@@ -48,12 +48,17 @@ class RandomSampler : public Sampler {
   public:
     RandomSampler(int ns, int seed = 0);
     void StartPixel(const Point2i &);
+    bool StartNextSample();
+    bool SetSampleNumber(int64_t sampleNum);
     Float Get1D();
     Point2f Get2D();
     std::unique_ptr<Sampler> Clone(int seed);
 
   private:
+    // _rng_ is reseeded for each pixel sample, so that the values of a
+    // sample don't depend on which samples were taken before it
     RNG rng;
+    int seed;
 };
 
 Sampler *CreateRandomSampler(const ParamSet &params);
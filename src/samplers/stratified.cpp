@@ -42,6 +42,7 @@ namespace pbrt {
 // StratifiedSampler Method Definitions
 void StratifiedSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    PixelSampler::StartPixel(p);
     // Generate single stratified samples for the pixel
     for (size_t i = 0; i < samples1D.size(); ++i) {
         StratifiedSample1D(&samples1D[i][0], xPixelSamples * yPixelSamples, rng,
@@ -67,12 +68,11 @@ void StratifiedSampler::StartPixel(const Point2i &p) {
             int count = samples2DArraySizes[i];
             LatinHypercube(&sampleArray2D[i][j * count].x, count, 2, rng);
         }
-    PixelSampler::StartPixel(p);
 }
 
 std::unique_ptr<Sampler> StratifiedSampler::Clone(int seed) {
     StratifiedSampler *ss = new StratifiedSampler(*this);
-    ss->rng.SetSequence(seed);
+    ss->SetSeed(seed);
     return std::unique_ptr<Sampler>(ss);
 }
 
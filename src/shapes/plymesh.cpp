@@ -32,17 +32,376 @@
 
 
 // shapes/plymesh.cpp*
-#include "shapes/triangle.h"
+#include "shapes/plymesh.h"
 #include "textures/constant.h"
+#include "fileutil.h"
 #include "paramset.h"
+#include "parallel.h"
 #include "ext/rply.h"
 
+#include <atomic>
+#include <climits>
 #include <iostream>
+#include <sstream>
 
 namespace pbrt {
 using namespace std;
 
+STAT_COUNTER("Scene/PLY files decoded directly", nDirectPLYFiles);
+
+// PLY Direct Reading Definitions
+enum class PLYType {
+    Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64
+};
+
+struct PLYProperty {
+    std::string name;
+    // For list properties, _type_ is the type of the list's items
+    PLYType type, countType;
+    int size, countSize;
+    bool isList;
+};
+
+struct PLYElement {
+    std::string name;
+    int64_t count;
+    std::vector<PLYProperty> properties;
+};
+
+static bool parsePLYType(const std::string &name, PLYType *type, int *size) {
+    static const struct {
+        const char *names[2];
+        PLYType type;
+        int size;
+    } types[] = {{{"char", "int8"}, PLYType::Int8, 1},
+                 {{"uchar", "uint8"}, PLYType::UInt8, 1},
+                 {{"short", "int16"}, PLYType::Int16, 2},
+                 {{"ushort", "uint16"}, PLYType::UInt16, 2},
+                 {{"int", "int32"}, PLYType::Int32, 4},
+                 {{"uint", "uint32"}, PLYType::UInt32, 4},
+                 {{"float", "float32"}, PLYType::Float32, 4},
+                 {{"double", "float64"}, PLYType::Float64, 8}};
+    for (const auto &t : types)
+        if (name == t.names[0] || name == t.names[1]) {
+            *type = t.type;
+            *size = t.size;
+            return true;
+        }
+    return false;
+}
+
+static bool isIntegerPLYType(PLYType type) {
+    return type != PLYType::Float32 && type != PLYType::Float64;
+}
+
+// Parses the header of a binary little-endian PLY file, returning the
+// offset of the data that follows it in _*dataOffset_.
+static bool parsePLYHeader(const char *data, size_t size,
+                           std::vector<PLYElement> *elements,
+                           size_t *dataOffset) {
+    size_t pos = 0;
+    bool sawFormat = false;
+    for (int lineNumber = 0;; ++lineNumber) {
+        const char *eol = (const char *)memchr(data + pos, '\n', size - pos);
+        if (!eol) return false;
+        std::string line(data + pos, eol - (data + pos));
+        pos = eol - data + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if (lineNumber == 0) {
+            if (keyword != "ply") return false;
+        } else if (keyword == "format") {
+            std::string format, version;
+            tokens >> format >> version;
+            if (format != "binary_little_endian" || version != "1.0")
+                return false;
+            sawFormat = true;
+        } else if (keyword == "comment" || keyword == "obj_info") {
+            continue;
+        } else if (keyword == "element") {
+            PLYElement element;
+            if (!(tokens >> element.name >> element.count) ||
+                element.count < 0)
+                return false;
+            elements->push_back(element);
+        } else if (keyword == "property") {
+            if (elements->empty()) return false;
+            PLYProperty prop;
+            std::string type;
+            tokens >> type;
+            prop.isList = (type == "list");
+            if (prop.isList) {
+                std::string countType;
+                tokens >> countType >> type;
+                if (!parsePLYType(countType, &prop.countType,
+                                  &prop.countSize) ||
+                    !isIntegerPLYType(prop.countType))
+                    return false;
+            }
+            if (!parsePLYType(type, &prop.type, &prop.size) ||
+                !(tokens >> prop.name))
+                return false;
+            elements->back().properties.push_back(prop);
+        } else if (keyword == "end_header") {
+            *dataOffset = pos;
+            return sawFormat;
+        } else
+            return false;
+    }
+}
+
+template <typename T>
+static inline T readPLYValue(const char *ptr) {
+    T value;
+    memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+static inline double decodePLYValue(const char *ptr, PLYType type) {
+    switch (type) {
+    case PLYType::Int8:
+        return readPLYValue<int8_t>(ptr);
+    case PLYType::UInt8:
+        return readPLYValue<uint8_t>(ptr);
+    case PLYType::Int16:
+        return readPLYValue<int16_t>(ptr);
+    case PLYType::UInt16:
+        return readPLYValue<uint16_t>(ptr);
+    case PLYType::Int32:
+        return readPLYValue<int32_t>(ptr);
+    case PLYType::UInt32:
+        return readPLYValue<uint32_t>(ptr);
+    case PLYType::Float32:
+        return readPLYValue<float>(ptr);
+    default:
+        return readPLYValue<double>(ptr);
+    }
+}
+
+static inline Float decodePLYFloat(const char *ptr, PLYType type) {
+    // Vertex properties are almost always 32-bit floats
+    if (type == PLYType::Float32) return readPLYValue<float>(ptr);
+    return Float(decodePLYValue(ptr, type));
+}
+
+static inline int64_t decodePLYInt(const char *ptr, PLYType type) {
+    switch (type) {
+    case PLYType::Int32:
+        return readPLYValue<int32_t>(ptr);
+    case PLYType::UInt32:
+        return readPLYValue<uint32_t>(ptr);
+    case PLYType::UInt8:
+        return readPLYValue<uint8_t>(ptr);
+    default:
+        return int64_t(decodePLYValue(ptr, type));
+    }
+}
+
+// PLY files are read in ranges of this many vertices or faces, in parallel
+static const int plyRangeSize = 64 * 1024;
+
+bool ReadPLYMeshDirect(const std::string &filename, PLYMesh *mesh) {
+    // The data is decoded in place, so the host must be little-endian too
+    const uint32_t one = 1;
+    if (*(const uint8_t *)&one != 1) return false;
+
+    MappedFile file;
+    if (!file.Open(filename)) return false;
+    std::vector<PLYElement> elements;
+    size_t dataOffset;
+    if (!parsePLYHeader(file.Data(), file.Size(), &elements, &dataOffset))
+        return false;
+    // Only files holding vertices followed by faces are handled
+    if (elements.size() != 2 || elements[0].name != "vertex" ||
+        elements[1].name != "face")
+        return false;
+    const PLYElement &vertex = elements[0], &face = elements[1];
+    if (vertex.count == 0 || face.count == 0 || vertex.count > INT_MAX ||
+        face.count > INT_MAX / 6)
+        return false;
+    int nVertices = vertex.count, nFaces = face.count;
+
+    // Find the offsets of the vertex properties; every vertex has the same
+    // layout.
+    int vertexSize = 0;
+    std::map<std::string, const PLYProperty *> vertexProps;
+    std::map<std::string, int> vertexOffsets;
+    for (const PLYProperty &prop : vertex.properties) {
+        if (prop.isList) return false;
+        vertexProps[prop.name] = &prop;
+        vertexOffsets[prop.name] = vertexSize;
+        vertexSize += prop.size;
+    }
+    auto hasProps = [&](const char *a, const char *b, const char *c) {
+        return vertexProps.count(a) && vertexProps.count(b) &&
+               (!c || vertexProps.count(c));
+    };
+    if (!hasProps("x", "y", "z")) return false;
+    bool hasNormals = hasProps("nx", "ny", "nz");
+    // Use the same names for texture coordinates as ReadPLYMeshRply()
+    const char *uvNames[][2] = {{"u", "v"},
+                                {"s", "t"},
+                                {"texture_u", "texture_v"},
+                                {"texture_s", "texture_t"}};
+    const char *uName = nullptr, *vName = nullptr;
+    for (const auto &names : uvNames)
+        if (hasProps(names[0], names[1], nullptr)) {
+            uName = names[0];
+            vName = names[1];
+            break;
+        }
+
+    const char *vertexData = file.Data() + dataOffset;
+    const char *fileEnd = file.Data() + file.Size();
+    if (size_t(fileEnd - vertexData) / vertexSize < size_t(nVertices))
+        return false;
+    const char *faceData = vertexData + size_t(nVertices) * vertexSize;
+
+    // Decode the vertices
+    mesh->nVertices = nVertices;
+    mesh->p.reset(new Point3f[nVertices]);
+    if (hasNormals) mesh->n.reset(new Normal3f[nVertices]);
+    if (uName) mesh->uv.reset(new Point2f[nVertices]);
+    auto decodeVertices = [&](const char *names[], int nComponents,
+                              Float *values) {
+        int offsets[3];
+        PLYType types[3];
+        for (int c = 0; c < nComponents; ++c) {
+            offsets[c] = vertexOffsets[names[c]];
+            types[c] = vertexProps[names[c]]->type;
+        }
+        ParallelForRanges([&](int64_t start, int64_t end) {
+            const char *ptr = vertexData + start * vertexSize;
+            Float *v = values + start * nComponents;
+            for (int64_t i = start; i < end; ++i, ptr += vertexSize)
+                for (int c = 0; c < nComponents; ++c)
+                    *v++ = decodePLYFloat(ptr + offsets[c], types[c]);
+        }, nVertices, plyRangeSize);
+    };
+    const char *pNames[] = {"x", "y", "z"};
+    decodeVertices(pNames, 3, &mesh->p[0].x);
+    if (hasNormals) {
+        const char *nNames[] = {"nx", "ny", "nz"};
+        decodeVertices(nNames, 3, &mesh->n[0].x);
+    }
+    if (uName) {
+        const char *names[] = {uName, vName};
+        decodeVertices(names, 2, &mesh->uv[0].x);
+    }
+
+    // Check the face properties; the vertex indices are required, and face
+    // indices and other scalar properties are optional.
+    const PLYProperty *indicesProp = nullptr;
+    int faceIndicesProp = -1;
+    for (size_t i = 0; i < face.properties.size(); ++i) {
+        const PLYProperty &prop = face.properties[i];
+        if (prop.isList) {
+            if (prop.name != "vertex_indices" || indicesProp ||
+                !isIntegerPLYType(prop.type))
+                return false;
+            indicesProp = &prop;
+        } else if (prop.name == "face_indices") {
+            if (!isIntegerPLYType(prop.type)) return false;
+            faceIndicesProp = i;
+        }
+    }
+    if (!indicesProp) return false;
+
+    // Faces are usually all triangles, in which case they have a fixed
+    // layout, can be decoded in parallel, and give one triangle each.
+    int triangleSize = 0, countOffset = 0, faceIndexOffset = 0;
+    for (size_t i = 0; i < face.properties.size(); ++i) {
+        const PLYProperty &prop = face.properties[i];
+        if (&prop == indicesProp) countOffset = triangleSize;
+        if (int(i) == faceIndicesProp) faceIndexOffset = triangleSize;
+        triangleSize += prop.isList ? prop.countSize + 3 * prop.size
+                                    : prop.size;
+    }
+    auto validIndex = [&](int64_t index) {
+        return index >= 0 && index < nVertices;
+    };
+    bool allTriangles = false;
+    if (size_t(fileEnd - faceData) / triangleSize >= size_t(nFaces)) {
+        mesh->indices.resize(3 * size_t(nFaces));
+        if (faceIndicesProp != -1) mesh->faceIndices.resize(nFaces);
+        std::atomic<bool> failed{false};
+        ParallelForRanges([&](int64_t start, int64_t end) {
+            const char *ptr = faceData + start * triangleSize;
+            int *indices = &mesh->indices[3 * start];
+            for (int64_t i = start; i < end; ++i, ptr += triangleSize) {
+                const char *count = ptr + countOffset;
+                if (decodePLYInt(count, indicesProp->countType) != 3) {
+                    failed = true;
+                    return;
+                }
+                const char *items = count + indicesProp->countSize;
+                for (int v = 0; v < 3; ++v) {
+                    int64_t index = decodePLYInt(items + v * indicesProp->size,
+                                                 indicesProp->type);
+                    if (!validIndex(index)) {
+                        failed = true;
+                        return;
+                    }
+                    *indices++ = int(index);
+                }
+                if (faceIndicesProp != -1)
+                    mesh->faceIndices[i] = decodePLYInt(
+                        ptr + faceIndexOffset,
+                        face.properties[faceIndicesProp].type);
+            }
+        }, nFaces, plyRangeSize);
+        allTriangles = !failed;
+    }
+
+    if (!allTriangles) {
+        // Walk through the faces one at a time, splitting quads into two
+        // triangles the same way as ReadPLYMeshRply()
+        mesh->indices.clear();
+        mesh->indices.reserve(3 * size_t(nFaces));
+        mesh->faceIndices.clear();
+        const char *ptr = faceData;
+        for (int f = 0; f < nFaces; ++f) {
+            for (size_t i = 0; i < face.properties.size(); ++i) {
+                const PLYProperty &prop = face.properties[i];
+                if (fileEnd - ptr < (prop.isList ? prop.countSize : prop.size))
+                    return false;
+                if (!prop.isList) {
+                    if (int(i) == faceIndicesProp)
+                        mesh->faceIndices.push_back(
+                            decodePLYInt(ptr, prop.type));
+                    ptr += prop.size;
+                    continue;
+                }
+                int64_t count = decodePLYInt(ptr, prop.countType);
+                ptr += prop.countSize;
+                // Leave faces that aren't triangles or quads to rply, which
+                // warns about them; face indices for quads aren't supported.
+                if ((count != 3 && count != 4) ||
+                    (count == 4 && faceIndicesProp != -1) ||
+                    fileEnd - ptr < count * prop.size)
+                    return false;
+                int64_t v[4];
+                for (int j = 0; j < count; ++j, ptr += prop.size) {
+                    v[j] = decodePLYInt(ptr, prop.type);
+                    if (!validIndex(v[j])) return false;
+                }
+                for (int j : {0, 1, 2}) mesh->indices.push_back(v[j]);
+                if (count == 4)
+                    for (int j : {3, 0, 2}) mesh->indices.push_back(v[j]);
+            }
+        }
+    }
+    ++nDirectPLYFiles;
+    return true;
+}
+
+// PLY rply Reading Definitions
 struct CallbackContext {
+    // The vertex callback uses the first three members as an array of
+    // buffers, indexed by the buffer index in its flags.
     Point3f *p;
     Normal3f *n;
     Point2f *uv;
@@ -63,14 +422,6 @@ struct CallbackContext {
           faceIndexCtr(0),
           error(false),
           vertexCount(0) {}
-
-    ~CallbackContext() {
-        delete[] p;
-        delete[] n;
-        delete[] uv;
-        delete[] indices;
-        delete[] faceIndices;
-    }
 };
 
 void rply_message_callback(p_ply ply, const char *message) {
@@ -154,20 +505,18 @@ int rply_face_callback(p_ply_argument argument) {
     return 1;
 }
 
-std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
-    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
-    const ParamSet &params,
-    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
-    const std::string filename = params.FindOneFilename("filename", "");
+bool ReadPLYMeshRply(const std::string &filename, PLYMesh *mesh) {
+    *mesh = PLYMesh();
     p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
     if (!ply) {
         Error("Couldn't open PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     if (!ply_read_header(ply)) {
         Error("Unable to read the header of PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        ply_close(ply);
+        return false;
     }
 
     p_ply_element element = nullptr;
@@ -188,7 +537,8 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     if (vertexCount == 0 || faceCount == 0) {
         Error("%s: PLY file is invalid! No face/vertex elements found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        ply_close(ply);
+        return false;
     }
 
     CallbackContext context;
@@ -199,11 +549,13 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
                         0x031) &&
         ply_set_read_cb(ply, "vertex", "z", rply_vertex_callback, &context,
                         0x032)) {
-        context.p = new Point3f[vertexCount];
+        mesh->p.reset(new Point3f[vertexCount]);
+        context.p = mesh->p.get();
     } else {
         Error("%s: Vertex coordinate property not found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        ply_close(ply);
+        return false;
     }
 
     if (ply_set_read_cb(ply, "vertex", "nx", rply_vertex_callback, &context,
@@ -211,8 +563,10 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
         ply_set_read_cb(ply, "vertex", "ny", rply_vertex_callback, &context,
                         0x131) &&
         ply_set_read_cb(ply, "vertex", "nz", rply_vertex_callback, &context,
-                        0x132))
-        context.n = new Normal3f[vertexCount];
+                        0x132)) {
+        mesh->n.reset(new Normal3f[vertexCount]);
+        context.n = mesh->n.get();
+    }
 
     /* There seem to be lots of different conventions regarding UV coordinate
      * names */
@@ -231,30 +585,48 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
         (ply_set_read_cb(ply, "vertex", "texture_s", rply_vertex_callback,
                          &context, 0x220) &&
          ply_set_read_cb(ply, "vertex", "texture_t", rply_vertex_callback,
-                         &context, 0x221)))
-        context.uv = new Point2f[vertexCount];
+                         &context, 0x221))) {
+        mesh->uv.reset(new Point2f[vertexCount]);
+        context.uv = mesh->uv.get();
+    }
 
     /* Allocate enough space in case all faces are quads */
-    context.indices = new int[faceCount * 6];
+    mesh->indices.resize(faceCount * 6);
+    context.indices = mesh->indices.data();
     context.vertexCount = vertexCount;
 
     ply_set_read_cb(ply, "face", "vertex_indices", rply_face_callback, &context,
                     0);
     if (ply_set_read_cb(ply, "face", "face_indices", rply_face_callback, &context,
-                        1))
-        // Extra space in case they're quads
-        context.faceIndices = new int[faceCount];
+                        1)) {
+        mesh->faceIndices.resize(faceCount);
+        context.faceIndices = mesh->faceIndices.data();
+    }
 
     if (!ply_read(ply)) {
         Error("%s: unable to read the contents of PLY file",
               filename.c_str());
         ply_close(ply);
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     ply_close(ply);
 
-    if (context.error) return std::vector<std::shared_ptr<Shape>>();
+    if (context.error) return false;
+    mesh->nVertices = vertexCount;
+    mesh->indices.resize(context.indexCtr);
+    return true;
+}
+
+std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    const std::string filename = params.FindOneFilename("filename", "");
+    PLYMesh plyMesh;
+    if (!ReadPLYMeshDirect(filename, &plyMesh) &&
+        !ReadPLYMeshRply(filename, &plyMesh))
+        return std::vector<std::shared_ptr<Shape>>();
 
     // Look up an alpha texture, if applicable
     std::shared_ptr<Texture<Float>> alphaTex;
@@ -282,11 +654,13 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     } else if (params.FindOneFloat("shadowalpha", 1.f) == 0.f)
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
-    return CreateTriangleMesh(o2w, w2o, reverseOrientation,
-                              context.indexCtr / 3, context.indices,
-                              vertexCount, context.p, nullptr, context.n,
-                              context.uv, alphaTex, shadowAlphaTex,
-                              context.faceIndices);
+    // The mesh takes over the vertex data and transforms it to world space
+    std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
+        *o2w, std::move(plyMesh.indices), plyMesh.nVertices,
+        std::move(plyMesh.p), nullptr, std::move(plyMesh.n),
+        std::move(plyMesh.uv), alphaTex, shadowAlphaTex,
+        std::move(plyMesh.faceIndices));
+    return CreateTriangleMesh(o2w, w2o, reverseOrientation, mesh);
 }
 
 }  // namespace pbrt
@@ -43,6 +43,25 @@
 
 namespace pbrt {
 
+// PLYMesh holds the object-space contents of a PLY file's mesh; quads are
+// split into two triangles.
+struct PLYMesh {
+    int nVertices = 0;
+    std::vector<int> indices;
+    std::unique_ptr<Point3f[]> p;
+    std::unique_ptr<Normal3f[]> n;
+    std::unique_ptr<Point2f[]> uv;
+    std::vector<int> faceIndices;
+};
+
+// ReadPLYMeshDirect() decodes binary little-endian PLY files straight from
+// a memory mapping of the file. It returns false, without reporting an
+// error, for files whose layout it doesn't handle and for files with
+// invalid contents; CreatePLYMesh() then uses ReadPLYMeshRply(), which
+// reads any PLY file and reports errors.
+bool ReadPLYMeshDirect(const std::string &filename, PLYMesh *mesh);
+bool ReadPLYMeshRply(const std::string &filename, PLYMesh *mesh);
+
 std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
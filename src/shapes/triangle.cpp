@@ -37,6 +37,7 @@
 #include "paramset.h"
 #include "sampling.h"
 #include "efloat.h"
+#include "parallel.h"
 #include "ext/rply.h"
 #include <array>
 
@@ -49,6 +50,18 @@ static void PlyErrorCallback(p_ply, const char *message) {
     Error("PLY writing error: %s", message);
 }
 
+template <typename T>
+static std::unique_ptr<T[]> copyVertexData(const T *data, int n) {
+    if (!data) return nullptr;
+    std::unique_ptr<T[]> copy(new T[n]);
+    std::copy(data, data + n, copy.get());
+    return copy;
+}
+
+// Large meshes are processed in parallel in ranges of this many vertices
+// or triangles.
+static const int meshRangeSize = 64 * 1024;
+
 // Triangle Method Definitions
 STAT_RATIO("Scene/Triangles per triangle mesh", nTris, nMeshes);
 TriangleMesh::TriangleMesh(
@@ -57,38 +70,49 @@ TriangleMesh::TriangleMesh(
     const Point2f *UV, const std::shared_ptr<Texture<Float>> &alphaMask,
     const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
     const int *fIndices)
-    : nTriangles(nTriangles),
+    : TriangleMesh(
+          ObjectToWorld,
+          std::vector<int>(vertexIndices, vertexIndices + 3 * nTriangles),
+          nVertices, copyVertexData(P, nVertices),
+          copyVertexData(S, nVertices), copyVertexData(N, nVertices),
+          copyVertexData(UV, nVertices), alphaMask, shadowAlphaMask,
+          fIndices ? std::vector<int>(fIndices, fIndices + nTriangles)
+                   : std::vector<int>()) {}
+
+TriangleMesh::TriangleMesh(
+    const Transform &ObjectToWorld, std::vector<int> vertexIndices,
+    int nVertices, std::unique_ptr<Point3f[]> P, std::unique_ptr<Vector3f[]> S,
+    std::unique_ptr<Normal3f[]> N, std::unique_ptr<Point2f[]> UV,
+    const std::shared_ptr<Texture<Float>> &alphaMask,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+    std::vector<int> fIndices)
+    : nTriangles(vertexIndices.size() / 3),
       nVertices(nVertices),
-      vertexIndices(vertexIndices, vertexIndices + 3 * nTriangles),
+      vertexIndices(std::move(vertexIndices)),
+      p(std::move(P)),
+      n(std::move(N)),
+      s(std::move(S)),
+      uv(std::move(UV)),
       alphaMask(alphaMask),
-      shadowAlphaMask(shadowAlphaMask) {
+      shadowAlphaMask(shadowAlphaMask),
+      faceIndices(std::move(fIndices)) {
     ++nMeshes;
     nTris += nTriangles;
     triMeshBytes += sizeof(*this) + this->vertexIndices.size() * sizeof(int) +
-                    nVertices * (sizeof(*P) + (N ? sizeof(*N) : 0) +
-                                 (S ? sizeof(*S) : 0) + (UV ? sizeof(*UV) : 0) +
-                                 (fIndices ? sizeof(*fIndices) : 0));
+                    nVertices * (sizeof(Point3f) + (n ? sizeof(Normal3f) : 0) +
+                                 (s ? sizeof(Vector3f) : 0) +
+                                 (uv ? sizeof(Point2f) : 0)) +
+                    faceIndices.size() * sizeof(int);
 
     // Transform mesh vertices to world space
-    p.reset(new Point3f[nVertices]);
-    for (int i = 0; i < nVertices; ++i) p[i] = ObjectToWorld(P[i]);
-
-    // Copy _UV_, _N_, and _S_ vertex data, if present
-    if (UV) {
-        uv.reset(new Point2f[nVertices]);
-        memcpy(uv.get(), UV, nVertices * sizeof(Point2f));
-    }
-    if (N) {
-        n.reset(new Normal3f[nVertices]);
-        for (int i = 0; i < nVertices; ++i) n[i] = ObjectToWorld(N[i]);
-    }
-    if (S) {
-        s.reset(new Vector3f[nVertices]);
-        for (int i = 0; i < nVertices; ++i) s[i] = ObjectToWorld(S[i]);
-    }
-
-    if (fIndices)
-        faceIndices = std::vector<int>(fIndices, fIndices + nTriangles);
+    if (ObjectToWorld.IsIdentity()) return;
+    ParallelForRanges([&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+            p[i] = ObjectToWorld(p[i]);
+            if (n) n[i] = ObjectToWorld(n[i]);
+            if (s) s[i] = ObjectToWorld(s[i]);
+        }
+    }, nVertices, meshRangeSize);
 }
 
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
@@ -101,11 +125,19 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
         *ObjectToWorld, nTriangles, vertexIndices, nVertices, p, s, n, uv,
         alphaMask, shadowAlphaMask, faceIndices);
-    std::vector<std::shared_ptr<Shape>> tris;
-    tris.reserve(nTriangles);
-    for (int i = 0; i < nTriangles; ++i)
-        tris.push_back(std::make_shared<Triangle>(ObjectToWorld, WorldToObject,
-                                                  reverseOrientation, mesh, i));
+    return CreateTriangleMesh(ObjectToWorld, WorldToObject,
+                              reverseOrientation, mesh);
+}
+
+std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, const std::shared_ptr<TriangleMesh> &mesh) {
+    std::vector<std::shared_ptr<Shape>> tris(mesh->nTriangles);
+    ParallelForRanges([&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i)
+            tris[i] = std::make_shared<Triangle>(
+                ObjectToWorld, WorldToObject, reverseOrientation, mesh, i);
+    }, mesh->nTriangles, meshRangeSize);
     return tris;
 }
 
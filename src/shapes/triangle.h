@@ -56,6 +56,15 @@ struct TriangleMesh {
                  const std::shared_ptr<Texture<Float>> &alphaMask,
                  const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
                  const int *faceIndices);
+    // Takes ownership of the given object-space vertex data, which is
+    // transformed to world space in place.
+    TriangleMesh(const Transform &ObjectToWorld,
+                 std::vector<int> vertexIndices, int nVertices,
+                 std::unique_ptr<Point3f[]> P, std::unique_ptr<Vector3f[]> S,
+                 std::unique_ptr<Normal3f[]> N, std::unique_ptr<Point2f[]> uv,
+                 const std::shared_ptr<Texture<Float>> &alphaMask,
+                 const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+                 std::vector<int> faceIndices);
 
     // TriangleMesh Data
     const int nTriangles, nVertices;
@@ -93,6 +102,14 @@ class Triangle : public Shape {
     // reference point p.
     Float SolidAngle(const Point3f &p, int nSamples = 0) const;
 
+    // Returns the world-space positions of the triangle's vertices.
+    void GetVertices(Point3f p[3]) const {
+        for (int i = 0; i < 3; ++i) p[i] = mesh->p[v[i]];
+    }
+    bool HasAlphaMask() const {
+        return mesh->alphaMask || mesh->shadowAlphaMask;
+    }
+
   private:
     // Triangle Private Methods
     void GetUVs(Point2f uv[3]) const {
@@ -120,6 +137,9 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const std::shared_ptr<Texture<Float>> &alphaTexture,
     const std::shared_ptr<Texture<Float>> &shadowAlphaTexture,
     const int *faceIndices = nullptr);
+std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const std::shared_ptr<TriangleMesh> &mesh);
 std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
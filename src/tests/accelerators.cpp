@@ -0,0 +1,295 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "sampling.h"
+#include "transform.h"
+#include "accelerators/bvh.h"
+#include "accelerators/instancebvh.h"
+#include "accelerators/widebvh.h"
+#include "shapes/sphere.h"
+#include "shapes/triangle.h"
+
+using namespace pbrt;
+
+// Returns primitives for a soup of small, randomly-placed triangles.
+static std::vector<std::shared_ptr<Primitive>> RandomTriangles(int nTriangles,
+                                                               RNG &rng) {
+    static Transform identity;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f center(Lerp(rng.UniformFloat(), -10, 10),
+                       Lerp(rng.UniformFloat(), -10, 10),
+                       Lerp(rng.UniformFloat(), -10, 10));
+        for (int v = 0; v < 3; ++v) {
+            indices.push_back(p.size());
+            p.push_back(center + Vector3f(rng.UniformFloat(),
+                                          rng.UniformFloat(),
+                                          rng.UniformFloat()));
+        }
+    }
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, nTriangles, indices.data(), p.size(),
+        p.data(), nullptr, nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (const auto &tri : tris)
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+    return prims;
+}
+
+// Checks that _accel_ finds the same intersections as a binary BVH for
+// random rays and returns the number of rays that hit something.
+static int CheckAgainstBVH(
+    const std::vector<std::shared_ptr<Primitive>> &prims,
+    const Primitive &accel, RNG &rng) {
+    BVHAccel bvh(prims, 4);
+    EXPECT_EQ(bvh.WorldBound(), accel.WorldBound());
+    int nHits = 0;
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.UniformFloat(), -15, 15),
+                  Lerp(rng.UniformFloat(), -15, 15),
+                  Lerp(rng.UniformFloat(), -15, 15));
+        Vector3f d = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        // Some rays have directions that are zero along some axes.
+        if (i % 4 == 0) d[i / 4 % 3] = 0;
+        if (i % 8 == 0) d[(i / 4 + 1) % 3] = 0;
+        if (d == Vector3f(0, 0, 0)) continue;
+        Float tMax = (i % 3 == 0) ? 10 : Infinity;
+
+        Ray bvhRay(o, d, tMax), ray(o, d, tMax);
+        SurfaceInteraction bvhIsect, isect;
+        bool bvhHit = bvh.Intersect(bvhRay, &bvhIsect);
+        EXPECT_EQ(bvhHit, accel.Intersect(ray, &isect)) << ray;
+        EXPECT_EQ(bvhRay.tMax, ray.tMax) << ray;
+        if (bvhHit) {
+            ++nHits;
+            EXPECT_EQ(bvhIsect.p, isect.p);
+        }
+
+        Ray shadowRay(o, d, tMax);
+        EXPECT_EQ(bvhHit, accel.IntersectP(shadowRay)) << shadowRay;
+    }
+    return nHits;
+}
+
+TEST(WideBVH, MatchesBVH4) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    WideBVHAccel<4> accel(prims, 4);
+    EXPECT_GT(CheckAgainstBVH(prims, accel, rng), 1000);
+}
+
+TEST(WideBVH, MatchesBVH8) {
+    RNG rng(1);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    WideBVHAccel<8> accel(prims, 4);
+    EXPECT_GT(CheckAgainstBVH(prims, accel, rng), 1000);
+}
+
+TEST(WideBVH, FewPrimitives) {
+    // The root of the binary BVH is a leaf.
+    RNG rng(2);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(3, rng);
+    WideBVHAccel<4> accel(prims, 4);
+    CheckAgainstBVH(prims, accel, rng);
+
+    WideBVHAccel<4> empty({});
+    EXPECT_FALSE(empty.IntersectP(Ray(Point3f(0, 0, 0), Vector3f(1, 0, 0))));
+}
+
+TEST(BVH, IntersectBatch) {
+    RNG rng(3);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    BVHAccel bvh(prims, 4);
+
+    // Batches of sizes that aren't a multiple of the packet width, with
+    // both incoherent rays and coherent ones from a common origin.
+    for (int batch = 0; batch < 40; ++batch) {
+        bool coherent = batch % 2 == 0;
+        int nRays = 1 + batch * 37 % 200;
+        Point3f origin(Lerp(rng.UniformFloat(), -15, 15), 0, -25);
+        RayBatch rays;
+        std::vector<Ray> single;
+        for (int i = 0; i < nRays; ++i) {
+            Point3f o = coherent ? origin
+                                 : Point3f(Lerp(rng.UniformFloat(), -15, 15),
+                                           Lerp(rng.UniformFloat(), -15, 15),
+                                           Lerp(rng.UniformFloat(), -15, 15));
+            Vector3f d = coherent
+                             ? Normalize(Vector3f(rng.UniformFloat() - .5f,
+                                                  rng.UniformFloat() - .5f, 1))
+                             : UniformSampleSphere(Point2f(
+                                   rng.UniformFloat(), rng.UniformFloat()));
+            if (i % 5 == 0) d[i % 3] = 0;
+            Float tMax = (i % 3 == 0) ? 20 : Infinity;
+            rays.Add(Ray(o, d, tMax));
+            single.push_back(Ray(o, d, tMax));
+        }
+
+        std::unique_ptr<SurfaceInteraction[]> isects(
+            new SurfaceInteraction[nRays]);
+        std::unique_ptr<bool[]> hits(new bool[nRays]);
+        std::unique_ptr<bool[]> occluded(new bool[nRays]);
+        bvh.IntersectBatch(rays, isects.get(), hits.get());
+        for (int i = 0; i < nRays; ++i) {
+            SurfaceInteraction isect;
+            Ray ray = single[i];
+            bool hit = bvh.Intersect(ray, &isect);
+            EXPECT_EQ(hit, hits[i]) << ray;
+            EXPECT_EQ(ray.tMax, rays.tMax[i]) << ray;
+            if (hit) EXPECT_EQ(isect.p, isects[i].p);
+        }
+
+        RayBatch shadowRays;
+        for (const Ray &ray : single) shadowRays.Add(ray);
+        bvh.IntersectPBatch(shadowRays, occluded.get());
+        for (int i = 0; i < nRays; ++i)
+            EXPECT_EQ(bvh.IntersectP(single[i]), occluded[i]) << single[i];
+    }
+}
+
+TEST(BVH, ParallelBuildMatchesSerial) {
+    // Enough primitives that the top levels are binned and partitioned
+    // in parallel as well as having their subtrees built as tasks.
+    RNG rng(4);
+    std::vector<std::shared_ptr<Primitive>> prims =
+        RandomTriangles(150000, rng);
+    for (auto splitMethod :
+         {BVHAccel::SplitMethod::SAH, BVHAccel::SplitMethod::Middle}) {
+        BVHAccel serial(prims, 4, splitMethod);
+        // Use several threads even on machines with a single core
+        const int savedThreads = PbrtOptions.nThreads;
+        PbrtOptions.nThreads = 4;
+        ParallelInit();
+        EXPECT_TRUE(ParallelRunning());
+        BVHAccel parallel(prims, 4, splitMethod);
+        ParallelCleanup();
+        PbrtOptions.nThreads = savedThreads;
+
+        EXPECT_EQ(serial.WorldBound(), parallel.WorldBound());
+        EXPECT_FLOAT_EQ(serial.SAHCost(), parallel.SAHCost());
+        for (int i = 0; i < 1000; ++i) {
+            Point3f o(Lerp(rng.UniformFloat(), -15, 15),
+                      Lerp(rng.UniformFloat(), -15, 15),
+                      Lerp(rng.UniformFloat(), -15, 15));
+            Vector3f d = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            Ray serialRay(o, d), parallelRay(o, d);
+            SurfaceInteraction serialIsect, parallelIsect;
+            EXPECT_EQ(serial.Intersect(serialRay, &serialIsect),
+                      parallel.Intersect(parallelRay, &parallelIsect));
+            EXPECT_EQ(serialRay.tMax, parallelRay.tMax);
+        }
+    }
+}
+
+TEST(BVH, CompactNodes) {
+    RNG rng(5);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    BVHAccel bvh(prims, 4);
+    for (int bits : {8, 16}) {
+        BVHAccel compact(prims, 4, BVHAccel::SplitMethod::SAH, bits);
+        EXPECT_GT(CheckAgainstBVH(prims, compact, rng), 1000);
+        // Quantized bounds are conservative, so they can only make the
+        // tree more expensive to traverse.
+        EXPECT_GE(compact.SAHCost(), bvh.SAHCost());
+        EXPECT_LT(compact.SAHCost(), (bits == 8 ? 1.5f : 1.05f) * bvh.SAHCost());
+    }
+
+    // The root of the binary BVH is a leaf.
+    std::vector<std::shared_ptr<Primitive>> few = RandomTriangles(3, rng);
+    BVHAccel compact(few, 4, BVHAccel::SplitMethod::SAH, 8);
+    CheckAgainstBVH(few, compact, rng);
+}
+
+TEST(BVH, CompactLargeLeaves) {
+    // Coincident triangles can't be split, so they end up in a single
+    // leaf, however many there are; compact nodes only have room for 255
+    // primitives per leaf.
+    static Transform identity;
+    RNG rng(7);
+    for (int nCoincident : {255, 256, 300, 1000}) {
+        std::vector<std::shared_ptr<Primitive>> prims =
+            RandomTriangles(50, rng);
+        Point3f p[3] = {Point3f(-8, -8, 1), Point3f(8, -8, 1),
+                        Point3f(0, 8, 2)};
+        std::vector<int> indices;
+        for (int i = 0; i < nCoincident; ++i)
+            indices.insert(indices.end(), {0, 1, 2});
+        std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+            &identity, &identity, false, nCoincident, indices.data(), 3, p,
+            nullptr, nullptr, nullptr, nullptr, nullptr);
+        for (const auto &tri : tris)
+            prims.push_back(std::make_shared<GeometricPrimitive>(
+                tri, nullptr, nullptr, MediumInterface()));
+
+        for (int bits : {8, 16}) {
+            BVHAccel compact(prims, 4, BVHAccel::SplitMethod::SAH, bits);
+            EXPECT_GT(CheckAgainstBVH(prims, compact, rng), 100);
+            Ray ray(Point3f(0, 0, -10), Vector3f(0, 0, 1));
+            EXPECT_TRUE(compact.IntersectP(ray));
+        }
+    }
+}
+
+TEST(BVH, LeafTriangles) {
+    // The default BVH stores its triangles in its leaves; it should find
+    // the same intersections as one that goes through the primitives.
+    RNG rng(6);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    for (int bits : {8, 32}) {
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, bits, false);
+        EXPECT_GT(CheckAgainstBVH(prims, bvh, rng), 1000);
+    }
+
+    // Scenes with other shapes are handled by the primitives.
+    static Transform toSphere = Translate(Vector3f(0, 0, 50));
+    static Transform fromSphere = Inverse(toSphere);
+    auto sphere = std::make_shared<Sphere>(&toSphere, &fromSphere, false, 2.f,
+                                           -2.f, 2.f, 360.f);
+    prims.push_back(std::make_shared<GeometricPrimitive>(
+        sphere, nullptr, nullptr, MediumInterface()));
+    BVHAccel mixed(prims, 4);
+    Ray ray(Point3f(0, 0, 40), Vector3f(0, 0, 1));
+    SurfaceInteraction isect;
+    ASSERT_TRUE(mixed.Intersect(ray, &isect));
+    EXPECT_EQ(sphere.get(), isect.shape);
+    EXPECT_TRUE(mixed.IntersectP(Ray(Point3f(0, 0, 40), Vector3f(0, 0, 1))));
+}
+
+TEST(InstanceBVH, MatchesTransformedPrimitives) {
+    RNG rng(7);
+    std::shared_ptr<Primitive> prototype =
+        std::make_shared<BVHAccel>(RandomTriangles(200, rng), 4);
+
+    // Scaled-down, rotated copies of the prototype, some of them moving
+    const int nInstances = 100;
+    std::vector<Transform> transforms;
+    transforms.reserve(2 * nInstances);
+    std::vector<InstanceUse> uses;
+    std::vector<std::shared_ptr<Primitive>> transformed;
+    for (int i = 0; i < nInstances; ++i) {
+        Vector3f offset(Lerp(rng.UniformFloat(), -10, 10),
+                        Lerp(rng.UniformFloat(), -10, 10),
+                        Lerp(rng.UniformFloat(), -10, 10));
+        transforms.push_back(Translate(offset) *
+                             Rotate(360 * rng.UniformFloat(),
+                                    Vector3f(1, 1, rng.UniformFloat())) *
+                             Scale(.2f, .2f, .2f));
+        const Transform *start = &transforms.back();
+        if (i % 10 == 0)
+            transforms.push_back(Translate(Vector3f(1, 0, 0)) * *start);
+        const Transform *end = &transforms.back();
+        uses.push_back({prototype, {start, end}, 0, 1});
+        transformed.push_back(std::make_shared<TransformedPrimitive>(
+            prototype, AnimatedTransform(start, 0, end, 1)));
+    }
+
+    InstanceBVHAccel accel(uses);
+    EXPECT_GT(CheckAgainstBVH(transformed, accel, rng), 200);
+}
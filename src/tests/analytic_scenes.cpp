@@ -8,19 +8,23 @@
 #include "cameras/perspective.h"
 #include "film.h"
 #include "filters/box.h"
+#include "filters/gaussian.h"
 #include "geometry.h"
 #include "imageio.h"
 #include "integrators/bdpt.h"
 #include "integrators/directlighting.h"
 #include "integrators/mlt.h"
 #include "integrators/path.h"
+#include "integrators/sppm.h"
 #include "integrators/volpath.h"
+#include "integrators/wavefront.h"
 #include "lights/diffuse.h"
 #include "lights/point.h"
 #include "materials/matte.h"
 #include "materials/mirror.h"
 #include "materials/uber.h"
 #include "samplers/halton.h"
+#include "samplers/maxmin.h"
 #include "samplers/random.h"
 #include "samplers/stratified.h"
 #include "samplers/sobol.h"
@@ -30,6 +34,8 @@
 #include "spectrum.h"
 #include "textures/constant.h"
 
+#include <atomic>
+
 using namespace pbrt;
 
 static std::string inTestDir(const std::string &path) { return path; }
@@ -51,11 +57,8 @@ void PrintTo(const TestIntegrator &tr, ::std::ostream *os) {
     *os << tr.description;
 }
 
-void CheckSceneAverage(const std::string &filename, float expected) {
-    Point2i resolution;
-    std::unique_ptr<RGBSpectrum[]> image = ReadImage(filename, &resolution);
-    ASSERT_TRUE(image.get() != nullptr);
-
+void CheckSceneAverage(const RGBSpectrum *image, const Point2i &resolution,
+                       float expected) {
     float delta = .02;
     float sum = 0;
 
@@ -65,6 +68,13 @@ void CheckSceneAverage(const std::string &filename, float expected) {
     EXPECT_NEAR(expected, sum / nPixels, delta);
 }
 
+void CheckSceneAverage(const std::string &filename, float expected) {
+    Point2i resolution;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(filename, &resolution);
+    ASSERT_TRUE(image.get() != nullptr);
+    CheckSceneAverage(image.get(), resolution, expected);
+}
+
 std::vector<TestScene> GetScenes() {
     std::vector<TestScene> scenes;
 
@@ -313,6 +323,26 @@ std::vector<TestIntegrator> GetIntegrators() {
                                    scene});
         }
 
+        for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator =
+                new WavefrontPathIntegrator(8, camera, sampler.first,
+                                            film->croppedPixelBounds);
+            integrators.push_back({integrator, film,
+                                   "Wavefront path, depth 8, Perspective, " +
+                                       sampler.second + ", " +
+                                       scene.description,
+                                   scene});
+        }
+
         // Volume path tracing integrators
         for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
             std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
@@ -438,3 +468,364 @@ TEST_P(RenderTest, RadianceMatches) {
 
 INSTANTIATE_TEST_CASE_P(AnalyticTestScenes, RenderTest,
                         testing::ValuesIn(GetIntegrators()));
+
+// Describes a render of a test scene by RenderToImage(), through a
+// perspective camera at the origin looking down +z.
+struct TestRender {
+    Options options;
+    Point2i resolution = Point2i(10, 10);
+    int samplesPerPixel = 16;
+    // Use a Gaussian filter, which reaches across tile boundaries, rather
+    // than a box filter that doesn't
+    bool gaussianFilter = false;
+    int tileSize = 0;
+    TileOrder tileOrder = TileOrder::Hilbert;
+    // Returns the sampler to render with; a Halton sampler by default
+    std::function<std::shared_ptr<Sampler>()> makeSampler;
+    // Returns the integrator to render with; the path tracer by default
+    std::function<Integrator *(std::shared_ptr<const Camera>,
+                               std::shared_ptr<Sampler>, const Bounds2i &)>
+        makeIntegrator;
+    // If set, called with the film after rendering
+    std::function<void(const Film &)> checkFilm;
+};
+
+// Renders _scene_ as described by _render_ and returns the image that was
+// written, or nullptr if there was none.
+static std::unique_ptr<RGBSpectrum[]> RenderToImage(const TestScene &scene,
+                                                    const TestRender &render) {
+    Options options = render.options;
+    options.quiet = true;
+    pbrtInit(options);
+
+    std::unique_ptr<Filter> filter;
+    if (render.gaussianFilter)
+        filter.reset(new GaussianFilter(Vector2f(1.5, 1.5), 2));
+    else
+        filter.reset(new BoxFilter(Vector2f(0.5, 0.5)));
+    Film *film =
+        new Film(render.resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                 std::move(filter), 1., inTestDir("test.exr"), 1.);
+    film->tileSize = render.tileSize;
+    film->tileOrder = render.tileOrder;
+    AnimatedTransform identity(new Transform, 0, new Transform, 1);
+    std::shared_ptr<Camera> camera = std::make_shared<PerspectiveCamera>(
+        identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1., 0., 10.,
+        45, film, nullptr);
+    std::shared_ptr<Sampler> sampler =
+        render.makeSampler
+            ? render.makeSampler()
+            : std::make_shared<HaltonSampler>(
+                  render.samplesPerPixel,
+                  Bounds2i(Point2i(0, 0), render.resolution));
+    std::unique_ptr<Integrator> integrator(
+        render.makeIntegrator
+            ? render.makeIntegrator(camera, sampler, film->croppedPixelBounds)
+            : new PathIntegrator(8, camera, sampler,
+                                 film->croppedPixelBounds));
+    integrator->Render(*scene.scene);
+    integrator.reset();
+    pbrtCleanup();
+    if (render.checkFilm) render.checkFilm(*film);
+
+    Point2i resolution;
+    std::unique_ptr<RGBSpectrum[]> image =
+        ReadImage(inTestDir("test.exr"), &resolution);
+    if (image) {
+        EXPECT_EQ(render.resolution, resolution);
+        EXPECT_EQ(0, remove(inTestDir("test.exr").c_str()));
+    }
+    return image;
+}
+
+TEST(Wavefront, MatchesPath) {
+    // The wavefront integrator computes the same estimates as the path
+    // integrator for each sample. With a sampler whose samples don't
+    // depend on how it's cloned and with the path integrator adding
+    // samples to the film in the same order, the images should be
+    // identical.
+    for (auto scene : GetScenes()) {
+        std::unique_ptr<RGBSpectrum[]> images[2];
+        for (int wavefront = 0; wavefront < 2; ++wavefront) {
+            TestRender render;
+            render.options.batchCameraRays = true;
+            if (wavefront)
+                render.makeIntegrator = [](std::shared_ptr<const Camera> camera,
+                                           std::shared_ptr<Sampler> sampler,
+                                           const Bounds2i &pixelBounds) {
+                    return new WavefrontPathIntegrator(8, camera, sampler,
+                                                       pixelBounds);
+                };
+            images[wavefront] = RenderToImage(scene, render);
+            ASSERT_TRUE(images[wavefront].get() != nullptr);
+        }
+        for (int i = 0; i < 10 * 10; ++i)
+            EXPECT_EQ(images[0][i], images[1][i]) << scene.description;
+    }
+}
+
+// Returns functions that make each type of sampler with 16 samples per
+// pixel, paired with descriptions of them. The pixel samplers precompute
+// fewer dimensions than the path tracer uses, so they also draw values
+// from their fallback RNGs.
+static std::vector<
+    std::pair<std::function<std::shared_ptr<Sampler>()>, std::string>>
+GetTestSamplers() {
+    typedef std::function<std::shared_ptr<Sampler>()> MakeSampler;
+    Bounds2i sampleBounds(Point2i(0, 0), Point2i(10, 10));
+    return {
+        {MakeSampler([=]() {
+             return std::make_shared<HaltonSampler>(16, sampleBounds);
+         }),
+         "Halton"},
+        {MakeSampler([]() {
+             return std::make_shared<StratifiedSampler>(4, 4, true, 2);
+         }),
+         "Stratified"},
+        {MakeSampler([]() {
+             return std::make_shared<ZeroTwoSequenceSampler>(16, 2);
+         }),
+         "(0,2)-seq"},
+        {MakeSampler([]() {
+             return std::make_shared<MaxMinDistSampler>(16, 2);
+         }),
+         "MaxMin"},
+        {MakeSampler([]() {
+             return std::make_shared<RandomSampler>(16);
+         }),
+         "Random"}};
+}
+
+TEST(BatchRays, MatchesUnbatched) {
+    // Batched tiles clone their samplers with the same seed as unbatched
+    // ones, and pixel samples don't depend on which clone takes them, so
+    // the images should match up to the order in which samples are summed.
+    // The 100 pixels of the single tile take more than one batch.
+    for (auto scene : GetScenes())
+        for (const auto &sampler : GetTestSamplers()) {
+            std::unique_ptr<RGBSpectrum[]> images[2];
+            for (int batch = 0; batch < 2; ++batch) {
+                TestRender render;
+                render.options.batchCameraRays = batch;
+                render.makeSampler = sampler.first;
+                images[batch] = RenderToImage(scene, render);
+                ASSERT_TRUE(images[batch].get() != nullptr);
+            }
+            for (int i = 0; i < 10 * 10; ++i)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(images[0][i][c], images[1][i][c],
+                                1e-4f * std::max(Float(1), images[0][i][c]))
+                        << scene.description << ", " << sampler.second;
+        }
+}
+
+TEST(Wavefront, MatchesUnbatchedPath) {
+    // The wavefront integrator always batches camera rays, which takes the
+    // same samples as rendering unbatched tiles, so it should also match
+    // the path integrator without --batchrays, with any type of sampler,
+    // up to the order in which samples are summed.
+    for (auto scene : GetScenes())
+        for (const auto &sampler : GetTestSamplers()) {
+            std::unique_ptr<RGBSpectrum[]> images[2];
+            for (int wavefront = 0; wavefront < 2; ++wavefront) {
+                TestRender render;
+                render.makeSampler = sampler.first;
+                if (wavefront)
+                    render.makeIntegrator =
+                        [](std::shared_ptr<const Camera> camera,
+                           std::shared_ptr<Sampler> sampler,
+                           const Bounds2i &pixelBounds) {
+                            return new WavefrontPathIntegrator(
+                                8, camera, sampler, pixelBounds);
+                        };
+                images[wavefront] = RenderToImage(scene, render);
+                ASSERT_TRUE(images[wavefront].get() != nullptr);
+            }
+            for (int i = 0; i < 10 * 10; ++i)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(images[0][i][c], images[1][i][c],
+                                1e-4f * std::max(Float(1), images[0][i][c]))
+                        << scene.description << ", " << sampler.second;
+        }
+}
+
+TEST(Progressive, MatchesSinglePass) {
+    // Tile samplers take the same samples however a pixel's samples are
+    // split into passes, so rendering in progressive passes should give
+    // the same image as rendering each tile at once; only the order in
+    // which the samples are summed differs.
+    for (auto scene : GetScenes())
+        for (const auto &sampler : GetTestSamplers()) {
+            std::unique_ptr<RGBSpectrum[]> images[2];
+            for (int progressive = 0; progressive < 2; ++progressive) {
+                TestRender render;
+                render.options.progressive = progressive;
+                render.makeSampler = sampler.first;
+                images[progressive] = RenderToImage(scene, render);
+                ASSERT_TRUE(images[progressive].get() != nullptr);
+            }
+            for (int i = 0; i < 10 * 10; ++i)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(images[0][i][c], images[1][i][c],
+                                1e-4f * std::max(Float(1), images[0][i][c]))
+                        << scene.description << ", " << sampler.second;
+        }
+}
+
+// Path tracer that counts the camera rays it traces
+class CountingPathIntegrator : public PathIntegrator {
+  public:
+    CountingPathIntegrator(std::shared_ptr<const Camera> camera,
+                           std::shared_ptr<Sampler> sampler,
+                           const Bounds2i &pixelBounds,
+                           std::atomic<int64_t> *nRays)
+        : PathIntegrator(8, camera, sampler, pixelBounds), nRays(nRays) {}
+    Spectrum Li(const RayDifferential &ray, const Scene &scene,
+                Sampler &sampler, MemoryArena &arena,
+                int depth) const {
+        ++*nRays;
+        return PathIntegrator::Li(ray, scene, sampler, arena, depth);
+    }
+
+  private:
+    std::atomic<int64_t> *nRays;
+};
+
+TEST(Checkpoint, ResumeMatchesUninterrupted) {
+    // Render the first test scene progressively, stopping after three
+    // passes (four samples per pixel), and then resume the render from its
+    // checkpoint; the resumed render should only take the remaining
+    // samples, and the result should be identical to rendering it all at
+    // once, with adaptive sampling too. Tiles don't overlap with the box
+    // filter, so the order in which they are merged doesn't matter.
+    TestScene scene = GetScenes()[0];
+    const int64_t nPixels = 32 * 32;
+    for (Float adaptiveThreshold : {0.f, .02f}) {
+        std::unique_ptr<RGBSpectrum[]> images[2];
+        int64_t nRays[3];
+        for (int run = 0; run < 3; ++run) {
+            std::atomic<int64_t> nRunRays{0};
+            TestRender render;
+            render.resolution = Point2i(32, 32);
+            render.samplesPerPixel = 256;
+            render.options.progressive = true;
+            render.options.adaptiveThreshold = adaptiveThreshold;
+            if (run > 0) {
+                render.options.checkpointFile = inTestDir("test.checkpoint");
+                render.options.maxPasses = run == 1 ? 3 : 0;
+                render.options.resume = run == 2;
+            }
+            render.makeIntegrator = [&](std::shared_ptr<const Camera> camera,
+                                        std::shared_ptr<Sampler> sampler,
+                                        const Bounds2i &pixelBounds) {
+                return new CountingPathIntegrator(camera, sampler,
+                                                  pixelBounds, &nRunRays);
+            };
+            std::unique_ptr<RGBSpectrum[]> image =
+                RenderToImage(scene, render);
+            ASSERT_TRUE(image.get() != nullptr);
+            nRays[run] = nRunRays;
+            if (run == 1) {
+                // The interrupted render leaves its checkpoint behind.
+                FILE *f = fopen(inTestDir("test.checkpoint").c_str(), "rb");
+                ASSERT_TRUE(f != nullptr);
+                fclose(f);
+            } else
+                images[run / 2] = std::move(image);
+        }
+        EXPECT_EQ(nPixels * 4, nRays[1]);
+        if (adaptiveThreshold == 0)
+            EXPECT_EQ(nPixels * 256, nRays[0]);
+        else
+            EXPECT_LT(nRays[0], nPixels * 256);
+        EXPECT_EQ(nRays[0], nRays[1] + nRays[2]);
+        for (int i = 0; i < nPixels; ++i)
+            EXPECT_EQ(images[0][i], images[1][i]) << i;
+        // The checkpoint is removed once the image is complete.
+        EXPECT_NE(0, remove(inTestDir("test.checkpoint").c_str()));
+    }
+}
+
+TEST(Adaptive, RadianceMatches) {
+    // Adaptive sampling should still give the expected radiance, while
+    // stopping early in some of the pixels; the error threshold is loose
+    // enough for that to happen at 256 samples per pixel.
+    for (auto scene : GetScenes()) {
+        for (int batched = 0; batched < 2; ++batched) {
+            TestRender render;
+            render.samplesPerPixel = 256;
+            render.options.adaptiveThreshold = .02f;
+            render.options.batchCameraRays = batched;
+            render.checkFilm = [&](const Film &film) {
+                int nStopped = 0;
+                for (Point2i p : film.croppedPixelBounds) {
+                    int64_t n = film.GetPixelMoments(p).n;
+                    EXPECT_GE(n, render.options.adaptiveMinSamples);
+                    EXPECT_LE(n, 256);
+                    if (n < 256) ++nStopped;
+                }
+                EXPECT_GT(nStopped, 0) << scene.description;
+            };
+            std::unique_ptr<RGBSpectrum[]> image = RenderToImage(scene, render);
+            ASSERT_TRUE(image.get() != nullptr);
+            CheckSceneAverage(image.get(), render.resolution, scene.expected);
+        }
+    }
+}
+
+TEST(TileOrder, ImagesMatch) {
+    // Every tile should be rendered exactly once whatever the order, with
+    // the same samples; only the order in which overlapping tiles are
+    // merged differs. The tiles don't evenly cover the image.
+    TestScene scene = GetScenes()[0];
+    std::unique_ptr<RGBSpectrum[]> images[3];
+    TileOrder orders[3] = {TileOrder::Scanline, TileOrder::Hilbert,
+                           TileOrder::Spiral};
+    for (int i = 0; i < 3; ++i) {
+        TestRender render;
+        render.resolution = Point2i(37, 23);
+        render.samplesPerPixel = 4;
+        render.gaussianFilter = true;
+        render.tileSize = 8;
+        render.tileOrder = orders[i];
+        images[i] = RenderToImage(scene, render);
+        ASSERT_TRUE(images[i].get() != nullptr);
+    }
+    for (int i = 1; i < 3; ++i)
+        for (int p = 0; p < 37 * 23; ++p)
+            for (int c = 0; c < 3; ++c)
+                EXPECT_NEAR(images[0][p][c], images[i][p][c],
+                            1e-4f * std::max(Float(1), images[0][p][c]))
+                    << i << " " << p;
+}
+
+TEST(SPPM, RadianceMatches) {
+    // SPPM should give the expected radiance. The visible point grid must
+    // find each visible point near a photon exactly once, whether it's
+    // built by one thread or by many and whatever its resolution, so all
+    // of the images should match.
+    for (auto scene : GetScenes()) {
+        std::unique_ptr<RGBSpectrum[]> images[4];
+        for (int i = 0; i < 4; ++i) {
+            TestRender render;
+            render.options.nThreads = (i & 1) ? 4 : 1;
+            bool tuneGrid = i & 2;
+            render.makeIntegrator = [&](std::shared_ptr<const Camera> camera,
+                                        std::shared_ptr<Sampler>,
+                                        const Bounds2i &) {
+                return new SPPMIntegrator(camera, 16, 10000, 8, .1f, 1 << 30,
+                                          tuneGrid);
+            };
+            images[i] = RenderToImage(scene, render);
+            ASSERT_TRUE(images[i].get() != nullptr);
+            CheckSceneAverage(images[i].get(), render.resolution,
+                              scene.expected);
+        }
+        for (int i = 1; i < 4; ++i)
+            for (int p = 0; p < 10 * 10; ++p)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(images[0][p][c], images[i][p][c],
+                                1e-4f * std::max(Float(1), images[0][p][c]))
+                        << scene.description << " " << i << " " << p;
+    }
+}
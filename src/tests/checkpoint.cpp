@@ -0,0 +1,68 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "checkpoint.h"
+#include "film.h"
+#include "filters/box.h"
+
+using namespace pbrt;
+
+static std::unique_ptr<Film> MakeFilm() {
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5f, 0.5f)));
+    return std::unique_ptr<Film>(
+        new Film(Point2i(32, 16), Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                 std::move(filter), 35.f, "unused.exr", 1.f));
+}
+
+TEST(Checkpoint, RoundTrip) {
+    const char *filename = "test.checkpoint";
+    std::unique_ptr<Film> film = MakeFilm();
+    film->TrackPixelMoments();
+    {
+        RenderCheckpoint checkpoint(filename, film.get(), 2, 17, 0, false);
+        Bounds2i bounds(Point2i(16, 0), Point2i(32, 16));
+        std::unique_ptr<FilmTile> tile = film->GetFilmTile(bounds);
+        for (Point2i p : bounds) {
+            Float rgb[3] = {Float(p.x), Float(p.y), 0.25f};
+            tile->AddSample(Point2f(p.x + 0.5f, p.y + 0.5f),
+                            Spectrum::FromRGB(rgb));
+        }
+        checkpoint.MergeTile(1, std::move(tile), 8);
+        EXPECT_TRUE(checkpoint.Write());
+    }
+    std::vector<Float> saved;
+    film->SaveAccumulation(&saved);
+
+    // Resuming restores the film, its pixels' moments and the tiles'
+    // progress.
+    std::unique_ptr<Film> resumedFilm = MakeFilm();
+    resumedFilm->TrackPixelMoments();
+    RenderCheckpoint resumed(filename, resumedFilm.get(), 2, 17, 0, true);
+    EXPECT_EQ(0, resumed.TileSamples(0));
+    EXPECT_EQ(8, resumed.TileSamples(1));
+    std::vector<Float> restored;
+    resumedFilm->SaveAccumulation(&restored);
+    EXPECT_EQ(saved, restored);
+    for (Point2i p : resumedFilm->croppedPixelBounds) {
+        PixelMoments m = film->GetPixelMoments(p);
+        PixelMoments r = resumedFilm->GetPixelMoments(p);
+        EXPECT_EQ(p.x >= 16 ? 1 : 0, r.n);
+        EXPECT_EQ(m.n, r.n);
+        EXPECT_EQ(m.sum, r.sum);
+        EXPECT_EQ(m.sumSq, r.sumSq);
+    }
+
+    // A film that doesn't track moments can't resume from it.
+    std::unique_ptr<Film> plainFilm = MakeFilm();
+    RenderCheckpoint plain(filename, plainFilm.get(), 2, 17, 0, true);
+    EXPECT_EQ(0, plain.TileSamples(1));
+
+    // A checkpoint of another image isn't used.
+    std::unique_ptr<Film> otherFilm = MakeFilm();
+    RenderCheckpoint other(filename, otherFilm.get(), 2, 18, 0, true);
+    EXPECT_EQ(0, other.TileSamples(1));
+
+    // Finishing the render removes the checkpoint.
+    resumed.Finish();
+    EXPECT_EQ(nullptr, fopen(filename, "rb"));
+}
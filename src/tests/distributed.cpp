@@ -0,0 +1,214 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "distributed.h"
+#include "film.h"
+#include "filters/box.h"
+#include "parallel.h"
+#include <atomic>
+#include <thread>
+#ifndef PBRT_IS_WINDOWS
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace pbrt;
+
+static std::vector<char> TilePayload(int tileIndex) {
+    std::string s = StringPrintf("tile %d", tileIndex);
+    return std::vector<char>(s.begin(), s.end());
+}
+
+TEST(Distributed, AllTilesMergedOnce) {
+    ParallelInit();
+
+    const int nTiles = 137, nWorkers = 3;
+    const uint64_t jobId = 0x1234;
+    std::vector<int> coordinatorFds;
+    std::vector<std::thread> workers;
+    std::atomic<int> tilesRendered{0};
+    for (int i = 0; i < nWorkers; ++i) {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        coordinatorFds.push_back(fds[0]);
+        int fd = fds[1];
+        workers.push_back(std::thread([&, fd]() {
+            EXPECT_TRUE(ServeTiles(fd, nTiles, jobId,
+                                   [&](int index, std::vector<char> *data) {
+                                       ++tilesRendered;
+                                       *data = TilePayload(index);
+                                   }));
+            close(fd);
+        }));
+    }
+
+    std::vector<int> merged(nTiles, 0);
+    EXPECT_TRUE(CoordinateTiles(-1, coordinatorFds, nTiles, jobId, 4,
+                                [&](int index, const std::vector<char> &data) {
+                                    ++merged[index];
+                                    EXPECT_EQ(TilePayload(index), data);
+                                }));
+    for (std::thread &t : workers) t.join();
+
+    for (int i = 0; i < nTiles; ++i) EXPECT_EQ(1, merged[i]);
+    EXPECT_EQ(nTiles, tilesRendered);
+
+    ParallelCleanup();
+}
+
+TEST(Distributed, LostWorkerTilesReassigned) {
+    ParallelInit();
+
+    const int nTiles = 100;
+    const uint64_t jobId = 42;
+    int goodFds[2], badFds[2], wrongJobFds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, goodFds));
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, badFds));
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, wrongJobFds));
+
+    // This worker dies partway through its second tile.
+    std::thread badWorker([&]() {
+        int count = 0;
+        EXPECT_FALSE(ServeTiles(badFds[1], nTiles, jobId,
+                                [&](int index, std::vector<char> *data) {
+                                    if (++count == 2)
+                                        shutdown(badFds[1], SHUT_RDWR);
+                                    *data = TilePayload(index);
+                                }));
+        close(badFds[1]);
+    });
+    // This one is rendering some other image and should be turned away.
+    std::thread wrongJobWorker([&]() {
+        EXPECT_FALSE(ServeTiles(wrongJobFds[1], nTiles, jobId + 1,
+                                [&](int index, std::vector<char> *data) {
+                                    ADD_FAILURE() << "Rendered tile " << index;
+                                }));
+        close(wrongJobFds[1]);
+    });
+    // Start the good worker only once the bad one is gone, so that it
+    // must pick up the tiles that were assigned to the bad one.
+    std::thread goodWorker([&]() {
+        badWorker.join();
+        EXPECT_TRUE(ServeTiles(goodFds[1], nTiles, jobId,
+                               [&](int index, std::vector<char> *data) {
+                                   *data = TilePayload(index);
+                               }));
+        close(goodFds[1]);
+    });
+
+    std::vector<int> merged(nTiles, 0);
+    EXPECT_TRUE(CoordinateTiles(-1, {badFds[0], wrongJobFds[0], goodFds[0]},
+                                nTiles, jobId, 8,
+                                [&](int index, const std::vector<char> &data) {
+                                    ++merged[index];
+                                    EXPECT_EQ(TilePayload(index), data);
+                                }));
+    goodWorker.join();
+    wrongJobWorker.join();
+
+    for (int i = 0; i < nTiles; ++i) EXPECT_EQ(1, merged[i]);
+
+    ParallelCleanup();
+}
+
+TEST(Distributed, AllWorkersLost) {
+    ParallelInit();
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    close(fds[1]);
+    int nMerged = 0;
+    EXPECT_FALSE(CoordinateTiles(-1, {fds[0]}, 10, 0, 1,
+                                 [&](int, const std::vector<char> &) {
+                                     ++nMerged;
+                                 }));
+    EXPECT_EQ(0, nMerged);
+
+    ParallelCleanup();
+}
+
+TEST(Distributed, LostWorkersTilesRenderedLocally) {
+    ParallelInit();
+
+    // The only worker renders one tile and then disconnects
+    const int nTiles = 20;
+    const uint64_t jobId = 7;
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::thread worker([&]() {
+        std::atomic<int> nRendered{0};
+        ServeTiles(fds[1], nTiles, jobId,
+                   [&](int index, std::vector<char> *data) {
+                       if (++nRendered > 1) shutdown(fds[1], SHUT_RDWR);
+                       *data = TilePayload(index);
+                   });
+        close(fds[1]);
+    });
+
+    std::vector<int> merged(nTiles, 0);
+    std::atomic<int> nLocal{0};
+    EXPECT_TRUE(CoordinateTiles(-1, {fds[0]}, nTiles, jobId, 4,
+                                [&](int index, const std::vector<char> &data) {
+                                    ++merged[index];
+                                    EXPECT_EQ(TilePayload(index), data);
+                                },
+                                [&](int index, std::vector<char> *data) {
+                                    ++nLocal;
+                                    *data = TilePayload(index);
+                                }));
+    worker.join();
+
+    for (int i = 0; i < nTiles; ++i) EXPECT_EQ(1, merged[i]);
+    EXPECT_GE(nLocal, nTiles - 1);
+
+    ParallelCleanup();
+}
+
+TEST(Distributed, OversizedMessageDropsWorker) {
+    ParallelInit();
+
+    // A peer that claims an absurdly large message is disconnected
+    // rather than having that much memory allocated for it.
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    uint32_t header[2] = {1, 0xfffffff0u};
+    ASSERT_EQ((ssize_t)sizeof(header), write(fds[1], header, sizeof(header)));
+    int nMerged = 0;
+    EXPECT_FALSE(CoordinateTiles(-1, {fds[0]}, 10, 0, 1,
+                                 [&](int, const std::vector<char> &) {
+                                     ++nMerged;
+                                 }));
+    EXPECT_EQ(0, nMerged);
+    close(fds[1]);
+
+    ParallelCleanup();
+}
+
+TEST(Distributed, FilmTileRoundTrip) {
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5f, 0.5f)));
+    Film film(Point2i(64, 32), Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+              std::move(filter), 35.f, "unused.exr", 1.f);
+    Bounds2i bounds(Point2i(16, 8), Point2i(32, 24));
+    std::unique_ptr<FilmTile> tile = film.GetFilmTile(bounds);
+    for (Point2i p : bounds) {
+        Float rgb[3] = {Float(p.x), Float(p.y), 0.5f};
+        tile->AddSample(Point2f(p.x + 0.5f, p.y + 0.5f),
+                        Spectrum::FromRGB(rgb));
+    }
+
+    std::vector<char> data;
+    SerializeFilmTile(*tile, &data);
+    std::unique_ptr<FilmTile> copy = film.GetFilmTile(bounds);
+    ASSERT_TRUE(DeserializeFilmTile(data, copy.get()));
+    for (Point2i p : tile->GetPixelBounds()) {
+        EXPECT_EQ(tile->GetPixel(p).contribSum, copy->GetPixel(p).contribSum);
+        EXPECT_EQ(tile->GetPixel(p).filterWeightSum,
+                  copy->GetPixel(p).filterWeightSum);
+    }
+
+    // A tile with different bounds shouldn't accept the data.
+    std::unique_ptr<FilmTile> other =
+        film.GetFilmTile(Bounds2i(Point2i(0, 0), Point2i(16, 16)));
+    EXPECT_FALSE(DeserializeFilmTile(data, other.get()));
+}
+
+#endif  // !PBRT_IS_WINDOWS
@@ -0,0 +1,45 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "film.h"
+#include "filters/box.h"
+#include "parallel.h"
+#include "rng.h"
+
+using namespace pbrt;
+
+TEST(Film, SplatBuffers) {
+    // Splats accumulated in per-thread buffers should add up to the same
+    // values as splats added to the pixels directly, including when the
+    // buffers are only big enough for a few blocks and so are flushed
+    // while splatting.
+    ParallelInit();
+    Point2i resolution(200, 150);
+    Bounds2f crop(Point2f(0, 0), Point2f(1, 1));
+    for (size_t bufferBytes : {size_t(4 * 3 * sizeof(Float) * 8 * 8),
+                               size_t(16 * 1024 * 1024)}) {
+        std::vector<Float> values[2];
+        for (int buffered = 0; buffered < 2; ++buffered) {
+            std::unique_ptr<Filter> filter(
+                new BoxFilter(Vector2f(0.5f, 0.5f)));
+            Film film(resolution, crop, std::move(filter), 35.f, "unused.exr",
+                      1.f, Infinity, buffered ? bufferBytes : 0);
+            ParallelFor([&](int64_t chunk) {
+                RNG rng(chunk);
+                for (int i = 0; i < 1000; ++i) {
+                    Point2f p(rng.UniformFloat() * resolution.x,
+                              rng.UniformFloat() * resolution.y);
+                    Float rgb[3] = {1, 2, Float(rng.UniformUInt32(4))};
+                    film.AddSplat(p, Spectrum::FromRGB(rgb));
+                }
+            }, 64);
+            film.SaveAccumulation(&values[buffered]);
+        }
+        ASSERT_EQ(values[0].size(), values[1].size());
+        for (size_t i = 0; i < values[0].size(); ++i)
+            EXPECT_NEAR(values[0][i], values[1][i],
+                        1e-4f * std::max(Float(1), values[0][i]))
+                << i;
+    }
+    ParallelCleanup();
+}
@@ -0,0 +1,98 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "mipfile.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "rng.h"
+#include "texcache.h"
+#include <stdio.h>
+
+using namespace pbrt;
+
+static bool WriteFile(const char *filename, const MIPMap<RGBSpectrum> &mipmap,
+                      ImageWrap wrapMode) {
+    std::vector<Point2i> levelRes;
+    for (int level = 0; level < mipmap.Levels(); ++level)
+        levelRes.push_back(Point2i(std::max(1, mipmap.Width() >> level),
+                                   std::max(1, mipmap.Height() >> level)));
+    return WriteMIPMapFile(filename, levelRes, 3, wrapMode,
+                           [&](int level, int s, int t, Float *v) {
+                               mipmap.Texel(level, s, t).ToRGB(v);
+                           });
+}
+
+TEST(MIPMapFile, LookupsMatch) {
+    // Lookups in a MIPMap that uses a MIP map file should match those in
+    // the in-memory MIPMap that the file was written from, whether or not
+    // the file's tiles are kept in the texture cache.
+    ParallelInit();
+    const char *filename = "test.mip";
+    Point2i res(300, 170);
+    std::vector<RGBSpectrum> image(res.x * res.y);
+    RNG rng;
+    for (RGBSpectrum &v : image) {
+        Float rgb[3] = {rng.UniformFloat(), rng.UniformFloat(),
+                        rng.UniformFloat()};
+        v = RGBSpectrum::FromRGB(rgb);
+    }
+
+    for (ImageWrap wrap :
+         {ImageWrap::Repeat, ImageWrap::Black, ImageWrap::Clamp}) {
+        MIPMap<RGBSpectrum> resident(res, image.data(), false, 8.f, wrap);
+        ASSERT_TRUE(WriteFile(filename, resident, wrap));
+        EXPECT_TRUE(fopen("test.mip.tmp", "rb") == nullptr);
+
+        for (size_t cacheBytes :
+             {size_t(0), 4 * 64 * 64 * sizeof(RGBSpectrum)}) {
+            SetTextureCacheSize(cacheBytes);
+            std::unique_ptr<MIPMapFile> file = MIPMapFile::Open(filename);
+            ASSERT_TRUE(file != nullptr);
+            EXPECT_EQ(3, file->Channels());
+            EXPECT_EQ(wrap, file->WrapMode());
+            EXPECT_EQ(resident.Levels(), file->Levels());
+            MIPMap<RGBSpectrum> mapped(std::move(file), 2.f, false, 8.f,
+                                       wrap);
+
+            for (int i = 0; i < 200; ++i) {
+                Point2f st(2 * rng.UniformFloat() - .5f,
+                           2 * rng.UniformFloat() - .5f);
+                Float width = std::pow(2.f, -10 * rng.UniformFloat());
+                EXPECT_EQ(2.f * resident.Lookup(st, width),
+                          mapped.Lookup(st, width));
+                Vector2f dst0(width, 0.1f * width),
+                    dst1(-0.2f * width, width);
+                RGBSpectrum ewa = resident.Lookup(st, dst0, dst1);
+                RGBSpectrum mappedEWA = mapped.Lookup(st, dst0, dst1);
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_FLOAT_EQ(2.f * ewa[c], mappedEWA[c]);
+            }
+            ClearTextureCache();
+        }
+    }
+    SetTextureCacheSize(0);
+    EXPECT_EQ(0, remove(filename));
+    ParallelCleanup();
+}
+
+TEST(MIPMapFile, RejectsTruncated) {
+    ParallelInit();
+    const char *filename = "test.mip";
+    RGBSpectrum image[64 * 32];
+    MIPMap<RGBSpectrum> mipmap(Point2i(64, 32), image);
+    ASSERT_TRUE(WriteFile(filename, mipmap, ImageWrap::Repeat));
+
+    // Chop off the last few texels of the file
+    FILE *f = fopen(filename, "rb");
+    ASSERT_TRUE(f != nullptr);
+    std::vector<char> contents(1 << 20);
+    contents.resize(fread(contents.data(), 1, contents.size(), f));
+    fclose(f);
+    f = fopen(filename, "wb");
+    fwrite(contents.data(), 1, contents.size() - 16, f);
+    fclose(f);
+    EXPECT_TRUE(MIPMapFile::Open(filename) == nullptr);
+
+    EXPECT_EQ(0, remove(filename));
+    ParallelCleanup();
+}
@@ -3,6 +3,7 @@
 #include "pbrt.h"
 #include "parallel.h"
 #include <atomic>
+#include <chrono>
 
 using namespace pbrt;
 
@@ -37,3 +38,60 @@ TEST(Parallel, DoNothing) {
 
     ParallelCleanup();
 }
+
+TEST(Parallel, Nested) {
+    ParallelInit();
+
+    std::atomic<int> counter{0};
+    ParallelFor([&](int64_t) {
+        ParallelFor([&](int64_t) { ++counter; }, 100, 7);
+    }, 50);
+    EXPECT_EQ(50 * 100, counter);
+
+    counter = 0;
+    ParallelFor2D([&](Point2i p) {
+        ParallelFor([&](int64_t) {
+            ParallelFor([&](int64_t) { ++counter; }, 10);
+        }, 10);
+    }, Point2i(4, 5));
+    EXPECT_EQ(4 * 5 * 10 * 10, counter);
+
+    ParallelCleanup();
+}
+
+// Not a correctness test: reports how the throughput of loops made of
+// many short chunks (as in the SPPM photon pass or MLT bootstrapping)
+// scales as the number of threads increases.
+TEST(Parallel, ShortChunkScaling) {
+    const int savedThreads = PbrtOptions.nThreads;
+    const int64_t count = 1 << 18;
+    for (int nThreads = 1; nThreads <= NumSystemCores(); nThreads *= 2) {
+        PbrtOptions.nThreads = nThreads;
+        ParallelInit();
+
+        std::atomic<uint64_t> sum{0};
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < 8; ++pass)
+            ParallelForRanges([&](int64_t start, int64_t end) {
+                // A small amount of work so that scheduling overhead
+                // dominates; accumulate locally so that the shared atomic
+                // is only updated once per chunk.
+                uint64_t localSum = 0;
+                for (int64_t i = start; i < end; ++i) {
+                    uint64_t v = i;
+                    for (int j = 0; j < 16; ++j)
+                        v = v * 6364136223846793005ull + 1;
+                    localSum += v & 1;
+                }
+                sum += localSum;
+            }, count, 16);
+        auto end = std::chrono::steady_clock::now();
+        double ms =
+            std::chrono::duration<double, std::milli>(end - start).count();
+        printf("%3d threads: %8.2f ms (%.1f M iterations/s)\n", nThreads, ms,
+               8 * count / (1000. * ms));
+
+        ParallelCleanup();
+    }
+    PbrtOptions.nThreads = savedThreads;
+}
@@ -0,0 +1,68 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "paramset.h"
+#include "spectrum.h"
+
+using namespace pbrt;
+
+static std::unique_ptr<Float[]> floats(std::initializer_list<Float> v) {
+    std::unique_ptr<Float[]> values(new Float[v.size()]);
+    std::copy(v.begin(), v.end(), values.get());
+    return values;
+}
+
+TEST(ParamSet, Lookups) {
+    // Enough names that every bit of the set's name filter is taken, so
+    // that lookups of missing names have to search.
+    ParamSet ps;
+    const int nNames = 500;
+    for (int i = 0; i < nNames; ++i)
+        ps.AddFloat(StringPrintf("f%d", i), floats({Float(i)}), 1);
+    ps.AddRGBSpectrum("Kd", floats({.5, .5, .5}), 3);
+    ps.AddTexture("bumpmap", "bumps");
+    ps.AddInt("indices", std::unique_ptr<int[]>(new int[3]{0, 1, 2}), 3);
+
+    for (int i = 0; i < nNames; ++i) {
+        EXPECT_EQ(Float(i), ps.FindOneFloat(StringPrintf("f%d", i), -1));
+        EXPECT_EQ(-1, ps.FindOneFloat(StringPrintf("g%d", i), -1));
+    }
+    EXPECT_EQ(Spectrum(.5), ps.FindOneSpectrum("Kd", Spectrum(0.)));
+    EXPECT_EQ("bumps", ps.FindTexture("bumpmap"));
+    EXPECT_EQ("", ps.FindTexture("Kd"));
+    int n;
+    const int *indices = ps.FindInt("indices", &n);
+    ASSERT_TRUE(indices != nullptr);
+    EXPECT_EQ(3, n);
+    EXPECT_EQ(2, indices[2]);
+    // Parameters are only found with their own type, and FindOne*()
+    // ignores parameters with more than one value.
+    EXPECT_TRUE(ps.FindFloat("Kd", &n) == nullptr);
+    EXPECT_EQ(7, ps.FindOneInt("indices", 7));
+
+    // Adding a parameter again replaces it; erased and cleared parameters
+    // aren't found.
+    ps.AddFloat("f3", floats({42}), 1);
+    EXPECT_EQ(42, ps.FindOneFloat("f3", -1));
+    EXPECT_TRUE(ps.EraseFloat("f3"));
+    EXPECT_EQ(-1, ps.FindOneFloat("f3", -1));
+    ps.Clear();
+    EXPECT_EQ(-1, ps.FindOneFloat("f4", -1));
+    EXPECT_EQ("", ps.FindTexture("bumpmap"));
+    ps.AddFloat("radius", floats({2}), 1);
+    EXPECT_EQ(2, ps.FindOneFloat("radius", -1));
+}
+
+TEST(ParamSet, FewNames) {
+    // With few parameters, lookups of others mostly return without
+    // searching; they still have to be found once they're added.
+    ParamSet ps;
+    ps.AddFloat("radius", floats({2}), 1);
+    for (const char *name : {"Kd", "Ks", "roughness", "eta", "alpha"}) {
+        EXPECT_EQ(-1, ps.FindOneFloat(name, -1));
+        ps.AddFloat(name, floats({3}), 1);
+        EXPECT_EQ(3, ps.FindOneFloat(name, -1));
+    }
+    ParamSet copy = ps;
+    EXPECT_EQ(3, copy.FindOneFloat("eta", -1));
+    EXPECT_EQ(2, copy.FindOneFloat("radius", -1));
+}
@@ -1,8 +1,13 @@
 
 #include "tests/gtest/gtest.h"
 #include "pbrt.h"
+#include "api.h"
+#include "imageio.h"
 #include "parser.h"
+#include "rng.h"
+#include "spectrum.h"
 
+#include <algorithm>
 #include <fstream>
 #include <initializer_list>
 #include <string>
@@ -130,3 +135,158 @@ Integrator "deep" "float density" [ 2 2.66612 -5e-51]
     EXPECT_EQ(0, remove(filename.c_str()));
 }
 
+static void writeFile(const std::string &filename, const std::string &text) {
+    std::ofstream out(filename);
+    out << text;
+    out.close();
+    ASSERT_TRUE(out.good());
+}
+
+TEST(Parser, ImportMatchesInclude) {
+    // The imported files use a texture and an object instance defined by
+    // the main file, and change the graphics state without affecting it.
+    const int nFiles = 6;
+    for (int i = 0; i < nFiles; ++i)
+        writeFile(inTestDir(StringPrintf("import-%d.pbrt", i)),
+                  StringPrintf(R"(
+Translate %f 0 0
+Material "matte" "texture Kd" "checks"
+Shape "sphere" "float radius" .3
+AttributeBegin
+Translate 0 .6 0
+ObjectInstance "ball"
+AttributeEnd
+)", 0.7f * (i - nFiles / 2)));
+
+    std::unique_ptr<RGBSpectrum[]> images[2];
+    Point2i resolution;
+    for (int pass = 0; pass < 2; ++pass) {
+        std::string scene = R"(
+LookAt 0 0 -5  0 0 0  0 1 0
+Camera "perspective" "float fov" 45
+Film "image" "integer xresolution" 32 "integer yresolution" 16
+    "string filename" "import-test.exr"
+Sampler "halton" "integer pixelsamples" 4
+WorldBegin
+LightSource "point" "point from" [0 2 -4] "rgb I" [10 10 10]
+Texture "checks" "spectrum" "checkerboard" "float uscale" 8 "float vscale" 8
+ObjectBegin "ball"
+Shape "sphere" "float radius" .2
+ObjectEnd
+Material "matte" "rgb Kd" [.5 .5 .5]
+)";
+        for (int i = 0; i < nFiles; ++i) {
+            std::string filename =
+                inTestDir(StringPrintf("import-%d.pbrt", i));
+            if (pass == 0)
+                scene += "AttributeBegin Include \"" + filename +
+                         "\" AttributeEnd\n";
+            else
+                scene += "Import \"" + filename + "\"\n";
+            // Primitives between the imports must keep their place
+            if (i == nFiles / 2)
+                scene += "Shape \"sphere\" \"float radius\" .1\n";
+        }
+        scene += "WorldEnd\n";
+
+        Options options;
+        options.quiet = true;
+        options.nThreads = 4;
+        pbrtInit(options);
+        pbrtParseString(scene);
+        pbrtCleanup();
+
+        images[pass] = ReadImage(inTestDir("import-test.exr"), &resolution);
+        ASSERT_TRUE(images[pass].get() != nullptr);
+        EXPECT_EQ(0, remove(inTestDir("import-test.exr").c_str()));
+    }
+
+    for (int p = 0; p < resolution.x * resolution.y; ++p)
+        for (int c = 0; c < 3; ++c)
+            EXPECT_NEAR(images[0][p][c], images[1][p][c],
+                        1e-4f * std::max(Float(1), images[0][p][c]))
+                << p;
+    for (int i = 0; i < nFiles; ++i)
+        EXPECT_EQ(0,
+                  remove(inTestDir(StringPrintf("import-%d.pbrt", i)).c_str()));
+}
+
+TEST(Parser, ImportErrorsHaveLocations) {
+    // Errors about imported files should be reported at their Import
+    // directives, whichever threads parse them.
+    const int nFiles = 8;
+    std::string scene = R"(
+LookAt 0 0 -5  0 0 0  0 1 0
+Camera "perspective" "float fov" 45
+Film "image" "integer xresolution" 4 "integer yresolution" 4
+    "string filename" "import-errors.exr"
+WorldBegin
+)";
+    std::vector<int> importLines;
+    for (int i = 0; i < nFiles; ++i) {
+        std::string filename =
+            inTestDir(StringPrintf("import-error-%d.pbrt", i));
+        writeFile(filename, StringPrintf("ObjectBegin \"unended-%d\"\n"
+                                         "Shape \"sphere\"\n", i));
+        importLines.push_back(
+            std::count(scene.begin(), scene.end(), '\n') + 1);
+        scene += "Import \"" + filename + "\"\n";
+    }
+    scene += "WorldEnd\n";
+
+    Options options;
+    options.quiet = true;
+    options.nThreads = 4;
+    pbrtInit(options);
+    testing::internal::CaptureStderr();
+    pbrtParseString(scene);
+    std::string errors = testing::internal::GetCapturedStderr();
+    pbrtCleanup();
+
+    for (int i = 0; i < nFiles; ++i) {
+        std::string error =
+            StringPrintf("import-error-%d.pbrt\": missing ObjectEnd", i);
+        size_t end = errors.find(error);
+        ASSERT_NE(std::string::npos, end) << errors;
+        size_t start = errors.rfind('\n', end);
+        start = (start == std::string::npos) ? 0 : start + 1;
+        std::string prefix = StringPrintf("<stdin>:%d:", importLines[i]);
+        EXPECT_EQ(prefix, errors.substr(start, prefix.size())) << errors;
+        EXPECT_EQ(0, remove(inTestDir(StringPrintf("import-error-%d.pbrt", i))
+                                .c_str()));
+    }
+    remove(inTestDir("import-errors.exr").c_str());
+}
+
+TEST(Parser, NumberParsing) {
+    auto reference = [](const std::string &s) -> double {
+        if (s.find_first_not_of("0123456789") == std::string::npos)
+            return double(strtol(s.c_str(), nullptr, 10));
+        if (sizeof(Float) == sizeof(float)) return strtof(s.c_str(), nullptr);
+        return strtod(s.c_str(), nullptr);
+    };
+    auto check = [&](const std::string &s) {
+        EXPECT_EQ(reference(s), ParseNumber(string_view(s.data(), s.size())))
+            << s;
+    };
+
+    for (const char *s :
+         {"0", "7", "-0", "+3", "16777217", "123456789012", "-16777217",
+          "0.1", ".5", "5.", "-2.66612", "1e10", "1E-5", "-5e-51", "3e38",
+          "4e38", "1e-40", "0.000000000000000000000000123", "1e+22", "1e23",
+          "9007199254740993", "12345678901234567890", "0.30000001192092896",
+          "1.00000005960464477539", "inf", "0x1p3", "1.5x"})
+        check(s);
+
+    RNG rng;
+    for (int i = 0; i < 100000; ++i) {
+        double v = (rng.UniformFloat() - .5) *
+                   std::pow(10., int(rng.UniformUInt32(20)) - 10);
+        int digits = 1 + rng.UniformUInt32(17);
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*g", digits, v);
+        check(buf);
+        snprintf(buf, sizeof(buf), "%.*f", digits % 10, v);
+        check(buf);
+    }
+}
@@ -0,0 +1,82 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "paramset.h"
+#include "scenecache.h"
+#include "spectrum.h"
+
+using namespace pbrt;
+
+static void writeFile(const std::string &filename, const std::string &text) {
+    FILE *f = fopen(filename.c_str(), "w");
+    ASSERT_TRUE(f != nullptr);
+    fputs(text.c_str(), f);
+    fclose(f);
+}
+
+TEST(SceneCache, ParamSetRoundTrip) {
+    ParamSet ps;
+    ps.AddFloat("radius", std::unique_ptr<Float[]>(new Float[1]{2.5f}), 1);
+    ps.AddInt("indices", std::unique_ptr<int[]>(new int[3]{0, 1, 2}), 3);
+    ps.AddBool("flip", std::unique_ptr<bool[]>(new bool[1]{true}), 1);
+    ps.AddPoint3f("P",
+                  std::unique_ptr<Point3f[]>(
+                      new Point3f[2]{Point3f(1, 2, 3), Point3f(-1, 0, 4)}),
+                  2);
+    ps.AddRGBSpectrum("Kd", std::unique_ptr<Float[]>(new Float[3]{.1, .2, .3}),
+                      3);
+    ps.AddString("filename",
+                 std::unique_ptr<std::string[]>(new std::string[1]{"a.ply"}),
+                 1);
+    ps.AddTexture("reflectance", "checks");
+
+    std::string data;
+    ps.Serialize(&data);
+    ParamSet copy;
+    const char *ptr = data.data(), *end = data.data() + data.size();
+    ASSERT_TRUE(copy.Deserialize(&ptr, end));
+    EXPECT_EQ(end, ptr);
+
+    EXPECT_EQ(2.5f, copy.FindOneFloat("radius", 0));
+    int n;
+    const int *indices = copy.FindInt("indices", &n);
+    ASSERT_EQ(3, n);
+    for (int i = 0; i < 3; ++i) EXPECT_EQ(i, indices[i]);
+    EXPECT_TRUE(copy.FindOneBool("flip", false));
+    const Point3f *P = copy.FindPoint3f("P", &n);
+    ASSERT_EQ(2, n);
+    EXPECT_EQ(Point3f(-1, 0, 4), P[1]);
+    EXPECT_EQ(ps.FindOneSpectrum("Kd", Spectrum(0.)),
+              copy.FindOneSpectrum("Kd", Spectrum(0.)));
+    EXPECT_EQ("a.ply", copy.FindOneString("filename", ""));
+    EXPECT_EQ("checks", copy.FindTexture("reflectance"));
+
+    // Truncated data should be rejected.
+    ParamSet truncated;
+    ptr = data.data();
+    EXPECT_FALSE(truncated.Deserialize(&ptr, end - 1));
+}
+
+TEST(SceneCache, Invalidation) {
+    const std::string scene = "scenecache-test.pbrt";
+    const std::string cache = "scenecache-test.cache";
+    writeFile(scene, "WorldBegin\nWorldEnd\n");
+
+    BeginSceneCache(cache, {scene});
+    AddSceneCacheDependency(scene);
+    RecordSceneCacheCall(SceneCacheOp::SearchDirectory, {"."});
+    EXPECT_TRUE(SceneCacheRecording());
+    EXPECT_TRUE(EndSceneCache());
+    EXPECT_FALSE(SceneCacheRecording());
+
+    EXPECT_TRUE(ReplaySceneCache(cache, {scene}));
+    // The cache is only for the input files that it was created from.
+    EXPECT_FALSE(ReplaySceneCache(cache, {scene, scene}));
+    EXPECT_FALSE(ReplaySceneCache("nonexistent.cache", {scene}));
+
+    // Changing the scene file should make the cache stale.
+    writeFile(scene, "WorldBegin\n\nWorldEnd\n");
+    EXPECT_FALSE(ReplaySceneCache(cache, {scene}));
+
+    EXPECT_EQ(0, remove(scene.c_str()));
+    EXPECT_EQ(0, remove(cache.c_str()));
+}
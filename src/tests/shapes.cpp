@@ -11,8 +11,10 @@
 #include "shapes/cylinder.h"
 #include "shapes/disk.h"
 #include "shapes/paraboloid.h"
+#include "shapes/plymesh.h"
 #include "shapes/sphere.h"
 #include "shapes/triangle.h"
+#include "ext/rply.h"
 
 using namespace pbrt;
 
@@ -557,3 +559,101 @@ TEST(Triangle, BadCases) {
     SurfaceInteraction isect;
     EXPECT_FALSE(mesh[0]->Intersect(ray, &thit, &isect));
 }
+
+// Writes a grid of quads to a PLY file. Every other quad is written as two
+// triangles, or all of them if _splitQuads_ is true.
+static void writeGridPLY(const std::string &filename, e_ply_storage_mode mode,
+                         int res, bool splitQuads) {
+    p_ply ply = ply_create(filename.c_str(), mode, nullptr, 0, nullptr);
+    ASSERT_TRUE(ply != nullptr);
+    int nFaces = 0;
+    for (int i = 0; i < res * res; ++i)
+        nFaces += (splitQuads || (i & 1)) ? 2 : 1;
+    ply_add_element(ply, "vertex", (res + 1) * (res + 1));
+    ply_add_scalar_property(ply, "x", PLY_FLOAT);
+    ply_add_scalar_property(ply, "y", PLY_FLOAT);
+    ply_add_scalar_property(ply, "z", PLY_DOUBLE);
+    ply_add_scalar_property(ply, "nx", PLY_FLOAT);
+    ply_add_scalar_property(ply, "ny", PLY_FLOAT);
+    ply_add_scalar_property(ply, "nz", PLY_FLOAT);
+    ply_add_scalar_property(ply, "confidence", PLY_UINT8);
+    ply_add_scalar_property(ply, "s", PLY_FLOAT);
+    ply_add_scalar_property(ply, "t", PLY_FLOAT);
+    ply_add_element(ply, "face", nFaces);
+    ply_add_list_property(ply, "vertex_indices", PLY_UINT8, PLY_UINT);
+    ply_write_header(ply);
+
+    RNG rng;
+    for (int y = 0; y <= res; ++y)
+        for (int x = 0; x <= res; ++x) {
+            for (Float v : {Float(x), Float(y), rng.UniformFloat(),
+                            Float(0), Float(0), Float(1), Float(255),
+                            Float(x) / res, Float(y) / res})
+                ply_write(ply, v);
+        }
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x) {
+            int v[4] = {y * (res + 1) + x, y * (res + 1) + x + 1,
+                        (y + 1) * (res + 1) + x + 1, (y + 1) * (res + 1) + x};
+            if (splitQuads || ((y * res + x) & 1)) {
+                int tris[2][3] = {{0, 1, 2}, {0, 2, 3}};
+                for (const auto &tri : tris) {
+                    ply_write(ply, 3);
+                    for (int i : tri) ply_write(ply, v[i]);
+                }
+            } else {
+                ply_write(ply, 4);
+                for (int i = 0; i < 4; ++i) ply_write(ply, v[i]);
+            }
+        }
+    ply_close(ply);
+}
+
+TEST(PLYMesh, DirectMatchesRply) {
+    const std::string filename = "plymesh-test.ply";
+    for (bool splitQuads : {false, true}) {
+        writeGridPLY(filename, PLY_LITTLE_ENDIAN, 37, splitQuads);
+        PLYMesh direct, rply;
+        ASSERT_TRUE(ReadPLYMeshDirect(filename, &direct));
+        ASSERT_TRUE(ReadPLYMeshRply(filename, &rply));
+
+        ASSERT_EQ(rply.nVertices, direct.nVertices);
+        for (int i = 0; i < rply.nVertices; ++i) {
+            EXPECT_EQ(rply.p[i], direct.p[i]);
+            EXPECT_EQ(rply.n[i], direct.n[i]);
+            EXPECT_EQ(rply.uv[i], direct.uv[i]);
+        }
+        EXPECT_EQ(rply.indices, direct.indices);
+        EXPECT_TRUE(direct.faceIndices.empty());
+    }
+
+    // Files that aren't binary little-endian are left to rply
+    writeGridPLY(filename, PLY_ASCII, 4, false);
+    PLYMesh mesh;
+    EXPECT_FALSE(ReadPLYMeshDirect(filename, &mesh));
+    EXPECT_TRUE(ReadPLYMeshRply(filename, &mesh));
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(PLYMesh, FaceIndices) {
+    const std::string filename = "plymesh-test.ply";
+    int indices[6] = {0, 1, 2, 2, 1, 3};
+    Point3f p[4] = {Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(0, 1, 0),
+                    Point3f(1, 1, 0)};
+    int faceIndices[2] = {7, 3};
+    ASSERT_TRUE(WritePlyFile(filename, 2, indices, 4, p, nullptr, nullptr,
+                             nullptr, faceIndices));
+    PLYMesh mesh;
+    ASSERT_TRUE(ReadPLYMeshDirect(filename, &mesh));
+    EXPECT_EQ(std::vector<int>(indices, indices + 6), mesh.indices);
+    EXPECT_EQ(std::vector<int>(faceIndices, faceIndices + 2),
+              mesh.faceIndices);
+    EXPECT_TRUE(!mesh.n && !mesh.uv);
+
+    // Out-of-range vertex indices make the direct reader give up
+    indices[5] = 4;
+    ASSERT_TRUE(WritePlyFile(filename, 2, indices, 4, p, nullptr, nullptr,
+                             nullptr, faceIndices));
+    EXPECT_FALSE(ReadPLYMeshDirect(filename, &mesh));
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
@@ -230,3 +230,46 @@ TEST(Spectrum, LinearDownsampleIrreg) {
         EXPECT_LT(std::abs(lambda * lambda - newVal[i]), .8);
     }
 }
+
+// Checks each of the arithmetic operators against per-sample arithmetic,
+// which exercises the vectorized versions when PBRT_SPECTRUM_SIMD is set.
+template <typename S>
+static void checkArithmetic() {
+    RNG rng;
+    S a, b;
+    for (int i = 0; i < S::nSamples; ++i) {
+        a[i] = rng.UniformFloat();
+        b[i] = .5f + rng.UniformFloat();
+    }
+    S sum = a + b, diff = a - b, prod = a * b, neg = -a, root = Sqrt(a);
+    S scaled = a * 3.f, divided = a / 3.f, acc = a;
+    acc += b;
+    acc *= b;
+    for (int i = 0; i < S::nSamples; ++i) {
+        EXPECT_EQ(a[i] + b[i], sum[i]);
+        EXPECT_EQ(a[i] - b[i], diff[i]);
+        EXPECT_EQ(a[i] * b[i], prod[i]);
+        EXPECT_EQ(-a[i], neg[i]);
+        EXPECT_EQ(std::sqrt(a[i]), root[i]);
+        EXPECT_EQ(a[i] * 3.f, scaled[i]);
+        EXPECT_EQ(a[i] / 3.f, divided[i]);
+        EXPECT_EQ((a[i] + b[i]) * b[i], acc[i]);
+    }
+
+    // IsBlack() must look at every sample, and only at the samples
+    EXPECT_TRUE(S(0.f).IsBlack());
+    EXPECT_TRUE((-S(0.f)).IsBlack());
+    for (int i = 0; i < S::nSamples; ++i) {
+        S s(0.f);
+        s[i] = 1;
+        EXPECT_FALSE(s.IsBlack());
+        EXPECT_TRUE((s - s).IsBlack());
+    }
+    S one(1.f);
+    EXPECT_EQ(one, S(.5f) * 2.f);
+    EXPECT_EQ(Float(1), one.MaxComponentValue());
+}
+
+TEST(Spectrum, RGBArithmetic) { checkArithmetic<RGBSpectrum>(); }
+
+TEST(Spectrum, SampledArithmetic) { checkArithmetic<SampledSpectrum>(); }
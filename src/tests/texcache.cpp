@@ -0,0 +1,137 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "rng.h"
+#include "texcache.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace pbrt;
+
+// Tiles whose texels are all their own coordinates, counting the number of
+// times tiles are loaded.
+class CountingTileSource : public TextureTileSource {
+  public:
+    CountingTileSource() : TextureTileSource(16 * sizeof(int)) {}
+    void LoadTile(int level, int s, int t, void *texels) const {
+        ++nLoads;
+        for (int i = 0; i < 16; i += 4) {
+            ((int *)texels)[i] = level;
+            ((int *)texels)[i + 1] = s;
+            ((int *)texels)[i + 2] = t;
+            ((int *)texels)[i + 3] = i;
+        }
+    }
+    mutable std::atomic<int> nLoads{0};
+};
+
+static bool TileMatches(const void *texels, int level, int s, int t) {
+    const int *v = (const int *)texels;
+    for (int i = 0; i < 16; i += 4)
+        if (v[i] != level || v[i + 1] != s || v[i + 2] != t || v[i + 3] != i)
+            return false;
+    return true;
+}
+
+TEST(TextureCache, LoadsTilesOnce) {
+    SetTextureCacheSize(1024 * 1024);
+    CountingTileSource source;
+    for (int pass = 0; pass < 3; ++pass)
+        for (int t = 0; t < 10; ++t)
+            for (int s = 0; s < 10; ++s)
+                EXPECT_TRUE(
+                    TileMatches(GetTextureTile(source, 2, s, t), 2, s, t));
+    EXPECT_EQ(100, source.nLoads);
+    ClearTextureCache();
+    SetTextureCacheSize(0);
+}
+
+TEST(TextureCache, EvictsTiles) {
+    // With room for only a few tiles, lookups from many threads must still
+    // always find the right texels, reloading evicted tiles as needed.
+    ParallelInit();
+    SetTextureCacheSize(8 * 16 * sizeof(int));
+    CountingTileSource source;
+    ParallelFor([&](int64_t chunk) {
+        RNG rng(chunk);
+        for (int i = 0; i < 1000; ++i) {
+            int level = rng.UniformUInt32(3), s = rng.UniformUInt32(20),
+                t = rng.UniformUInt32(20);
+            EXPECT_TRUE(TileMatches(GetTextureTile(source, level, s, t),
+                                    level, s, t));
+        }
+    }, 16);
+    EXPECT_GT(source.nLoads, 3 * 20 * 20);
+    ClearTextureCache();
+    SetTextureCacheSize(0);
+    ParallelCleanup();
+}
+
+TEST(TextureCache, LoadsConcurrentlyMissedTilesOnce) {
+    // Threads that miss on a tile that another thread is loading should
+    // wait for it rather than loading it themselves.
+    class SlowTileSource : public CountingTileSource {
+      public:
+        void LoadTile(int level, int s, int t, void *texels) const {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            CountingTileSource::LoadTile(level, s, t, texels);
+        }
+    };
+    SetTextureCacheSize(1024 * 1024);
+    SlowTileSource source;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i)
+        threads.push_back(std::thread([&]() {
+            EXPECT_TRUE(TileMatches(GetTextureTile(source, 1, 3, 5), 1, 3, 5));
+        }));
+    for (std::thread &thread : threads) thread.join();
+    EXPECT_EQ(1, source.nLoads);
+    ClearTextureCache();
+    SetTextureCacheSize(0);
+}
+
+TEST(TextureCache, MIPMapLookupsMatch) {
+    // A MIPMap whose texels are kept in a cache that's much smaller than
+    // the texture should give the same results as one that's in memory.
+    ParallelInit();
+    Point2i res(300, 170);
+    std::vector<Float> image(res.x * res.y);
+    RNG rng;
+    for (Float &v : image) v = rng.UniformFloat();
+
+    for (ImageWrap wrap :
+         {ImageWrap::Repeat, ImageWrap::Black, ImageWrap::Clamp}) {
+        MIPMap<Float> resident(res, image.data(), false, 8.f, wrap);
+        int nReads = 0;
+        auto readImage = [&](Point2i *resolution) {
+            ++nReads;
+            *resolution = res;
+            std::unique_ptr<Float[]> texels(new Float[res.x * res.y]);
+            std::copy(image.begin(), image.end(), texels.get());
+            return texels;
+        };
+        SetTextureCacheSize(4 * 64 * 64 * sizeof(Float));
+        MIPMap<Float> cached(readImage, false, 8.f, wrap);
+        EXPECT_EQ(0, nReads);
+
+        for (int i = 0; i < 200; ++i) {
+            Point2f st(2 * rng.UniformFloat() - .5f,
+                       2 * rng.UniformFloat() - .5f);
+            Float width = std::pow(2.f, -10 * rng.UniformFloat());
+            EXPECT_EQ(resident.Lookup(st, width), cached.Lookup(st, width));
+            Vector2f dst0(width, 0.1f * width), dst1(-0.2f * width, width);
+            EXPECT_EQ(resident.Lookup(st, dst0, dst1),
+                      cached.Lookup(st, dst0, dst1));
+        }
+        EXPECT_EQ(resident.Width(), cached.Width());
+        EXPECT_EQ(resident.Levels(), cached.Levels());
+        // Evicted tiles are read back from the tile file, not the image
+        EXPECT_EQ(1, nReads);
+        ClearTextureCache();
+    }
+    SetTextureCacheSize(0);
+    ParallelCleanup();
+}
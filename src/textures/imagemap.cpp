@@ -35,9 +35,13 @@
 #include "textures/imagemap.h"
 #include "imageio.h"
 #include "stats.h"
+#include <mutex>
 
 namespace pbrt {
 
+// Protects _ImageTexture::textures_ for all texel types
+static std::mutex texturesMutex;
+
 // ImageTexture Method Definitions
 template <typename Tmemory, typename Treturn>
 ImageTexture<Tmemory, Treturn>::ImageTexture(
@@ -50,22 +54,15 @@ ImageTexture<Tmemory, Treturn>::ImageTexture(
 }
 
 template <typename Tmemory, typename Treturn>
-MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
-    const std::string &filename, bool doTrilinear, Float maxAniso,
-    ImageWrap wrap, Float scale, bool gamma) {
-    // Return _MIPMap_ from texture cache if present
-    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma);
-    if (textures.find(texInfo) != textures.end())
-        return textures[texInfo].get();
-
-    // Create _MIPMap_ for _filename_
+std::unique_ptr<Tmemory[]> ImageTexture<Tmemory, Treturn>::readTexels(
+    const std::string &filename, Float scale, bool gamma,
+    Point2i *resolution) {
     ProfilePhase _(Prof::TextureLoading);
-    Point2i resolution;
-    std::unique_ptr<RGBSpectrum[]> texels = ReadImage(filename, &resolution);
+    std::unique_ptr<RGBSpectrum[]> texels = ReadImage(filename, resolution);
     if (!texels) {
         Warning("Creating a constant grey texture to replace \"%s\".",
                 filename.c_str());
-        resolution.x = resolution.y = 1;
+        resolution->x = resolution->y = 1;
         RGBSpectrum *rgb = new RGBSpectrum[1];
         *rgb = RGBSpectrum(0.5f);
         texels.reset(rgb);
@@ -73,28 +70,80 @@ MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
 
     // Flip image in y; texture coordinate space has (0,0) at the lower
     // left corner.
-    for (int y = 0; y < resolution.y / 2; ++y)
-        for (int x = 0; x < resolution.x; ++x) {
-            int o1 = y * resolution.x + x;
-            int o2 = (resolution.y - 1 - y) * resolution.x + x;
+    for (int y = 0; y < resolution->y / 2; ++y)
+        for (int x = 0; x < resolution->x; ++x) {
+            int o1 = y * resolution->x + x;
+            int o2 = (resolution->y - 1 - y) * resolution->x + x;
             std::swap(texels[o1], texels[o2]);
         }
 
+    // Convert texels to type _Tmemory_
+    std::unique_ptr<Tmemory[]> convertedTexels(
+        new Tmemory[resolution->x * resolution->y]);
+    for (int i = 0; i < resolution->x * resolution->y; ++i)
+        convertIn(texels[i], &convertedTexels[i], scale, gamma);
+    return convertedTexels;
+}
+
+template <typename Tmemory, typename Treturn>
+MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
+    const std::string &filename, bool doTrilinear, Float maxAniso,
+    ImageWrap wrap, Float scale, bool gamma) {
+    // Return _MIPMap_ from texture cache if present
+    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma);
+    {
+        std::lock_guard<std::mutex> lock(texturesMutex);
+        if (textures.find(texInfo) != textures.end())
+            return textures[texInfo].get();
+    }
+
+    // Create _MIPMap_ for _filename_
     MIPMap<Tmemory> *mipmap = nullptr;
-    if (texels) {
-        // Convert texels to type _Tmemory_ and create _MIPMap_
-        std::unique_ptr<Tmemory[]> convertedTexels(
-            new Tmemory[resolution.x * resolution.y]);
-        for (int i = 0; i < resolution.x * resolution.y; ++i)
-            convertIn(texels[i], &convertedTexels[i], scale, gamma);
-        mipmap = new MIPMap<Tmemory>(resolution, convertedTexels.get(),
-                                     doTrilinear, maxAniso, wrap);
+    if (HasExtension(filename, ".mip")) {
+        // Look up texels directly in the pre-filtered pyramid in the file
+        std::unique_ptr<MIPMapFile> file = MIPMapFile::Open(filename);
+        if (file) {
+            if (gamma)
+                Warning("\"%s\": ignoring \"gamma\"; MIP map files hold "
+                        "linear values.", filename.c_str());
+            if (file->WrapMode() != wrap)
+                Warning("\"%s\": MIP map file was made with a different "
+                        "wrap mode than the texture's.", filename.c_str());
+            mipmap = new MIPMap<Tmemory>(std::move(file), scale, doTrilinear,
+                                         maxAniso, wrap);
+        } else {
+            Warning("Creating a constant grey texture to replace \"%s\".",
+                    filename.c_str());
+            Tmemory grey;
+            convertIn(RGBSpectrum(0.5f), &grey, scale, false);
+            mipmap = new MIPMap<Tmemory>(Point2i(1, 1), &grey, doTrilinear,
+                                         maxAniso, wrap);
+        }
+    } else if (TextureCacheSize() > 0) {
+        // Defer reading the image until the texture is first used, and then
+        // keep its texels in the texture cache
+        auto read = [=](Point2i *resolution) {
+            return readTexels(filename, scale, gamma, resolution);
+        };
+        mipmap = new MIPMap<Tmemory>(read, doTrilinear, maxAniso, wrap);
     } else {
-        // Create one-valued _MIPMap_
-        Tmemory oneVal = scale;
-        mipmap = new MIPMap<Tmemory>(Point2i(1, 1), &oneVal);
+        Point2i resolution;
+        std::unique_ptr<Tmemory[]> texels =
+            readTexels(filename, scale, gamma, &resolution);
+        mipmap = new MIPMap<Tmemory>(resolution, texels.get(), doTrilinear,
+                                     maxAniso, wrap);
+    }
+    // Files given to Import are parsed in parallel, so another thread may
+    // have created the same _MIPMap_ in the meantime; the lock isn't held
+    // while creating it, since the threads that help build its pyramid
+    // may go on to parse imported files that use textures.
+    std::lock_guard<std::mutex> lock(texturesMutex);
+    std::unique_ptr<MIPMap<Tmemory>> &cached = textures[texInfo];
+    if (cached) {
+        delete mipmap;
+        return cached.get();
     }
-    textures[texInfo].reset(mipmap);
+    cached.reset(mipmap);
     return mipmap;
 }
 
@@ -98,6 +98,9 @@ class ImageTexture : public Texture<Treturn> {
     static MIPMap<Tmemory> *GetTexture(const std::string &filename,
                                        bool doTrilinear, Float maxAniso,
                                        ImageWrap wm, Float scale, bool gamma);
+    static std::unique_ptr<Tmemory[]> readTexels(const std::string &filename,
+                                                 Float scale, bool gamma,
+                                                 Point2i *resolution);
     static void convertIn(const RGBSpectrum &from, RGBSpectrum *to, Float scale,
                           bool gamma) {
         for (int i = 0; i < RGBSpectrum::nSamples; ++i)
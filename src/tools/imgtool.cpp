@@ -11,6 +11,7 @@
 #include <algorithm>
 #include "fileutil.h"
 #include "imageio.h"
+#include "mipmap.h"
 #include "pbrt.h"
 #include "spectrum.h"
 #include "parallel.h"
@@ -31,7 +32,7 @@ static void usage(const char *msg = nullptr, ...) {
     }
     fprintf(stderr, R"(usage: imgtool <command> [options] <filenames...>
 
-commands: assemble, cat, convert, diff, info, makesky
+commands: assemble, cat, convert, diff, info, makemip, makesky
 
 assemble option:
     --outfile          Output image filename.
@@ -70,6 +71,18 @@ diff options:
     --outfile <name>   Filename to use for saving an image that encodes the
                        absolute value of per-pixel differences.
 
+makemip options:   imgtool makemip [options] <image> <output.mip>
+    --channels <n>     Number of values stored for each texel: 3 for RGB or 1
+                       for luminance only, for use with "float" textures.
+                       Default: 3
+    --gamma            Convert the image's values from sRGB to linear ones.
+                       Default: enabled for PNG and TGA images, as for the
+                       "imagemap" texture.
+    --nogamma          Don't convert the image's values to linear ones.
+    --wrap <mode>      Wrap mode to filter the image with: "repeat", "black"
+                       or "clamp"; should match the texture's "wrap"
+                       parameter. Default: "repeat"
+
 makesky options:
     --albedo <a>       Albedo of ground-plane (range 0-1). Default: 0.5
     --elevation <e>    Elevation of the sun in degrees (range 0-90). Default: 10
@@ -84,6 +97,108 @@ makesky options:
     exit(1);
 }
 
+// RGBSpectrum may be padded past its three channels, so images are copied
+// to packed RGB for WriteImage().
+static void writeRGBImage(const std::string &filename,
+                          const RGBSpectrum *image, const Bounds2i &bounds,
+                          const Point2i &totalResolution) {
+    size_t nPixels = bounds.Area();
+    std::unique_ptr<Float[]> rgb(new Float[3 * nPixels]);
+    for (size_t i = 0; i < nPixels; ++i) image[i].ToRGB(&rgb[3 * i]);
+    WriteImage(filename, rgb.get(), bounds, totalResolution);
+}
+
+static void texelValues(Float texel, Float *v) { *v = texel; }
+static void texelValues(const RGBSpectrum &texel, Float *v) { texel.ToRGB(v); }
+
+template <typename T>
+static bool writeMIPMap(const char *filename, const MIPMap<T> &mipmap,
+                        int nChannels, ImageWrap wrapMode) {
+    std::vector<Point2i> levelRes;
+    for (int level = 0; level < mipmap.Levels(); ++level)
+        levelRes.push_back(Point2i(std::max(1, mipmap.Width() >> level),
+                                   std::max(1, mipmap.Height() >> level)));
+    return WriteMIPMapFile(filename, levelRes, nChannels, wrapMode,
+                           [&](int level, int s, int t, Float *v) {
+                               texelValues(mipmap.Texel(level, s, t), v);
+                           });
+}
+
+int makemip(int argc, char *argv[]) {
+    int nChannels = 3;
+    int gamma = -1;  // Decide based on the image's extension
+    ImageWrap wrapMode = ImageWrap::Repeat;
+
+    int i;
+    for (i = 0; i < argc; ++i) {
+        if (argv[i][0] != '-') break;
+        if (!strcmp(argv[i], "--gamma") || !strcmp(argv[i], "-gamma"))
+            gamma = 1;
+        else if (!strcmp(argv[i], "--nogamma") || !strcmp(argv[i], "-nogamma"))
+            gamma = 0;
+        else if (!strcmp(argv[i], "--channels") ||
+                 !strcmp(argv[i], "-channels")) {
+            if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+            nChannels = atoi(argv[++i]);
+            if (nChannels != 1 && nChannels != 3)
+                usage("--channels must be 1 or 3");
+        } else if (!strcmp(argv[i], "--wrap") || !strcmp(argv[i], "-wrap")) {
+            if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+            std::string wrap = argv[++i];
+            if (wrap == "repeat")
+                wrapMode = ImageWrap::Repeat;
+            else if (wrap == "black")
+                wrapMode = ImageWrap::Black;
+            else if (wrap == "clamp")
+                wrapMode = ImageWrap::Clamp;
+            else
+                usage("unknown wrap mode \"%s\"", wrap.c_str());
+        } else
+            usage("unknown makemip option \"%s\"", argv[i]);
+    }
+    if (i + 2 != argc) usage("makemip requires input and output filenames");
+    const char *inFilename = argv[i], *outFilename = argv[i + 1];
+    if (gamma == -1)
+        gamma = HasExtension(inFilename, ".png") ||
+                HasExtension(inFilename, ".tga");
+
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image(ReadImage(inFilename, &res));
+    if (!image) {
+        fprintf(stderr, "%s: unable to read image\n", inFilename);
+        return 1;
+    }
+
+    // Convert the image to texels as the "imagemap" texture does, flipping
+    // it in y and converting the values to linear ones, and then build the
+    // MIP pyramid and write it.
+    ParallelInit();
+    bool ok;
+    if (nChannels == 1) {
+        std::vector<Float> texels(res.x * res.y);
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x) {
+                Float v = image[(res.y - 1 - y) * res.x + x].y();
+                texels[y * res.x + x] = gamma ? InverseGammaCorrect(v) : v;
+            }
+        MIPMap<Float> mipmap(res, texels.data(), false, 8.f, wrapMode);
+        ok = writeMIPMap(outFilename, mipmap, 1, wrapMode);
+    } else {
+        std::vector<RGBSpectrum> texels(res.x * res.y);
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x) {
+                RGBSpectrum v = image[(res.y - 1 - y) * res.x + x];
+                for (int c = 0; c < 3 && gamma; ++c)
+                    v[c] = InverseGammaCorrect(v[c]);
+                texels[y * res.x + x] = v;
+            }
+        MIPMap<RGBSpectrum> mipmap(res, texels.data(), false, 8.f, wrapMode);
+        ok = writeMIPMap(outFilename, mipmap, 3, wrapMode);
+    }
+    ParallelCleanup();
+    return ok ? 0 : 1;
+}
+
 int makesky(int argc, char *argv[]) {
     const char *outfile = "sky.exr";
     float albedo = 0.5;
@@ -278,8 +393,7 @@ int assemble(int argc, char *argv[]) {
         fprintf(stderr, "%s: %d pixels not present in any images.\n", outfile,
                 unseenPixels);
 
-    // TODO: fix yet another bad cast here.
-    WriteImage(outfile, (Float *)fullImg.get(), displayWindow, fullRes);
+    writeRGBImage(outfile, fullImg.get(), displayWindow, fullRes);
 
     return 0;
 }
@@ -430,9 +544,8 @@ int diff(int argc, char *argv[]) {
             avg[1], 100. * avgDelta, mse / (3. * res[0].x * res[0].y),
             100. * sqrt(mse / (3. * res[0].x * res[0].y)));
         if (outfile) {
-            // FIXME: diffImage cast is bad.
-            WriteImage(outfile, (Float *)diffImage.get(),
-                       Bounds2i(Point2i(0, 0), res[0]), res[0]);
+            writeRGBImage(outfile, diffImage.get(),
+                          Bounds2i(Point2i(0, 0), res[0]), res[0]);
         }
         return 1;
     }
@@ -754,9 +867,8 @@ int convert(int argc, char *argv[]) {
         }
     }
 
-    // FIXME: another bad RGBSpectrum -> Float cast.
-    WriteImage(outFilename, (Float *)image.get(), Bounds2i(Point2i(0, 0), res),
-               res);
+    writeRGBImage(outFilename, image.get(), Bounds2i(Point2i(0, 0), res),
+                  res);
 
     return 0;
 }
@@ -777,6 +889,8 @@ int main(int argc, char *argv[]) {
         return diff(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "info"))
         return info(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "makemip"))
+        return makemip(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "makesky"))
         return makesky(argc - 2, argv + 2);
     else
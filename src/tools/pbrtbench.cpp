@@ -0,0 +1,649 @@
+//
+// pbrtbench.cpp
+//
+// Microbenchmarks of parts of the renderer that are hard to measure in
+// full renders.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+#include "pbrt.h"
+#include "api.h"
+#include "film.h"
+#include "fileutil.h"
+#include "filters/gaussian.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "paramset.h"
+#include "parser.h"
+#include "rng.h"
+#include "shapes/plymesh.h"
+#include "spectrum.h"
+#include <glog/logging.h>
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "pbrtbench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: pbrtbench <command> [options] [<filename>]
+
+commands: merge, mipmap, paramset, parse, plymesh, spectrum, splat, tiles
+
+merge options:
+    --maxthreads <n>   Measure with 1, 2, 4, ... threads, up to <n>.
+                       Default: twice the number of cores.
+    --resolution <r>   Resolution of the (square) film. Default: 1024
+    --rounds <n>       Number of times all of the film's tiles are merged
+                       for each thread count. Default: 20
+
+mipmap options:
+    --channels <n>     1 to build Float MIP maps, 3 for RGB. Default: 3
+    --repeats <n>      Number of MIP maps built; the fastest time is
+                       reported. Default: 3
+    --resolution <r>   Resolution of the (square) image. Resolutions that
+                       aren't powers of two include resampling the image.
+                       Default: 8192
+
+paramset options:
+    --millions <n>     Millions of parameter lookups. Default: 20
+    --repeats <n>      Number of times the lookups are repeated; the
+                       fastest time is reported. Default: 3
+
+parse options:
+    --millions <n>     Millions of numbers in the parameter lists of the
+                       scene that is parsed. Default: 10
+    --repeats <n>      Number of times the scene is parsed; the fastest
+                       time is reported. Default: 3
+
+plymesh options:
+    --millions <n>     Millions of triangles in the mesh that's written to
+                       pbrtbench.ply and loaded. Default: 10
+    --repeats <n>      Number of times the mesh is loaded with each
+                       reader; the fastest time is reported. Default: 3
+    <filename>.ply     PLY file to load instead of writing one.
+
+spectrum options:
+    --millions <n>     Millions of path vertices evaluated by the arithmetic
+                       kernel for each spectrum type. Default: 50
+    --repeats <n>      Number of times each measurement is repeated; the
+                       fastest time is reported. Default: 3
+    <filename>         Scene to render with the renderer's Spectrum type.
+
+splat options:
+    --maxthreads <n>   Measure with 1, 2, 4, ... threads, up to <n>.
+                       Default: twice the number of cores.
+    --xresolution <x>  Width of the film. Default: 1920
+    --yresolution <y>  Height of the film. Default: 1080
+    --splatbuffermb <m> Memory for each thread's splat buffer, in MB; zero
+                       disables them, as films do by default. Default: 0
+    --splats <n>       Number of splats added by each thread, in millions.
+                       Default: 4
+
+tiles options:
+    --repeats <n>      Number of times the scene is rendered with each tile
+                       order; the fastest time is reported. Default: 3
+    --tilesize <n>     Size of the tiles. Default: chosen by the renderer.
+    <filename>         Scene to render.
+
+)");
+    exit(1);
+}
+
+// Parses the options of the form --name <value> or --name=<value> in
+// _argv_, storing their values in the variables in _options_.
+static void parseOptions(int argc, char *argv[],
+                         const std::map<std::string, double *> &options) {
+    for (int i = 0; i < argc; ++i) {
+        const char *ptr = argv[i];
+        // Skip over a leading dash or two.
+        if (*ptr != '-') usage("unexpected argument \"%s\"", argv[i]);
+        ++ptr;
+        if (*ptr == '-') ++ptr;
+
+        // Copy the flag name to the string.
+        std::string flag;
+        while (*ptr && *ptr != '=') flag += *ptr++;
+        auto iter = options.find(flag);
+        if (iter == options.end()) usage("unknown option \"%s\"", argv[i]);
+
+        if (!*ptr && i + 1 == argc)
+            usage("missing value after %s flag", argv[i]);
+        const char *value = (*ptr == '=') ? (ptr + 1) : argv[++i];
+        *iter->second = atof(value);
+    }
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Measures the throughput of Film::MergeFilmTile() with tiles like those
+// of SamplerIntegrator::Render() being merged by a growing number of
+// threads.
+int merge(int argc, char *argv[]) {
+    double maxThreads = 2 * NumSystemCores(), resolution = 1024, rounds = 20;
+    parseOptions(argc, argv, {{"maxthreads", &maxThreads},
+                              {"resolution", &resolution},
+                              {"rounds", &rounds}});
+    if (maxThreads < 1 || resolution < 1 || rounds < 1)
+        usage("merge options must be positive");
+
+    int res = int(resolution);
+    Film film(Point2i(res, res), Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+              std::unique_ptr<Filter>(new GaussianFilter(Vector2f(2, 2), 2)),
+              35.f, "unused.exr", 1.f);
+    Bounds2i sampleBounds = film.GetSampleBounds();
+    const int tileSize = 16;
+    std::vector<Bounds2i> tileBounds;
+    for (int y = sampleBounds.pMin.y; y < sampleBounds.pMax.y; y += tileSize)
+        for (int x = sampleBounds.pMin.x; x < sampleBounds.pMax.x;
+             x += tileSize)
+            tileBounds.push_back(Bounds2i(
+                Point2i(x, y),
+                Min(Point2i(x + tileSize, y + tileSize), sampleBounds.pMax)));
+    int nTiles = tileBounds.size();
+
+    printf("%d tiles of %dx%d pixels\n", nTiles, tileSize, tileSize);
+    printf("threads    tiles/sec  Mpixels/sec\n");
+    std::vector<int> threadCounts;
+    for (int n = 1; n < int(maxThreads); n *= 2) threadCounts.push_back(n);
+    threadCounts.push_back(int(maxThreads));
+    for (int nThreads : threadCounts) {
+        double seconds = 0;
+        int64_t nPixels = 0;
+        for (int round = 0; round < int(rounds); ++round) {
+            // Make tiles with a sample in each pixel
+            std::vector<std::unique_ptr<FilmTile>> tiles;
+            for (const Bounds2i &b : tileBounds) {
+                tiles.push_back(film.GetFilmTile(b));
+                for (Point2i p : b)
+                    tiles.back()->AddSample(Point2f(p.x + .5f, p.y + .5f),
+                                            Spectrum(1.f));
+                nPixels += tiles.back()->GetPixelBounds().Area();
+            }
+
+            // Merge all of the tiles using _nThreads_ threads
+            std::atomic<int> nextTile{0};
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for (int t = 0; t < nThreads; ++t)
+                threads.push_back(std::thread([&]() {
+                    int i;
+                    while ((i = nextTile++) < nTiles)
+                        film.MergeFilmTile(std::move(tiles[i]));
+                }));
+            for (std::thread &thread : threads) thread.join();
+            seconds += secondsSince(start);
+        }
+        printf("%7d %12.0f %12.2f\n", nThreads, nTiles * rounds / seconds,
+               nPixels / seconds * 1e-6);
+    }
+    return 0;
+}
+
+// Returns the sum of all of the texels in all of the MIPMap's levels, so
+// that MIPMaps built by different implementations can be compared.
+template <typename T>
+static double texelSum(const MIPMap<T> &mipmap) {
+    double sum = 0;
+    for (int level = 0; level < mipmap.Levels(); ++level) {
+        int sRes = std::max(1, mipmap.Width() >> level);
+        int tRes = std::max(1, mipmap.Height() >> level);
+        for (int t = 0; t < tRes; ++t)
+            for (int s = 0; s < sRes; ++s) {
+                T texel = mipmap.Texel(level, s, t);
+                for (int i = 0; i < int(sizeof(T) / sizeof(Float)); ++i)
+                    sum += ((const Float *)&texel)[i];
+            }
+    }
+    return sum;
+}
+
+template <typename T>
+static void buildMIPMaps(int res, int repeats) {
+    std::unique_ptr<T[]> image(new T[size_t(res) * res]);
+    RNG rng;
+    Float *v = (Float *)image.get();
+    for (size_t i = 0; i < size_t(res) * res * sizeof(T) / sizeof(Float); ++i)
+        v[i] = rng.UniformFloat();
+
+    double best = Infinity, sum = 0;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        MIPMap<T> mipmap(Point2i(res, res), image.get());
+        best = std::min(best, secondsSince(start));
+        if (i == 0) sum = texelSum(mipmap);
+    }
+    printf("%dx%d: %.3f seconds, %.1f Mtexels/sec (texel sum %.17g)\n", res,
+           res, best, double(res) * res / best * 1e-6, sum);
+}
+
+// Measures the time taken to build MIPMaps, including resampling images
+// whose resolution isn't a power of two.
+int mipmap(int argc, char *argv[]) {
+    double channels = 3, repeats = 3, resolution = 8192;
+    parseOptions(argc, argv, {{"channels", &channels},
+                              {"repeats", &repeats},
+                              {"resolution", &resolution}});
+    if ((channels != 1 && channels != 3) || repeats < 1 || resolution < 1)
+        usage("invalid mipmap options");
+
+    ParallelInit();
+    if (channels == 1)
+        buildMIPMaps<Float>(int(resolution), int(repeats));
+    else
+        buildMIPMaps<RGBSpectrum>(int(resolution), int(repeats));
+    ParallelCleanup();
+    return 0;
+}
+
+// Measures ParamSet lookups the way materials make them: each parameter
+// is looked up in the shape's parameters and then in the material's, as a
+// texture name and then as a value.
+int paramset(int argc, char *argv[]) {
+    double millions = 20, repeats = 3;
+    parseOptions(argc, argv,
+                 {{"millions", &millions}, {"repeats", &repeats}});
+    if (millions <= 0 || repeats < 1) usage("invalid paramset options");
+
+    auto floats = [](std::initializer_list<Float> v) {
+        std::unique_ptr<Float[]> values(new Float[v.size()]);
+        std::copy(v.begin(), v.end(), values.get());
+        return values;
+    };
+    // A sphere with an "uber" material, as in many exported scenes
+    ParamSet geomParams, materialParams;
+    geomParams.AddFloat("radius", floats({2}), 1);
+    materialParams.AddRGBSpectrum("Kd", floats({.5, .4, .3}), 3);
+    materialParams.AddRGBSpectrum("Ks", floats({.1, .1, .1}), 3);
+    materialParams.AddFloat("roughness", floats({.05}), 1);
+    materialParams.AddFloat("index", floats({1.33}), 1);
+    materialParams.AddTexture("bumpmap", "bumps");
+    std::unique_ptr<std::string[]> type(new std::string[1]);
+    type[0] = "uber";
+    materialParams.AddString("type", std::move(type), 1);
+
+    const char *spectrumNames[] = {"Kd", "Ks", "Kr", "Kt", "opacity"};
+    const char *floatNames[] = {"roughness", "uroughness", "vroughness",
+                                "eta", "index", "bumpmap"};
+    const std::vector<std::string> spectra(std::begin(spectrumNames),
+                                           std::end(spectrumNames));
+    const std::vector<std::string> floatParams(std::begin(floatNames),
+                                               std::end(floatNames));
+    const int lookupsPerMaterial = 4 * (spectra.size() + floatParams.size());
+    int64_t nMaterials = int64_t(millions * 1e6) / lookupsPerMaterial;
+
+    double best = Infinity;
+    int64_t found = 0;
+    for (int r = 0; r < int(repeats); ++r) {
+        auto start = std::chrono::steady_clock::now();
+        for (int64_t i = 0; i < nMaterials; ++i) {
+            int n;
+            for (const ParamSet *ps : {&geomParams, &materialParams})
+                for (const std::string &name : spectra) {
+                    found += !ps->FindTexture(name).empty();
+                    found += ps->FindSpectrum(name, &n) != nullptr;
+                }
+            for (const ParamSet *ps : {&geomParams, &materialParams})
+                for (const std::string &name : floatParams) {
+                    found += !ps->FindTexture(name).empty();
+                    found += ps->FindFloat(name, &n) != nullptr;
+                }
+        }
+        best = std::min(best, secondsSince(start));
+    }
+    printf("%.3f seconds, %.2f Mlookups/sec (%d found)\n", best,
+           nMaterials * lookupsPerMaterial / best * 1e-6,
+           int(found / (repeats * nMaterials)));
+    return 0;
+}
+
+// Measures the conversion of numbers in scene files and the parsing of
+// large parameter lists like those of inline triangle meshes.
+int parse(int argc, char *argv[]) {
+    double millions = 10, repeats = 3;
+    parseOptions(argc, argv,
+                 {{"millions", &millions}, {"repeats", &repeats}});
+    if (millions <= 0 || repeats < 1) usage("invalid parse options");
+
+    // Print the numbers the way exporters typically do: vertex positions
+    // with six or so significant digits and plain integer indices.
+    int64_t nNumbers = int64_t(millions * 1e6);
+    std::vector<std::string> numbers(nNumbers);
+    std::string points, indices;
+    RNG rng;
+    for (int64_t i = 0; i < nNumbers; ++i) {
+        char buf[32];
+        if (i & 1)
+            snprintf(buf, sizeof(buf), "%.6g", 100 * rng.UniformFloat() - 50);
+        else
+            snprintf(buf, sizeof(buf), "%d", int(rng.UniformUInt32(1 << 24)));
+        numbers[i] = buf;
+        std::string &list = (i & 1) ? points : indices;
+        list += buf;
+        list += (i % 32 == 31) ? '\n' : ' ';
+    }
+
+    printf("converter  seconds  Mnumbers/sec\n");
+    for (int fast = 0; fast < 2; ++fast) {
+        double best = Infinity, sum = 0;
+        for (int r = 0; r < int(repeats); ++r) {
+            auto start = std::chrono::steady_clock::now();
+            for (const std::string &n : numbers)
+                if (fast)
+                    sum += ParseNumber(string_view(n.data(), n.size()));
+                else if (sizeof(Float) == sizeof(float))
+                    sum += strtof(n.c_str(), nullptr);
+                else
+                    sum += strtod(n.c_str(), nullptr);
+            best = std::min(best, secondsSince(start));
+        }
+        printf("%-8s %9.3f %13.2f (sum %g)\n", fast ? "parser" : "libc",
+               best, nNumbers / best * 1e-6, sum);
+    }
+
+    // The camera's parameters are only stored until WorldEnd, so parsing
+    // them doesn't include the time to create anything from them.
+    std::string scene = "Camera \"perspective\"\n\"point P\" [\n" + points +
+                        "]\n\"integer indices\" [\n" + indices + "]\n";
+    numbers.clear();
+    Options options;
+    options.quiet = true;
+    double best = Infinity;
+    for (int r = 0; r < int(repeats); ++r) {
+        pbrtInit(options);
+        auto start = std::chrono::steady_clock::now();
+        pbrtParseString(scene);
+        best = std::min(best, secondsSince(start));
+        pbrtCleanup();
+    }
+    printf("parsing %.1f MB: %.3f seconds, %.2f Mnumbers/sec\n",
+           scene.size() / (1024. * 1024.), best, nNumbers / best * 1e-6);
+    return 0;
+}
+
+// Measures loading a PLY mesh with rply and with the direct reader, and
+// then creating the _TriangleMesh_ and its _Triangle_s.
+int plymesh(int argc, char *argv[]) {
+    std::string filename;
+    if (argc > 0 && HasExtension(argv[argc - 1], ".ply"))
+        filename = argv[--argc];
+    double millions = 10, repeats = 3;
+    parseOptions(argc, argv,
+                 {{"millions", &millions}, {"repeats", &repeats}});
+    if (millions <= 0 || repeats < 1) usage("invalid plymesh options");
+
+    Options options;
+    options.quiet = true;
+    pbrtInit(options);
+    bool writeMesh = filename.empty();
+    if (writeMesh) {
+        // Write a bumpy grid with normals and texture coordinates
+        filename = "pbrtbench.ply";
+        int res = std::max(1, int(std::sqrt(millions * 1e6 / 2)));
+        int nVertices = (res + 1) * (res + 1);
+        std::vector<Point3f> p(nVertices);
+        std::vector<Normal3f> n(nVertices, Normal3f(0, 0, 1));
+        std::vector<Point2f> uv(nVertices);
+        RNG rng;
+        for (int y = 0; y <= res; ++y)
+            for (int x = 0; x <= res; ++x) {
+                p[y * (res + 1) + x] = Point3f(x, y, rng.UniformFloat());
+                uv[y * (res + 1) + x] = Point2f(Float(x) / res, Float(y) / res);
+            }
+        std::vector<int> indices;
+        for (int y = 0; y < res; ++y)
+            for (int x = 0; x < res; ++x) {
+                int v00 = y * (res + 1) + x, v10 = v00 + 1;
+                int v01 = v00 + res + 1, v11 = v01 + 1;
+                for (int v : {v00, v10, v11, v00, v11, v01})
+                    indices.push_back(v);
+            }
+        if (!WritePlyFile(filename, indices.size() / 3, indices.data(),
+                          nVertices, p.data(), nullptr, n.data(), uv.data(),
+                          nullptr)) {
+            fprintf(stderr, "pbrtbench: unable to write \"%s\"\n",
+                    filename.c_str());
+            return 1;
+        }
+    }
+
+    printf("reader     seconds  Mtriangles/sec\n");
+    PLYMesh mesh;
+    for (int direct = 0; direct < 2; ++direct) {
+        double best = Infinity;
+        for (int i = 0; i < int(repeats); ++i) {
+            auto start = std::chrono::steady_clock::now();
+            bool read = direct ? ReadPLYMeshDirect(filename, &mesh)
+                               : ReadPLYMeshRply(filename, &mesh);
+            best = std::min(best, secondsSince(start));
+            if (!read) {
+                printf("%-8s %9s\n", direct ? "direct" : "rply", "failed");
+                break;
+            }
+        }
+        if (best < Infinity)
+            printf("%-8s %9.3f %15.2f\n", direct ? "direct" : "rply", best,
+                   mesh.indices.size() / 3 / best * 1e-6);
+    }
+
+    // Create the mesh, transforming its vertices to world space
+    Transform objectToWorld = Translate(Vector3f(1, 2, 3)) * Scale(2, 2, 2);
+    Transform worldToObject = Inverse(objectToWorld);
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<TriangleMesh> triMesh = std::make_shared<TriangleMesh>(
+        objectToWorld, std::move(mesh.indices), mesh.nVertices,
+        std::move(mesh.p), nullptr, std::move(mesh.n), std::move(mesh.uv),
+        nullptr, nullptr, std::move(mesh.faceIndices));
+    std::vector<std::shared_ptr<Shape>> triangles = CreateTriangleMesh(
+        &objectToWorld, &worldToObject, false, triMesh);
+    printf("creating %d triangles: %.3f seconds\n", int(triangles.size()),
+           secondsSince(start));
+    triangles.clear();
+    triMesh.reset();
+    pbrtCleanup();
+    if (writeMesh) remove(filename.c_str());
+    return 0;
+}
+
+// Accumulates radiance along paths with _S_ the way the integrators do,
+// reporting millions of path vertices per second.
+template <typename S>
+static void spectrumArithmetic(const char *name, int64_t nVertices,
+                               int repeats) {
+    // Choose BSDF values and emission for the vertices to cycle through
+    RNG rng;
+    const int nValues = 64;
+    std::vector<S> f(nValues), Le(nValues);
+    for (int i = 0; i < nValues; ++i)
+        for (int c = 0; c < S::nSamples; ++c) {
+            f[i][c] = rng.UniformFloat();
+            Le[i][c] = rng.UniformFloat() < .1f ? rng.UniformFloat() : 0;
+        }
+
+    double best = Infinity;
+    Float result = 0;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        S L(0.f), beta(1.f);
+        for (int64_t i = 0; i < nVertices; ++i) {
+            const S &fv = f[i % nValues];
+            const S &Lev = Le[(i * 7) % nValues];
+            if (!Lev.IsBlack()) L += beta * Lev;
+            Float pdf = .25f + .5f * (i % 3);
+            beta *= fv * (Float(.7) / pdf);
+            // Start a new path every eight vertices
+            if ((i & 7) == 7 || beta.IsBlack()) beta = S(1.f);
+        }
+        best = std::min(best, secondsSince(start));
+        result = L.MaxComponentValue();
+    }
+    printf("%-16s %10.2f (result %g)\n", name, nVertices / best * 1e-6,
+           result);
+}
+
+// Measures Spectrum arithmetic, with the representations and SIMD
+// configuration that pbrt was compiled with, and renders a scene with
+// the renderer's Spectrum type. Running it with builds that differ in
+// PBRT_SPECTRUM_SIMD or PBRT_SAMPLED_SPECTRUM compares them.
+int spectrum(int argc, char *argv[]) {
+    if (argc < 1 || argv[argc - 1][0] == '-')
+        usage("missing scene filename for spectrum");
+    double millions = 50, repeats = 3;
+    parseOptions(argc - 1, argv,
+                 {{"millions", &millions}, {"repeats", &repeats}});
+    if (millions <= 0 || repeats < 1) usage("invalid spectrum options");
+
+#ifdef PBRT_SPECTRUM_SIMD
+    printf("SIMD spectra: RGBSpectrum %d bytes, SampledSpectrum %d bytes\n",
+           int(sizeof(RGBSpectrum)), int(sizeof(SampledSpectrum)));
+#else
+    printf("scalar spectra: RGBSpectrum %d bytes, SampledSpectrum %d bytes\n",
+           int(sizeof(RGBSpectrum)), int(sizeof(SampledSpectrum)));
+#endif
+    printf("spectrum         Mvertices/sec\n");
+    int64_t nVertices = int64_t(millions * 1e6);
+    spectrumArithmetic<RGBSpectrum>("RGBSpectrum", nVertices, int(repeats));
+    spectrumArithmetic<SampledSpectrum>("SampledSpectrum", nVertices,
+                                        int(repeats));
+
+    double best = Infinity;
+    for (int i = 0; i < int(repeats); ++i) {
+        Options options;
+        options.quiet = true;
+        options.imageFile = "pbrtbench.exr";
+        pbrtInit(options);
+        auto start = std::chrono::steady_clock::now();
+        pbrtParseFile(argv[argc - 1]);
+        best = std::min(best, secondsSince(start));
+        pbrtCleanup();
+        remove("pbrtbench.exr");
+    }
+    printf("render with %s: %.3f seconds\n",
+           std::is_same<Spectrum, RGBSpectrum>::value ? "RGBSpectrum"
+                                                      : "SampledSpectrum",
+           best);
+    return 0;
+}
+
+// Measures the throughput of Film::AddSplat() with splats at random
+// positions being added by a growing number of threads.
+int splat(int argc, char *argv[]) {
+    double maxThreads = 2 * NumSystemCores(), xResolution = 1920,
+           yResolution = 1080, splatBufferMB = 0, splatMillions = 4;
+    parseOptions(argc, argv, {{"maxthreads", &maxThreads},
+                              {"xresolution", &xResolution},
+                              {"yresolution", &yResolution},
+                              {"splatbuffermb", &splatBufferMB},
+                              {"splats", &splatMillions}});
+    if (maxThreads < 1 || xResolution < 1 || yResolution < 1 ||
+        splatBufferMB < 0 || splatMillions <= 0)
+        usage("invalid splat options");
+
+    // Splat buffers are allocated for up to _MaxThreadIndex()_ threads
+    int64_t nSplats = int64_t(splatMillions * 1e6);
+    Point2i res((int)xResolution, (int)yResolution);
+    printf("threads  Msplats/sec\n");
+    std::vector<int> threadCounts;
+    for (int n = 1; n < int(maxThreads); n *= 2) threadCounts.push_back(n);
+    threadCounts.push_back(int(maxThreads));
+    for (int nThreads : threadCounts) {
+        Options options;
+        options.nThreads = nThreads;
+        pbrtInit(options);
+        std::unique_ptr<Filter> filter(
+            new GaussianFilter(Vector2f(2, 2), 2));
+        Film film(res, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                  std::move(filter), 35.f, "unused.exr", 1.f, Infinity,
+                  size_t(splatBufferMB * 1024 * 1024));
+        auto start = std::chrono::steady_clock::now();
+        ParallelFor([&](int64_t t) {
+            RNG rng(t);
+            for (int64_t i = 0; i < nSplats; ++i)
+                film.AddSplat(Point2f(rng.UniformFloat() * res.x,
+                                      rng.UniformFloat() * res.y),
+                              Spectrum(1.f));
+        }, nThreads);
+        // Include flushing the splat buffers into the film's pixels
+        std::vector<Float> values;
+        film.SaveAccumulation(&values);
+        printf("%7d %12.2f\n", nThreads,
+               nThreads * nSplats / secondsSince(start) * 1e-6);
+        pbrtCleanup();
+    }
+    return 0;
+}
+
+// Renders a scene with each of the tile orders, reporting the fastest
+// time, including parsing the scene, for each.
+int tiles(int argc, char *argv[]) {
+    if (argc < 1 || argv[argc - 1][0] == '-')
+        usage("missing scene filename for tiles");
+    double repeats = 3, tileSize = 0;
+    parseOptions(argc - 1, argv,
+                 {{"repeats", &repeats}, {"tilesize", &tileSize}});
+    if (repeats < 1 || tileSize < 0) usage("invalid tiles options");
+
+    printf("order         seconds\n");
+    for (const char *order : {"scanline", "hilbert", "spiral"}) {
+        double best = Infinity;
+        for (int i = 0; i < int(repeats); ++i) {
+            Options options;
+            options.quiet = true;
+            options.tileOrder = order;
+            options.tileSize = int(tileSize);
+            options.imageFile = "pbrtbench.exr";
+            pbrtInit(options);
+            auto start = std::chrono::steady_clock::now();
+            pbrtParseFile(argv[argc - 1]);
+            best = std::min(best, secondsSince(start));
+            pbrtCleanup();
+            remove("pbrtbench.exr");
+        }
+        printf("%-10s %10.3f\n", order, best);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_stderrthreshold = 1; // Warning and above.
+
+    if (argc < 2) usage();
+
+    if (!strcmp(argv[1], "merge"))
+        return merge(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "mipmap"))
+        return mipmap(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "paramset"))
+        return paramset(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "parse"))
+        return parse(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "plymesh"))
+        return plymesh(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "spectrum"))
+        return spectrum(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "splat"))
+        return splat(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "tiles"))
+        return tiles(argc - 2, argv + 2);
+    else
+        usage("unknown command \"%s\"", argv[1]);
+
+    return 0;
+}